@@ -0,0 +1,64 @@
+import os
+import sys
+
+# sets the writhe, twist and length a run logged in its globaldata_*.txt files against those of another - the same parameters run with
+# FN_Knot_Float (make float) against FN_Knot, say - and says how far apart they get. run it as
+#   python comparetimeseries.py doublerundirectory floatrundirectory [tolerance]
+# the tolerance (0.01 by default) is on the difference relative to the size of the quantity in the first run, and the exit status is 1
+# if any component goes over it, or if the runs differ in their components or times
+
+Quantities = ('writhe', 'twist', 'length')
+
+def read_globaldata(filename):
+    series = {}
+    for line in open(filename):
+        columns = line.split()
+        if len(columns) < 4:
+            continue # a line cut short by the end of a run
+        series[columns[0]] = [float(c) for c in columns[1:4]]
+    return series
+
+def components(directory):
+    names = [f for f in os.listdir(directory) if f.startswith('globaldata_') and f.endswith('.txt')]
+    return sorted(names, key=lambda f: int(f[len('globaldata_'):-len('.txt')]))
+
+if len(sys.argv) < 3:
+    print('usage: python comparetimeseries.py firstrundirectory secondrundirectory [tolerance]')
+    sys.exit(2)
+first = sys.argv[1]
+second = sys.argv[2]
+tolerance = float(sys.argv[3]) if len(sys.argv) > 3 else 0.01
+
+failed = False
+firstnames = components(first)
+secondnames = components(second)
+if firstnames != secondnames:
+    print('the runs have different components: ' + ' '.join(firstnames) + ' against ' + ' '.join(secondnames))
+    failed = True
+
+for name in firstnames:
+    if name not in secondnames:
+        continue
+    a = read_globaldata(os.path.join(first, name))
+    b = read_globaldata(os.path.join(second, name))
+    times = [t for t in a if t in b]
+    if len(times) != len(a) or len(times) != len(b):
+        print(name + ': the runs logged different times, only the %d they share are compared' % len(times))
+        failed = True
+    for q in range(len(Quantities)):
+        # the scale of the quantity is its largest size over the first run, so one that passes through zero isn't blown up
+        scale = max([abs(a[t][q]) for t in times] + [1e-12])
+        largest = 0.0
+        worsttime = None
+        for t in times:
+            difference = abs(a[t][q] - b[t][q])
+            if worsttime is None or difference > largest:
+                largest = difference
+                worsttime = t
+        relative = largest / scale
+        verdict = 'ok' if relative <= tolerance else 'DIFFERS'
+        print('%s %-7s  largest difference %.6g (%.3g relative) at t=%s  %s' % (name, Quantities[q], largest, relative, worsttime, verdict))
+        if relative > tolerance:
+            failed = True
+
+sys.exit(1 if failed else 0)
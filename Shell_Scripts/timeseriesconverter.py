@@ -1,25 +1,98 @@
 import os
+import struct
 from decimal import *
 from shutil import copy2
 
-names = os.listdir("./knotplots");
 cwd = os.getcwd()+"/knotplots";
 
 Period = Decimal('11.2');
 
-for name in names[:]:
-    bits = name.split('_')
-    bobs = bits[1].split('.vtk')
-    number = Decimal(bobs[0]);
-
-    divisor = number/Period;
-    if divisor%1==0:
-        oldfilename = cwd + '/' + name
-        hackedformatnumber = "%.0f" % divisor
-        newfilename = cwd+ '/velocityknotplot' + str(hackedformatnumber) +'.vtk'
-        copy2(oldfilename,newfilename);
+# a run with INSERT_KNOT_FORMAT=KNOT_SERIES leaves all its knot curves in the one binary file knotplots.bin, laid out as the comment
+# above append_knot_record in ReadingWriting.cpp describes - the '<dii6d' of a record header has to stay in step with its
+# KnotRecordHeader. the vtk files for the prints wanted are written straight from it
+seriesname = cwd + '/knotplots.bin'
+if not os.path.exists(seriesname):
+    seriesname = os.getcwd() + '/knotplots.bin'
 
+def read_series(filename):
+    records = {}
+    with open(filename, 'rb') as f:
+        data = f.read()
+    if data[0:8] != b'FNKNOTCV':
+        raise ValueError(filename + ' is not a knot series')
+    version, nfields = struct.unpack_from('<ii', data, 8)
+    offset = 16
+    names = []
+    for field in range(nfields):
+        names.append(data[offset:offset+16].split(b'\0')[0].decode())
+        offset += 16
+    headersize = struct.calcsize('<dii6d')
+    while offset + headersize <= len(data):
+        t, c, n, writhe, twist, length, xavg, yavg, zavg = struct.unpack_from('<dii6d', data, offset)
+        offset += headersize
+        if offset + 4*n*nfields > len(data):
+            break # a print cut short by the end of a run
+        fields = {}
+        for field in range(nfields):
+            fields[names[field]] = struct.unpack_from('<%df' % n, data, offset)
+            offset += 4*n
+        # the velocity print of a time comes after its plain one, so the last record of a time wins. the times are keyed as the vtk
+        # files are named, so two which would make the same file are the same time
+        records[(g(t), c)] = (t, n, fields)
+    return records
 
+def g(x):
+    return '%g' % x
 
+def write_vtk(filename, n, fields):
+    out = open(filename, 'w')
+    out.write("# vtk DataFile Version 3.0\nKnot\nASCII\nDATASET UNSTRUCTURED_GRID\n")
+    out.write("POINTS %d float\n" % n)
+    for i in range(n):
+        out.write(g(fields['x'][i]) + ' ' + g(fields['y'][i]) + ' ' + g(fields['z'][i]) + '\n')
+    out.write("\n\nCELLS %d %d\n" % (n, 3*n))
+    for i in range(n):
+        out.write("2 %d %d\n" % (i, (i+1) % n))
+    out.write("\n\nCELL_TYPES %d\n" % n)
+    for i in range(n):
+        out.write("3\n")
+    out.write("\n\nPOINT_DATA %d\n\n" % n)
+    for name, field in (('Curvature', 'curvature'), ('Torsion', 'torsion')):
+        out.write("\nSCALARS " + name + " float\nLOOKUP_TABLE default\n")
+        for i in range(n):
+            out.write(g(fields[field][i]) + '\n')
+    for name, field in (('A', 'a'), ('V', 'v'), ('t', 't'), ('n', 'n'), ('b', 'b'), ('vdotn', 'vdotn'), ('vdotb', 'vdotb')):
+        out.write("\nVECTORS " + name + " float\n")
+        for i in range(n):
+            out.write(g(fields[field+'x'][i]) + ' ' + g(fields[field+'y'][i]) + ' ' + g(fields[field+'z'][i]) + '\n')
+    out.write("\n\nCELL_DATA %d\n\n" % n)
+    for name, field in (('Writhe', 'writhe'), ('Twist', 'twist'), ('Length', 'length')):
+        out.write("\nSCALARS " + name + " float\nLOOKUP_TABLE default\n")
+        for i in range(n):
+            out.write(g(fields[field][i]) + '\n')
+    out.close()
 
+if os.path.exists(seriesname):
+    outdir = os.path.dirname(seriesname)
+    records = read_series(seriesname)
+    for key in sorted(records.keys()):
+        t, n, fields = records[key]
+        c = key[1]
+        divisor = Decimal('%g' % t)/Period;
+        if divisor%1==0:
+            hackedformatnumber = "%.0f" % divisor
+            suffix = '' if c == 0 else '_' + str(c)
+            write_vtk(outdir + '/velocityknotplot' + str(hackedformatnumber) + suffix + '.vtk', n, fields)
+else:
+    names = os.listdir("./knotplots");
+    for name in names[:]:
+        bits = name.split('_')
+        bobs = bits[1].split('.vtk')
+        number = Decimal(bobs[0]);
 
+        divisor = number/Period;
+        if divisor%1==0:
+            oldfilename = cwd + '/' + name
+            hackedformatnumber = "%.0f" % divisor
+            newfilename = cwd+ '/velocityknotplot' + str(hackedformatnumber) +'.vtk'
+            copy2(oldfilename,newfilename);
@@ -0,0 +1,344 @@
+/* the benchmark. make bench builds FN_Knot_Bench, which needs no input files: it puts an unknot and a trefoil into grids of a few sizes,
+   and times the main kernels on them with a few thread counts. each case goes
+
+   phi_calc_curve       the solid angle of the synthetic curve at every grid point (and the phi.vtk print which goes with it)
+   uv_update            enough steps to take the initial field to time BenchTime, so there is a scroll wave to trace
+   crossgrad_calc       grad u x grad v, a few times over
+   find_knot_properties tracing the curve back out, with all its analysis
+   print_uv             the uv print, until the file is written
+
+   and prints the seconds each took, and what they got through in them. the same goes on the end of bench.csv, so it can be tracked from
+   one version to the next. the results which shouldn't depend on the thread count or the speed of the kernels - sums over the fields, and
+   the length and writhe of the curve traced - are checked against bench_reference.txt, to a relative tolerance of BenchTolerance. if there
+   is no reference yet, or with record on the command line, the results of this run are stored as the reference instead. before any of
+   that, a trefoil is traced at 32^3 on its own and again straight after an unknot, and the two have to agree, as the cases all share
+   the one process.
+
+   usage: ./FN_Knot_Bench [sizes=48,96] [threads=1,2,4] [curves=unknot,trefoil] [time=2] [reference=bench_reference.txt] [record] [KEY=VALUE...]
+   anything else of the form KEY=VALUE is a parameter, as in the parameters file (eg RK_SCHEME=RK4LOWSTORAGE), a different set of which
+   wants a reference file of its own. by default, the threads are 1 and the powers of 2 up to OMP_NUM_THREADS. run it somewhere it can
+   leave phi.vtk, bench.csv and the reference behind */
+#include "FN_Knot.h"
+#include "Initialisation.h"
+#include "ReadingWriting.h"
+#include "Stencil.h"
+#include "Distributed.h"
+#include "Profiling.h"
+#include <omp.h>
+#include <stdio.h>
+#include <map>
+#include <algorithm>
+
+const double BenchTolerance = 1e-6;
+const int CrossgradRepeats = 10;
+
+static vector<int> parse_list(const string& value)
+{
+    vector<int> list;
+    stringstream ss(value);
+    string item;
+    while(getline(ss,item,',')) list.push_back(atoi(item.c_str()));
+    return list;
+}
+
+// the curve, of 1000 points, scaled to fill the box as InitialiseFromFile would, with its geometry
+static void synthetic_curve(const string& name, Link& Curve)
+{
+    const int NP = 1000;
+    Curve.NumComponents = 1;
+    Curve.NumPoints = NP;
+    Curve.Components.resize(1);
+    knotpoints& Points = Curve.Components[0].knotcurve;
+    double largest = 0;
+    for(int s=0; s<NP; s++)
+    {
+        const double t = 2*M_PI*s/NP;
+        double x, y, z;
+        if(name == "trefoil")
+        {
+            x = sin(t) + 2*sin(2*t);
+            y = cos(t) - 2*cos(2*t);
+            z = -sin(3*t);
+        }
+        else
+        {
+            x = cos(t);
+            y = sin(t);
+            z = 0;
+        }
+        Points.push_back(x,y,z);
+        largest = std::max(largest,std::max(fabs(x),std::max(fabs(y),fabs(z))));
+    }
+    const double scale = std::min(xmax,std::min(ymax,zmax))/(2*largest);
+    for(int s=0; s<NP; s++)
+    {
+        Points.xcoord[s] *= scale;
+        Points.ycoord[s] *= scale;
+        Points.zcoord[s] *= scale;
+    }
+    ComputeLengths(Curve);
+    ComputeTangent(Curve);
+    ComputeKappaN(Curve);
+    ComputeWrithe(Curve);
+}
+
+// phi is double whatever the fields are stored as
+template <typename T> static double grid_sum(const vector<T>& grid)
+{
+    double sum = 0;
+    for(unsigned int n=0; n<grid.size(); n++) sum += grid[n];
+    return sum;
+}
+
+static double file_size(const string& filename)
+{
+    ifstream file (filename.c_str(),std::ios::binary | std::ios::ate);
+    return file.good() ? (double)file.tellg() : 0;
+}
+
+static ofstream benchcsv;
+static void report(const string& curve, int N, int threads, const string& kernel, double seconds, double amount, const string& unit)
+{
+    cout << setw(8) << curve << setw(6) << N << setw(4) << threads << "  " << setw(21) << std::left << kernel << std::right << setw(12) << seconds << "s";
+    if(amount > 0) cout << setw(12) << amount/seconds << ' ' << unit;
+    cout << '\n';
+    benchcsv << curve << ',' << N << ',' << threads << ',' << kernel << ',' << seconds << ',' << ((amount > 0) ? amount/seconds : 0) << ',' << unit << '\n';
+}
+
+static map<string,double> reference;
+static bool referencechanged = false;
+static int checked = 0;
+static int mismatches = 0;
+// check a result against the reference, or make it the reference if there isn't one for it
+static void check(const string& curve, int N, const string& quantity, double value)
+{
+    stringstream ss;
+    ss << curve << '_' << N << '_' << quantity;
+    const string key = ss.str();
+    map<string,double>::iterator found = reference.find(key);
+    if(found == reference.end())
+    {
+        reference[key] = value;
+        referencechanged = true;
+        return;
+    }
+    checked++;
+    const double difference = fabs(value - found->second);
+    if(difference > BenchTolerance*std::max(fabs(found->second),1.0))
+    {
+        cout << "  " << key << " is " << setprecision(15) << value << ", the reference has " << found->second << setprecision(6) << '\n';
+        mismatches++;
+    }
+}
+
+static void run_case(const string& curvename, int N, int threads, double benchtime)
+{
+    omp_set_num_threads(threads);
+    // each case is a run of its own, so its components aren't matched against the last case's
+    reset_component_matching();
+    Griddata griddata;
+    griddata.Nx = griddata.Ny = griddata.Nz = N;
+    griddata.h = initialh;
+    initialNx = initialNy = initialNz = N;
+    xmax = ymax = zmax = 8*N*initialh/10.0;
+    const int gridsize = N*N*N;
+    vector<double> phi(gridsize);
+    Field u(gridsize), v(gridsize), ucvx(gridsize), ucvy(gridsize), ucvz(gridsize), ucvmag(gridsize);
+    vector<knotcurve> knotcurves;
+
+    Link Curve;
+    synthetic_curve(curvename,Curve);
+    double start = omp_get_wtime();
+    phi_calc_curve(phi,Curve,griddata);
+    report(curvename,N,threads,"phi_calc_curve",omp_get_wtime() - start,gridsize/1e6,"Mpoints/s");
+    remove("phi.vtk");
+    check(curvename,N,"phi",grid_sum(phi));
+    uv_initialise(phi,u,v,griddata);
+
+    Griddata slabgriddata;
+    decompose(griddata,slabgriddata);
+    setup_active_blocks(griddata);
+    Field padA(padsize(griddata)), padB(padsize(griddata));
+    Field ku(NumSlopeGrids*gridsize,0), kv(NumSlopeGrids*gridsize,0);
+    uvupdatefunction uv_update = choose_uv_update(BoundaryType,TimeStepper);
+    crossgradfunction crossgrad_calc = choose_crossgrad_calc(BoundaryType);
+
+    const int steps = std::max((int)(benchtime/dtime),1);
+    start = omp_get_wtime();
+#pragma omp parallel default(none) shared(uv_update,u,v,ku,kv,padA,padB,ucvx,ucvy,ucvz,ucvmag,griddata,steps)
+    {
+        for(int it=0; it<steps; it++) uv_update(u,v,ku,kv,padA,padB,ucvx,ucvy,ucvz,ucvmag,false,griddata);
+    }
+    const double updatetime = omp_get_wtime() - start;
+    report(curvename,N,threads,"uv_update",updatetime,(double)gridsize*steps/1e6,"Mpoints/s");
+    report(curvename,N,threads,"uv_update traffic",updatetime,(double)gridsize*steps*stencil_bytes_per_point()/1e9,"GB/s");
+    check(curvename,N,"u",grid_sum(u));
+    check(curvename,N,"v",grid_sum(v));
+
+    start = omp_get_wtime();
+#pragma omp parallel default(none) shared(crossgrad_calc,u,v,ucvx,ucvy,ucvz,ucvmag,padA,padB,griddata)
+    {
+        for(int repeat=0; repeat<CrossgradRepeats; repeat++) crossgrad_calc(u,v,ucvx,ucvy,ucvz,ucvmag,padA,padB,griddata);
+    }
+    report(curvename,N,threads,"crossgrad_calc",omp_get_wtime() - start,(double)gridsize*CrossgradRepeats/1e6,"Mpoints/s");
+    check(curvename,N,"ucvmag",grid_sum(ucvmag));
+
+    const double t = steps*dtime;
+    start = omp_get_wtime();
+#pragma omp parallel default(none) shared(ucvx,ucvy,ucvz,ucvmag,u,knotcurves,t,griddata)
+    {
+#pragma omp single
+        find_knot_properties(ucvx,ucvy,ucvz,ucvmag,u,knotcurves,t,griddata);
+    }
+    const double tracetime = omp_get_wtime() - start;
+    double length = 0, writhe = 0, curvepoints = 0;
+    for(unsigned int c=0; c<knotcurves.size(); c++)
+    {
+        length += knotcurves[c].length;
+        writhe += knotcurves[c].writhe;
+        curvepoints += knotcurves[c].knotcurve.size();
+    }
+    report(curvename,N,threads,"find_knot_properties",tracetime,curvepoints,"curve points/s");
+    check(curvename,N,"components",knotcurves.size());
+    check(curvename,N,"length",length);
+    check(curvename,N,"writhe",writhe);
+
+    start = omp_get_wtime();
+#pragma omp parallel default(none) shared(u,v,ucvx,ucvy,ucvz,ucvmag,knotcurves,t,griddata)
+    {
+#pragma omp single
+        print_uv(u,v,ucvx,ucvy,ucvz,ucvmag,knotcurves,t,griddata);
+    }
+    finish_output();
+    const double printtime = omp_get_wtime() - start;
+    stringstream ss;
+    ss << "uv_plot" << t << ".vtk";
+    report(curvename,N,threads,"print_uv",printtime,file_size(ss.str())/1e6,"MB/s");
+    remove(ss.str().c_str());
+}
+
+// the curves traced from the field of the synthetic curve, as run_case traces them, without the timing
+static void trace_synthetic(const string& curvename, int N, double benchtime, vector<knotcurve>& knotcurves)
+{
+    Griddata griddata;
+    griddata.Nx = griddata.Ny = griddata.Nz = N;
+    griddata.h = initialh;
+    initialNx = initialNy = initialNz = N;
+    xmax = ymax = zmax = 8*N*initialh/10.0;
+    const int gridsize = N*N*N;
+    vector<double> phi(gridsize);
+    Field u(gridsize), v(gridsize), ucvx(gridsize), ucvy(gridsize), ucvz(gridsize), ucvmag(gridsize);
+    Link Curve;
+    synthetic_curve(curvename,Curve);
+    phi_calc_curve(phi,Curve,griddata);
+    remove("phi.vtk");
+    uv_initialise(phi,u,v,griddata);
+
+    Griddata slabgriddata;
+    decompose(griddata,slabgriddata);
+    setup_active_blocks(griddata);
+    Field padA(padsize(griddata)), padB(padsize(griddata));
+    Field ku(NumSlopeGrids*gridsize,0), kv(NumSlopeGrids*gridsize,0);
+    uvupdatefunction uv_update = choose_uv_update(BoundaryType,TimeStepper);
+    crossgradfunction crossgrad_calc = choose_crossgrad_calc(BoundaryType);
+    const int steps = std::max((int)(benchtime/dtime),1);
+    const double t = steps*dtime;
+#pragma omp parallel default(none) shared(uv_update,crossgrad_calc,u,v,ku,kv,padA,padB,ucvx,ucvy,ucvz,ucvmag,knotcurves,griddata,steps,t)
+    {
+        for(int it=0; it<steps; it++) uv_update(u,v,ku,kv,padA,padB,ucvx,ucvy,ucvz,ucvmag,false,griddata);
+        crossgrad_calc(u,v,ucvx,ucvy,ucvz,ucvmag,padA,padB,griddata);
+#pragma omp single
+        find_knot_properties(ucvx,ucvy,ucvz,ucvmag,u,knotcurves,t,griddata);
+    }
+}
+
+// the cases are traced one after another in the one process, so the trefoil traced straight after the unknot, with nothing reset in
+// between, has to come out just as it does on its own - the same components, in the same order, with the same lengths and writhes.
+// they trace to different numbers of components, which the matching of the components from one trace to the next has to cope with
+static bool cases_independent(double benchtime)
+{
+    const int N = 32;
+    omp_set_num_threads(1);
+    vector<knotcurve> alone, unknot, after;
+    reset_component_matching();
+    trace_synthetic("unknot",N,benchtime,unknot);
+    trace_synthetic("trefoil",N,benchtime,after);
+    reset_component_matching();
+    trace_synthetic("trefoil",N,benchtime,alone);
+    bool same = (alone.size() == after.size());
+    for(unsigned int c=0; same && c<alone.size(); c++) same = (alone[c].length == after[c].length && alone[c].writhe == after[c].writhe);
+    if(!same) cout << "The trefoil traced at " << N << "^3 after the unknot doesn't match the trefoil traced on its own\n";
+    return same;
+}
+
+int main (int argc, char** argv)
+{
+    if(distributed_init(&argc,&argv)) return 1;
+    vector<int> sizes(1,48);
+    sizes.push_back(96);
+    vector<int> threadcounts;
+    vector<string> curves(1,"unknot");
+    curves.push_back("trefoil");
+    double benchtime = 2;
+    string referencefilename = "bench_reference.txt";
+    bool record = false;
+    for(int i=1;i<argc;i++)
+    {
+        const string arg = argv[i];
+        const size_t equalspos = arg.find('=');
+        const string key = arg.substr(0,equalspos);
+        const string value = (equalspos == string::npos) ? "" : arg.substr(equalspos+1);
+        if(arg == "record") record = true;
+        else if(key == "sizes") sizes = parse_list(value);
+        else if(key == "threads") threadcounts = parse_list(value);
+        else if(key == "time") benchtime = atof(value.c_str());
+        else if(key == "reference") referencefilename = value;
+        else if(key == "curves")
+        {
+            curves.clear();
+            stringstream ss(value);
+            string item;
+            while(getline(ss,item,',')) curves.push_back(item);
+        }
+        else if(set_parameter(arg)) return 1;
+    }
+    NumSlopeGrids = (TimeStepper == RK4CLASSIC) ? 3 : 1;
+    if(threadcounts.empty())
+    {
+        const int maxthreads = omp_get_max_threads();
+        for(int threads=1; threads<maxthreads; threads*=2) threadcounts.push_back(threads);
+        threadcounts.push_back(maxthreads);
+    }
+
+    if(!record)
+    {
+        ifstream referencefile (referencefilename.c_str());
+        string key;
+        double value;
+        while(referencefile >> key >> value) reference[key] = value;
+    }
+    if(!cases_independent(benchtime)) mismatches++;
+    benchcsv.open("bench.csv",std::ofstream::app);
+    if(benchcsv.tellp() == 0) benchcsv << "curve,N,threads,kernel,seconds,rate,unit\n";
+
+    for(unsigned int c=0; c<curves.size(); c++)
+    {
+        for(unsigned int s=0; s<sizes.size(); s++)
+        {
+            for(unsigned int n=0; n<threadcounts.size(); n++) run_case(curves[c],sizes[s],threadcounts[n],benchtime);
+        }
+    }
+    benchcsv.close();
+
+    if(referencechanged)
+    {
+        ofstream referencefile (referencefilename.c_str());
+        referencefile << setprecision(17);
+        for(map<string,double>::iterator it=reference.begin(); it!=reference.end(); ++it) referencefile << it->first << ' ' << it->second << '\n';
+        cout << "Results stored in " << referencefilename << "\n";
+    }
+    if(mismatches > 0) cout << mismatches << " results differ from " << referencefilename << "\n";
+    else if(checked > 0) cout << "All " << checked << " results checked agree with " << referencefilename << "\n";
+    distributed_finalize();
+    return (mismatches > 0) ? 1 : 0;
+}
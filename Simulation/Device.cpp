@@ -0,0 +1,381 @@
+#include "Device.h"
+#include "Stencil.h"
+#include "FN_Constants.h"
+
+#ifdef USE_GPU
+// the n values at p onto the device, copied over or only allocated, and off it again, copied back or only released. the fields are
+// mapped through these, as without an offload target the directives are dropped, and pointers to them kept in locals would go unused
+static void field_enter_data(fieldvalue* p, int n, bool copy)
+{
+    if(copy)
+    {
+#pragma omp target enter data map(to: p[0:n])
+    }
+    else
+    {
+#pragma omp target enter data map(alloc: p[0:n])
+    }
+}
+
+static void field_exit_data(fieldvalue* p, int n, bool copy)
+{
+    if(copy)
+    {
+#pragma omp target exit data map(from: p[0:n])
+    }
+    else
+    {
+#pragma omp target exit data map(release: p[0:n])
+    }
+}
+#endif
+
+void device_enter_data(Field& u, Field& v, Field& ku, Field& kv, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB)
+{
+#ifdef USE_GPU
+    // the slopes go over as well as u and v - the low storage scheme scales its slope by A[0]=0 on the first stage, and 0*garbage needn't be 0
+    field_enter_data(&u[0],u.size(),true);
+    field_enter_data(&v[0],v.size(),true);
+    field_enter_data(&ku[0],ku.size(),true);
+    field_enter_data(&kv[0],kv.size(),true);
+    field_enter_data(&ucvx[0],ucvx.size(),false);
+    field_enter_data(&ucvy[0],ucvy.size(),false);
+    field_enter_data(&ucvz[0],ucvz.size(),false);
+    field_enter_data(&ucvmag[0],ucvmag.size(),false);
+    field_enter_data(&padA[0],padA.size(),false);
+    field_enter_data(&padB[0],padB.size(),false);
+#endif
+}
+
+void device_exit_data(Field& u, Field& v, Field& ku, Field& kv, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB)
+{
+#ifdef USE_GPU
+    field_exit_data(&u[0],u.size(),true);
+    field_exit_data(&v[0],v.size(),true);
+    field_exit_data(&ku[0],ku.size(),false);
+    field_exit_data(&kv[0],kv.size(),false);
+    field_exit_data(&ucvx[0],ucvx.size(),false);
+    field_exit_data(&ucvy[0],ucvy.size(),false);
+    field_exit_data(&ucvz[0],ucvz.size(),false);
+    field_exit_data(&ucvmag[0],ucvmag.size(),false);
+    field_exit_data(&padA[0],padA.size(),false);
+    field_exit_data(&padB[0],padB.size(),false);
+#endif
+}
+
+#ifdef USE_GPU
+
+crossgradfunction choose_device_crossgrad_calc(enum BoundaryType boundarytype)
+{
+    switch(boundarytype)
+    {
+        case ALLREFLECTING: return &crossgrad_calc_device<ALLREFLECTING>;
+        case ZPERIODIC: return &crossgrad_calc_device<ZPERIODIC>;
+        case ALLPERIODIC: return &crossgrad_calc_device<ALLPERIODIC>;
+    }
+    return NULL;
+}
+
+uvupdatefunction choose_device_uv_update(enum BoundaryType boundarytype, TimeStepperType timestepper)
+{
+    if(timestepper == RK4LOWSTORAGE)
+    {
+        switch(boundarytype)
+        {
+            case ALLREFLECTING: return &uv_update_lowstorage_rk4_device<ALLREFLECTING>;
+            case ZPERIODIC: return &uv_update_lowstorage_rk4_device<ZPERIODIC>;
+            case ALLPERIODIC: return &uv_update_lowstorage_rk4_device<ALLPERIODIC>;
+        }
+    }
+    switch(boundarytype)
+    {
+        case ALLREFLECTING: return &uv_update_rk4_device<ALLREFLECTING>;
+        case ZPERIODIC: return &uv_update_rk4_device<ZPERIODIC>;
+        case ALLPERIODIC: return &uv_update_rk4_device<ALLPERIODIC>;
+    }
+    return NULL;
+}
+
+// the same ghost values as fill_halo, on the device copy of padded. the index arithmetic is written out, rather than going through padpt,
+// so that nothing but plain arithmetic has to be compiled for the device
+template <enum BoundaryType BC> void fill_halo_device(fieldvalue* padded, const Griddata& griddata)
+{
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+    const int np = padsize(griddata);
+    const int sx = (Ny+2)*(Nz+2);
+    const int sy = Nz+2;
+    const bool xperiodic = (BC == ALLPERIODIC);
+    const bool yperiodic = (BC == ALLPERIODIC);
+    const bool zperiodic = (BC == ALLPERIODIC || BC == ZPERIODIC);
+
+    // x faces
+#pragma omp target teams distribute parallel for collapse(2) map(alloc: padded[0:np])
+    for(int j=0; j<Ny; j++)
+    {
+        for(int k=0; k<Nz; k++)
+        {
+            const int p = (j+1)*sy + (k+1);
+            padded[p] = padded[p + ((xperiodic ? Nx-1 : 0)+1)*sx];
+            padded[p + (Nx+1)*sx] = padded[p + ((xperiodic ? 0 : Nx-1)+1)*sx];
+        }
+    }
+    // y faces
+#pragma omp target teams distribute parallel for collapse(2) map(alloc: padded[0:np])
+    for(int i=0; i<Nx; i++)
+    {
+        for(int k=0; k<Nz; k++)
+        {
+            const int p = (i+1)*sx + (k+1);
+            padded[p] = padded[p + ((yperiodic ? Ny-1 : 0)+1)*sy];
+            padded[p + (Ny+1)*sy] = padded[p + ((yperiodic ? 0 : Ny-1)+1)*sy];
+        }
+    }
+    // z faces
+#pragma omp target teams distribute parallel for collapse(2) map(alloc: padded[0:np])
+    for(int i=0; i<Nx; i++)
+    {
+        for(int j=0; j<Ny; j++)
+        {
+            const int p = (i+1)*sx + (j+1)*sy;
+            padded[p] = padded[p + (zperiodic ? Nz-1 : 0)+1];
+            padded[p + Nz+1] = padded[p + (zperiodic ? 0 : Nz-1)+1];
+        }
+    }
+}
+
+// main calls the kernels from every thread of its parallel region, but here the device does the work, so one host thread
+// launches it and the rest wait at the end of the single
+template <enum BoundaryType BC> void crossgrad_calc_device(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB, const Griddata& griddata)
+{
+#pragma omp single
+    crossgrad_on_device<BC>(u,v,ucvx,ucvy,ucvz,ucvmag,padA,padB,griddata);
+}
+
+// the gradients are only ever wanted when the host is about to look at the fields, so this finishes by copying u, v and the ucv grids back
+template <enum BoundaryType BC> void crossgrad_on_device(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB, const Griddata& griddata)
+{
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+    const double h = griddata.h;
+    const int n = Nx*Ny*Nz;
+    const int np = padsize(griddata);
+    const int sx = (Ny+2)*(Nz+2);
+    const int sy = Nz+2;
+    fieldvalue* up = &u[0]; fieldvalue* vp = &v[0];
+    fieldvalue* ucvxp = &ucvx[0]; fieldvalue* ucvyp = &ucvy[0]; fieldvalue* ucvzp = &ucvz[0]; fieldvalue* ucvmagp = &ucvmag[0];
+    fieldvalue* a = &padA[0]; fieldvalue* b = &padB[0];
+
+#pragma omp target teams distribute parallel for collapse(3) map(alloc: up[0:n], vp[0:n], a[0:np], b[0:np])
+    for(int i=0;i<Nx;i++)
+    {
+        for(int j=0; j<Ny; j++)
+        {
+            for(int k=0; k<Nz; k++)
+            {
+                const int p = (i+1)*sx + (j+1)*sy + (k+1);
+                a[p] = up[(i*Ny+j)*Nz+k];
+                b[p] = vp[(i*Ny+j)*Nz+k];
+            }
+        }
+    }
+    fill_halo_device<BC>(a,griddata);
+    fill_halo_device<BC>(b,griddata);
+
+#pragma omp target teams distribute parallel for collapse(3) map(alloc: a[0:np], b[0:np], ucvxp[0:n], ucvyp[0:n], ucvzp[0:n], ucvmagp[0:n])
+    for(int i=0;i<Nx;i++)
+    {
+        for(int j=0; j<Ny; j++)
+        {
+            for(int k=0; k<Nz; k++)   //Central difference
+            {
+                const int p = (i+1)*sx + (j+1)*sy + (k+1);
+                const int m = (i*Ny+j)*Nz+k;
+                const double dxu = 0.5*((double)a[p+sx]-a[p-sx])/h;
+                const double dxv = 0.5*((double)b[p+sx]-b[p-sx])/h;
+                const double dyu = 0.5*((double)a[p+sy]-a[p-sy])/h;
+                const double dyv = 0.5*((double)b[p+sy]-b[p-sy])/h;
+                const double dzu = 0.5*((double)a[p+1]-a[p-1])/h;
+                const double dzv = 0.5*((double)b[p+1]-b[p-1])/h;
+                ucvxp[m] = dyu*dzv - dzu*dyv;
+                ucvyp[m] = dzu*dxv - dxu*dzv;    //Grad u cross Grad v
+                ucvzp[m] = dxu*dyv - dyu*dxv;
+                ucvmagp[m] = sqrt(ucvxp[m]*ucvxp[m] + ucvyp[m]*ucvyp[m] + ucvzp[m]*ucvzp[m]);
+            }
+        }
+    }
+#pragma omp target update from(up[0:n], vp[0:n], ucvxp[0:n], ucvyp[0:n], ucvzp[0:n], ucvmagp[0:n])
+}
+
+// the same scheme as uv_update_rk4, launched from one host thread as in crossgrad_calc_device. the gradients are a separate pass
+// here, the extra copy of u on the device is nothing next to copying the fields back to the host
+template <enum BoundaryType BC> void uv_update_rk4_device(Field& u, Field& v, Field& ku, Field& kv, Field& padA, Field& padB, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata& griddata)
+{
+#pragma omp single
+    {
+        const int Nx = griddata.Nx;
+        const int Ny = griddata.Ny;
+        const int Nz = griddata.Nz;
+        const double h = griddata.h;
+        const int arraysize = Nx*Ny*Nz;
+        const int np = padsize(griddata);
+        const int sx = (Ny+2)*(Nz+2);
+        const int sy = Nz+2;
+
+        const double eps = epsilon;
+        const double bet = beta;
+        const double gm = gam;
+        const double dt = dtime;
+        const double sixth = 1.0/6.0;
+        const double ONETHIRD = 1.0/3.0;
+        const double oneoverepsilon = 1.0/eps;
+        const double oneoverhsq = 1.0/(h*h);
+        const double inc[4] = {0, 0.5, 0.5, 1};
+
+        fieldvalue* up = &u[0]; fieldvalue* vp = &v[0];
+        fieldvalue* kup = &ku[0]; fieldvalue* kvp = &kv[0];
+        // the ping-pong is done on these pointers rather than by swapping the vectors, the device copies are found by the host addresses
+        fieldvalue* a = &padA[0]; fieldvalue* b = &padB[0];
+
+#pragma omp target teams distribute parallel for collapse(3) map(alloc: up[0:arraysize], a[0:np])
+        for(int i=0;i<Nx;i++)
+        {
+            for(int j=0; j<Ny; j++)
+            {
+                for(int k=0; k<Nz; k++) a[(i+1)*sx + (j+1)*sy + (k+1)] = up[(i*Ny+j)*Nz+k];
+            }
+        }
+        fill_halo_device<BC>(a,griddata);
+
+        for(int l=0;l<4;l++)
+        {
+            const double vinc = dt*inc[l];
+            const double nextinc = (l<3) ? dt*inc[l+1] : 0;
+            const double dtsixth = dt*sixth;
+#pragma omp target teams distribute parallel for collapse(3) map(alloc: up[0:arraysize], vp[0:arraysize], kup[0:3*arraysize], kvp[0:3*arraysize], a[0:np], b[0:np])
+            for(int i=0;i<Nx;i++)
+            {
+                for(int j=0; j<Ny; j++)
+                {
+                    for(int k=0; k<Nz; k++)
+                    {
+                        const int n = (i*Ny+j)*Nz+k;
+                        const int p = (i+1)*sx + (j+1)*sy + (k+1);
+                        const double currentu = a[p];
+                        const double currentv = (l==0) ? vp[n] : vp[n] + vinc*kvp[(l-1)*arraysize+n];
+                        const double D2u = oneoverhsq*((double)a[p+sx] + a[p-sx] + a[p+sy] + a[p-sy] + a[p+1] + a[p-1] - 6.0*currentu);
+                        const double kun = oneoverepsilon*(currentu - (ONETHIRD*currentu)*(currentu*currentu) - currentv) + D2u;
+                        const double kvn = eps*(currentu + bet - gm*currentv);
+                        if(l<3)
+                        {
+                            kup[l*arraysize+n] = kun;
+                            kvp[l*arraysize+n] = kvn;
+                            b[p] = up[n] + nextinc*kun;
+                        }
+                        else
+                        {
+                            up[n] = up[n] + dtsixth*((double)kup[n]+2*kup[arraysize+n]+2*kup[2*arraysize+n]+kun);
+                            vp[n] = vp[n] + dtsixth*((double)kvp[n]+2*kvp[arraysize+n]+2*kvp[2*arraysize+n]+kvn);
+                        }
+                    }
+                }
+            }
+            if(l<3)
+            {
+                fill_halo_device<BC>(b,griddata);
+                fieldvalue* temp = a;
+                a = b;
+                b = temp;
+            }
+        }
+        if(computegradients) crossgrad_on_device<BC>(u,v,ucvx,ucvy,ucvz,ucvmag,padA,padB,griddata);
+    }
+}
+
+// the same scheme as uv_update_lowstorage_rk4, launched from one host thread as in uv_update_rk4_device
+template <enum BoundaryType BC> void uv_update_lowstorage_rk4_device(Field& u, Field& v, Field& ku, Field& kv, Field& padA, Field& padB, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata& griddata)
+{
+#pragma omp single
+    {
+        const int Nx = griddata.Nx;
+        const int Ny = griddata.Ny;
+        const int Nz = griddata.Nz;
+        const double h = griddata.h;
+        const int arraysize = Nx*Ny*Nz;
+        const int np = padsize(griddata);
+        const int sx = (Ny+2)*(Nz+2);
+        const int sy = Nz+2;
+
+        static const double A[5] = {0.0, -567301805773.0/1357537059087.0, -2404267990393.0/2016746695238.0, -3550918686646.0/2091501179385.0, -1275806237668.0/842570457699.0};
+        static const double B[5] = {1432997174477.0/9575080441755.0, 5161836677717.0/13612068292357.0, 1720146321549.0/2090206949498.0, 3134564353537.0/4481467310338.0, 2277821191437.0/14882151754819.0};
+
+        const double eps = epsilon;
+        const double bet = beta;
+        const double gm = gam;
+        const double dt = dtime;
+        const double ONETHIRD = 1.0/3.0;
+        const double oneoverepsilon = 1.0/eps;
+        const double oneoverhsq = 1.0/(h*h);
+
+        fieldvalue* up = &u[0]; fieldvalue* vp = &v[0];
+        fieldvalue* kup = &ku[0]; fieldvalue* kvp = &kv[0];
+        fieldvalue* a = &padA[0];
+
+#pragma omp target teams distribute parallel for collapse(3) map(alloc: up[0:arraysize], a[0:np])
+        for(int i=0;i<Nx;i++)
+        {
+            for(int j=0; j<Ny; j++)
+            {
+                for(int k=0; k<Nz; k++) a[(i+1)*sx + (j+1)*sy + (k+1)] = up[(i*Ny+j)*Nz+k];
+            }
+        }
+        fill_halo_device<BC>(a,griddata);
+
+        for(int l=0;l<5;l++)
+        {
+            const double Al = A[l];
+            const double Bl = B[l];
+#pragma omp target teams distribute parallel for collapse(3) map(alloc: vp[0:arraysize], kup[0:arraysize], kvp[0:arraysize], a[0:np])
+            for(int i=0;i<Nx;i++)
+            {
+                for(int j=0; j<Ny; j++)
+                {
+                    for(int k=0; k<Nz; k++)
+                    {
+                        const int n = (i*Ny+j)*Nz+k;
+                        const int p = (i+1)*sx + (j+1)*sy + (k+1);
+                        const double D2u = oneoverhsq*((double)a[p+sx] + a[p-sx] + a[p+sy] + a[p-sy] + a[p+1] + a[p-1] - 6.0*a[p]);
+                        kup[n] = Al*kup[n] + dt*(oneoverepsilon*(a[p] - (ONETHIRD*a[p])*((double)a[p]*a[p]) - vp[n]) + D2u);
+                        kvp[n] = Al*kvp[n] + dt*(eps*(a[p] + bet - gm*vp[n]));
+                    }
+                }
+            }
+            const bool last = (l==4);
+#pragma omp target teams distribute parallel for collapse(3) map(alloc: up[0:arraysize], vp[0:arraysize], kup[0:arraysize], kvp[0:arraysize], a[0:np])
+            for(int i=0;i<Nx;i++)
+            {
+                for(int j=0; j<Ny; j++)
+                {
+                    for(int k=0; k<Nz; k++)
+                    {
+                        const int n = (i*Ny+j)*Nz+k;
+                        const int p = (i+1)*sx + (j+1)*sy + (k+1);
+                        if(last) up[n] = a[p] + Bl*kup[n];
+                        else a[p] += Bl*kup[n];
+                        vp[n] += Bl*kvp[n];
+                    }
+                }
+            }
+            if(!last) fill_halo_device<BC>(a,griddata);
+        }
+        if(computegradients) crossgrad_on_device<BC>(u,v,ucvx,ucvy,ucvz,ucvmag,padA,padB,griddata);
+    }
+}
+
+template void fill_halo_device<ALLREFLECTING>(fieldvalue* padded, const Griddata& griddata);
+template void fill_halo_device<ZPERIODIC>(fieldvalue* padded, const Griddata& griddata);
+template void fill_halo_device<ALLPERIODIC>(fieldvalue* padded, const Griddata& griddata);
+
+#endif
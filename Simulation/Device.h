@@ -0,0 +1,32 @@
+#include "FN_Knot.h"
+using namespace std;
+
+#ifndef DEVICE_H
+#define DEVICE_H
+
+/* the GPU backend. built with -DUSE_GPU (make gpu), the update and gradient kernels are OpenMP target regions, and u, v, the slopes, the
+   padded grids and grad u x grad v stay resident on the device for the whole run. the host copies of u, v and the ucv grids are only
+   brought up to date when the gradients are computed, which only happens on the iterations the curve tracing or the output look at them.
+   without USE_GPU none of this is compiled in. */
+
+#if defined(USE_GPU) && defined(USE_MPI)
+#error "the device backend runs on a single rank, build with one of USE_GPU and USE_MPI"
+#endif
+
+// put the grids on the device at the start of the run, and take them off at the end
+void device_enter_data(Field& u, Field& v, Field& ku, Field& kv, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB);
+void device_exit_data(Field& u, Field& v, Field& ku, Field& kv, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB);
+
+#ifdef USE_GPU
+// the device versions of the kernels, with the same signatures as the host ones so main can pick between them
+template <enum BoundaryType BC> void crossgrad_calc_device(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB, const Griddata& griddata);
+template <enum BoundaryType BC> void uv_update_rk4_device(Field& u, Field& v, Field& ku, Field& kv, Field& padA, Field& padB, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata& griddata);
+template <enum BoundaryType BC> void uv_update_lowstorage_rk4_device(Field& u, Field& v, Field& ku, Field& kv, Field& padA, Field& padB, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata& griddata);
+// crossgrad_calc_device without the omp single, for calling from inside the device updates
+template <enum BoundaryType BC> void crossgrad_on_device(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB, const Griddata& griddata);
+template <enum BoundaryType BC> void fill_halo_device(fieldvalue* padded, const Griddata& griddata);
+crossgradfunction choose_device_crossgrad_calc(enum BoundaryType boundarytype);
+uvupdatefunction choose_device_uv_update(enum BoundaryType boundarytype, TimeStepperType timestepper);
+#endif
+
+#endif //DEVICE_H
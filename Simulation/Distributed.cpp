@@ -0,0 +1,185 @@
+#include "Distributed.h"
+#include <algorithm>
+
+Decomposition decomposition = {0, 1, 0, 0, -1, -1};
+
+#ifdef USE_MPI
+// the halo swaps in flight - up to two grids worth, each with a send and a receive either side
+static MPI_Request halorequests[8];
+static int numhalorequests = 0;
+// what the grids are sent as, to go with fieldvalue
+#ifdef FLOAT_FIELDS
+#define MPI_FIELDVALUE MPI_FLOAT
+#else
+#define MPI_FIELDVALUE MPI_DOUBLE
+#endif
+
+// the number of x planes each rank gets, and the first of them. the remainder goes to the lowest ranks
+static int slab_planes(int rank)
+{
+    return decomposition.globalNx/decomposition.numranks + ((rank < decomposition.globalNx%decomposition.numranks) ? 1 : 0);
+}
+static int slab_start(int rank)
+{
+    return rank*(decomposition.globalNx/decomposition.numranks) + std::min(rank, decomposition.globalNx%decomposition.numranks);
+}
+#endif
+
+int distributed_init(int* argc, char*** argv)
+{
+#ifdef USE_MPI
+    // the MPI calls all happen inside omp single blocks, so any thread may make them, but never two at once
+    int provided;
+    MPI_Init_thread(argc,argv,MPI_THREAD_SERIALIZED,&provided);
+    if(provided < MPI_THREAD_SERIALIZED)
+    {
+        cout << "The MPI library doesn't support MPI_THREAD_SERIALIZED\n";
+        MPI_Finalize();
+        return 1;
+    }
+    MPI_Comm_rank(MPI_COMM_WORLD,&decomposition.rank);
+    MPI_Comm_size(MPI_COMM_WORLD,&decomposition.numranks);
+#endif
+    return 0;
+}
+
+void distributed_finalize()
+{
+#ifdef USE_MPI
+    MPI_Finalize();
+#endif
+}
+
+int share_setup(int status, Griddata& griddata, double& starttime, int& startiteration)
+{
+#ifdef USE_MPI
+    int buffer[5] = {status, griddata.Nx, griddata.Ny, griddata.Nz, startiteration};
+    double doublebuffer[2] = {griddata.h, starttime};
+    MPI_Bcast(buffer,5,MPI_INT,0,MPI_COMM_WORLD);
+    MPI_Bcast(doublebuffer,2,MPI_DOUBLE,0,MPI_COMM_WORLD);
+    status = buffer[0];
+    griddata.Nx = buffer[1];
+    griddata.Ny = buffer[2];
+    griddata.Nz = buffer[3];
+    startiteration = buffer[4];
+    griddata.h = doublebuffer[0];
+    starttime = doublebuffer[1];
+#endif
+    return status;
+}
+
+double distributed_sum(double value)
+{
+#ifdef USE_MPI
+    double sum = 0;
+    MPI_Allreduce(&value,&sum,1,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+    return sum;
+#else
+    return value;
+#endif
+}
+
+int decompose(const Griddata& griddata, Griddata& slabgriddata)
+{
+    slabgriddata = griddata;
+    decomposition.globalNx = griddata.Nx;
+    decomposition.xstart = 0;
+    decomposition.leftrank = -1;
+    decomposition.rightrank = -1;
+#ifdef USE_MPI
+    const int rank = decomposition.rank;
+    const int numranks = decomposition.numranks;
+    if(numranks > griddata.Nx)
+    {
+        if(rank==0) cout << "Can't cut " << griddata.Nx << " x planes between " << numranks << " ranks\n";
+        return 1;
+    }
+    slabgriddata.Nx = slab_planes(rank);
+    decomposition.xstart = slab_start(rank);
+    // along x the ranks sit in a line, or a ring if x is periodic. the walls of a reflecting box are left to fill_halo,
+    // as is everything on a single rank
+    if(numranks > 1)
+    {
+        const bool xperiodic = (BoundaryType == ALLPERIODIC);
+        decomposition.leftrank = (rank > 0) ? rank-1 : (xperiodic ? numranks-1 : -1);
+        decomposition.rightrank = (rank < numranks-1) ? rank+1 : (xperiodic ? 0 : -1);
+    }
+#endif
+    return 0;
+}
+
+void scatter_grid(const Field& grid, Field& slab, const Griddata& slabgriddata)
+{
+    if(&grid == &slab) return;
+#ifdef USE_MPI
+    const int planesize = slabgriddata.Ny*slabgriddata.Nz;
+    vector<int> counts(decomposition.numranks);
+    vector<int> displacements(decomposition.numranks);
+    for(int r=0;r<decomposition.numranks;r++)
+    {
+        counts[r] = slab_planes(r)*planesize;
+        displacements[r] = slab_start(r)*planesize;
+    }
+    const fieldvalue* sendbuffer = (decomposition.rank==0) ? &grid[0] : NULL;
+    MPI_Scatterv(sendbuffer,&counts[0],&displacements[0],MPI_FIELDVALUE,&slab[0],counts[decomposition.rank],MPI_FIELDVALUE,0,MPI_COMM_WORLD);
+#else
+    slab = grid;
+#endif
+}
+
+void gather_grid(const Field& slab, Field& grid, const Griddata& slabgriddata)
+{
+    if(&grid == &slab) return;
+#ifdef USE_MPI
+    const int planesize = slabgriddata.Ny*slabgriddata.Nz;
+    vector<int> counts(decomposition.numranks);
+    vector<int> displacements(decomposition.numranks);
+    for(int r=0;r<decomposition.numranks;r++)
+    {
+        counts[r] = slab_planes(r)*planesize;
+        displacements[r] = slab_start(r)*planesize;
+    }
+    fieldvalue* receivebuffer = (decomposition.rank==0) ? &grid[0] : NULL;
+    MPI_Gatherv(&slab[0],counts[decomposition.rank],MPI_FIELDVALUE,receivebuffer,&counts[0],&displacements[0],MPI_FIELDVALUE,0,MPI_COMM_WORLD);
+#else
+    grid = slab;
+#endif
+}
+
+void gather_fields(const Field& uslab, const Field& vslab, const Field& ucvxslab, const Field& ucvyslab, const Field& ucvzslab, const Field& ucvmagslab, Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, const Griddata& slabgriddata)
+{
+    gather_grid(uslab,u,slabgriddata);
+    gather_grid(vslab,v,slabgriddata);
+    gather_grid(ucvxslab,ucvx,slabgriddata);
+    gather_grid(ucvyslab,ucvy,slabgriddata);
+    gather_grid(ucvzslab,ucvz,slabgriddata);
+    gather_grid(ucvmagslab,ucvmag,slabgriddata);
+}
+
+void halo_exchange_begin(Field& padded, const Griddata& slabgriddata)
+{
+#ifdef USE_MPI
+    // with the padding, x plane i (-1 to Nx) of the slab is the sx values starting at (i+1)*sx. we send whole planes, halos and all,
+    // as that keeps them contiguous. tag 0 is for planes travelling up in x, tag 1 for planes travelling down
+    const int Nx = slabgriddata.Nx;
+    const int sx = (slabgriddata.Ny+2)*(slabgriddata.Nz+2);
+    if(decomposition.leftrank >= 0)
+    {
+        MPI_Irecv(&padded[0],sx,MPI_FIELDVALUE,decomposition.leftrank,0,MPI_COMM_WORLD,&halorequests[numhalorequests++]);
+        MPI_Isend(&padded[sx],sx,MPI_FIELDVALUE,decomposition.leftrank,1,MPI_COMM_WORLD,&halorequests[numhalorequests++]);
+    }
+    if(decomposition.rightrank >= 0)
+    {
+        MPI_Irecv(&padded[(Nx+1)*sx],sx,MPI_FIELDVALUE,decomposition.rightrank,1,MPI_COMM_WORLD,&halorequests[numhalorequests++]);
+        MPI_Isend(&padded[Nx*sx],sx,MPI_FIELDVALUE,decomposition.rightrank,0,MPI_COMM_WORLD,&halorequests[numhalorequests++]);
+    }
+#endif
+}
+
+void halo_exchange_end()
+{
+#ifdef USE_MPI
+    MPI_Waitall(numhalorequests,halorequests,MPI_STATUSES_IGNORE);
+    numhalorequests = 0;
+#endif
+}
@@ -0,0 +1,40 @@
+#include "FN_Knot.h"
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+using namespace std;
+
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+/* the distributed mode. built with -DUSE_MPI (make mpi), the grid is cut into slabs along x, one per rank. x is the slowest index of pt,
+   so each slab is a contiguous run of the global arrays, and the x faces of a padded slab are contiguous planes we can swap straight
+   with the neighbouring ranks. the slabs are stepped and differentiated where they live - the curve tracing and the output stay on rank 0,
+   which gathers the fields when it needs them. without USE_MPI there is one rank holding the whole grid, and all of this does nothing. */
+struct Decomposition
+{
+    int rank, numranks;
+    int globalNx;    // the x size of the whole grid
+    int xstart;      // the global i of this ranks first plane
+    int leftrank, rightrank;   // the ranks holding the planes either side of our slab, or -1 if there is nobody there (a reflecting wall, or a single rank)
+};
+extern Decomposition decomposition;
+
+int distributed_init(int* argc, char*** argv);
+void distributed_finalize();
+// broadcast whether rank 0s initialisation worked, and the grid, time and iteration it ended up with. returns the status
+int share_setup(int status, Griddata& griddata, double& starttime, int& startiteration);
+// the sum of value over all the ranks
+double distributed_sum(double value);
+// set up the decomposition of griddata, and give the grid of this ranks slab
+int decompose(const Griddata& griddata, Griddata& slabgriddata);
+// move whole grids on rank 0 to and from the slabs. if the slab is the grid itself (one rank) they do nothing
+void scatter_grid(const Field& grid, Field& slab, const Griddata& slabgriddata);
+void gather_grid(const Field& slab, Field& grid, const Griddata& slabgriddata);
+void gather_fields(const Field& uslab, const Field& vslab, const Field& ucvxslab, const Field& ucvyslab, const Field& ucvzslab, const Field& ucvmagslab, Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, const Griddata& slabgriddata);
+// swap the x halo planes of a padded slab with the neighbouring ranks. begin can be called on several grids before the one end which waits for them all
+// the halos should already have been filled with fill_halo, the swap only overwrites the x faces that have a neighbour
+void halo_exchange_begin(Field& padded, const Griddata& slabgriddata);
+void halo_exchange_end();
+
+#endif //DISTRIBUTED_H
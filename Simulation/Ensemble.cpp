@@ -0,0 +1,192 @@
+/* the ensemble. make ensemble builds FN_Knot_Ensemble, which runs a list of jobs on one node, several at a time, sharing its threads
+   out between them - the 100^3 to 150^3 boxes of a parameter sweep can't make use of a whole node each. the jobs file has a line a job,
+
+   directory [KEY=VALUE...]
+
+   and each job is run in its directory just as FN_Knot would be there: on its parameters file, or if it has none the one given to the
+   ensemble, with the KEY=VALUEs of its line on top (eg SURFACE_FILENAME="five2" BOUNDARY_TYPE=ZPERIODIC EPSILON=0.3). the directory
+   must have its input files in it already, and everything the job writes, and prints (to log.txt), goes there. blank lines and lines
+   starting with # are skipped.
+
+   the simulation keeps its parameters, and much of its state, in globals, so each job is a process of its own, forked from this one.
+   the jobs are handed out in order as threads come free, whichever job it was that finished, so short jobs don't hold up the long ones.
+   they start on threads/jobs threads each, until there are fewer jobs left than could run at once, when the last of them share the
+   threads which have come free between them. while one job is tracing its knot, the others carry on with their updates. the directory,
+   threads, wall time and exit status of each job go on the end of ensemble.csv
+
+   usage: ./FN_Knot_Ensemble jobsfile [threads=N] [jobs=N] [parameters=parameterfile] [KEY=VALUE...]
+   threads is OMP_NUM_THREADS by default, and jobs is enough to give each DefaultJobThreads threads. any other KEY=VALUE is a parameter
+   for every job, which that job's own line can override. the exit status is 1 if any job failed */
+#include "FN_Knot.h"
+#include "ReadingWriting.h"
+#include <omp.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <map>
+#include <algorithm>
+
+const int DefaultJobThreads = 4;
+
+struct EnsembleJob
+{
+    string directory;
+    vector<string> overrides;   // the KEY=VALUEs of its line
+    int threads;
+    double starttime;
+};
+
+static int read_jobs(const string& filename, vector<EnsembleJob>& jobs)
+{
+    ifstream fin (filename.c_str());
+    if(!fin.good())
+    {
+        cout << "Couldn't open the jobs file " << filename << "\n";
+        return 1;
+    }
+    string buff;
+    while(getline(fin,buff))
+    {
+        stringstream ss(buff);
+        EnsembleJob job;
+        if(!(ss >> job.directory) || job.directory[0] == '#') continue;
+        string override;
+        while(ss >> override) job.overrides.push_back(override);
+        jobs.push_back(job);
+    }
+    return 0;
+}
+
+// in the forked process: go to the job's directory, put the output in log.txt, and run it. never returns
+static void run_job(const EnsembleJob& job, const string& parameterfilename, const vector<string>& overrides)
+{
+    if(chdir(job.directory.c_str()) != 0)
+    {
+        cout << "Couldn't go into the directory " << job.directory << "\n";
+        exit(1);
+    }
+    if(freopen("log.txt","w",stdout) == NULL) exit(1);
+    dup2(fileno(stdout),fileno(stderr));
+    omp_set_num_threads(job.threads);
+
+    vector<string> args(1,"FN_Knot");
+    ifstream ownparameters ("parameters");
+    args.push_back(ownparameters.good() ? string("parameters") : parameterfilename);
+    args.insert(args.end(),overrides.begin(),overrides.end());
+    args.insert(args.end(),job.overrides.begin(),job.overrides.end());
+    vector<char*> argv;
+    for(unsigned int i=0;i<args.size();i++) argv.push_back(&args[i][0]);
+    argv.push_back(NULL);
+    exit(run_simulation((int)args.size(),&argv[0]));
+}
+
+int main (int argc, char** argv)
+{
+    string jobsfilename;
+    string parameterfilename = "parameters";
+    int threads = omp_get_max_threads();
+    int maxjobs = 0;
+    vector<string> overrides;
+    for(int i=1;i<argc;i++)
+    {
+        const string arg = argv[i];
+        const size_t equalspos = arg.find('=');
+        const string key = arg.substr(0,equalspos);
+        const string value = (equalspos == string::npos) ? "" : arg.substr(equalspos+1);
+        if(equalspos == string::npos) jobsfilename = arg;
+        else if(key == "threads") threads = atoi(value.c_str());
+        else if(key == "jobs") maxjobs = atoi(value.c_str());
+        else if(key == "parameters") parameterfilename = value;
+        else overrides.push_back(arg);
+    }
+    if(jobsfilename.empty())
+    {
+        cout << "usage: ./FN_Knot_Ensemble jobsfile [threads=N] [jobs=N] [parameters=parameterfile] [KEY=VALUE...]\n";
+        return 1;
+    }
+    vector<EnsembleJob> jobs;
+    if(read_jobs(jobsfilename,jobs)) return 1;
+    // the parameters are checked here, so a typo is found before any job starts rather than in the log of every one. setting them
+    // changes the globals the jobs start from, so it is done in a process of its own
+    cout.flush();
+    const pid_t checker = fork();
+    if(checker == 0)
+    {
+        for(unsigned int i=0;i<overrides.size();i++) if(set_parameter(overrides[i])) exit(1);
+        for(unsigned int j=0;j<jobs.size();j++)
+        {
+            for(unsigned int i=0;i<jobs[j].overrides.size();i++) if(set_parameter(jobs[j].overrides[i])) exit(1);
+        }
+        exit(0);
+    }
+    int checkstatus;
+    if(checker < 0 || waitpid(checker,&checkstatus,0) != checker || !WIFEXITED(checkstatus) || WEXITSTATUS(checkstatus) != 0) return 1;
+    // the jobs run in their own directories, so the parameter file they fall back on has to be found from anywhere
+    if(parameterfilename[0] != '/')
+    {
+        char cwd[4096];
+        if(getcwd(cwd,sizeof(cwd)) != NULL) parameterfilename = string(cwd) + "/" + parameterfilename;
+    }
+    threads = std::max(threads,1);
+    if(maxjobs <= 0) maxjobs = std::max(threads/DefaultJobThreads,1);
+    maxjobs = std::min(maxjobs,threads);
+    cout << jobs.size() << " jobs, up to " << maxjobs << " at a time on " << threads << " threads\n";
+
+    ofstream ensemblecsv ("ensemble.csv",std::ofstream::app);
+    if(ensemblecsv.tellp() == 0) ensemblecsv << "directory,threads,seconds,status\n";
+    map<pid_t,int> running;     // the job each process is running
+    int freethreads = threads;
+    unsigned int next = 0;
+    int failed = 0;
+    const double start = omp_get_wtime();
+    while(next < jobs.size() || !running.empty())
+    {
+        // start as many as there is room for. the free threads are shared between the jobs starting now, or all of them that could
+        while(next < jobs.size() && (int)running.size() < maxjobs && freethreads > 0)
+        {
+            const int starting = std::min(maxjobs - (int)running.size(),(int)(jobs.size() - next));
+            EnsembleJob& job = jobs[next];
+            job.threads = std::max(freethreads/starting,1);
+            // anything still buffered would be printed again by the job
+            cout.flush();
+            const pid_t pid = fork();
+            if(pid == 0) run_job(job,parameterfilename,overrides);
+            if(pid < 0)
+            {
+                cout << "Couldn't start a process for " << job.directory << "\n";
+                failed++;
+                next++;
+                continue;
+            }
+            job.starttime = omp_get_wtime();
+            running[pid] = next;
+            freethreads -= job.threads;
+            cout << "Started " << job.directory << " on " << job.threads << " threads\n";
+            next++;
+        }
+        if(running.empty()) break;
+
+        int status;
+        const pid_t pid = wait(&status);
+        if(pid < 0) break;
+        map<pid_t,int>::iterator it = running.find(pid);
+        if(it == running.end()) continue;
+        const EnsembleJob& job = jobs[it->second];
+        running.erase(it);
+        freethreads += job.threads;
+        const double seconds = omp_get_wtime() - job.starttime;
+        // as the shell would give it, 128 + the signal for a job which was killed
+        const int exitstatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        if(exitstatus == 0) cout << "Finished " << job.directory << " in " << seconds << "s\n";
+        else
+        {
+            cout << job.directory << " failed with exit status " << exitstatus << ", see " << job.directory << "/log.txt\n";
+            failed++;
+        }
+        ensemblecsv << job.directory << ',' << job.threads << ',' << seconds << ',' << exitstatus << '\n';
+        ensemblecsv.flush();
+    }
+    ensemblecsv.close();
+    cout << jobs.size() - failed << " of " << jobs.size() << " jobs finished in " << omp_get_wtime() - start << "s\n";
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+#include "FN_Constants.h"
+
+// the (RUNTIME) options from FN_Constants.h, with the values they take if neither the parameter file nor the command line sets them.
+int option = FROM_SURFACE_FILE;
+std::string knot_filename = "";
+std::string B_filename = "";
+int NumComponents = 1;
+
+enum BoundaryType BoundaryType = ALLREFLECTING;
+
+double SolidAngleTolerance = 0.2;
+
+bool PreserveRatios = true;
+
+double TTime = 1000;
+double UVPrintTime = 10;
+double VelocityKnotplotPrintTime = 10;
+double FrequentKnotplotPrintTime = 1;
+double InitialSkipTime = 10;
+double CheckpointTime = 0;
+double PerfLogTime = 0;
+
+UVFormatType UVFormat = VTK_FILES;
+int HDF5Compression = 4;
+int HDF5Digits = -1;
+KnotFormatType KnotFormat = VTK_KNOTPLOTS;
+double ROIMargin = 0;
+int ROICoarseStride = 4;
+double ActiveThreshold = 0;
+double ActiveCheckTime = 1;
+double RefineMargin = 0;
+int AnalysisThreads = 0;
+int AnalysisSnapshots = 2;
+bool LeanMemory = 0;
+
+double initialh = 0.5;
+int initialNx = 100;
+int initialNy = 100;
+int initialNz = 100;
+
+int interpolationflag = 0;
+int interpolatedNx = 0;
+int interpolatedNy = 0;
+int interpolatedNz = 0;
+
+double dtime = 0.02;
+
+TimeStepperType TimeStepper = RK4CLASSIC;
+
+double epsilon = 0.3;
+double beta = 0.7;
+double gam = 0.5;
+
+// derived from the above in read_parameters
+int NumSlopeGrids = 3;
+double xmax = 8*100*0.5/10.0;
+double ymax = 8*100*0.5/10.0;
+double zmax = 8*100*0.5/10.0;
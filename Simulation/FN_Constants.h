@@ -7,10 +7,15 @@
 #define FROM_CURVE_FILE 1
 #define FROM_UV_FILE 2
 #define FROM_FUNCTION 3
+#define FROM_CHECKPOINT_FILE 4
 // the different boundary conditions
 enum BoundaryType {ALLREFLECTING, ZPERIODIC, ALLPERIODIC};
 
 /* CHANGE THESE OPTIONS */
+/* the options marked (RUNTIME) are read at startup by read_parameters, from a parameter file (default "parameters") of
+   KEY=VALUE lines using the INSERT_ keys given next to each one, then from any KEY=VALUE arguments on the command line.
+   their defaults live in FN_Constants.cpp.
+   eg: ./FN_Knot parameters INSERT_NX=100 INSERT_TIMESTEP=0.01 */
 
 // OPTION - // what kind of initialisation
 /* the different initialisation options
@@ -19,44 +24,112 @@ FROM_PHI_FILE: Skip initialisation, input from previous run.
 FROM_SURFACE_FILE: Initialise from input file(s) generated in surface evolver.
 FROM_UV_FILE: Skip initialisation, run FN dynamics from uv file
 FROM_FUNCTION: Initialise from some function which can be implemented by the user in phi_calc_manual. eg using theta(x) = artcan(y-y0/x-x0) to give a pole at x0,y0 etc..:wq
+FROM_CHECKPOINT_FILE: Carry on exactly where a previous run left off, from the checkpoint file named by INSERT_UV_FILENAME. the grid, time and iteration come from the file
  */
 //if ncomp > 1 (no. of components) then component files should be separated to 'XXXXX.txt" "XXXXX2.txt", ....
-const int option = INSERT_INITIALISATION_TYPE;         //unknot default option
-const std::string knot_filename = "INSERT_SURFACE_FILENAME";      //if FROM_SURFACE_FILE assumed input filename format of "XXXXX.stl"
-const std::string B_filename = "INSERT_UV_FILENAME";    //filename for phi field or uv field
-const int NumComponents = INSERT_NUM_COMPONENTS;   //No. points in x,y and z
+extern int option;         // (RUNTIME) INSERT_INITIALISATION_TYPE
+extern std::string knot_filename;      // (RUNTIME) INSERT_SURFACE_FILENAME. if FROM_SURFACE_FILE assumed input filename format of "XXXXX.stl"
+extern std::string B_filename;    // (RUNTIME) INSERT_UV_FILENAME. filename for phi field or uv field
+extern int NumComponents;   // (RUNTIME) INSERT_NUM_COMPONENTS
 
 // OPTION - what kind of boundary condition
-const BoundaryType BoundaryType=INSERT_BOUNDARY_TYPE;
+extern BoundaryType BoundaryType;   // (RUNTIME) INSERT_BOUNDARY_TYPE
+
+// OPTION - how accurately should the initial solid angle be summed
+/* above 0, the sums over the curve points or surface triangles are done by a treecode: groups of them seen from further away than
+   their size over the tolerance are summed from their moments. the error goes roughly as the square of the tolerance. 0 sums them all directly */
+extern double SolidAngleTolerance;   // (RUNTIME) INSERT_SOLIDANGLE_TOLERANCE
 
 //OPTION - do you want the geometry of the input file to be exactly preserved, or can it be scaled to fit the box better
-#define PRESERVE_RATIOS INSERT_PRESERVE_RATIOS  //1 to scale input file preserving the aspect ratio
+extern bool PreserveRatios;  // (RUNTIME) INSERT_PRESERVE_RATIOS. 1 to scale input file preserving the aspect ratio
 
 // OPTION - how long should it run, when do you want data printed, what time value should it start at
-const double TTime = INSERT_RUNTIME;       //total time of simulation (simulation units)
-const double UVPrintTime = INSERT_UVPRINTTIME;       //print out UV every # unit of time (simulation units)
-const double VelocityKnotplotPrintTime = INSERT_VELOCITYPRINTTIME;       //print out the velocity every # unit of time (simulation units)
-const double FrequentKnotplotPrintTime = INSERT_FREQUENTPRINTTIME; // print out the knot , without the velocity
-const double InitialSkipTime = INSERT_SKIPTIME;       // amout to skip before beginning the curve tracing
+extern double TTime;       // (RUNTIME) INSERT_RUNTIME. total time of simulation (simulation units)
+extern double UVPrintTime;       // (RUNTIME) INSERT_UVPRINTTIME. print out UV every # unit of time (simulation units)
+extern double VelocityKnotplotPrintTime;       // (RUNTIME) INSERT_VELOCITYPRINTTIME. print out the velocity every # unit of time (simulation units)
+extern double FrequentKnotplotPrintTime; // (RUNTIME) INSERT_FREQUENTPRINTTIME. print out the knot , without the velocity
+extern double InitialSkipTime;       // (RUNTIME) INSERT_SKIPTIME. amout to skip before beginning the curve tracing
+extern double CheckpointTime;       // (RUNTIME) INSERT_CHECKPOINTTIME. write a checkpoint, for restarting from, every # unit of time. 0 for none
+extern double PerfLogTime;       // (RUNTIME) INSERT_PERF_LOG_TIME. write a row of timings to performance.csv every # unit of time (see Profiling.h). 0 for none
+
+// OPTION - what should the uv output look like
+/* Available options:
+VTK_FILES: a binary vtk file per print, uv_plot<t>.vtk
+HDF5_FILE: every print in the one compressed file uv_fields.h5, with uv_fields.xmf for ParaView. needs a build with HDF5 (make hdf5), see Hdf5Output.h
+ */
+enum UVFormatType {VTK_FILES, HDF5_FILE};
+extern UVFormatType UVFormat;   // (RUNTIME) INSERT_UV_FORMAT
+extern int HDF5Compression;   // (RUNTIME) INSERT_HDF5_COMPRESSION. deflate level, 0 (none) to 9
+extern int HDF5Digits;   // (RUNTIME) INSERT_HDF5_DIGITS. keep this many decimal places (lossy), or -1 to store the floats exactly
+
+// OPTION - what should the knot output look like
+/* Available options:
+VTK_KNOTPLOTS: an ascii vtk file per component per print, knotplot<c>_<t>.vtk
+KNOT_SERIES: every print appended to the one binary file knotplots.bin (see append_knot_record in ReadingWriting.cpp). Shell_Scripts/timeseriesconverter.py turns it back into vtk files
+ */
+enum KnotFormatType {VTK_KNOTPLOTS, KNOT_SERIES};
+extern KnotFormatType KnotFormat;   // (RUNTIME) INSERT_KNOT_FORMAT
+
+// OPTION - do you want the whole grid in every uv print, or only the part round the knot?
+/* above 0, once there is a traced knot each print is two files: uv_plot<t>_roi.vtk, the fields at full resolution in the box round the
+   knot (the modded curve points, pushed out by the margin), and uv_plot<t>_coarse.vtk, every stride'th point of the whole grid.
+   until the first trace, and with a margin of 0, the whole grid is printed as usual */
+extern double ROIMargin;   // (RUNTIME) INSERT_ROI_MARGIN. how far round the knot, in simulation units, to print at full resolution
+extern int ROICoarseStride;   // (RUNTIME) INSERT_ROI_COARSE_STRIDE. the stride of the coarse print of the whole grid
+
+// OPTION - do you want to step only the parts of the grid where something is happening?
+/* above 0, blocks of the grid where |du/dt| and |dv/dt| are both below the threshold, as are their neighbours', are left unstepped
+   between checks (see Stencil.h). the error this makes grows with the threshold, so keep it small next to the slopes in a wave front.
+   a wave should cross less than a block (16 points) between checks. 0 steps everything, every step. not for the GPU backend */
+extern double ActiveThreshold;   // (RUNTIME) INSERT_ACTIVE_THRESHOLD
+extern double ActiveCheckTime;   // (RUNTIME) INSERT_ACTIVE_CHECKTIME. how often, in simulation units, to measure every block again
+
+// OPTION - do you want the grid refined round the knot?
+/* above 0, each traced component gets a patch twice as fine as the grid round it, out to this far from it, which follows the knot
+   each time it is traced (see Refinement.h). 0 for none. a single rank on the host only */
+extern double RefineMargin;   // (RUNTIME) INSERT_REFINE_MARGIN
+
+// OPTION - do you want the update to carry on while the knot is traced and printed?
+/* above 0, rank 0 copies the fields into a snapshot whenever there is analysis to do, and a thread of its own does it with a team of this
+   many OpenMP threads, while the update carries on (see Pipeline.h). leave them the cores to do it, eg by lowering OMP_NUM_THREADS.
+   0 does it all in place, with everyone waiting. not with the refined patches, which have to follow the knot as soon as it is traced */
+extern int AnalysisThreads;   // (RUNTIME) INSERT_ANALYSIS_THREADS
+extern int AnalysisSnapshots;   // (RUNTIME) INSERT_ANALYSIS_SNAPSHOTS. how many snapshots can be waiting at once, before the update waits for the analysis
+
+// OPTION - do you want to leave out the grad u x grad v grids, to fit a bigger grid in memory?
+/* 1 keeps no grids of grad u x grad v at all, only u, v and the slopes. when the knot is traced or uv printed, rank 0 works it out from
+   u and v near the filaments instead, and anywhere else it is needed point by point (see Gradients.h). the knot comes out the same, the
+   tracing takes a little longer. not for the GPU backend, or with the refined patches, whose updates fill the grids */
+extern bool LeanMemory;   // (RUNTIME) INSERT_LEAN_MEMORY
 
 // OPTION - what grid values do you want/ timestep
 //Grid points
-const double initialh = INSERT_GRIDSPACING;            //grid spacing
-const int initialNx = INSERT_NX;   //No. points in x,y and z
-const int initialNy = INSERT_NY;
-const int initialNz = INSERT_NZ;
+extern double initialh;            // (RUNTIME) INSERT_GRIDSPACING. grid spacing
+extern int initialNx;   // (RUNTIME) INSERT_NX, INSERT_NY, INSERT_NZ. No. points in x,y and z
+extern int initialNy;
+extern int initialNz;
 
 // OPTION - do you want to read in a coarse uv file , and interpolate onto a finer grid? If so,
 // first, set the flag to 1 if you want, 0 if you dont.
 // give the # points in each dimension, which should be > initialNx - the spacing will be set by (initialNx-1)*h/(interpolatedNx-1)
-const int interpolationflag = INSERT_INTERPOLATION_FLAG ;
-const int interpolatedNx = INSERT_INTERPOLATED_NX;   //No. points in x,y and z
-const int interpolatedNy = INSERT_INTERPOLATED_NY;
-const int interpolatedNz = INSERT_INTERPOLATED_NZ;
+extern int interpolationflag;   // (RUNTIME) INSERT_INTERPOLATION_FLAG
+extern int interpolatedNx;   // (RUNTIME) INSERT_INTERPOLATED_NX, INSERT_INTERPOLATED_NY, INSERT_INTERPOLATED_NZ
+extern int interpolatedNy;
+extern int interpolatedNz;
 
 
 // timestep
-const double dtime = INSERT_TIMESTEP;         //size of each time step
+extern double dtime;         // (RUNTIME) INSERT_TIMESTEP. size of each time step
+
+// OPTION - which time stepping scheme do you want
+/* Available options:
+RK4CLASSIC: standard four stage Runge-Kutta. Stores the first three slopes, so needs 3 extra grids per field
+RK4LOWSTORAGE: Carpenter-Kennedy five stage, fourth order Runge-Kutta in 2N-storage form. Needs 1 extra grid per field
+ */
+enum TimeStepperType {RK4CLASSIC, RK4LOWSTORAGE};
+extern TimeStepperType TimeStepper;   // (RUNTIME) INSERT_RK_SCHEME
+// the number of Nx*Ny*Nz slope grids (ku and kv) the chosen scheme needs. set by read_parameters
+extern int NumSlopeGrids;
 
 // OPTION - do you want to resize the box? if so, when?
 const bool BoxResizeFlag = 0;
@@ -69,10 +142,10 @@ const double sensorycoord = 0;
 const double sensorzcoord = 0;
 
 // OPTION - how big should the knot be in the box, do you want it tilted or displaced?
-//Size boundaries of knot (now autoscaled)
-const double xmax = 8*initialNx*initialh/10.0;
-const double ymax = 8*initialNy*initialh/10.0;
-const double zmax = 8*initialNz*initialh/10.0;
+//Size boundaries of knot (now autoscaled). these are 8/10 of the box, and are set by read_parameters
+extern double xmax;
+extern double ymax;
+extern double zmax;
 /** two rotation angles for the initial stl file, and a displacement vector for the file **/
 const double initialthetarotation = 0;
 const double initialxdisplacement = 0;
@@ -85,9 +158,9 @@ const double zscalefactortweak = 0;
 // OPTION - what system params do you want . Don't touch these usually
 //System size parameters
 const double lambda = 21.3;                //approx wavelength
-const double epsilon = 0.3;                //parameters for F-N eqns
-const double beta = 0.7;
-const double gam = 0.5;
+extern double epsilon;                // (RUNTIME) INSERT_EPSILON, INSERT_BETA, INSERT_GAMMA. parameters for F-N eqns
+extern double beta;
+extern double gam;
 
 
 #endif //FNCONSTANTS_H
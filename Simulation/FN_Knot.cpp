@@ -12,7 +12,7 @@
    The pde's used are
    dudt = (u - u^3/3 - v)/epsilon + Del^2 u
    dvdt = epsilon*(u + beta - gam v)
-   5) The update method is Runge-Kutta fourth order (update_uv) unless RK4 is set to 0, otherwise Euler forward method is used.
+   5) The update method is Runge-Kutta fourth order (uv_update), either the classic four stage scheme or a low storage five stage one, chosen by TimeStepper.
    6) A parametric curve for the knot is found at each unit T
 
 
@@ -23,17 +23,31 @@
 #include "Initialisation.h"    //contains user defined variables for the simulation, and the parameters used
 #include "TriCubicInterpolator.h"    //contains user defined variables for the simulation, and the parameters used
 #include "ReadingWriting.h"    //contains user defined variables for the simulation, and the parameters used
+#include "Stencil.h"    //ghost padded grids for the laplacian and gradient kernels
+#include "Distributed.h"    //the slab decomposition for running over several MPI ranks
+#include "Device.h"    //the GPU versions of the kernels
+#include "Refinement.h"    //the refined patches round the knot
+#include "Pipeline.h"    //the analysis thread, which works on copies of the fields while the update carries on
+#include "Profiling.h"    //the phase timers, and the performance log
+#include "Gradients.h"    //grad u x grad v for the curve tracing, from the grids or worked out near the knot
 #include <omp.h>
 #include <math.h>
 #include <string.h>
 #include <algorithm>
+#include <map>
 //includes for the signal processing
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_fft_real.h>
 #include <gsl/gsl_fft_halfcomplex.h>
 
-int main (void)
+// the benchmark (make bench, see Benchmark.cpp) brings its own main, and uses everything else here
+#ifndef FN_BENCHMARK
+int run_simulation(int argc, char** argv)
 {
+    if(distributed_init(&argc,&argv)) return 1;
+    // the run parameters come from a parameter file and the command line, so one binary serves every job
+    if(read_parameters(argc,argv)) { distributed_finalize(); return 1; }
+
     Griddata griddata;
     griddata.Nx = initialNx;
     griddata.Ny = initialNy;
@@ -42,145 +56,259 @@ int main (void)
     int Nx = griddata.Nx;
     int Ny = griddata.Ny;
     int Nz = griddata.Nz;
+    // the whole grid only lives on rank 0, which does the initialisation, the curve tracing and the output
+    const bool rootrank = (decomposition.rank == 0);
+    const int gridsize = rootrank ? Nx*Ny*Nz : 0;
     // all major allocations are here
     // the main data storage arrays, contain info associated with the grid
-    vector<double>phi(Nx*Ny*Nz);  //scalar potential
-    vector<double>u(Nx*Ny*Nz);
-    vector<double>v(Nx*Ny*Nz);
-    vector<double>ucvx(Nx*Ny*Nz);
-    vector<double>ucvy(Nx*Ny*Nz);
-    vector<double>ucvz(Nx*Ny*Nz);
-    vector<double>ucvmag(Nx*Ny*Nz);// mod(grad u cross grad v)
-    vector<double>ku(4*Nx*Ny*Nz);
-    vector<double>kv(4*Nx*Ny*Nz);
-    // objects to hold information about the knotcurve we find, andthe surface we read in
-    vector<knotcurve > knotcurves; // a structure containing some number of knot curves, each curve a list of knotpoints
-    vector<knotcurve > knotcurvesold; // a structure containing some number of knot curves, each curve a list of knotpoints
+    vector<double>phi(gridsize);  //scalar potential
+    Field u(gridsize);
+    Field v(gridsize);
+    // in the lean memory mode (INSERT_LEAN_MEMORY) these stay empty, and the analysis works grad u x grad v out for itself
+    const int ucvsize = LeanMemory ? 0 : gridsize;
+    Field ucvx(ucvsize);
+    Field ucvy(ucvsize);
+    Field ucvz(ucvsize);
+    Field ucvmag(ucvsize);// mod(grad u cross grad v)
+    // the slopes are allocated once we know the grid each rank steps
+    Field ku;
+    Field kv;
+    // objects to hold information about the knotcurve we find, andthe surface we read in. the knot curves, and the sensor point
+    // we output u values at, are kept in the analysis state
+    AnalysisState analysis;
     vector<triangle> knotsurface;    //structure for storing knot surface coordinates
-    // sensor points we output u values at
-    viewpoint sensorpoint;
-    // GSL initialization
-    const gsl_multimin_fminimizer_type *Type;
-    gsl_multimin_fminimizer *minimizerstate;
-    Type = gsl_multimin_fminimizer_nmsimplex2;
-    minimizerstate = gsl_multimin_fminimizer_alloc (Type,2);
 
     // setting things from globals
-    int starttime = 0;
+    double starttime = 0;
+    int startiteration = 0;
     int FrequentKnotplotPrintIteration = (int)(FrequentKnotplotPrintTime/dtime);
     int VelocityKnotplotPrintIteration = (int)(VelocityKnotplotPrintTime/dtime);
     int InitialSkipIteration = (int)(InitialSkipTime/dtime);
     int UVPrintIteration = (int)(UVPrintTime/dtime);
-    sensorpoint.xcoord = sensorxcoord ;
-    sensorpoint.ycoord = sensorycoord ;
-    sensorpoint.zcoord = sensorzcoord ;
-    // initialising timers
-    time_t rawtime;
-    time (&rawtime);
-    struct tm * timeinfo;
+    int CheckpointIteration = (int)(CheckpointTime/dtime);
+    int ActiveCheckIteration = std::max((int)(ActiveCheckTime/dtime),1);
+    int PerfLogIteration = (int)(PerfLogTime/dtime);
+    analysis.sensorpoint.xcoord = sensorxcoord ;
+    analysis.sensorpoint.ycoord = sensorycoord ;
+    analysis.sensorpoint.zcoord = sensorzcoord ;
+    analysis.InitialSkipIteration = InitialSkipIteration;
+    analysis.FrequentKnotplotPrintIteration = FrequentKnotplotPrintIteration;
+    analysis.VelocityKnotplotPrintIteration = VelocityKnotplotPrintIteration;
+    analysis.UVPrintIteration = UVPrintIteration;
+    analysis.CheckpointIteration = CheckpointIteration;
 
     // INITIALISATION
 
-    switch(option)
+    int initstatus = 0;
+    if(rootrank)
     {
-        case FROM_UV_FILE:
-            {
-                cout << "Reading input file...\n";
-                if(uvfile_read(u,v,ku,kv, ucvx,ucvy,ucvz,ucvmag,griddata)){return 1;}
-                // get the start time -  we hack this together as so:
-                // the filename looks like uv_plotxxx.vtk, we want the xxx. so we find the t, find the ., and grab everyting between
-                string number = B_filename.substr(B_filename.find('t')+1,B_filename.find('.')-B_filename.find('t')-1);
-                starttime = atoi(number.c_str());
-                break;
-            }
-        case FROM_FUNCTION:
-            {
-                phi_calc_manual(phi,griddata);
-                cout << "Calculating u and v...\n";
-                uv_initialise(phi,u,v,griddata);
-                break;
-            }
-        case FROM_SURFACE_FILE:
-            {
-                init_from_surface_file(knotsurface);
-                phi_calc_surface(phi,knotsurface,griddata);
-                cout << "Calculating u and v...\n";
-                uv_initialise(phi,u,v,griddata);
-                break;
-            }
-        case FROM_CURVE_FILE:
-            {
-                Link Curve;
-                InitialiseFromFile(Curve);
-                cout << "calculating the solid angle..." << endl;
-                phi_calc_curve(phi,Curve,griddata);
-                cout << "Calculating u and v...\n";
-                uv_initialise(phi,u,v,griddata);
-            }
+        switch(option)
+        {
+            case FROM_UV_FILE:
+                {
+                    cout << "Reading input file...\n";
+                    if(uvfile_read(u,v,ucvx,ucvy,ucvz,ucvmag,griddata)){initstatus = 1; break;}
+                    // get the start time -  we hack this together as so:
+                    // the filename looks like uv_plotxxx.vtk, we want the xxx. so we find the t, find the ., and grab everyting between
+                    string number = B_filename.substr(B_filename.find('t')+1,B_filename.find('.')-B_filename.find('t')-1);
+                    starttime = atoi(number.c_str());
+                    startiteration = (int)(starttime/dtime);
+                    break;
+                }
+            case FROM_CHECKPOINT_FILE:
+                {
+                    cout << "Reading checkpoint file...\n";
+                    if(checkpoint_read(u,v,ucvx,ucvy,ucvz,ucvmag,griddata,startiteration)){initstatus = 1; break;}
+                    // the same time the run which wrote it had, not a rounded one from the filename
+                    starttime = startiteration*dtime;
+                    break;
+                }
+            case FROM_FUNCTION:
+                {
+                    phi_calc_manual(phi,griddata);
+                    cout << "Calculating u and v...\n";
+                    uv_initialise(phi,u,v,griddata);
+                    break;
+                }
+            case FROM_SURFACE_FILE:
+                {
+                    init_from_surface_file(knotsurface);
+                    phi_calc_surface(phi,knotsurface,griddata);
+                    cout << "Calculating u and v...\n";
+                    uv_initialise(phi,u,v,griddata);
+                    break;
+                }
+            case FROM_CURVE_FILE:
+                {
+                    Link Curve;
+                    InitialiseFromFile(Curve);
+                    cout << "calculating the solid angle..." << endl;
+                    phi_calc_curve(phi,Curve,griddata);
+                    cout << "Calculating u and v...\n";
+                    uv_initialise(phi,u,v,griddata);
+                }
 
+        }
+        // phi is only ever needed to set up u and v. the readers can also have sized the ucv grids to the grid they read
+        vector<double>().swap(phi);
+        if(LeanMemory)
+        {
+            Field().swap(ucvx);
+            Field().swap(ucvy);
+            Field().swap(ucvz);
+            Field().swap(ucvmag);
+        }
     }
+    // everyone else needs to know the grid rank 0 ended up with (reading in a uv file can change it), and whether it got this far
+    if(share_setup(initstatus,griddata,starttime,startiteration)) { distributed_finalize(); return 1; }
+    analysis.startiteration = startiteration;
+
+    // cut the grid into a slab per rank. on a single rank the slab is the whole grid, and the slab vectors below are just the global ones
+    Griddata slabgriddata;
+    if(decompose(griddata,slabgriddata)) { distributed_finalize(); return 1; }
+    const int slabsize = slabgriddata.Nx*slabgriddata.Ny*slabgriddata.Nz;
+    const bool distributed = (decomposition.numranks > 1);
+    Field uslabstorage, vslabstorage, ucvxslabstorage, ucvyslabstorage, ucvzslabstorage, ucvmagslabstorage;
+    Field& uslab = distributed ? uslabstorage : u;
+    Field& vslab = distributed ? vslabstorage : v;
+    Field& ucvxslab = distributed ? ucvxslabstorage : ucvx;
+    Field& ucvyslab = distributed ? ucvyslabstorage : ucvy;
+    Field& ucvzslab = distributed ? ucvzslabstorage : ucvz;
+    Field& ucvmagslab = distributed ? ucvmagslabstorage : ucvmag;
+    if(distributed)
+    {
+        uslab.resize(slabsize);
+        vslab.resize(slabsize);
+        if(!LeanMemory)
+        {
+            ucvxslab.resize(slabsize);
+            ucvyslab.resize(slabsize);
+            ucvzslab.resize(slabsize);
+            ucvmagslab.resize(slabsize);
+        }
+    }
+    scatter_grid(u,uslab,slabgriddata);
+    scatter_grid(v,vslab,slabgriddata);
+    ku.assign(NumSlopeGrids*slabsize,0);
+    kv.assign(NumSlopeGrids*slabsize,0);
+
+    // ghost padded work grids for the stencil kernels. allocated here, rather than above, as reading in a uv file can change the grid
+    Field padA(padsize(slabgriddata));
+    Field padB(padsize(slabgriddata));
+    setup_active_blocks(slabgriddata);
+
+    // pick the update and gradient kernels for this boundary condition and time stepper, once, rather than branching on them in the loops
+#ifdef USE_GPU
+    uvupdatefunction uv_update = choose_device_uv_update(BoundaryType,TimeStepper);
+    crossgradfunction crossgrad_calc = choose_device_crossgrad_calc(BoundaryType);
+#else
+    uvupdatefunction uv_update = choose_uv_update(BoundaryType,TimeStepper);
+    crossgradfunction crossgrad_calc = choose_crossgrad_calc(BoundaryType);
+#endif
+    // with the GPU backend, the fields live on the device from here on
+    device_enter_data(uslab,vslab,ku,kv,ucvxslab,ucvyslab,ucvzslab,ucvmagslab,padA,padB);
 
     // UPDATE
-    cout << "Updating u and v...\n";
+    if(rootrank) cout << "Updating u and v...\n";
 
     double CurrentTime = starttime;
-    int CurrentIteration = (int)(CurrentTime/dtime);
-#pragma omp parallel default(none) shared (u,v,ku,kv,ucvx, CurrentIteration,InitialSkipIteration,FrequentKnotplotPrintIteration,UVPrintIteration,VelocityKnotplotPrintIteration,ucvy, ucvz,ucvmag,cout, rawtime, starttime, timeinfo,CurrentTime, knotcurves,knotcurvesold,minimizerstate,griddata,sensorpoint)
+    int CurrentIteration = startiteration;
+    const double slabpoints = (double)slabsize;
+    setup_profiling(omp_get_max_threads());
+    if(rootrank && AnalysisThreads > 0) start_pipeline(analysis,griddata);
+#pragma omp parallel default(none) shared (uv_update,crossgrad_calc,u,v,ku,kv,padA,padB,ucvx, CurrentIteration,InitialSkipIteration,FrequentKnotplotPrintIteration,UVPrintIteration,VelocityKnotplotPrintIteration,CheckpointIteration,ActiveCheckIteration,PerfLogIteration,slabpoints,ActiveThreshold,activeblocks,RefineMargin,LeanMemory,AnalysisThreads,startiteration,ucvy, ucvz,ucvmag,cout, starttime,CurrentTime,analysis,griddata,TTime,dtime,uslab,vslab,ucvxslab,ucvyslab,ucvzslab,ucvmagslab,slabgriddata,rootrank)
     {
+        // grad u x grad v is worked out once per iteration, by all the threads, and only on the iterations which use it. after this
+        // first one, it comes out of the end of the update which steps onto that iteration
+        if(!LeanMemory && gradients_needed(CurrentIteration,InitialSkipIteration,FrequentKnotplotPrintIteration,VelocityKnotplotPrintIteration,UVPrintIteration,CheckpointIteration))
+        {
+            crossgrad_calc(uslab,vslab,ucvxslab,ucvyslab,ucvzslab,ucvmagslab,padA,padB,slabgriddata); //find Grad u cross Grad v
+        }
         while(CurrentTime <= TTime)
         {
+            // everyone has to have read CurrentTime for the test above before the single moves it on, or a thread can leave the loop
+            // one iteration early and the rest are left waiting for it
+#pragma omp barrier
 #pragma omp single
             {
-
-                // its useful to have an oppurtunity to print the knotcurve, without doing the velocity tracking, whihc doesnt work too well if we go more frequenclty
-                // than a cycle
-                if( ( CurrentIteration >= InitialSkipIteration ) && ( CurrentIteration%FrequentKnotplotPrintIteration==0) )
+                // every rank has the gradients on its own slab, rank 0 gathers them up and does the analysis
+                if(gradients_needed(CurrentIteration,InitialSkipIteration,FrequentKnotplotPrintIteration,VelocityKnotplotPrintIteration,UVPrintIteration,CheckpointIteration))
                 {
-                    cout << "T = " << CurrentTime << endl;
-                    time (&rawtime);
-                    timeinfo = localtime (&rawtime);
-                    cout << "current time \t" << asctime(timeinfo) << "\n";
-                    crossgrad_calc(u,v,ucvx,ucvy,ucvz,ucvmag,griddata); //find Grad u cross Grad v
-
-                    find_knot_properties(ucvx,ucvy,ucvz,ucvmag,u,knotcurves,CurrentTime,minimizerstate ,griddata);      //find knot curve and twist and writhe
-                    print_knot(CurrentTime, knotcurves, griddata);
-
-                    print_sensor_point(CurrentTime,sensorpoint,u,griddata);
+                    ProfileTimer timer(ProfileGather);
+                    if(LeanMemory)
+                    {
+                        gather_grid(uslab,u,slabgriddata);
+                        gather_grid(vslab,v,slabgriddata);
+                    }
+                    else gather_fields(uslab,vslab,ucvxslab,ucvyslab,ucvzslab,ucvmagslab,u,v,ucvx,ucvy,ucvz,ucvmag,slabgriddata);
                 }
-
-                // run the curve tracing, and find the velocity of the one we previously stored, then print that previous one
-                if( ( CurrentIteration > InitialSkipIteration ) && ( CurrentIteration%VelocityKnotplotPrintIteration==0) )
+                if(rootrank)
                 {
-                    crossgrad_calc(u,v,ucvx,ucvy,ucvz,ucvmag,griddata); //find Grad u cross Grad v
-
-                    find_knot_properties(ucvx,ucvy,ucvz,ucvmag,u,knotcurves,CurrentTime,minimizerstate ,griddata);      //find knot curve and twist and writhe
-                    if(!knotcurvesold.empty())
+                    // with the pipeline, the analysis thread gets a copy of the fields, and we carry on
+                    if(AnalysisThreads > 0)
                     {
-                        find_knot_velocity(knotcurves,knotcurvesold,griddata,VelocityKnotplotPrintTime);
-                        print_knot(CurrentTime - VelocityKnotplotPrintTime , knotcurvesold, griddata);
+                        if(gradients_needed(CurrentIteration,InitialSkipIteration,FrequentKnotplotPrintIteration,VelocityKnotplotPrintIteration,UVPrintIteration,CheckpointIteration))
+                        {
+                            ProfileTimer timer(ProfileSnapshot);
+                            queue_snapshot(CurrentIteration,CurrentTime,u,v,ucvx,ucvy,ucvz,ucvmag);
+                        }
+                    }
+                    else
+                    {
+                        const bool traced = analyse_iteration(CurrentIteration,CurrentTime,u,v,ucvx,ucvy,ucvz,ucvmag,analysis,griddata);
+                        // the refined patches follow the knot we just traced
+                        if(traced && RefineMargin > 0) regrid_patches(analysis.knotcurves,u,v,griddata);
                     }
-                    knotcurvesold = knotcurves;
-
                 }
-
-                // print the UV, and ucrossv data
-                if(CurrentIteration%UVPrintIteration==0)
+                if( ( PerfLogIteration > 0 ) && ( CurrentIteration%PerfLogIteration==0) && ( CurrentIteration != startiteration ) )
                 {
-                    crossgrad_calc(u,v,ucvx,ucvy,ucvz,ucvmag,griddata); //find Grad u cross Grad v
-                    print_uv(u,v,ucvx,ucvy,ucvz,ucvmag,CurrentTime,griddata);
+                    log_performance(CurrentIteration,CurrentTime);
                 }
                 //though its useful to have a double time, we want to be careful to avoid double round off accumulation in the timer
                 CurrentIteration++;
                 CurrentTime  = ((double)(CurrentIteration) * dtime);
+                // the step onto a check iteration goes over every block, and picks the ones to step after it. only ever set here, so
+                // every thread sees the same value all through the update
+                activeblocks.measure = ( ActiveThreshold > 0 ) && ( CurrentIteration%ActiveCheckIteration==0);
+                if(activeblocks.measure) activate_all_blocks();
+                count_active_blocks();
+                profile_points_stepped(slabpoints*activeblocks.numactive/activeblocks.active.size());
             }
-            uv_update(u,v,ku,kv,griddata);
+            // CurrentIteration is now the one we are stepping onto. nobody moves it on again until everyone is through the update
+            const bool computegradients = !LeanMemory && gradients_needed(CurrentIteration,InitialSkipIteration,FrequentKnotplotPrintIteration,VelocityKnotplotPrintIteration,UVPrintIteration,CheckpointIteration);
+            const double updatestart = omp_get_wtime();
+            if(RefineMargin > 0) save_patch_boundaries(uslab,slabgriddata);
+            uv_update(uslab,vslab,ku,kv,padA,padB,ucvxslab,ucvyslab,ucvzslab,ucvmagslab,computegradients,slabgriddata);
+            if(RefineMargin > 0) step_patches(uslab,vslab,ucvxslab,ucvyslab,ucvzslab,ucvmagslab,computegradients,slabgriddata);
+#pragma omp master
+            profile_add(ProfileUpdate,omp_get_wtime() - updatestart);
         }
     }
+    if(rootrank && AnalysisThreads > 0) finish_pipeline();
+    finish_output();
+    if(PerfLogIteration > 0) report_performance();
+    if(ActiveThreshold > 0)
+    {
+        const double stepped = distributed_sum(activeblocks.stepped);
+        const double skipped = distributed_sum(activeblocks.skipped);
+        if(rootrank) cout << "Active block stepping left out " << 100*skipped/std::max(stepped+skipped,1.0) << "% of the block updates\n";
+    }
+    device_exit_data(uslab,vslab,ku,kv,ucvxslab,ucvyslab,ucvzslab,ucvmagslab,padA,padB);
+    distributed_finalize();
     return 0;
 }
 
+// the ensemble (make ensemble, see Ensemble.cpp) has a main of its own too, which runs each of its jobs with run_simulation
+#ifndef FN_ENSEMBLE
+int main (int argc, char** argv)
+{
+    return run_simulation(argc,argv);
+}
+#endif
+#endif
 
-void uv_initialise(vector<double>&phi, vector<double>&u, vector<double>&v, const Griddata& griddata)
+
+void uv_initialise(vector<double>&phi, Field& u, Field& v, const Griddata& griddata)
 {
     int Nx = griddata.Nx;
     int Ny = griddata.Ny;
@@ -196,722 +324,899 @@ void uv_initialise(vector<double>&phi, vector<double>&u, vector<double>&v, const
     }
 }
 
-void crossgrad_calc( vector<double>&u, vector<double>&v, vector<double>&ucvx, vector<double>&ucvy, vector<double>&ucvz, vector<double>&ucvmag,const Griddata& griddata)
+crossgradfunction choose_crossgrad_calc(enum BoundaryType boundarytype)
+{
+    switch(boundarytype)
+    {
+        case ALLREFLECTING: return &crossgrad_calc<ALLREFLECTING>;
+        case ZPERIODIC: return &crossgrad_calc<ZPERIODIC>;
+        case ALLPERIODIC: return &crossgrad_calc<ALLPERIODIC>;
+    }
+    return NULL;
+}
+
+template <enum BoundaryType BC> void crossgrad_calc( Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB, const Griddata& griddata)
 {
     int Nx = griddata.Nx;
     int Ny = griddata.Ny;
     int Nz = griddata.Nz;
-    double h = griddata.h;
-    int i,j,k,n,kup,kdown;
-    double dxu,dyu,dzu,dxv,dyv,dzv;
-    for(i=0;i<Nx;i++)
+    // put u and v in the padded grids, the halos then take care of the boundaries for us
+#pragma omp for
+    for(int i=0;i<Nx;i++)
     {
-        for(j=0; j<Ny; j++)
+        for(int j=0; j<Ny; j++)
         {
-            for(k=0; k<Nz; k++)   //Central difference
+            const int row = pt(i,j,0,griddata);
+            const int padrow = padpt(i,j,0,griddata);
+            for(int k=0; k<Nz; k++)
             {
-                kup = gridinc(k,1,Nz,2);
-                kdown = gridinc(k,-1,Nz,2);
-                dxu = 0.5*(u[pt(gridinc(i,1,Nx,0),j,k,griddata)]-u[pt(gridinc(i,-1,Nx,0),j,k,griddata)])/h;
-                dxv = 0.5*(v[pt(gridinc(i,1,Nx,0),j,k,griddata)]-v[pt(gridinc(i,-1,Nx,0),j,k,griddata)])/h;
-                dyu = 0.5*(u[pt(i,gridinc(j,1,Ny,1),k,griddata)]-u[pt(i,gridinc(j,-1,Ny,1),k,griddata)])/h;
-                dyv = 0.5*(v[pt(i,gridinc(j,1,Ny,1),k,griddata)]-v[pt(i,gridinc(j,-1,Ny,1),k,griddata)])/h;
-                dzu = 0.5*(u[pt(i,j,kup,griddata)]-u[pt(i,j,kdown,griddata)])/h;
-                dzv = 0.5*(v[pt(i,j,kup,griddata)]-v[pt(i,j,kdown,griddata)])/h;
-                //          dxu =(-u[pt(gridinc(i,2,Nx,0),j,k,griddata)]+8*u[pt(gridinc(i,1,Nx,0),j,k,griddata)]-8*u[pt(gridinc(i,-1,Nx,0),j,k,griddata)]+u[pt(gridinc(i,-2,Nx,0),j,k,griddata)])/(12*h);
-                //          dxv =(-v[pt(gridinc(i,2,Nx,0),j,k,griddata)]+8*v[pt(gridinc(i,1,Nx,0),j,k,griddata)]-8*v[pt(gridinc(i,-1,Nx,0),j,k,griddata)]+v[pt(gridinc(i,-2,Nx,0),j,k,griddata)])/(12*h);
-                //          dyu =(-u[pt(gridinc(j,2,Ny,1),j,k,griddata)]+8*u[pt(gridinc(j,1,Ny,1),j,k,griddata)]-8*u[pt(gridinc(j,-1,Ny,1),j,k,griddata)]+u[pt(gridinc(j,-2,Ny,1),j,k,griddata)])/(12*h);
-                //          dyv =(-v[pt(gridinc(j,2,Ny,1),j,k,griddata)]+8*v[pt(gridinc(j,1,Ny,1),j,k,griddata)]-8*v[pt(gridinc(j,-1,Ny,1),j,k,griddata)]+v[pt(gridinc(j,-2,Ny,1),j,k,griddata)])/(12*h);
-                //          dzu =(-u[pt(gridinc(k,2,Nz,2),j,k,griddata)]+8*u[pt(gridinc(k,1,Nz,2),j,k,griddata)]-8*u[pt(gridinc(k,-1,Nz,2),j,k,griddata)]+u[pt(gridinc(k,-2,Nz,2),j,k,griddata)])/(12*h);
-                //          dzv =(-v[pt(gridinc(k,2,Nz,2),j,k,griddata)]+8*v[pt(gridinc(k,1,Nz,2),j,k,griddata)]-8*v[pt(gridinc(k,-1,Nz,2),j,k,griddata)]+v[pt(gridinc(k,-2,Nz,2),j,k,griddata)])/(12*h);
-                n = pt(i,j,k,griddata);
-                ucvx[n] = dyu*dzv - dzu*dyv;
-                ucvy[n] = dzu*dxv - dxu*dzv;    //Grad u cross Grad v
-                ucvz[n] = dxu*dyv - dyu*dxv;
-                ucvmag[n] = sqrt(ucvx[n]*ucvx[n] + ucvy[n]*ucvy[n] + ucvz[n]*ucvz[n]);
+                padA[padrow+k] = u[row+k];
+                padB[padrow+k] = v[row+k];
             }
         }
     }
+#pragma omp single
+    {
+        fill_halo<BC>(padA,griddata);
+        fill_halo<BC>(padB,griddata);
+        // and if the grid is one slab of many, the x faces come from the neighbouring ranks
+        halo_exchange_begin(padA,griddata);
+        halo_exchange_begin(padB,griddata);
+        halo_exchange_end();
+    }
+    crossgrad_from_padded(padA,padB,ucvx,ucvy,ucvz,ucvmag,griddata);
 }
 
-void find_knot_properties( vector<double>&ucvx, vector<double>&ucvy, vector<double>&ucvz, vector<double>& ucvmag,vector<double>&u,vector<knotcurve>& knotcurves,double t, gsl_multimin_fminimizer* minimizerstate, const Griddata& griddata)
+void crossgrad_from_padded(const Field& padu, const Field& padv, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, const Griddata& griddata)
 {
-    // first thing, clear the knotcurve object before we begin writing a new one
-    knotcurves.clear(); //empty vector with knot curve points
-
     int Nx = griddata.Nx;
     int Ny = griddata.Ny;
     int Nz = griddata.Nz;
     double h = griddata.h;
-
-    // initialise the tricubic interpolator for ucvmag
-    likely::TriCubicInterpolator interpolateducvmag(ucvmag, h, Nx,Ny,Nz);
-
-    int c =0;
-    bool knotexists = true;
-    vector<int> marked(Nx*Ny*Nz,0);
-
-    while(knotexists)
+    const int sx = (Ny+2)*(Nz+2);
+    const int sy = Nz+2;
+#pragma omp for collapse(2)
+    for(int i=0;i<Nx;i++)
     {
-        double   ucvmax = -1.0; // should always be +ve, so setting it to an initially -ve # means it always gets written to once.
-        int n,i,j,k,imax,jmax,kmax;
-        for(i=0;i<Nx;i++)
+        for(int j=0; j<Ny; j++)
         {
-            for(j=0; j<Ny; j++)
+            const fieldvalue* pu = &padu[padpt(i,j,0,griddata)];
+            const fieldvalue* pv = &padv[padpt(i,j,0,griddata)];
+            const int row = pt(i,j,0,griddata);
+            for(int k=0; k<Nz; k++)   //Central difference
             {
-                for(k=0; k<Nz; k++)   //Central difference
-                {
-                    n = pt(i,j,k,griddata);
-                    if( ucvmag[n] > ucvmax && marked[n]==0)
-                    {
-                        ucvmax = ucvmag[n];
-                        imax = i;
-                        jmax = j;
-                        kmax=k;
-
-                    }
-                }
+                const double dxu = 0.5*((double)pu[k+sx]-pu[k-sx])/h;
+                const double dxv = 0.5*((double)pv[k+sx]-pv[k-sx])/h;
+                const double dyu = 0.5*((double)pu[k+sy]-pu[k-sy])/h;
+                const double dyv = 0.5*((double)pv[k+sy]-pv[k-sy])/h;
+                const double dzu = 0.5*((double)pu[k+1]-pu[k-1])/h;
+                const double dzv = 0.5*((double)pv[k+1]-pv[k-1])/h;
+                const int n = row + k;
+                ucvx[n] = dyu*dzv - dzu*dyv;
+                ucvy[n] = dzu*dxv - dxu*dzv;    //Grad u cross Grad v
+                ucvz[n] = dxu*dyv - dyu*dxv;
+                ucvmag[n] = sqrt(ucvx[n]*ucvx[n] + ucvy[n]*ucvy[n] + ucvz[n]*ucvz[n]);
             }
         }
+    }
+}
 
-        if(ucvmax<0.45) knotexists = false;
+bool gradients_needed(int it, int InitialSkipIteration, int FrequentKnotplotPrintIteration, int VelocityKnotplotPrintIteration, int UVPrintIteration, int CheckpointIteration)
+{
+    if( ( it >= InitialSkipIteration ) && ( it%FrequentKnotplotPrintIteration==0) ) return true;
+    if( ( it > InitialSkipIteration ) && ( it%VelocityKnotplotPrintIteration==0) ) return true;
+    if( ( CheckpointIteration > 0 ) && ( it%CheckpointIteration==0) ) return true;
+    return (it%UVPrintIteration==0);
+}
 
-        if(knotexists)
+bool analyse_iteration(int it, double t, Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, AnalysisState& analysis, const Griddata& griddata)
+{
+    time_t rawtime;
+    struct tm * timeinfo;
+    bool traced = false;
+    const bool frequenttrace = ( it >= analysis.InitialSkipIteration ) && ( it%analysis.FrequentKnotplotPrintIteration==0);
+    const bool velocitytrace = ( it > analysis.InitialSkipIteration ) && ( it%analysis.VelocityKnotplotPrintIteration==0);
+    const bool uvprint = (it%analysis.UVPrintIteration==0);
+    // in the lean memory mode the ucv grids are empty, and grad u x grad v is worked out round where the knot was last traced instead,
+    // once for everything below which needs it
+    UcvCache ucv(u,v,griddata);
+    if(LeanMemory && (frequenttrace || velocitytrace || uvprint))
+    {
+        ProfileTimer timer(ProfileSeeds);
+        ucv.build(analysis.knotcurves,SeedThreshold);
+    }
+    // its useful to have an oppurtunity to print the knotcurve, without doing the velocity tracking, whihc doesnt work too well if we go more frequenclty
+    // than a cycle
+    if(frequenttrace)
+    {
+        cout << "T = " << t << endl;
+        time (&rawtime);
+        timeinfo = localtime (&rawtime);
+        cout << "current time \t" << asctime(timeinfo) << "\n";
+
+        if(LeanMemory) find_knot_properties(ucv,u,analysis.knotcurves,t,griddata);
+        else find_knot_properties(ucvx,ucvy,ucvz,ucvmag,u,analysis.knotcurves,t,griddata);      //find knot curve and twist and writhe
+        traced = true;
+        ProfileTimer timer(ProfilePrintKnot);
+        // the sensor point first, so the print of the knot flushes its line too
+        print_sensor_point(t,analysis.sensorpoint,u,griddata);
+        print_knot(t, analysis.knotcurves, griddata);
+    }
+
+    // run the curve tracing, and find the velocity of the one we previously stored, then print that previous one
+    if(velocitytrace)
+    {
+        if(LeanMemory) find_knot_properties(ucv,u,analysis.knotcurves,t,griddata);
+        else find_knot_properties(ucvx,ucvy,ucvz,ucvmag,u,analysis.knotcurves,t,griddata);      //find knot curve and twist and writhe
+        traced = true;
+        if(!analysis.knotcurvesold.empty())
         {
-            knotcurves.push_back(knotcurve() );
-            knotcurves[c].knotcurve.push_back(knotpoint());
-            knotcurves[c].knotcurve[0].xcoord=x(imax,griddata);
-            knotcurves[c].knotcurve[0].ycoord=y(jmax,griddata);
-            knotcurves[c].knotcurve[0].zcoord=z(kmax,griddata);
-
-            int idwn,jdwn,kdwn, modidwn, modjdwn, modkdwn,m,iinc,jinc,kinc;
-            double ucvxs, ucvys, ucvzs, graducvx, graducvy, graducvz, prefactor, xd, yd ,zd, fx, fy, fz, xdiff, ydiff, zdiff;
-            int s=1;
-            bool finish=false;
-            // we will discard the first few points from the knot, using this flag
-            bool burnin=true;
-            // if the curve we are tracing terminates at a boundary, for now we will just strike it from the record, entering a cleanup mode that marks the broken curve as "do not touch"
-            int boundaryhits = 0;
-            /*calculate local direction of grad u x grad v (the tangent to the knot curve) at point s-1, then move to point s by moving along tangent + unit confinement force*/
-            while (finish==false)
             {
+                ProfileTimer timer(ProfileVelocity);
+                find_knot_velocity(analysis.knotcurves,analysis.knotcurvesold,griddata,VelocityKnotplotPrintTime);
+            }
+            // labelled with the time of the iteration it was traced at, worked out just as that iteration's plain print was, so the two
+            // have the one time and the velocity print takes the plain one's place
+            ProfileTimer timer(ProfilePrintKnot);
+            print_knot((it - analysis.VelocityKnotplotPrintIteration)*dtime, analysis.knotcurvesold, griddata);
+        }
+        analysis.knotcurvesold = analysis.knotcurves;
+    }
 
-                /**Find nearest gridpoint**/
-                idwn = (int) ((knotcurves[c].knotcurve[s-1].xcoord/h) - 0.5 + Nx/2.0);
-                jdwn = (int) ((knotcurves[c].knotcurve[s-1].ycoord/h) - 0.5 + Ny/2.0);
-                kdwn = (int) ((knotcurves[c].knotcurve[s-1].zcoord/h) - 0.5 + Nz/2.0);
-                // idwn etc can be off the actual grid , into "ghost" grids around the real one. this is useful for knotcurve tracing over periodic boundaries
-                // but we also need the corresponding real grid positions!
-                modidwn = circularmod(idwn,Nx);
-                modjdwn = circularmod(jdwn,Ny);
-                modkdwn = circularmod(kdwn,Nz);
-
-                // if we have hit a boundary, dont go off grid - rather, set a cleanup flag and stick to the grid egde
-                if(BoundaryType==ALLREFLECTING)
-                {
-                    if(idwn <=0){idwn=0; boundaryhits++;}
-                    if(idwn >=Nx-1){idwn=Nx-1; boundaryhits++;}
-                    if(jdwn <=0){jdwn=0; boundaryhits++;}
-                    if(jdwn >=Ny-1){jdwn=Ny-1; boundaryhits++;}
-                    if(kdwn <=0){kdwn=0; boundaryhits++;}
-                    if(kdwn >=Nz-1){kdwn=Nz-1; boundaryhits++;}
-                }
-                if(BoundaryType==ZPERIODIC)
-                {
-                    if(idwn <=0){idwn=0; boundaryhits++;}
-                    if(idwn >Nx-1){idwn=Nx-1; boundaryhits++;}
-                    if(jdwn <=0){jdwn=0; boundaryhits++;}
-                    if(jdwn >Ny-1){jdwn=Ny-1; boundaryhits++;}
-                }
-
-                ucvxs=0;
-                ucvys=0;
-                ucvzs=0;
-                /*curve to gridpoint down distance*/
-                xd = (knotcurves[c].knotcurve[s-1].xcoord - x(idwn,griddata))/h;
-                yd = (knotcurves[c].knotcurve[s-1].ycoord - y(jdwn,griddata))/h;
-                zd = (knotcurves[c].knotcurve[s-1].zcoord - z(kdwn,griddata))/h;
-                for(m=0;m<8;m++)  //linear interpolation from 8 nearest neighbours
-                {
-                    /* Work out increments*/
-                    iinc = m%2;
-                    jinc = (m/2)%2;
-                    kinc = (m/4)%2;
-                    /*Loop over nearest points*/
-                    i = gridinc(modidwn, iinc, Nx,0);
-                    j = gridinc(modjdwn, jinc, Ny,1);
-                    k = gridinc(modkdwn,kinc, Nz,2);
-                    prefactor = (1-iinc + pow(-1,1+iinc)*xd)*(1-jinc + pow(-1,1+jinc)*yd)*(1-kinc + pow(-1,1+kinc)*zd);
-                    /*interpolate grad u x grad v over nearest points*/
-                    ucvxs += prefactor*ucvx[pt(i,j,k,griddata)];
-                    ucvys += prefactor*ucvy[pt(i,j,k,griddata)];
-                    ucvzs += prefactor*ucvz[pt(i,j,k,griddata)];
-                }
-                double norm = sqrt(ucvxs*ucvxs + ucvys*ucvys + ucvzs*ucvzs);
-                ucvxs = ucvxs/norm; //normalise
-                ucvys = ucvys/norm; //normalise
-                ucvzs = ucvzs/norm; //normalise
-
-                // if we have hit a boundary, we want to back up along the curve instead
-                if(boundaryhits==1)
-                {
-                    ucvxs *= -1 ;
-                    ucvys *= -1 ;
-                    ucvzs *= -1;
-                }
+    // print the UV, and ucrossv data
+    if(uvprint)
+    {
+        ProfileTimer timer(ProfilePrintUV);
+        if(LeanMemory) print_uv(u,v,ucv,analysis.knotcurves,t,griddata);
+        else print_uv(u,v,ucvx,ucvy,ucvz,ucvmag,analysis.knotcurves,t,griddata);
+    }
 
-                // okay we have our first guess, move forward in this direction
-                // we actually want to walk in the direction gradv cross gradu - that should be our +ve tangent,
-                // so that the rotation sense of the curve is positive. Get this we - signs below.
-                double testx = knotcurves[c].knotcurve[s-1].xcoord - h*ucvxs;
-                double testy = knotcurves[c].knotcurve[s-1].ycoord - h*ucvys;
-                double testz = knotcurves[c].knotcurve[s-1].zcoord - h*ucvzs;
-
-                // now get the grad at this point
-                idwn = (int) ((testx/h) - 0.5 + Nx/2.0);
-                jdwn = (int) ((testy/h) - 0.5 + Ny/2.0);
-                kdwn = (int) ((testz/h) - 0.5 + Nz/2.0);
-                modidwn = circularmod(idwn,Nx);
-                modjdwn = circularmod(jdwn,Ny);
-                modkdwn = circularmod(kdwn,Nz);
-                graducvx=0;
-                graducvy=0;
-                graducvz=0;
-                /*curve to gridpoint down distance*/
-                xd = (testx - x(idwn,griddata))/h;
-                yd = (testy - y(jdwn,griddata))/h;
-                zd = (testz - z(kdwn,griddata))/h;
-                for(m=0;m<8;m++)  //linear interpolation from 8 nearest neighbours
-                {
-                    /* Work out increments*/
-                    iinc = m%2;
-                    jinc = (m/2)%2;
-                    kinc = (m/4)%2;
-                    /*Loop over nearest points*/
-                    i = gridinc(modidwn, iinc, Nx,0);
-                    j = gridinc(modjdwn, jinc, Ny,1);
-                    k = gridinc(modkdwn,kinc, Nz,2);
-                    prefactor = (1-iinc + pow(-1,1+iinc)*xd)*(1-jinc + pow(-1,1+jinc)*yd)*(1-kinc + pow(-1,1+kinc)*zd);
-                    /*interpolate gradients of |grad u x grad v|*/
-                    graducvx += prefactor*(sqrt(ucvx[pt(gridinc(i,1,Nx,0),j,k,griddata)]*ucvx[pt(gridinc(i,1,Nx,0),j,k,griddata)] + ucvy[pt(gridinc(i,1,Nx,0),j,k,griddata)]*ucvy[pt(gridinc(i,1,Nx,0),j,k,griddata)] + ucvz[pt(gridinc(i,1,Nx,0),j,k,griddata)]*ucvz[pt(gridinc(i,1,Nx,0),j,k,griddata)]) - sqrt(ucvx[pt(gridinc(i,-1,Nx,0),j,k,griddata)]*ucvx[pt(gridinc(i,-1,Nx,0),j,k,griddata)] + ucvy[pt(gridinc(i,-1,Nx,0),j,k,griddata)]*ucvy[pt(gridinc(i,-1,Nx,0),j,k,griddata)] + ucvz[pt(gridinc(i,-1,Nx,0),j,k,griddata)]*ucvz[pt(gridinc(i,-1,Nx,0),j,k,griddata)]))/(2*h);
-                    graducvy += prefactor*(sqrt(ucvx[pt(i,gridinc(j,1,Ny,1),k,griddata)]*ucvx[pt(i,gridinc(j,1,Ny,1),k,griddata)] + ucvy[pt(i,gridinc(j,1,Ny,1),k,griddata)]*ucvy[pt(i,gridinc(j,1,Ny,1),k,griddata)] + ucvz[pt(i,gridinc(j,1,Ny,1),k,griddata)]*ucvz[pt(i,gridinc(j,1,Ny,1),k,griddata)]) - sqrt(ucvx[pt(i,gridinc(j,-1,Ny,1),k,griddata)]*ucvx[pt(i,gridinc(j,-1,Ny,1),k,griddata)] + ucvy[pt(i,gridinc(j,-1,Ny,1),k,griddata)]*ucvy[pt(i,gridinc(j,-1,Ny,1),k,griddata)] + ucvz[pt(i,gridinc(j,-1,Ny,1),k,griddata)]*ucvz[pt(i,gridinc(j,-1,Ny,1),k,griddata)]))/(2*h);
-                    graducvz += prefactor*(sqrt(ucvx[pt(i,j,gridinc(k,1,Nz,2),griddata)]*ucvx[pt(i,j,gridinc(k,1,Nz,2),griddata)] + ucvy[pt(i,j,gridinc(k,1,Nz,2),griddata)]*ucvy[pt(i,j,gridinc(k,1,Nz,2),griddata)] + ucvz[pt(i,j,gridinc(k,1,Nz,2),griddata)]*ucvz[pt(i,j,gridinc(k,1,Nz,2),griddata)]) - sqrt(ucvx[pt(i,j,gridinc(k,-1,Nz,2),griddata)]*ucvx[pt(i,j,gridinc(k,-1,Nz,2),griddata)] + ucvy[pt(i,j,gridinc(k,-1,Nz,2),griddata)]*ucvy[pt(i,j,gridinc(k,-1,Nz,2),griddata)] + ucvz[pt(i,j,gridinc(k,-1,Nz,2),griddata)]*ucvz[pt(i,j,gridinc(k,-1,Nz,2),griddata)]))/(2*h);
+    // and a checkpoint to restart from. theres no need for one of the iteration we started on
+    if( ( analysis.CheckpointIteration > 0 ) && ( it%analysis.CheckpointIteration==0) && ( it != analysis.startiteration ) )
+    {
+        ProfileTimer timer(ProfileCheckpoint);
+        write_checkpoint(u,v,it,t,griddata);
+    }
+    return traced;
+}
 
-                }
-                knotcurves[c].knotcurve.push_back(knotpoint());
-                // one of the vectors in the plane we wish to perfrom our minimisation in
-                fx = (graducvx - (graducvx*ucvxs + graducvy*ucvys + graducvz*ucvzs)*ucvxs);
-                fy = (graducvy - (graducvx*ucvxs + graducvy*ucvys + graducvz*ucvzs)*ucvys);
-                fz = (graducvz - (graducvx*ucvxs + graducvy*ucvys + graducvz*ucvzs)*ucvzs);
-                norm = sqrt(fx*fx + fy*fy + fz*fz);
-                fx = fx/norm;
-                fy = fy/norm;
-                fz = fz/norm;
-
-                // okay we have our direction to perfrom the line minimisation in
-                // the point
-                gsl_vector* v = gsl_vector_alloc (3);
-                gsl_vector_set (v, 0, testx);
-                gsl_vector_set (v, 1, testy);
-                gsl_vector_set (v, 2, testz);
-                // one vector in the plane we with to minimize in
-                gsl_vector* f = gsl_vector_alloc (3);
-                gsl_vector_set (f, 0, fx);
-                gsl_vector_set (f, 1, fy);
-                gsl_vector_set (f, 2, fz);
-                // the ucv vector
-                gsl_vector* ucv = gsl_vector_alloc (3);
-                gsl_vector_set (ucv, 0, ucvxs);
-                gsl_vector_set (ucv, 1, ucvys);
-                gsl_vector_set (ucv, 2, ucvzs);
-                // take a cross product to get the other vector in the plane
-                gsl_vector* b = gsl_vector_alloc (3);
-                cross_product(f,ucv,b);
-                // initial conditions
-                gsl_vector* minimum = gsl_vector_alloc (2);
-                gsl_vector_set (minimum, 0, 0);
-                gsl_vector_set (minimum, 1, 0);
-                struct parameters params; struct parameters* pparams = &params;
-                pparams->ucvmag=&interpolateducvmag;
-                pparams->v = v; pparams->f = f;pparams->b=b;
-                pparams->mygriddata = griddata;
-                // some initial values
-                gsl_multimin_function F;
-                F.n=2;
-                F.f = &my_f;
-                F.params = (void*) pparams;
-                gsl_vector* stepsize = gsl_vector_alloc (2);
-                gsl_vector_set (stepsize, 0, lambda/(8*M_PI));
-                gsl_vector_set (stepsize, 1, lambda/(8*M_PI));
-                gsl_multimin_fminimizer_set (minimizerstate, &F, minimum, stepsize);
-
-                int iter=0;
-                int status =0;
-                double minimizersize=0;
-                do
-                {
-                    iter++;
-                    status = gsl_multimin_fminimizer_iterate(minimizerstate);
+// the fft tables for curves of one length. they are kept from one trace to the next, as long as there aren't too many lengths to keep.
+// the tables are only read by the transforms, so the components can share them. the workspaces are scratch, so each smoothing has its own
+struct CurveFFT
+{
+    gsl_fft_real_wavetable* real;
+    gsl_fft_halfcomplex_wavetable* hc;
+};
+static map<int,CurveFFT> curveffts;
+const unsigned int MaxCurveFFTLengths = 16;
+
+// the components are smoothed as tasks, so they find their tables one at a time. adding to a map leaves the other entries where they are
+static const CurveFFT& curve_fft(int NP)
+{
+    const CurveFFT* fft;
+#pragma omp critical(curveffts)
+    {
+        map<int,CurveFFT>::iterator found = curveffts.find(NP);
+        if(found == curveffts.end())
+        {
+            found = curveffts.insert(make_pair(NP,CurveFFT())).first;
+            found->second.real = gsl_fft_real_wavetable_alloc(NP);
+            found->second.hc = gsl_fft_halfcomplex_wavetable_alloc(NP);
+        }
+        fft = &found->second;
+    }
+    return *fft;
+}
 
-                    if (status)
-                        break;
+// once there are too many lengths kept, start again. only while no smoothing is going on
+static void prune_curve_ffts()
+{
+    if(curveffts.size() < MaxCurveFFTLengths) return;
+    for(map<int,CurveFFT>::iterator found = curveffts.begin(); found != curveffts.end(); found++)
+    {
+        gsl_fft_real_wavetable_free(found->second.real);
+        gsl_fft_halfcomplex_wavetable_free(found->second.hc);
+    }
+    curveffts.clear();
+}
 
-                    minimizersize = gsl_multimin_fminimizer_size (minimizerstate);
-                    status = gsl_multimin_test_size (minimizersize, 1e-2);
+// low pass filter three arrays along a curve of NP points, in place. the filter is the same for all three, and they go out as tasks
+static void smooth_curve_arrays(vector<double>* arrays[3], int NP, double totlength)
+{
+    ProfileTimer timer(ProfileSmoothing);
+    const CurveFFT& fft = curve_fft(NP);
+    // 21/11/2016: make our low pass filter. To apply our filter. we should sample frequencies fn = n/Delta N , n = -N/2 ... N/2
+    // this is discretizing the nyquist interval, with extreme frequency ~1/2Delta.
+    // to cut out the frequencies of grid fluctuation size and larger we need a lengthscale Delta to
+    // plug in above. im doing a rough length calc below, this might be overkill.
+    // at the moment its just a hard filter, we can choose others though.
+    // compute a rough length to set scale
+    const double cutoff = 2*M_PI*(totlength/(6*lambda));
+    vector<double> filter(NP);
+    for (int i = 0; i < NP; ++i) filter[i] = 1/sqrt(1+pow((i/cutoff),8));
+#pragma omp taskloop grainsize(1) default(none) shared(arrays,NP,fft,filter)
+    for(int j=0; j<3; j++)
+    {
+        double* data = arrays[j]->data();
+        gsl_fft_real_workspace* work = gsl_fft_real_workspace_alloc(NP);
+        // take the fft
+        gsl_fft_real_transform (data, 1, NP, fft.real, work);
+        for (int i = 0; i < NP; ++i) data[i] *= filter[i];
+        // transform back
+        gsl_fft_halfcomplex_inverse (data, 1, NP, fft.hc, work);
+        gsl_fft_real_workspace_free(work);
+    }
+}
 
-                }
-                while (status == GSL_CONTINUE && iter < 5000);
+// trace the component through grid point n, by walking along grad u x grad v from it and pulling each step back onto the maximum of
+// |grad u x grad v| in the plane across the curve. returns how many times it ran into the boundary - a curve which does is no use to us
+template <class Gradients> static int trace_curve(int n, const Gradients& ucv, const likely::BasicTriCubicInterpolator<typename Gradients::Magnitudes>& interpolateducvmag, const Griddata& griddata, knotcurve& curve)
+{
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+    const double h = griddata.h;
+    const int imax = n/(Ny*Nz);
+    const int jmax = (n/Nz)%Ny;
+    const int kmax = n%Nz;
+    curve.knotcurve.push_back(x(imax,griddata),y(jmax,griddata),z(kmax,griddata));
+
+    int i,j,k;
+    int idwn,jdwn,kdwn, modidwn, modjdwn, modkdwn,m,iinc,jinc,kinc;
+    double ucvxs, ucvys, ucvzs, graducvx, graducvy, graducvz, prefactor, xd, yd ,zd, fx, fy, fz, xdiff, ydiff, zdiff;
+    int s=1;
+    bool finish=false;
+    // we will discard the first few points from the knot, using this flag
+    bool burnin=true;
+    // if the curve we are tracing terminates at a boundary, for now we will just strike it from the record, entering a cleanup mode that marks the broken curve as "do not touch"
+    int boundaryhits = 0;
+    /*calculate local direction of grad u x grad v (the tangent to the knot curve) at point s-1, then move to point s by moving along tangent + unit confinement force*/
+    while (finish==false)
+    {
 
+        /**Find nearest gridpoint**/
+        idwn = (int) ((curve.knotcurve.xcoord[s-1]/h) - 0.5 + Nx/2.0);
+        jdwn = (int) ((curve.knotcurve.ycoord[s-1]/h) - 0.5 + Ny/2.0);
+        kdwn = (int) ((curve.knotcurve.zcoord[s-1]/h) - 0.5 + Nz/2.0);
+        // idwn etc can be off the actual grid , into "ghost" grids around the real one. this is useful for knotcurve tracing over periodic boundaries
+        // but we also need the corresponding real grid positions!
+        modidwn = circularmod(idwn,Nx);
+        modjdwn = circularmod(jdwn,Ny);
+        modkdwn = circularmod(kdwn,Nz);
+
+        // if we have hit a boundary, dont go off grid - rather, set a cleanup flag and stick to the grid egde
+        if(BoundaryType==ALLREFLECTING)
+        {
+            if(idwn <=0){idwn=0; boundaryhits++;}
+            if(idwn >=Nx-1){idwn=Nx-1; boundaryhits++;}
+            if(jdwn <=0){jdwn=0; boundaryhits++;}
+            if(jdwn >=Ny-1){jdwn=Ny-1; boundaryhits++;}
+            if(kdwn <=0){kdwn=0; boundaryhits++;}
+            if(kdwn >=Nz-1){kdwn=Nz-1; boundaryhits++;}
+        }
+        if(BoundaryType==ZPERIODIC)
+        {
+            if(idwn <=0){idwn=0; boundaryhits++;}
+            if(idwn >Nx-1){idwn=Nx-1; boundaryhits++;}
+            if(jdwn <=0){jdwn=0; boundaryhits++;}
+            if(jdwn >Ny-1){jdwn=Ny-1; boundaryhits++;}
+        }
 
-                gsl_vector_scale(f,gsl_vector_get(minimizerstate->x, 0));
-                gsl_vector_scale(b,gsl_vector_get(minimizerstate->x, 1));
-                gsl_vector_add(f,b);
-                gsl_vector_add(v,f);
-                knotcurves[c].knotcurve[s].xcoord = gsl_vector_get(v, 0);
-                knotcurves[c].knotcurve[s].ycoord= gsl_vector_get(v, 1);
-                knotcurves[c].knotcurve[s].zcoord= gsl_vector_get(v, 2);
+        ucvxs=0;
+        ucvys=0;
+        ucvzs=0;
+        /*curve to gridpoint down distance*/
+        xd = (curve.knotcurve.xcoord[s-1] - x(idwn,griddata))/h;
+        yd = (curve.knotcurve.ycoord[s-1] - y(jdwn,griddata))/h;
+        zd = (curve.knotcurve.zcoord[s-1] - z(kdwn,griddata))/h;
+        for(m=0;m<8;m++)  //linear interpolation from 8 nearest neighbours
+        {
+            /* Work out increments*/
+            iinc = m%2;
+            jinc = (m/2)%2;
+            kinc = (m/4)%2;
+            /*Loop over nearest points*/
+            i = gridinc(modidwn, iinc, Nx,0);
+            j = gridinc(modjdwn, jinc, Ny,1);
+            k = gridinc(modkdwn,kinc, Nz,2);
+            prefactor = (1-iinc + pow(-1,1+iinc)*xd)*(1-jinc + pow(-1,1+jinc)*yd)*(1-kinc + pow(-1,1+kinc)*zd);
+            /*interpolate grad u x grad v over nearest points*/
+            ucvxs += prefactor*ucv.x(pt(i,j,k,griddata));
+            ucvys += prefactor*ucv.y(pt(i,j,k,griddata));
+            ucvzs += prefactor*ucv.z(pt(i,j,k,griddata));
+        }
+        double norm = sqrt(ucvxs*ucvxs + ucvys*ucvys + ucvzs*ucvzs);
+        ucvxs = ucvxs/norm; //normalise
+        ucvys = ucvys/norm; //normalise
+        ucvzs = ucvzs/norm; //normalise
 
-                gsl_vector_free(v);
-                gsl_vector_free(f);
-                gsl_vector_free(b);
-                gsl_vector_free(ucv);
-                gsl_vector_free(stepsize);
+        // if we have hit a boundary, we want to back up along the curve instead
+        if(boundaryhits==1)
+        {
+            ucvxs *= -1 ;
+            ucvys *= -1 ;
+            ucvzs *= -1;
+        }
 
-                xdiff = knotcurves[c].knotcurve[0].xcoord - knotcurves[c].knotcurve[s].xcoord;     //distance from start/end point
-                ydiff = knotcurves[c].knotcurve[0].ycoord - knotcurves[c].knotcurve[s].ycoord;
-                zdiff = knotcurves[c].knotcurve[0].zcoord - knotcurves[c].knotcurve[s].zcoord;
+        // okay we have our first guess, move forward in this direction
+        // we actually want to walk in the direction gradv cross gradu - that should be our +ve tangent,
+        // so that the rotation sense of the curve is positive. Get this we - signs below.
+        double testx = curve.knotcurve.xcoord[s-1] - h*ucvxs;
+        double testy = curve.knotcurve.ycoord[s-1] - h*ucvys;
+        double testz = curve.knotcurve.zcoord[s-1] - h*ucvzs;
+
+        // now get the grad at this point
+        idwn = (int) ((testx/h) - 0.5 + Nx/2.0);
+        jdwn = (int) ((testy/h) - 0.5 + Ny/2.0);
+        kdwn = (int) ((testz/h) - 0.5 + Nz/2.0);
+        modidwn = circularmod(idwn,Nx);
+        modjdwn = circularmod(jdwn,Ny);
+        modkdwn = circularmod(kdwn,Nz);
+        graducvx=0;
+        graducvy=0;
+        graducvz=0;
+        /*curve to gridpoint down distance*/
+        xd = (testx - x(idwn,griddata))/h;
+        yd = (testy - y(jdwn,griddata))/h;
+        zd = (testz - z(kdwn,griddata))/h;
+        for(m=0;m<8;m++)  //linear interpolation from 8 nearest neighbours
+        {
+            /* Work out increments*/
+            iinc = m%2;
+            jinc = (m/2)%2;
+            kinc = (m/4)%2;
+            /*Loop over nearest points*/
+            i = gridinc(modidwn, iinc, Nx,0);
+            j = gridinc(modjdwn, jinc, Ny,1);
+            k = gridinc(modkdwn,kinc, Nz,2);
+            prefactor = (1-iinc + pow(-1,1+iinc)*xd)*(1-jinc + pow(-1,1+jinc)*yd)*(1-kinc + pow(-1,1+kinc)*zd);
+            /*interpolate gradients of |grad u x grad v|*/
+            graducvx += prefactor*(ucv.mag(pt(gridinc(i,1,Nx,0),j,k,griddata)) - ucv.mag(pt(gridinc(i,-1,Nx,0),j,k,griddata)))/(2*h);
+            graducvy += prefactor*(ucv.mag(pt(i,gridinc(j,1,Ny,1),k,griddata)) - ucv.mag(pt(i,gridinc(j,-1,Ny,1),k,griddata)))/(2*h);
+            graducvz += prefactor*(ucv.mag(pt(i,j,gridinc(k,1,Nz,2),griddata)) - ucv.mag(pt(i,j,gridinc(k,-1,Nz,2),griddata)))/(2*h);
 
-                if( (boundaryhits==0 && sqrt(xdiff*xdiff + ydiff*ydiff + zdiff*zdiff) <h  && s > 10 ) || boundaryhits>1 ||s>5000) finish = true;
+        }
+        curve.knotcurve.resize(curve.knotcurve.size()+1);
+        // one of the vectors in the plane we wish to perfrom our minimisation in
+        fx = (graducvx - (graducvx*ucvxs + graducvy*ucvys + graducvz*ucvzs)*ucvxs);
+        fy = (graducvy - (graducvx*ucvxs + graducvy*ucvys + graducvz*ucvzs)*ucvys);
+        fz = (graducvz - (graducvx*ucvxs + graducvy*ucvys + graducvz*ucvzs)*ucvzs);
+        norm = sqrt(fx*fx + fy*fy + fz*fz);
+        fx = fx/norm;
+        fy = fy/norm;
+        fz = fz/norm;
+
+        // okay we have our direction to perfrom the maximisation in
+        // the point
+        const double v[3] = {testx,testy,testz};
+        // one vector in the plane we wish to maximise in
+        const double f[3] = {fx,fy,fz};
+        // take a cross product with the ucv vector to get the other one
+        const double b[3] = {fy*ucvzs - fz*ucvys, fz*ucvxs - fx*ucvzs, fx*ucvys - fy*ucvxs};
+        double alongf, alongb;
+        maximise_in_plane(interpolateducvmag,v,f,b,alongf,alongb);
+
+        curve.knotcurve.xcoord[s] = v[0] + alongf*f[0] + alongb*b[0];
+        curve.knotcurve.ycoord[s] = v[1] + alongf*f[1] + alongb*b[1];
+        curve.knotcurve.zcoord[s] = v[2] + alongf*f[2] + alongb*b[2];
+
+        xdiff = curve.knotcurve.xcoord[0] - curve.knotcurve.xcoord[s];     //distance from start/end point
+        ydiff = curve.knotcurve.ycoord[0] - curve.knotcurve.ycoord[s];
+        zdiff = curve.knotcurve.zcoord[0] - curve.knotcurve.zcoord[s];
+
+        if( (boundaryhits==0 && sqrt(xdiff*xdiff + ydiff*ydiff + zdiff*zdiff) <h  && s > 10 ) || boundaryhits>1 ||s>5000) finish = true;
+
+        // okay, we just added a point in position s in the vector
+        // if we have a few points in the vector, discard the first few and restart the whole thing - burn it in
+        int newstartingposition =20;
+        if(s==newstartingposition && burnin && (boundaryhits==0))
+        {
+            curve.knotcurve.erase_front(newstartingposition);
+            s =0;
+            burnin =false;
+        }
 
-                // okay, we just added a point in position s in the vector
-                // if we have a few points in the vector, discard the first few and restart the whole thing - burn it in
-                int newstartingposition =20;
-                if(s==newstartingposition && burnin && (boundaryhits==0))
-                {
-                    knotcurves[c].knotcurve.erase(knotcurves[c].knotcurve.begin(),knotcurves[c].knotcurve.begin()+newstartingposition);
-                    s =0;
-                    burnin =false;
-                }
+        s++;
+    }
+    return boundaryhits;
+}
 
-                s++;
-            }
-            int NP = knotcurves[c].knotcurve.size();  //store number of points in knot curve
+// mark the candidates in a tube round the curve, so none of them is taken as the seed of another component
+template <class Gradients> static void mark_tube(const knotcurve& curve, const Gradients& ucv, double seedthreshold, const vector<int>& candidates, vector<char>& marked, const Griddata& griddata)
+{
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+    const double h = griddata.h;
+    const int NP = curve.knotcurve.size();
 
-            // construct a tube around the knot, to use as an excluded region if we searching for multiple components.
-            double radius = 3;
-            int numiterations = (int)(radius/griddata.h);
-            for(int s=0; s<NP; s++)
+    // construct a tube around the knot, to use as an excluded region if we searching for multiple components.
+    double radius = 3;
+    int numiterations = (int)(radius/griddata.h);
+    for(int s=0; s<NP; s++)
+    {
+        int icentral = (int) ((curve.knotcurve.xcoord[s]/h) - 0.5 + Nx/2.0);
+        int jcentral = (int) ((curve.knotcurve.ycoord[s]/h) - 0.5 + Ny/2.0);
+        int kcentral = (int) ((curve.knotcurve.zcoord[s]/h) - 0.5 + Nz/2.0);
+        // construct a ball of radius "radius" around each point in the knotcurve object. we circumscribe it in a cube which is then looped over
+        for(int i =-numiterations;i<=numiterations;i++)
+        {
+            for(int j=-numiterations ;j<=numiterations;j++)
             {
-                int icentral = (int) ((knotcurves[c].knotcurve[s].xcoord/h) - 0.5 + Nx/2.0);
-                int jcentral = (int) ((knotcurves[c].knotcurve[s].ycoord/h) - 0.5 + Ny/2.0);
-                int kcentral = (int) ((knotcurves[c].knotcurve[s].zcoord/h) - 0.5 + Nz/2.0);
-                // construct a ball of radius "radius" around each point in the knotcurve object. we circumscribe it in a cube which is then looped over
-                for(int i =-numiterations;i<=numiterations;i++)
+                for(int k =-numiterations;k<=numiterations;k++)
                 {
-                    for(int j=-numiterations ;j<=numiterations;j++)
-                    {
-                        for(int k =-numiterations;k<=numiterations;k++)
-                        {
-                            int modi = circularmod(i+icentral,Nx);
-                            int modj = circularmod(j+jcentral,Ny);
-                            int modk = circularmod(k+kcentral,Nz);
-                            int n = pt(modi,modj,modk,griddata);
+                    int modi = circularmod(i+icentral,Nx);
+                    int modj = circularmod(j+jcentral,Ny);
+                    int modk = circularmod(k+kcentral,Nz);
+                    int n = pt(modi,modj,modk,griddata);
 
-                            double dxsq = (x(i+icentral,griddata)-x(icentral,griddata))*(x(i+icentral,griddata)-x(icentral,griddata));
-                            double dysq = (y(j+jcentral,griddata)-y(jcentral,griddata))*(y(j+jcentral,griddata)-y(jcentral,griddata));
-                            double dzsq = (z(k+kcentral,griddata)-z(kcentral,griddata))*(z(k+kcentral,griddata)-z(kcentral,griddata));
+                    double dxsq = (x(i+icentral,griddata)-x(icentral,griddata))*(x(i+icentral,griddata)-x(icentral,griddata));
+                    double dysq = (y(j+jcentral,griddata)-y(jcentral,griddata))*(y(j+jcentral,griddata)-y(jcentral,griddata));
+                    double dzsq = (z(k+kcentral,griddata)-z(kcentral,griddata))*(z(k+kcentral,griddata)-z(kcentral,griddata));
 
-                            double r = sqrt(dxsq + dysq + dzsq);
+                    double r = sqrt(dxsq + dysq + dzsq);
 
-                            if(r < radius )
-                            {
-                                marked[n]=1;
-                            }
-                        }
+                    // only the candidates can ever be picked as a seed, so only they need marking
+                    if(r < radius && ucv.mag(n) >= seedthreshold)
+                    {
+                        vector<int>::const_iterator candidate = lower_bound(candidates.begin(),candidates.end(),n);
+                        if(candidate != candidates.end() && *candidate == n) marked[candidate - candidates.begin()] = 1;
                     }
                 }
             }
+        }
+    }
+}
 
+// the geometry of a traced curve: it is evened out and smoothed, and then gets its framing, frenet serret frame, twist and writhe
+static void analyse_curve(knotcurve& curve, const Field& u, const Griddata& griddata)
+{
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+    const double h = griddata.h;
+    int NP = curve.knotcurve.size();
+    int i,j,k,s,m,iinc,jinc,kinc;
+    int idwn,jdwn,kdwn,modidwn,modjdwn,modkdwn;
+    double xd,yd,zd,prefactor;
 
-            // now comes a lot of curve analysis. but for now Im not going to do this on the boundary curves. 
-            if(boundaryhits==0)
-            {
+    /*******Vertex averaging*********/
 
-                /*******Vertex averaging*********/
+    double totlength, dl, dx,dy,dz;
+    for(i=0;i<3;i++)   //repeat a couple of times because of end point
+    {
+        totlength=0;
+        for(s=0; s<NP; s++)   //Work out total length of curve
+        {
+            dx = curve.knotcurve.xcoord[incp(s,1,NP)] - curve.knotcurve.xcoord[s];
+            dy = curve.knotcurve.ycoord[incp(s,1,NP)] - curve.knotcurve.ycoord[s];
+            dz = curve.knotcurve.zcoord[incp(s,1,NP)] - curve.knotcurve.zcoord[s];
+            totlength += sqrt(dx*dx + dy*dy + dz*dz);
+        }
+        dl = totlength/NP;
+        for(s=0; s<NP; s++)    //Move points to have spacing dl
+        {
+            dx = curve.knotcurve.xcoord[incp(s,1,NP)] - curve.knotcurve.xcoord[s];
+            dy = curve.knotcurve.ycoord[incp(s,1,NP)] - curve.knotcurve.ycoord[s];
+            dz = curve.knotcurve.zcoord[incp(s,1,NP)] - curve.knotcurve.zcoord[s];
+            double norm = sqrt(dx*dx + dy*dy + dz*dz);
+            curve.knotcurve.xcoord[incp(s,1,NP)] = curve.knotcurve.xcoord[s] + dl*dx/norm;
+            curve.knotcurve.ycoord[incp(s,1,NP)] = curve.knotcurve.ycoord[s] + dl*dy/norm;
+            curve.knotcurve.zcoord[incp(s,1,NP)] = curve.knotcurve.zcoord[s] + dl*dz/norm;
+        }
+    }
 
-                double totlength, dl, dx,dy,dz;
-                for(i=0;i<3;i++)   //repeat a couple of times because of end point
-                {
-                    totlength=0;
-                    for(s=0; s<NP; s++)   //Work out total length of curve
-                    {
-                        dx = knotcurves[c].knotcurve[incp(s,1,NP)].xcoord - knotcurves[c].knotcurve[s].xcoord;
-                        dy = knotcurves[c].knotcurve[incp(s,1,NP)].ycoord - knotcurves[c].knotcurve[s].ycoord;
-                        dz = knotcurves[c].knotcurve[incp(s,1,NP)].zcoord - knotcurves[c].knotcurve[s].zcoord;
-                        totlength += sqrt(dx*dx + dy*dy + dz*dz);
-                    }
-                    dl = totlength/NP;
-                    for(s=0; s<NP; s++)    //Move points to have spacing dl
-                    {
-                        dx = knotcurves[c].knotcurve[incp(s,1,NP)].xcoord - knotcurves[c].knotcurve[s].xcoord;
-                        dy = knotcurves[c].knotcurve[incp(s,1,NP)].ycoord - knotcurves[c].knotcurve[s].ycoord;
-                        dz = knotcurves[c].knotcurve[incp(s,1,NP)].zcoord - knotcurves[c].knotcurve[s].zcoord;
-                        double norm = sqrt(dx*dx + dy*dy + dz*dz);
-                        knotcurves[c].knotcurve[incp(s,1,NP)].xcoord = knotcurves[c].knotcurve[s].xcoord + dl*dx/norm;
-                        knotcurves[c].knotcurve[incp(s,1,NP)].ycoord = knotcurves[c].knotcurve[s].ycoord + dl*dy/norm;
-                        knotcurves[c].knotcurve[incp(s,1,NP)].zcoord = knotcurves[c].knotcurve[s].zcoord + dl*dz/norm;
-                    }
-                }
+    /*************Curve Smoothing*******************/
+    vector<double>* positions[3] = {&curve.knotcurve.xcoord,&curve.knotcurve.ycoord,&curve.knotcurve.zcoord};
+    smooth_curve_arrays(positions,NP,totlength);
 
-                /*************Curve Smoothing*******************/
-                vector<double> coord(NP);
-                gsl_fft_real_wavetable * real;
-                gsl_fft_halfcomplex_wavetable * hc;
-                gsl_fft_real_workspace * work;
-                work = gsl_fft_real_workspace_alloc (NP);
-                real = gsl_fft_real_wavetable_alloc (NP);
-                hc = gsl_fft_halfcomplex_wavetable_alloc (NP);
-                for(j=1; j<4; j++)
-                {
-                    switch(j)
-                    {
-                        case 1 :
-                            for(i=0; i<NP; i++) coord[i] =  knotcurves[c].knotcurve[i].xcoord ; break;
-                        case 2 :
-                            for(i=0; i<NP; i++) coord[i] =  knotcurves[c].knotcurve[i].ycoord ; break;
-                        case 3 :
-                            for(i=0; i<NP; i++) coord[i] =  knotcurves[c].knotcurve[i].zcoord ; break;
-                    }
-                    double* data = coord.data();
-                    // take the fft
-                    gsl_fft_real_transform (data, 1, NP, real, work);
-                    // 21/11/2016: make our low pass filter. To apply our filter. we should sample frequencies fn = n/Delta N , n = -N/2 ... N/2
-                    // this is discretizing the nyquist interval, with extreme frequency ~1/2Delta.
-                    // to cut out the frequencies of grid fluctuation size and larger we need a lengthscale Delta to
-                    // plug in above. im doing a rough length calc below, this might be overkill.
-                    // at the moment its just a hard filter, we can choose others though.
-                    // compute a rough length to set scale
-                    double filter;
-                    const double cutoff = 2*M_PI*(totlength/(6*lambda));
-                    for (i = 0; i < NP; ++i)
-                    {
-                        filter = 1/sqrt(1+pow((i/cutoff),8));
-                        data[i] *= filter;
-                    };
-                    // transform back
-                    gsl_fft_halfcomplex_inverse (data, 1, NP, hc, work);
-                    switch(j)
-                    {
-                        case 1 :
-                            for(i=0; i<NP; i++)  knotcurves[c].knotcurve[i].xcoord = coord[i] ; break;
-                        case 2 :
-                            for(i=0; i<NP; i++)  knotcurves[c].knotcurve[i].ycoord = coord[i] ; break;
-                        case 3 :
-                            for(i=0; i<NP; i++)  knotcurves[c].knotcurve[i].zcoord = coord[i] ; break;
-                    }
-                }
 
 
+    /******************Interpolate direction of grad u for twist calc*******/
+    /**Find nearest gridpoint**/
+    double dxu, dyu, dzu, dxup, dyup, dzup;
+    for(s=0; s<NP; s++)
+    {
+        idwn = (int) ((curve.knotcurve.xcoord[s]/h) - 0.5 + Nx/2.0);
+        jdwn = (int) ((curve.knotcurve.ycoord[s]/h) - 0.5 + Ny/2.0);
+        kdwn = (int) ((curve.knotcurve.zcoord[s]/h) - 0.5 + Nz/2.0);
+        modidwn = circularmod(idwn,Nx);
+        modjdwn = circularmod(jdwn,Ny);
+        modkdwn = circularmod(kdwn,Nz);
+        if((BoundaryType==ALLREFLECTING) && (idwn<0 || jdwn<0 || kdwn<0 || idwn > Nx-1 || jdwn > Ny-1 || kdwn > Nz-1)) break;
+        if((BoundaryType==ZPERIODIC) && (idwn<0 || jdwn<0 || idwn > Nx-1 || jdwn > Ny-1 )) break;
+        dxu=0;
+        dyu=0;
+        dzu=0;
+        /*curve to gridpoint down distance*/
+        xd = (curve.knotcurve.xcoord[s] - x(idwn,griddata))/h;
+        yd = (curve.knotcurve.ycoord[s] - y(jdwn,griddata))/h;
+        zd = (curve.knotcurve.zcoord[s] - z(kdwn,griddata))/h;
+        for(m=0;m<8;m++)  //linear interpolation of 8 NNs
+        {
+            /* Work out increments*/
+            iinc = m%2;
+            jinc = (m/2)%2;
+            kinc = (m/4)%2;
+            /*Loop over nearest points*/
+            i = gridinc(modidwn, iinc, Nx,0);
+            j = gridinc(modjdwn, jinc, Ny,1);
+            k = gridinc(modkdwn,kinc, Nz,2);
+            prefactor = (1-iinc + pow(-1,1+iinc)*xd)*(1-jinc + pow(-1,1+jinc)*yd)*(1-kinc + pow(-1,1+kinc)*zd);   //terms of the form (1-xd)(1-yd)zd etc. (interpolation coefficient)
+            /*interpolate grad u over nearest points*/
+            dxu += prefactor*0.5*(u[pt(gridinc(i,1,Nx,0),j,k,griddata)] -  u[pt(gridinc(i,-1,Nx,0),j,k,griddata)])/h;  //central diff
+            dyu += prefactor*0.5*(u[pt(i,gridinc(j,1,Ny,1),k,griddata)] -  u[pt(i,gridinc(j,-1,Ny,1),k,griddata)])/h;
+            dzu += prefactor*0.5*(u[pt(i,j,gridinc(k,1,Nz,2),griddata)] -  u[pt(i,j,gridinc(k,-1,Nz,2),griddata)])/h;
+        }
+        //project du onto perp of tangent direction first
+        dx = 0.5*(curve.knotcurve.xcoord[incp(s,1,NP)] - curve.knotcurve.xcoord[incp(s,-1,NP)]);   //central diff as a is defined on the points
+        dy = 0.5*(curve.knotcurve.ycoord[incp(s,1,NP)] - curve.knotcurve.ycoord[incp(s,-1,NP)]);
+        dz = 0.5*(curve.knotcurve.zcoord[incp(s,1,NP)] - curve.knotcurve.zcoord[incp(s,-1,NP)]);
+        dxup = dxu - (dxu*dx + dyu*dy + dzu*dz)*dx/(dx*dx+dy*dy+dz*dz);               //Grad u_j * (delta_ij - t_i t_j)
+        dyup = dyu - (dxu*dx + dyu*dy + dzu*dz)*dy/(dx*dx+dy*dy+dz*dz);
+        dzup = dzu - (dxu*dx + dyu*dy + dzu*dz)*dz/(dx*dx+dy*dy+dz*dz);
+        /*Vector a is the normalised gradient of u, should point in direction of max u perp to t*/
+        double norm = sqrt(dxup*dxup+dyup*dyup+dzup*dzup);
+        curve.knotcurve.ax[s] = dxup/norm;
+        curve.knotcurve.ay[s] = dyup/norm;
+        curve.knotcurve.az[s] = dzup/norm;
+    }
 
-                /******************Interpolate direction of grad u for twist calc*******/
-                /**Find nearest gridpoint**/
-                double dxu, dyu, dzu, dxup, dyup, dzup;
-                for(s=0; s<NP; s++)
-                {
-                    idwn = (int) ((knotcurves[c].knotcurve[s].xcoord/h) - 0.5 + Nx/2.0);
-                    jdwn = (int) ((knotcurves[c].knotcurve[s].ycoord/h) - 0.5 + Ny/2.0);
-                    kdwn = (int) ((knotcurves[c].knotcurve[s].zcoord/h) - 0.5 + Nz/2.0);
-                    modidwn = circularmod(idwn,Nx);
-                    modjdwn = circularmod(jdwn,Ny);
-                    modkdwn = circularmod(kdwn,Nz);
-                    if((BoundaryType==ALLREFLECTING) && (idwn<0 || jdwn<0 || kdwn<0 || idwn > Nx-1 || jdwn > Ny-1 || kdwn > Nz-1)) break;
-                    if((BoundaryType==ZPERIODIC) && (idwn<0 || jdwn<0 || idwn > Nx-1 || jdwn > Ny-1 )) break;
-                    dxu=0;
-                    dyu=0;
-                    dzu=0;
-                    /*curve to gridpoint down distance*/
-                    xd = (knotcurves[c].knotcurve[s].xcoord - x(idwn,griddata))/h;
-                    yd = (knotcurves[c].knotcurve[s].ycoord - y(jdwn,griddata))/h;
-                    zd = (knotcurves[c].knotcurve[s].zcoord - z(kdwn,griddata))/h;
-                    for(m=0;m<8;m++)  //linear interpolation of 8 NNs
-                    {
-                        /* Work out increments*/
-                        iinc = m%2;
-                        jinc = (m/2)%2;
-                        kinc = (m/4)%2;
-                        /*Loop over nearest points*/
-                        i = gridinc(modidwn, iinc, Nx,0);
-                        j = gridinc(modjdwn, jinc, Ny,1);
-                        k = gridinc(modkdwn,kinc, Nz,2);
-                        prefactor = (1-iinc + pow(-1,1+iinc)*xd)*(1-jinc + pow(-1,1+jinc)*yd)*(1-kinc + pow(-1,1+kinc)*zd);   //terms of the form (1-xd)(1-yd)zd etc. (interpolation coefficient)
-                        /*interpolate grad u over nearest points*/
-                        dxu += prefactor*0.5*(u[pt(gridinc(i,1,Nx,0),j,k,griddata)] -  u[pt(gridinc(i,-1,Nx,0),j,k,griddata)])/h;  //central diff
-                        dyu += prefactor*0.5*(u[pt(i,gridinc(j,1,Ny,1),k,griddata)] -  u[pt(i,gridinc(j,-1,Ny,1),k,griddata)])/h;
-                        dzu += prefactor*0.5*(u[pt(i,j,gridinc(k,1,Nz,2),griddata)] -  u[pt(i,j,gridinc(k,-1,Nz,2),griddata)])/h;
-                    }
-                    //project du onto perp of tangent direction first
-                    dx = 0.5*(knotcurves[c].knotcurve[incp(s,1,NP)].xcoord - knotcurves[c].knotcurve[incp(s,-1,NP)].xcoord);   //central diff as a is defined on the points
-                    dy = 0.5*(knotcurves[c].knotcurve[incp(s,1,NP)].ycoord - knotcurves[c].knotcurve[incp(s,-1,NP)].ycoord);
-                    dz = 0.5*(knotcurves[c].knotcurve[incp(s,1,NP)].zcoord - knotcurves[c].knotcurve[incp(s,-1,NP)].zcoord);
-                    dxup = dxu - (dxu*dx + dyu*dy + dzu*dz)*dx/(dx*dx+dy*dy+dz*dz);               //Grad u_j * (delta_ij - t_i t_j)
-                    dyup = dyu - (dxu*dx + dyu*dy + dzu*dz)*dy/(dx*dx+dy*dy+dz*dz);
-                    dzup = dzu - (dxu*dx + dyu*dy + dzu*dz)*dz/(dx*dx+dy*dy+dz*dz);
-                    /*Vector a is the normalised gradient of u, should point in direction of max u perp to t*/
-                    double norm = sqrt(dxup*dxup+dyup*dyup+dzup*dzup);
-                    knotcurves[c].knotcurve[s].ax = dxup/norm;
-                    knotcurves[c].knotcurve[s].ay = dyup/norm;
-                    knotcurves[c].knotcurve[s].az = dzup/norm;
-                }
+    vector<double>* gradients[3] = {&curve.knotcurve.ax,&curve.knotcurve.ay,&curve.knotcurve.az};
+    smooth_curve_arrays(gradients,NP,totlength);
 
-                for(j=1; j<4; j++)
-                {
-                    switch(j)
-                    {
-                        case 1 :
-                            for(i=0; i<NP; i++) coord[i] =  knotcurves[c].knotcurve[i].ax ; break;
-                        case 2 :
-                            for(i=0; i<NP; i++) coord[i] =  knotcurves[c].knotcurve[i].ay ; break;
-                        case 3 :
-                            for(i=0; i<NP; i++) coord[i] =  knotcurves[c].knotcurve[i].az ; break;
-                    }
-                    double* data = coord.data();
-                    // take the fft
-                    gsl_fft_real_transform (data, 1, NP, real, work);
-                    // 21/11/2016: make our low pass filter. To apply our filter. we should sample frequencies fn = n/Delta N , n = -N/2 ... N/2
-                    // this is discretizing the nyquist interval, with extreme frequency ~1/2Delta.
-                    // to cut out the frequencies of grid fluctuation size and larger we need a lengthscale Delta to
-                    // plug in above. im doing a rough length calc below, this might be overkill.
-                    // at the moment its just a hard filter, we can choose others though.
-                    // compute a rough length to set scale
-                    double filter;
-                    const double cutoff = 2*M_PI*(totlength/(6*lambda));
-                    for (i = 0; i < NP; ++i)
-                    {
-                        filter = 1/sqrt(1+pow((i/cutoff),8));
-                        data[i] *= filter;
-                    };
-                    // transform back
-                    gsl_fft_halfcomplex_inverse (data, 1, NP, hc, work);
-                    switch(j)
-                    {
-                        case 1 :
-                            for(i=0; i<NP; i++)  knotcurves[c].knotcurve[i].ax= coord[i] ; break;
-                        case 2 :
-                            for(i=0; i<NP; i++)  knotcurves[c].knotcurve[i].ay= coord[i] ; break;
-                        case 3 :
-                            for(i=0; i<NP; i++)  knotcurves[c].knotcurve[i].az = coord[i] ; break;
-                    }
-                }
-                gsl_fft_real_wavetable_free (real);
-                gsl_fft_halfcomplex_wavetable_free (hc);
-                gsl_fft_real_workspace_free (work);
 
+    // CURVE GEOMETRY - get curvatures, torsions, frennet serret frame
 
-                // CURVE GEOMETRY - get curvatures, torsions, frennet serret frame
 
+    NP = curve.knotcurve.size();
+    for(s=0; s<NP; s++)
+    {
+        // forward difference on the tangents
+        double dx = (curve.knotcurve.xcoord[incp(s,1,NP)] - curve.knotcurve.xcoord[incp(s,0,NP)]);
+        double dy = (curve.knotcurve.ycoord[incp(s,1,NP)] - curve.knotcurve.ycoord[incp(s,0,NP)]);
+        double dz = (curve.knotcurve.zcoord[incp(s,1,NP)] - curve.knotcurve.zcoord[incp(s,0,NP)]);
+        double deltas = sqrt(dx*dx+dy*dy+dz*dz);
+        curve.knotcurve.tx[s] = dx/(deltas);
+        curve.knotcurve.ty[s] = dy/(deltas);
+        curve.knotcurve.tz[s] = dz/(deltas);
+        curve.knotcurve.length[s] = deltas;
+        curve.length +=deltas;
+    }
+    for(s=0; s<NP; s++)
+    {
+        // backwards diff for the normals, amounting to a central diff overall
+        double nx = 2.0*(curve.knotcurve.tx[s]-curve.knotcurve.tx[incp(s,-1,NP)])/(curve.knotcurve.length[s]+curve.knotcurve.length[incp(s,-1,NP)]);
+        double ny = 2.0*(curve.knotcurve.ty[s]-curve.knotcurve.ty[incp(s,-1,NP)])/(curve.knotcurve.length[s]+curve.knotcurve.length[incp(s,-1,NP)]);
+        double nz = 2.0*(curve.knotcurve.tz[s]-curve.knotcurve.tz[incp(s,-1,NP)])/(curve.knotcurve.length[s]+curve.knotcurve.length[incp(s,-1,NP)]);
+        double curvature = sqrt(nx*nx+ny*ny+nz*nz);
+        nx /=curvature;
+        ny /=curvature;
+        nz /=curvature;
+        double tx = curve.knotcurve.tx[s] ;
+        double ty =  curve.knotcurve.ty[s] ;
+        double tz = curve.knotcurve.tz[s] ;
+        double bx = ty*nz - tz*ny;
+        double by = tz*nx - tx*nz;
+        double bz = tx*ny - ty*nx;
+        curve.knotcurve.nx[s] = nx ;
+        curve.knotcurve.ny[s] = ny ;
+        curve.knotcurve.nz[s] = nz ;
+        curve.knotcurve.bx[s] = bx ;
+        curve.knotcurve.by[s] = by ;
+        curve.knotcurve.bz[s] = bz ;
+        curve.knotcurve.curvature[s] = curvature ;
+    }
+    // torsions with a central difference
+    for(s=0; s<NP; s++)
+    {
+        double bx = curve.knotcurve.bx[s];
+        double by =  curve.knotcurve.by[s];
+        double bz = curve.knotcurve.bz[s];
 
-                NP = knotcurves[c].knotcurve.size();
-                for(s=0; s<NP; s++)
-                {
-                    // forward difference on the tangents
-                    double dx = (knotcurves[c].knotcurve[incp(s,1,NP)].xcoord - knotcurves[c].knotcurve[incp(s,0,NP)].xcoord);
-                    double dy = (knotcurves[c].knotcurve[incp(s,1,NP)].ycoord - knotcurves[c].knotcurve[incp(s,0,NP)].ycoord);
-                    double dz = (knotcurves[c].knotcurve[incp(s,1,NP)].zcoord - knotcurves[c].knotcurve[incp(s,0,NP)].zcoord);
-                    double deltas = sqrt(dx*dx+dy*dy+dz*dz);
-                    knotcurves[c].knotcurve[s].tx = dx/(deltas);
-                    knotcurves[c].knotcurve[s].ty = dy/(deltas);
-                    knotcurves[c].knotcurve[s].tz = dz/(deltas);
-                    knotcurves[c].knotcurve[s].length = deltas;
-                    knotcurves[c].length +=deltas;
-                }
-                for(s=0; s<NP; s++)
-                {
-                    // backwards diff for the normals, amounting to a central diff overall
-                    double nx = 2.0*(knotcurves[c].knotcurve[s].tx-knotcurves[c].knotcurve[incp(s,-1,NP)].tx)/(knotcurves[c].knotcurve[s].length+knotcurves[c].knotcurve[incp(s,-1,NP)].length);
-                    double ny = 2.0*(knotcurves[c].knotcurve[s].ty-knotcurves[c].knotcurve[incp(s,-1,NP)].ty)/(knotcurves[c].knotcurve[s].length+knotcurves[c].knotcurve[incp(s,-1,NP)].length);
-                    double nz = 2.0*(knotcurves[c].knotcurve[s].tz-knotcurves[c].knotcurve[incp(s,-1,NP)].tz)/(knotcurves[c].knotcurve[s].length+knotcurves[c].knotcurve[incp(s,-1,NP)].length);
-                    double curvature = sqrt(nx*nx+ny*ny+nz*nz);
-                    nx /=curvature;
-                    ny /=curvature;
-                    nz /=curvature;
-                    double tx = knotcurves[c].knotcurve[s].tx ;
-                    double ty =  knotcurves[c].knotcurve[s].ty ;
-                    double tz = knotcurves[c].knotcurve[s].tz ;
-                    double bx = ty*nz - tz*ny;
-                    double by = tz*nx - tx*nz;
-                    double bz = tx*ny - ty*nx;
-                    knotcurves[c].knotcurve[s].nx = nx ;
-                    knotcurves[c].knotcurve[s].ny = ny ;
-                    knotcurves[c].knotcurve[s].nz = nz ;
-                    knotcurves[c].knotcurve[s].bx = bx ;
-                    knotcurves[c].knotcurve[s].by = by ;
-                    knotcurves[c].knotcurve[s].bz = bz ;
-                    knotcurves[c].knotcurve[s].curvature = curvature ;
-                }
-                // torsions with a central difference
-                for(s=0; s<NP; s++)
-                {
-                    double bx = knotcurves[c].knotcurve[s].bx;
-                    double by =  knotcurves[c].knotcurve[s].by;
-                    double bz = knotcurves[c].knotcurve[s].bz;
+        double dnxds = 2.0*(curve.knotcurve.nx[incp(s,1,NP)]-curve.knotcurve.nx[incp(s,-1,NP)])/(curve.knotcurve.length[incp(s,1,NP)]+curve.knotcurve.length[incp(s,-1,NP)]);
+        double dnyds = 2.0*(curve.knotcurve.ny[incp(s,1,NP)]-curve.knotcurve.ny[incp(s,-1,NP)])/(curve.knotcurve.length[incp(s,1,NP)]+curve.knotcurve.length[incp(s,-1,NP)]);
+        double dnzds = 2.0*(curve.knotcurve.nz[incp(s,1,NP)]-curve.knotcurve.nz[incp(s,-1,NP)])/(curve.knotcurve.length[incp(s,1,NP)]+curve.knotcurve.length[incp(s,-1,NP)]);
 
-                    double dnxds = 2.0*(knotcurves[c].knotcurve[incp(s,1,NP)].nx-knotcurves[c].knotcurve[incp(s,-1,NP)].nx)/(knotcurves[c].knotcurve[incp(s,1,NP)].length+knotcurves[c].knotcurve[incp(s,-1,NP)].length);
-                    double dnyds = 2.0*(knotcurves[c].knotcurve[incp(s,1,NP)].ny-knotcurves[c].knotcurve[incp(s,-1,NP)].ny)/(knotcurves[c].knotcurve[incp(s,1,NP)].length+knotcurves[c].knotcurve[incp(s,-1,NP)].length);
-                    double dnzds = 2.0*(knotcurves[c].knotcurve[incp(s,1,NP)].nz-knotcurves[c].knotcurve[incp(s,-1,NP)].nz)/(knotcurves[c].knotcurve[incp(s,1,NP)].length+knotcurves[c].knotcurve[incp(s,-1,NP)].length);
+        double torsion = bx*dnxds+by*dnyds+bz*dnzds;
+        curve.knotcurve.torsion[s] = torsion ;
+    }
 
-                    double torsion = bx*dnxds+by*dnyds+bz*dnzds;
-                    knotcurves[c].knotcurve[s].torsion = torsion ;
-                }
 
+    // RIBBON TWIST AND WRITHE
 
-                // RIBBON TWIST AND WRITHE
+    // the writhe integrand is nonlocal, so it is done for all the points at once. it is evaluated between the segment midpoints,
+    // consistent with the fwd diff, with the tangent at s against the segment vector at m
+    vector<double> midpoints(3*NP), tangents(3*NP), segments(3*NP), writhedensity(NP);
+    const knotpoints& Points = curve.knotcurve;
+    for(s=0; s<NP; s++)
+    {
+        const int next = incp(s,1,NP);
+        midpoints[s] = 0.5*(Points.xcoord[next] + Points.xcoord[s]);
+        midpoints[NP+s] = 0.5*(Points.ycoord[next] + Points.ycoord[s]);
+        midpoints[2*NP+s] = 0.5*(Points.zcoord[next] + Points.zcoord[s]);
+        segments[s] = Points.xcoord[next] - Points.xcoord[s];
+        segments[NP+s] = Points.ycoord[next] - Points.ycoord[s];
+        segments[2*NP+s] = Points.zcoord[next] - Points.zcoord[s];
+    }
+    std::copy(Points.tx.begin(),Points.tx.end(),tangents.begin());
+    std::copy(Points.ty.begin(),Points.ty.end(),tangents.begin()+NP);
+    std::copy(Points.tz.begin(),Points.tz.end(),tangents.begin()+2*NP);
+    {
+        ProfileTimer timer(ProfileWrithe);
+        gauss_integrand(midpoints,tangents,segments,writhedensity);
+    }
 
-                for(s=0; s<NP; s++)
-                {
+    for(s=0; s<NP; s++)
+    {
 
-                    // twist of this segment
-                    double ds = knotcurves[c].knotcurve[s].length;
-                    double dxds = knotcurves[c].knotcurve[s].tx;
-                    double dyds = knotcurves[c].knotcurve[s].ty;
-                    double dzds = knotcurves[c].knotcurve[s].tz;
-                    double bx = (knotcurves[c].knotcurve[incp(s,1,NP)].ax - knotcurves[c].knotcurve[s].ax)/ds;
-                    double by = (knotcurves[c].knotcurve[incp(s,1,NP)].ay - knotcurves[c].knotcurve[s].ay)/ds;
-                    double bz = (knotcurves[c].knotcurve[incp(s,1,NP)].az - knotcurves[c].knotcurve[s].az)/ds;
-                    knotcurves[c].knotcurve[s].twist = (dxds*(knotcurves[c].knotcurve[s].ay*bz - knotcurves[c].knotcurve[s].az*by) + dyds*(knotcurves[c].knotcurve[s].az*bx - knotcurves[c].knotcurve[s].ax*bz) + dzds*(knotcurves[c].knotcurve[s].ax*by - knotcurves[c].knotcurve[s].ay*bx))/(2*M_PI*sqrt(dxds*dxds + dyds*dyds + dzds*dzds));
-
-                    // "writhe" of this segment. writhe is nonlocal, this is the thing in the integrand over s
-                    knotcurves[c].knotcurve[s].writhe = 0;
-                    for(m=0; m<NP; m++)
-                    {
-                        if(s != m)
-                        {
-                            xdiff = 0.5*(knotcurves[c].knotcurve[incp(s,1,NP)].xcoord + knotcurves[c].knotcurve[s].xcoord - knotcurves[c].knotcurve[incp(m,1,NP)].xcoord - knotcurves[c].knotcurve[m].xcoord);   //interpolate, consistent with fwd diff
-                            ydiff = 0.5*(knotcurves[c].knotcurve[incp(s,1,NP)].ycoord + knotcurves[c].knotcurve[s].ycoord - knotcurves[c].knotcurve[incp(m,1,NP)].ycoord - knotcurves[c].knotcurve[m].ycoord);
-                            zdiff = 0.5*(knotcurves[c].knotcurve[incp(s,1,NP)].zcoord + knotcurves[c].knotcurve[s].zcoord - knotcurves[c].knotcurve[incp(m,1,NP)].zcoord - knotcurves[c].knotcurve[m].zcoord);
-                            double dxdm = (knotcurves[c].knotcurve[incp(m,1,NP)].xcoord - knotcurves[c].knotcurve[m].xcoord)/(ds);
-                            double dydm = (knotcurves[c].knotcurve[incp(m,1,NP)].ycoord - knotcurves[c].knotcurve[m].ycoord)/(ds);
-                            double dzdm = (knotcurves[c].knotcurve[incp(m,1,NP)].zcoord - knotcurves[c].knotcurve[m].zcoord)/(ds);
-                            knotcurves[c].knotcurve[s].writhe += ds*(xdiff*(dyds*dzdm - dzds*dydm) + ydiff*(dzds*dxdm - dxds*dzdm) + zdiff*(dxds*dydm - dyds*dxdm))/(4*M_PI*(xdiff*xdiff + ydiff*ydiff + zdiff*zdiff)*sqrt(xdiff*xdiff + ydiff*ydiff + zdiff*zdiff));
-                        }
-                    }
+        // twist of this segment
+        double ds = curve.knotcurve.length[s];
+        double dxds = curve.knotcurve.tx[s];
+        double dyds = curve.knotcurve.ty[s];
+        double dzds = curve.knotcurve.tz[s];
+        double bx = (curve.knotcurve.ax[incp(s,1,NP)] - curve.knotcurve.ax[s])/ds;
+        double by = (curve.knotcurve.ay[incp(s,1,NP)] - curve.knotcurve.ay[s])/ds;
+        double bz = (curve.knotcurve.az[incp(s,1,NP)] - curve.knotcurve.az[s])/ds;
+        curve.knotcurve.twist[s] = (dxds*(curve.knotcurve.ay[s]*bz - curve.knotcurve.az[s]*by) + dyds*(curve.knotcurve.az[s]*bx - curve.knotcurve.ax[s]*bz) + dzds*(curve.knotcurve.ax[s]*by - curve.knotcurve.ay[s]*bx))/(2*M_PI*sqrt(dxds*dxds + dyds*dyds + dzds*dzds));
+
+        // "writhe" of this segment. writhe is nonlocal, this is the thing in the integrand over s
+        curve.knotcurve.writhe[s] = writhedensity[s]/(4*M_PI);
+
+        //Add on writhe, twist
+        curve.writhe += curve.knotcurve.writhe[s]*ds;
+        curve.twist  += curve.knotcurve.twist[s]*ds;
+        // while we are computing the global quantites, get the average position too
+        curve.xavgpos += curve.knotcurve.xcoord[s]/NP;
+        curve.yavgpos += curve.knotcurve.ycoord[s]/NP;
+        curve.zavgpos += curve.knotcurve.zcoord[s]/NP;
+    }
 
-                    //Add on writhe, twist
-                    knotcurves[c].writhe += knotcurves[c].knotcurve[s].writhe*ds;
-                    knotcurves[c].twist  += knotcurves[c].knotcurve[s].twist*ds;
-                    // while we are computing the global quantites, get the average position too
-                    knotcurves[c].xavgpos += knotcurves[c].knotcurve[s].xcoord/NP;
-                    knotcurves[c].yavgpos += knotcurves[c].knotcurve[s].ycoord/NP;
-                    knotcurves[c].zavgpos += knotcurves[c].knotcurve[s].zcoord/NP;
-                }
 
+    // the ghost grid has been useful for painlessly computing all the above quantities, without worrying about the periodic bc's
+    // but for storage and display, we should put it all in the box
+
+    // (1) construct the proper periodic co-ordinates from our ghost grid
+    double xupperlim = x(griddata.Nx -1 ,griddata);
+    double xlowerlim = x(0,griddata);
+    double deltax = griddata.Nx * h;
+    double yupperlim = y(griddata.Ny -1,griddata);
+    double ylowerlim = y(0,griddata);
+    double deltay = griddata.Ny * h;
+    double zupperlim = z(griddata.Nz -1 ,griddata);
+    double zlowermin = z(0,griddata);
+    double deltaz = griddata.Nz * h;
+    for(s=0; s<NP; s++)
+    {
+        curve.knotcurve.modxcoord[s] = curve.knotcurve.xcoord[s];
+        curve.knotcurve.modycoord[s] = curve.knotcurve.ycoord[s];
+        curve.knotcurve.modzcoord[s] = curve.knotcurve.zcoord[s];
+        if(curve.knotcurve.xcoord[s] > xupperlim) {
+            curve.knotcurve.modxcoord[s] = curve.knotcurve.xcoord[s]-deltax;
+        } ;
+        if(curve.knotcurve.xcoord[s] < xlowerlim) {
+            curve.knotcurve.modxcoord[s] = curve.knotcurve.xcoord[s]+deltax;
+        };
+        if(curve.knotcurve.ycoord[s] > yupperlim) {
+            curve.knotcurve.modycoord[s] = curve.knotcurve.ycoord[s]-deltay;
+        };
+        if(curve.knotcurve.ycoord[s] < ylowerlim) {
+            curve.knotcurve.modycoord[s] = curve.knotcurve.ycoord[s]+deltay;
+        };
+        if(curve.knotcurve.zcoord[s] > zupperlim) {
+            curve.knotcurve.modzcoord[s] = curve.knotcurve.zcoord[s]-deltaz;
+        };
+        if(curve.knotcurve.zcoord[s] < zlowermin)
+        {
+            curve.knotcurve.modzcoord[s] = curve.knotcurve.zcoord[s]+deltaz;
+        };
+    }
 
-                // the ghost grid has been useful for painlessly computing all the above quantities, without worrying about the periodic bc's
-                // but for storage and display, we should put it all in the box
-
-                // (1) construct the proper periodic co-ordinates from our ghost grid
-                double xupperlim = x(griddata.Nx -1 ,griddata);
-                double xlowerlim = x(0,griddata);
-                double deltax = griddata.Nx * h;
-                double yupperlim = y(griddata.Ny -1,griddata);
-                double ylowerlim = y(0,griddata);
-                double deltay = griddata.Ny * h;
-                double zupperlim = z(griddata.Nz -1 ,griddata);
-                double zlowermin = z(0,griddata);
-                double deltaz = griddata.Nz * h;
-                for(s=0; s<NP; s++)
-                {
-                    knotcurves[c].knotcurve[s].modxcoord = knotcurves[c].knotcurve[s].xcoord;
-                    knotcurves[c].knotcurve[s].modycoord = knotcurves[c].knotcurve[s].ycoord;
-                    knotcurves[c].knotcurve[s].modzcoord = knotcurves[c].knotcurve[s].zcoord;
-                    if(knotcurves[c].knotcurve[s].xcoord > xupperlim) {
-                        knotcurves[c].knotcurve[s].modxcoord = knotcurves[c].knotcurve[s].xcoord-deltax;
-                    } ;
-                    if(knotcurves[c].knotcurve[s].xcoord < xlowerlim) {
-                        knotcurves[c].knotcurve[s].modxcoord = knotcurves[c].knotcurve[s].xcoord+deltax;
-                    };
-                    if(knotcurves[c].knotcurve[s].ycoord > yupperlim) {
-                        knotcurves[c].knotcurve[s].modycoord = knotcurves[c].knotcurve[s].ycoord-deltay;
-                    };
-                    if(knotcurves[c].knotcurve[s].ycoord < ylowerlim) {
-                        knotcurves[c].knotcurve[s].modycoord = knotcurves[c].knotcurve[s].ycoord+deltay;
-                    };
-                    if(knotcurves[c].knotcurve[s].zcoord > zupperlim) {
-                        knotcurves[c].knotcurve[s].modzcoord = knotcurves[c].knotcurve[s].zcoord-deltaz;
-                    };
-                    if(knotcurves[c].knotcurve[s].zcoord < zlowermin)
-                    {
-                        knotcurves[c].knotcurve[s].modzcoord = knotcurves[c].knotcurve[s].zcoord+deltaz;
-                    };
-                }
+    // (2) standardise the knot such that the top right corner of the bounding box lies in the "actual" grid. This bounding box point may only lie
+    // off grid in the +ve x y z direction.
+    double xmax=curve.knotcurve.xcoord[0];
+    double ymax=curve.knotcurve.ycoord[0];
+    double zmax=curve.knotcurve.zcoord[0];
+    for(s=0; s<NP; s++)
+    {
+        if(curve.knotcurve.xcoord[s]>xmax)
+        {
+            xmax = curve.knotcurve.xcoord[s];
+        }
+        if(curve.knotcurve.ycoord[s]>ymax)
+        {
+            ymax = curve.knotcurve.ycoord[s];
+        }
+        if(curve.knotcurve.zcoord[s]>zmax)
+        {
+            zmax = curve.knotcurve.zcoord[s];
+        }
+    }
 
-                // (2) standardise the knot such that the top right corner of the bounding box lies in the "actual" grid. This bounding box point may only lie
-                // off grid in the +ve x y z direction.
-                double xmax=knotcurves[c].knotcurve[0].xcoord;
-                double ymax=knotcurves[c].knotcurve[0].ycoord;
-                double zmax=knotcurves[c].knotcurve[0].zcoord;
-                for(s=0; s<NP; s++)
-                {
-                    if(knotcurves[c].knotcurve[s].xcoord>xmax)
-                    {
-                        xmax = knotcurves[c].knotcurve[s].xcoord;
-                    }
-                    if(knotcurves[c].knotcurve[s].ycoord>ymax)
-                    {
-                        ymax = knotcurves[c].knotcurve[s].ycoord;
-                    }
-                    if(knotcurves[c].knotcurve[s].zcoord>zmax)
-                    {
-                        zmax = knotcurves[c].knotcurve[s].zcoord;
-                    }
-                }
+    // get how many lattice shifts are needed
+    int xlatticeshift = (int) (round(xmax/(griddata.Nx *griddata.h)));
+    int ylatticeshift = (int) (round(ymax/(griddata.Ny *griddata.h)));
+    int zlatticeshift = (int) (round(zmax/(griddata.Nz *griddata.h)));
+    // perform the shift
 
-                // get how many lattice shifts are needed
-                int xlatticeshift = (int) (round(xmax/(griddata.Nx *griddata.h)));
-                int ylatticeshift = (int) (round(ymax/(griddata.Ny *griddata.h)));
-                int zlatticeshift = (int) (round(zmax/(griddata.Nz *griddata.h)));
-                // perform the shift
+    for(int s=0; s<curve.knotcurve.size(); s++)
+    {
+        curve.knotcurve.xcoord[s] -= (double)(xlatticeshift) * (griddata.Nx *griddata.h);
+        curve.knotcurve.ycoord[s] -= (double)(ylatticeshift) * (griddata.Ny *griddata.h);
+        curve.knotcurve.zcoord[s] -= (double)(zlatticeshift) * (griddata.Nz *griddata.h);
+    }
+    // now we've done these shifts, we'd better move the knotcurve average position too.
+    curve.xavgpos = 0;
+    curve.yavgpos = 0;
+    curve.zavgpos = 0;
+    for(int s=0; s<curve.knotcurve.size(); s++)
+    {
+        curve.xavgpos += curve.knotcurve.xcoord[s]/NP;
+        curve.yavgpos += curve.knotcurve.ycoord[s]/NP;
+        curve.zavgpos += curve.knotcurve.zcoord[s]/NP;
+    }
+}
 
-                for(int s=0; s<knotcurves[c].knotcurve.size(); s++)
-                {
-                    knotcurves[c].knotcurve[s].xcoord -= (double)(xlatticeshift) * (griddata.Nx *griddata.h);
-                    knotcurves[c].knotcurve[s].ycoord -= (double)(ylatticeshift) * (griddata.Ny *griddata.h);
-                    knotcurves[c].knotcurve[s].zcoord -= (double)(zlatticeshift) * (griddata.Nz *griddata.h);
-                }
-                // now we've done these shifts, we'd better move the knotcurve average position too.
-                knotcurves[c].xavgpos = 0;
-                knotcurves[c].yavgpos = 0;
-                knotcurves[c].zavgpos = 0;
-                for(int s=0; s<knotcurves[c].knotcurve.size(); s++)
-                {
-                    knotcurves[c].xavgpos += knotcurves[c].knotcurve[s].xcoord/NP;
-                    knotcurves[c].yavgpos += knotcurves[c].knotcurve[s].ycoord/NP;
-                    knotcurves[c].zavgpos += knotcurves[c].knotcurve[s].zcoord/NP;
-                }
-                c++;
+// trace all the components there are in grad u x grad v, in the order the plain search for the brightest seed would find them
+template <class Gradients> static void trace_components(const Gradients& ucv, vector<knotcurve>& knotcurves, const Griddata& griddata)
+{
+    // first thing, clear the knotcurve object before we begin writing a new one
+    knotcurves.clear(); //empty vector with knot curve points
+
+    int Nx = griddata.Nx;
+    int Ny = griddata.Ny;
+    int Nz = griddata.Nz;
+    double h = griddata.h;
+
+    // the phases are timed from here, the thread running the single
+    double phasestart = omp_get_wtime();
+
+    // initialise the tricubic interpolator for ucvmag
+    likely::BasicTriCubicInterpolator<typename Gradients::Magnitudes> interpolateducvmag(ucv.magnitudes(), h, Nx,Ny,Nz);
+
+    // a component is seeded from the largest |grad u x grad v| left outside the tubes of the ones already found, as long as it is above this
+    const double seedthreshold = SeedThreshold;
+
+    // rather than sweep the whole grid for each component, one pass pulls out the few cells bright enough to ever be a seed. we are
+    // inside the single block in main here, so the pass is handed out as tasks, which the threads waiting at the end of the single pick up
+    vector<int> candidates;
+    ucv.candidates(seedthreshold,candidates);
+    // the order we try them in: brightest first, ties going to the earliest in the grid, just as a plain sweep for the maximum would pick.
+    // marking a candidate as inside a tube is then the only bookkeeping, in place of a marker over the whole grid
+    vector< pair<double,int> > seeds(candidates.size());
+    for(unsigned int q=0; q<candidates.size(); q++) seeds[q] = make_pair(-ucv.mag(candidates[q]), (int)q);
+    sort(seeds.begin(),seeds.end());
+    vector<char> marked(candidates.size(),0);
+    unsigned int nextseed = 0;
+    profile_add(ProfileSeeds,omp_get_wtime() - phasestart);
+    phasestart = omp_get_wtime();
+
+    // the components are traced a round at a time, each one of a round a task of its own. a round takes the next seeds outside the tubes
+    // found so far, leaving out any within a couple of tube radii of one already in it, which would likely just be the same component again.
+    // the curves are then taken in seed order, as if they had been traced one after another: a seed which the tube of a curve taken before
+    // it has covered is dropped, since it would only have traced that curve again, and the round ends at the first seed outside all the
+    // tubes which hasn't been traced yet. it starts the next round. the curves we end up with are just those the plain loop would find
+    const int roundsize = omp_get_num_threads();
+    const double separation = 2*3.0;
+    map<int,knotcurve> tracedcurves;
+    map<int,int> tracedhits;
+    while(true)
+    {
+        while(nextseed < seeds.size() && marked[seeds[nextseed].second]) nextseed++;
+        if(nextseed == seeds.size()) break;
+
+        vector<int> roundseeds;
+        for(unsigned int q=nextseed; q<seeds.size() && (int)roundseeds.size()<roundsize; q++)
+        {
+            if(marked[seeds[q].second]) continue;
+            const int n = candidates[seeds[q].second];
+            bool apart = true;
+            for(unsigned int r=0; r<roundseeds.size() && apart; r++)
+            {
+                const int other = candidates[seeds[roundseeds[r]].second];
+                const double dx = (n/(Ny*Nz) - other/(Ny*Nz))*h;
+                const double dy = ((n/Nz)%Ny - (other/Nz)%Ny)*h;
+                const double dz = (n%Nz - other%Nz)*h;
+                apart = (dx*dx + dy*dy + dz*dz >= separation*separation);
             }
-            // if we did hit a boundary, just strike the curve we made from the record. It lives on in the marked array!
-            else
+            if(apart) roundseeds.push_back(q);
+        }
+        vector<knotcurve> roundcurves(roundseeds.size());
+        vector<int> roundhits(roundseeds.size());
+#pragma omp taskloop grainsize(1) default(none) shared(roundseeds,roundcurves,roundhits,seeds,candidates,ucv,interpolateducvmag,griddata)
+        for(unsigned int r=0; r<roundseeds.size(); r++)
+        {
+            roundhits[r] = trace_curve(candidates[seeds[roundseeds[r]].second],ucv,interpolateducvmag,griddata,roundcurves[r]);
+        }
+        for(unsigned int r=0; r<roundseeds.size(); r++)
+        {
+            std::swap(tracedcurves[roundseeds[r]],roundcurves[r]);
+            tracedhits[roundseeds[r]] = roundhits[r];
+        }
+
+        while(true)
+        {
+            while(nextseed < seeds.size() && marked[seeds[nextseed].second]) nextseed++;
+            map<int,knotcurve>::iterator traced = tracedcurves.find(nextseed);
+            if(traced == tracedcurves.end()) break;
+            mark_tube(traced->second,ucv,seedthreshold,candidates,marked,griddata);
+            // the seed is always inside its own tube, but should it not be we still mustn't trace from it again
+            marked[seeds[nextseed].second] = 1;
+            // if the curve hit a boundary, just strike it from the record. It lives on in the marked array!
+            if(tracedhits[nextseed] == 0)
             {
-                knotcurves.pop_back();
+                knotcurves.push_back(knotcurve());
+                std::swap(knotcurves.back(),traced->second);
             }
+            tracedcurves.erase(traced);
         }
     }
+
+    profile_add(ProfileTracing,omp_get_wtime() - phasestart);
+}
+
+// the summary stats of the components as last traced, in their labelled order, and how the latest trace's components map onto them
+struct ComponentMatching
+{
+    ComponentMatching() : first(true) {}
+    bool first;
+    vector<double> oldwrithe;
+    vector<double> oldtwist;
+    vector<double> oldlength;
+    vector<double> oldxavgpos;
+    vector<double> oldyavgpos;
+    vector<double> oldzavgpos;
+    vector<int> permutation;
+};
+static ComponentMatching matching;
+
+void reset_component_matching()
+{
+    matching = ComponentMatching();
+}
+
+// the analysis of the traced components, and keeping their labels the same from one trace to the next
+static void analyse_components(Field& u, vector<knotcurve>& knotcurves, const Griddata& griddata)
+{
+    int Nx = griddata.Nx;
+    int Ny = griddata.Ny;
+    int Nz = griddata.Nz;
+    double h = griddata.h;
+    double phasestart = omp_get_wtime();
+
+    // now comes a lot of curve analysis, which is separate for each component
+    prune_curve_ffts();
+#pragma omp taskloop grainsize(1) default(none) shared(knotcurves,u,griddata)
+    for(unsigned int c=0; c<knotcurves.size(); c++) analyse_curve(knotcurves[c],u,griddata);
+    profile_add(ProfileCurves,omp_get_wtime() - phasestart);
+
     // the order of the components within the knotcurves vector is not guaranteed to remain fixed from timestep to timestep. thus, componenet 0 at one timtestep could be
     // components 1 at the next. the code needs a way of tracking which componenet is which.
     // at the moment, im doing this by fuzzily comparing summary stats on the components - at this point, the length twist and writhe.
 
-    // these variables have the summary stats from the last timestep
-
-    static vector<double> oldwrithe(knotcurves.size());
-    static vector<double> oldtwist(knotcurves.size());
-    static vector<double> oldlength(knotcurves.size());
-    static vector<double> oldxavgpos(knotcurves.size());
-    static vector<double> oldyavgpos(knotcurves.size());
-    static vector<double> oldzavgpos(knotcurves.size());
-    static bool first = true;
-    static vector<int> permutation(knotcurves.size());
+    // these variables have the summary stats from the last timestep. if the number of components has changed since then there is
+    // nothing to match them against, and they are labelled afresh, as on the first trace
+
+    vector<double>& oldwrithe = matching.oldwrithe;
+    vector<double>& oldtwist = matching.oldtwist;
+    vector<double>& oldlength = matching.oldlength;
+    vector<double>& oldxavgpos = matching.oldxavgpos;
+    vector<double>& oldyavgpos = matching.oldyavgpos;
+    vector<double>& oldzavgpos = matching.oldzavgpos;
+    vector<int>& permutation = matching.permutation;
+    if(oldwrithe.size() != knotcurves.size())
+    {
+        matching.first = true;
+        oldwrithe.resize(knotcurves.size());
+        oldtwist.resize(knotcurves.size());
+        oldlength.resize(knotcurves.size());
+        oldxavgpos.resize(knotcurves.size());
+        oldyavgpos.resize(knotcurves.size());
+        oldzavgpos.resize(knotcurves.size());
+        permutation.resize(knotcurves.size());
+    }
 
-    if(first)
+    if(matching.first)
     {
         for(int i = 0; i<knotcurves.size();i++)
         {
@@ -972,173 +1277,437 @@ void find_knot_properties( vector<double>&ucvx, vector<double>&ucvy, vector<doub
             oldzavgpos[i] = knotcurves[permutation[i]].zavgpos;
 
         }
-        // i can't be bothered to do this the smart way.
+        // the permutation is valid, so each curve is moved over exactly once - their points are swapped across, not copied
         vector<knotcurve> tempknotcurves(knotcurves.size());
         for(int i = 0; i<knotcurves.size();i++)
         {
-            tempknotcurves[i]=knotcurves[permutation[i]];
+            std::swap(tempknotcurves[i],knotcurves[permutation[i]]);
         }
-        knotcurves=tempknotcurves;
+        knotcurves.swap(tempknotcurves);
     }
-    first = false;
+    matching.first = false;
+}
+
+void find_knot_properties( Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag,Field& u,vector<knotcurve>& knotcurves,double t, const Griddata& griddata)
+{
+    trace_components(UcvGrids(ucvx,ucvy,ucvz,ucvmag,griddata),knotcurves,griddata);
+    analyse_components(u,knotcurves,griddata);
+}
+
+void find_knot_properties(const UcvCache& ucv, Field& u, vector<knotcurve>& knotcurves, double t, const Griddata& griddata)
+{
+    trace_components(ucv,knotcurves,griddata);
+    analyse_components(u,knotcurves,griddata);
 }
 
 void find_knot_velocity(const vector<knotcurve>& knotcurves,vector<knotcurve>& knotcurvesold,const Griddata& griddata,const double deltatime)
 {
     for(int c=0;c<knotcurvesold.size();c++)
     {
+        const knotcurve& curve = knotcurves[c];
+        knotcurve& oldcurve = knotcurvesold[c];
+        const int NPold = oldcurve.knotcurve.size();
+        // only the segments of the new curve near each old point are tried, rather than all of them. crossings further than this are ignored
+        SegmentGrid grid;
+        build_segment_grid(curve,grid);
+        const double maxdistance = sqrt(oldcurve.length);
+
+        // we are inside the single block in main, so the old points go out as tasks
+#pragma omp taskloop grainsize(16) default(none) shared(curve,oldcurve,grid,NPold,maxdistance,deltatime)
+        for(int s = 0; s< NPold; s++)
+        {
+            knotpoints& Points = oldcurve.knotcurve;
+            const double Start[3] = {Points.xcoord[s], Points.ycoord[s], Points.zcoord[s]};
+            const double End[3] = {Points.xcoord[(s+1)%NPold], Points.ycoord[(s+1)%NPold], Points.zcoord[(s+1)%NPold]};
+            // if no crossing is found this is left at the origin
+            double ClosestIntersection[3] = {0,0,0};
+            closest_plane_intersection(curve,grid,Start,End,maxdistance,ClosestIntersection);
+            // work out velocity and twist rate
+            Points.vx[s] = (ClosestIntersection[0] - Points.xcoord[s] )/ deltatime;
+            Points.vy[s] = (ClosestIntersection[1] - Points.ycoord[s] )/ deltatime;
+            Points.vz[s] = (ClosestIntersection[2] - Points.zcoord[s] )/ deltatime;
+            // for convenience, lets also output the decomposition into normal and binormal
+            double vdotn = Points.nx[s]*Points.vx[s]+Points.ny[s]*Points.vy[s]+Points.nz[s]*Points.vz[s];
+            double vdotb = Points.bx[s]*Points.vx[s]+Points.by[s]*Points.vy[s]+Points.bz[s]*Points.vz[s];
+
+            Points.vdotnx[s] = vdotn * Points.nx[s] ;
+            Points.vdotny[s] = vdotn * Points.ny[s] ;
+            Points.vdotnz[s] = vdotn * Points.nz[s] ;
+            Points.vdotbx[s] = vdotb * Points.bx[s] ;
+            Points.vdotby[s] = vdotb * Points.by[s] ;
+            Points.vdotbz[s] = vdotb * Points.bz[s] ;
+        }
+    }
+}
+uvupdatefunction choose_uv_update(enum BoundaryType boundarytype, TimeStepperType timestepper)
+{
+    if(timestepper == RK4LOWSTORAGE)
+    {
+        switch(boundarytype)
+        {
+            case ALLREFLECTING: return &uv_update_lowstorage_rk4<ALLREFLECTING>;
+            case ZPERIODIC: return &uv_update_lowstorage_rk4<ZPERIODIC>;
+            case ALLPERIODIC: return &uv_update_lowstorage_rk4<ALLPERIODIC>;
+        }
+    }
+    switch(boundarytype)
+    {
+        case ALLREFLECTING: return &uv_update_rk4<ALLREFLECTING>;
+        case ZPERIODIC: return &uv_update_rk4<ZPERIODIC>;
+        case ALLPERIODIC: return &uv_update_rk4<ALLPERIODIC>;
+    }
+    return NULL;
+}
 
-        int NP = knotcurves[c].knotcurve.size();
-        int NPold = knotcurvesold[c].knotcurve.size();
+// the stage inputs of u live in the padded grids padA and padB, which we ping-pong between: each stage reads its input from padA,
+// writes the next stages input into padB, and then the two are swapped. the last stage adds the slopes straight onto u and v,
+// so its own slope is never stored - ku and kv only need to hold three grids.
+template <enum BoundaryType BC> void uv_update_rk4(Field& u, Field& v,  Field& ku, Field& kv, Field& padA, Field& padB, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata& griddata)
+{
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+    const double h = griddata.h;
+    const int arraysize = Nx*Ny*Nz;
+    // strides of the padded grid in i and j
+    const int sx = (Ny+2)*(Nz+2);
+    const int sy = Nz+2;
+
+    // some constants we will use over and over below. the FN parameters are copied into locals so they stay
+    // in registers through the loops below, rather than being reloaded from the globals after every store
+    const double eps = epsilon;
+    const double bet = beta;
+    const double gm = gam;
+    const double dt = dtime;
+    const double sixth = 1.0/6.0;
+    const double ONETHIRD = 1.0/3.0;
+    const double oneoverepsilon = 1.0/eps;
+    const double oneoverhsq = 1.0/(h*h);
+    // the fraction of the time step each stage is evaluated at
+    const double inc[4] = {0, 0.5, 0.5, 1};
+    // the rows are cut into blocks only when some of them are being left out
+    const int kseg = (activeblocks.numactive == (int)activeblocks.active.size()) ? StencilBlockK : ActiveBlockSize;
+
+    // the first stage is evaluated at u itself
+#pragma omp for
+    for(int i=0;i<Nx;i++)
+    {
+        for(int j=0; j<Ny; j++)
+        {
+            const int row = pt(i,j,0,griddata);
+            const int padrow = padpt(i,j,0,griddata);
+            for(int k=0; k<Nz; k++) padA[padrow+k] = u[row+k];
+        }
+    }
+#pragma omp single
+    {
+        fill_halo<BC>(padA,griddata);
+        halo_exchange_begin(padA,griddata);
+    }
 
-        for(int s = 0; s< knotcurvesold[c].knotcurve.size(); s++)
+    for(int l=0;l<4;l++)
+    {
+        const double vinc = dt*inc[l];
+        const double nextinc = (l<3) ? dt*inc[l+1] : 0;
+        const double dtsixth = dt*sixth;
+        // the first pass does the planes which only need this ranks data, while the x halos are swapped with the neighbouring
+        // ranks behind it. the second does the two planes on the x faces, once the halos are in
+        for(int pass=0; pass<2; pass++)
         {
-            double IntersectionFraction =-1;
-            std::vector<double> IntersectionPoint(3);
-            std::vector<double> ClosestIntersection(3);
-            double closestdistancesquare = knotcurvesold[c].length;
-            for(int t = 0 ; t<knotcurves[c].knotcurve.size();t++)
+            if(pass==1)
             {
-                int intersection = 0;
-                intersection = intersect3D_SegmentPlane( knotcurves[c].knotcurve[t%NP], knotcurves[c].knotcurve[(t+1)%NP], knotcurvesold[c].knotcurve[s%NPold], knotcurvesold[c].knotcurve[(s+1)%NPold], IntersectionFraction, IntersectionPoint );
-                if(intersection ==1)
+#pragma omp single
+                halo_exchange_end();
+            }
+            const int ifirst = (pass==0) ? 1 : 0;
+            const int ilast = (pass==0) ? Nx-2 : Nx-1;
+            const int istride = (pass==0) ? 1 : std::max(Nx-1,1);
+            // the planes of the pass are numbered m = 0..nplanes-1, and shared out in chunks along with the tiles
+            const int nplanes = (ilast >= ifirst) ? (ilast-ifirst)/istride + 1 : 0;
+            const int ichunk = stencil_ichunk(nplanes,griddata);
+            // the barrier is left to after the timer, so each thread times only its own share
+            const double loopstart = omp_get_wtime();
+#pragma omp for collapse(3) schedule(static) nowait
+            for(int mb=0; mb<nplanes; mb+=ichunk)
+            {
+                for(int jb=0; jb<Ny; jb+=StencilBlockJ)
                 {
-                    double intersectiondistancesquare = (IntersectionPoint[0] - knotcurvesold[c].knotcurve[s].xcoord )*(IntersectionPoint[0] - knotcurvesold[c].knotcurve[s].xcoord )+ (IntersectionPoint[1] - knotcurvesold[c].knotcurve[s].ycoord )*(IntersectionPoint[1] - knotcurvesold[c].knotcurve[s].ycoord )+ (IntersectionPoint[2] - knotcurvesold[c].knotcurve[s].zcoord )*(IntersectionPoint[2] - knotcurvesold[c].knotcurve[s].zcoord );
-                    if(intersectiondistancesquare < closestdistancesquare)
+                    for(int kb=0; kb<Nz; kb+=StencilBlockK)
                     {
-                        closestdistancesquare = intersectiondistancesquare;
-                        ClosestIntersection[0] = IntersectionPoint[0];
-                        ClosestIntersection[1] = IntersectionPoint[1];
-                        ClosestIntersection[2] = IntersectionPoint[2];
+                        const int mend = std::min(mb+ichunk,nplanes);
+                        const int jend = std::min(jb+StencilBlockJ,Ny);
+                        const int kend = std::min(kb+StencilBlockK,Nz);
+                        for(int m=mb;m<mend;m++)
+                        {
+                            const int i = ifirst + m*istride;
+                            for(int j=jb; j<jend; j++)
+                            {
+                                const int row = pt(i,j,0,griddata);
+                                const fieldvalue* s = &padA[padpt(i,j,0,griddata)];
+                                fieldvalue* snext = &padB[padpt(i,j,0,griddata)];
+                                for(int ks=kb; ks<kend; ks+=kseg)
+                                {
+                                    if(!block_active(i,j,ks)) continue;
+                                    const int ksend = std::min(ks+kseg,kend);
+    #pragma omp simd
+                                    for(int k=ks; k<ksend; k++)   //Central difference
+                                    {
+                                        const int n = row + k;
+                                        const double currentu = s[k];
+                                        const double currentv = (l==0) ? v[n] : v[n] + vinc*kv[(l-1)*arraysize+n];
+                                        const double D2u = oneoverhsq*((double)s[k+sx] + s[k-sx] + s[k+sy] + s[k-sy] + s[k+1] + s[k-1] - 6.0*currentu);
+                                        const double kun = oneoverepsilon*(currentu - (ONETHIRD*currentu)*(currentu*currentu) - currentv) + D2u;
+                                        const double kvn = eps*(currentu + bet - gm*currentv);
+                                        if(l<3)
+                                        {
+                                            ku[l*arraysize+n] = kun;
+                                            kv[l*arraysize+n] = kvn;
+                                            snext[k] = u[n] + nextinc*kun;
+                                        }
+                                        else
+                                        {
+                                            u[n] = u[n] + dtsixth*((double)ku[n]+2*ku[arraysize+n]+2*ku[2*arraysize+n]+kun);
+                                            v[n] = v[n] + dtsixth*((double)kv[n]+2*kv[arraysize+n]+2*kv[2*arraysize+n]+kvn);
+                                            // padB is free on the last stage, so it can take the new u ready for the gradients
+                                            if(computegradients) snext[k] = u[n];
+                                        }
+                                    }
+                                }
+                            }
+                        }
                     }
-
                 }
             }
-            // work out velocity and twist rate
-            knotcurvesold[c].knotcurve[s].vx = (ClosestIntersection[0] - knotcurvesold[c].knotcurve[s].xcoord )/ deltatime;
-            knotcurvesold[c].knotcurve[s].vy = (ClosestIntersection[1] - knotcurvesold[c].knotcurve[s].ycoord )/ deltatime;
-            knotcurvesold[c].knotcurve[s].vz = (ClosestIntersection[2] - knotcurvesold[c].knotcurve[s].zcoord )/ deltatime;
-            // for convenience, lets also output the decomposition into normal and binormal
-            double vdotn = knotcurvesold[c].knotcurve[s].nx*knotcurvesold[c].knotcurve[s].vx+knotcurvesold[c].knotcurve[s].ny*knotcurvesold[c].knotcurve[s].vy+knotcurvesold[c].knotcurve[s].nz*knotcurvesold[c].knotcurve[s].vz;
-            double vdotb = knotcurvesold[c].knotcurve[s].bx*knotcurvesold[c].knotcurve[s].vx+knotcurvesold[c].knotcurve[s].by*knotcurvesold[c].knotcurve[s].vy+knotcurvesold[c].knotcurve[s].bz*knotcurvesold[c].knotcurve[s].vz;
-
-            knotcurvesold[c].knotcurve[s].vdotnx = vdotn * knotcurvesold[c].knotcurve[s].nx ;
-            knotcurvesold[c].knotcurve[s].vdotny = vdotn * knotcurvesold[c].knotcurve[s].ny ;
-            knotcurvesold[c].knotcurve[s].vdotnz = vdotn * knotcurvesold[c].knotcurve[s].nz ;
-            knotcurvesold[c].knotcurve[s].vdotbx = vdotb * knotcurvesold[c].knotcurve[s].bx ;
-            knotcurvesold[c].knotcurve[s].vdotby = vdotb * knotcurvesold[c].knotcurve[s].by ;
-            knotcurvesold[c].knotcurve[s].vdotbz = vdotb * knotcurvesold[c].knotcurve[s].bz ;
+            profile_stencil_loop(omp_get_wtime() - loopstart);
+#pragma omp barrier
+        }
+        if(l<3)
+        {
+#pragma omp single
+            {
+                fill_halo<BC>(padB,griddata);
+                padA.swap(padB);
+                halo_exchange_begin(padA,griddata);
+            }
+        }
+    }
+    // the new u is already padded in padB, so only v needs copying before the gradients
+    if(computegradients)
+    {
+#pragma omp for
+        for(int i=0;i<Nx;i++)
+        {
+            for(int j=0; j<Ny; j++)
+            {
+                const int row = pt(i,j,0,griddata);
+                const int padrow = padpt(i,j,0,griddata);
+                for(int k=0; k<Nz; k++) padA[padrow+k] = v[row+k];
+            }
+        }
+#pragma omp single
+        {
+            fill_halo<BC>(padB,griddata);
+            fill_halo<BC>(padA,griddata);
+            halo_exchange_begin(padB,griddata);
+            halo_exchange_begin(padA,griddata);
+            halo_exchange_end();
         }
+        crossgrad_from_padded(padB,padA,ucvx,ucvy,ucvz,ucvmag,griddata);
+    }
+    // the first slopes are still in ku and kv
+    if(activeblocks.measure)
+    {
+        measure_activity(ku,kv,1,griddata);
+        update_active_blocks<BC>(u,padB,griddata);
     }
 }
-void uv_update(vector<double>&u, vector<double>&v,  vector<double>&ku, vector<double>&kv,const Griddata& griddata)
+
+// Williamson's 2N-storage form of Runge-Kutta, with the five stage fourth order coefficients of Carpenter and Kennedy (NASA TM-109112, 1994).
+// each stage does  k = A k + dt F(u), u = u + B k , so ku and kv only need to be a single grid each rather than four.
+// during the step the running value of u is kept in the padded grid, and only copied back into u by the last stage.
+template <enum BoundaryType BC> void uv_update_lowstorage_rk4(Field& u, Field& v,  Field& ku, Field& kv, Field& padA, Field& padB, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata& griddata)
 {
-    int Nx = griddata.Nx;
-    int Ny = griddata.Ny;
-    int Nz = griddata.Nz;
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
     const double h = griddata.h;
-    int i,j,k,l,n,kup,kdown,iup,idown,jup,jdown;
-    double D2u;
-    const int arraysize = Nx*Ny*Nz;
+    const int sx = (Ny+2)*(Nz+2);
+    const int sy = Nz+2;
 
+    static const double A[5] = {0.0, -567301805773.0/1357537059087.0, -2404267990393.0/2016746695238.0, -3550918686646.0/2091501179385.0, -1275806237668.0/842570457699.0};
+    static const double B[5] = {1432997174477.0/9575080441755.0, 5161836677717.0/13612068292357.0, 1720146321549.0/2090206949498.0, 3134564353537.0/4481467310338.0, 2277821191437.0/14882151754819.0};
 
-    // some constants we will use over and over below:
-    const double sixth = 1.0/6.0;
+    const double eps = epsilon;
+    const double bet = beta;
+    const double gm = gam;
+    const double dt = dtime;
     const double ONETHIRD = 1.0/3.0;
-    const double oneoverepsilon = 1.0/epsilon;
+    const double oneoverepsilon = 1.0/eps;
     const double oneoverhsq = 1.0/(h*h);
-    // first loop. get k1, store (in testun] and testv[n], the value u[n]+h/2k1)
-#pragma omp for 
-    for(i=0;i<Nx;i++)
+    const int kseg = (activeblocks.numactive == (int)activeblocks.active.size()) ? StencilBlockK : ActiveBlockSize;
+
+#pragma omp for
+    for(int i=0;i<Nx;i++)
     {
-        for(j=0; j<Ny; j++)
+        for(int j=0; j<Ny; j++)
         {
-            for(k=0; k<Nz; k++)   //Central difference
-            {
-                n = pt(i,j,k,griddata);
-                kup = gridinc(k,1,Nz,2);
-                kdown = gridinc(k,-1,Nz,2);
-                D2u = oneoverhsq*(u[pt(gridinc(i,1,Nx,0),j,k,griddata)] + u[pt(gridinc(i,-1,Nx,0),j,k,griddata)] + u[pt(i,gridinc(j,1,Ny,1),k,griddata)] + u[pt(i,gridinc(j,-1,Ny,1),k,griddata)] + u[pt(i,j,kup,griddata)] + u[pt(i,j,kdown,griddata)] - 6.0*u[n]);
-                ku[n] = oneoverepsilon*(u[n] - (ONETHIRD*u[n])*(u[n]*u[n]) - v[n]) + D2u;
-                kv[n] = epsilon*(u[n] + beta - gam*v[n]);
-            }
+            const int row = pt(i,j,0,griddata);
+            const int padrow = padpt(i,j,0,griddata);
+            for(int k=0; k<Nz; k++) padA[padrow+k] = u[row+k];
         }
     }
-    // 2nd and 3rd loops
-    double inc ;
-    for(l=1;l<=3;l++)  //u and v update for each fractional time step
+#pragma omp single
     {
-        switch (l)
-        {
-            case 1:
-                {
-                    inc=0.5;   //add k1 to uv and add to total k
-                }
-                break;
+        fill_halo<BC>(padA,griddata);
+        halo_exchange_begin(padA,griddata);
+    }
 
-            case 2:
-                {
-                    inc=0.5 ;   //add k1 to uv and add to total k
-                }
-                break;
-            case 3:
+    for(int l=0;l<5;l++)
+    {
+        const double Al = A[l];
+        const double Bl = B[l];
+        // accumulate this stages slope into k. A[0] is 0, so whatever was left in k from the last step is forgotten.
+        // as in uv_update_rk4, the planes on the x faces wait for the halo swap in a second pass
+        for(int pass=0; pass<2; pass++)
+        {
+            if(pass==1)
+            {
+#pragma omp single
+                halo_exchange_end();
+            }
+            const int ifirst = (pass==0) ? 1 : 0;
+            const int ilast = (pass==0) ? Nx-2 : Nx-1;
+            const int istride = (pass==0) ? 1 : std::max(Nx-1,1);
+            // the planes of the pass are numbered m = 0..nplanes-1, and shared out in chunks along with the tiles
+            const int nplanes = (ilast >= ifirst) ? (ilast-ifirst)/istride + 1 : 0;
+            const int ichunk = stencil_ichunk(nplanes,griddata);
+            // as above, the barrier comes after the timer
+            const double loopstart = omp_get_wtime();
+#pragma omp for collapse(3) schedule(static) nowait
+            for(int mb=0; mb<nplanes; mb+=ichunk)
+            {
+                for(int jb=0; jb<Ny; jb+=StencilBlockJ)
                 {
-                    inc=1 ;   //add k1 to uv and add to total k
+                    for(int kb=0; kb<Nz; kb+=StencilBlockK)
+                    {
+                        const int mend = std::min(mb+ichunk,nplanes);
+                        const int jend = std::min(jb+StencilBlockJ,Ny);
+                        const int kend = std::min(kb+StencilBlockK,Nz);
+                        for(int m=mb;m<mend;m++)
+                        {
+                            const int i = ifirst + m*istride;
+                            for(int j=jb; j<jend; j++)
+                            {
+                                const int row = pt(i,j,0,griddata);
+                                const fieldvalue* s = &padA[padpt(i,j,0,griddata)];
+                                for(int ks=kb; ks<kend; ks+=kseg)
+                                {
+                                    if(!block_active(i,j,ks)) continue;
+                                    const int ksend = std::min(ks+kseg,kend);
+    #pragma omp simd
+                                    for(int k=ks; k<ksend; k++)   //Central difference
+                                    {
+                                        const int n = row + k;
+                                        const double D2u = oneoverhsq*((double)s[k+sx] + s[k-sx] + s[k+sy] + s[k-sy] + s[k+1] + s[k-1] - 6.0*s[k]);
+                                        ku[n] = Al*ku[n] + dt*(oneoverepsilon*(s[k] - (ONETHIRD*s[k])*((double)s[k]*s[k]) - v[n]) + D2u);
+                                        kv[n] = Al*kv[n] + dt*(eps*(s[k] + bet - gm*v[n]));
+                                    }
+                                }
+                            }
+                        }
+                    }
                 }
-                break;
+            }
+            profile_stencil_loop(omp_get_wtime() - loopstart);
+#pragma omp barrier
         }
-#pragma omp for 
-        for(i=0;i<Nx;i++)
+        // with A[0] = 0 the first stage's k is dt times the slopes, which is what a full step measures
+        if(l==0 && activeblocks.measure) measure_activity(ku,kv,1/dt,griddata);
+        // the implicit barrier above matters - every neighbour's slope must be in before u moves
+#pragma omp for
+        for(int i=0;i<Nx;i++)
         {
-            for(j=0; j<Ny; j++)
+            for(int j=0; j<Ny; j++)
             {
-                for(k=0; k<Nz; k++)   //Central difference
+                const int row = pt(i,j,0,griddata);
+                fieldvalue* s = &padA[padpt(i,j,0,griddata)];
+                for(int ks=0; ks<Nz; ks+=kseg)
                 {
-                    n = pt(i,j,k,griddata);
-
-                    iup = pt(gridinc(i,1,Nx,0),j,k,griddata);
-                    idown =pt(gridinc(i,-1,Nx,0),j,k,griddata);
-                    jup = pt(i,gridinc(j,1,Ny,1),k,griddata);
-                    jdown =pt(i,gridinc(j,-1,Ny,1),k,griddata);
-                    kup = pt(i,j,gridinc(k,1,Nz,2),griddata);
-                    kdown = pt(i,j,gridinc(k,-1,Nz,2),griddata);
-                    double currentu = u[n] + dtime*inc*ku[(l-1)*arraysize+n];
-                    double currentv = v[n] + dtime*inc*kv[(l-1)*arraysize+n];
-
-                    D2u = oneoverhsq*((u[iup]+dtime*inc*ku[(l-1)*arraysize+iup]) + (u[idown]+dtime*inc*ku[(l-1)*arraysize+idown]) +(u[jup]+dtime*inc*ku[(l-1)*arraysize+jup]) +(u[jdown]+dtime*inc*ku[(l-1)*arraysize+jdown]) + (u[kup]+dtime*inc*ku[(l-1)*arraysize+kup]) + (u[kdown]+dtime*inc*ku[(l-1)*arraysize+kdown])- 6.0*(currentu));
-
-
-                    ku[arraysize*l+n] = oneoverepsilon*(currentu - (ONETHIRD*currentu)*(currentu*currentu) - currentv) + D2u;
-                    kv[arraysize*l+n] = epsilon*(currentu + beta - gam*currentv);
+                    if(!block_active(i,j,ks)) continue;
+                    const int ksend = std::min(ks+kseg,Nz);
+                    if(l<4)
+                    {
+#pragma omp simd
+                        for(int k=ks; k<ksend; k++)
+                        {
+                            s[k] += Bl*ku[row+k];
+                            v[row+k] += Bl*kv[row+k];
+                        }
+                    }
+                    else
+                    {
+#pragma omp simd
+                        for(int k=ks; k<ksend; k++)
+                        {
+                            // the new u goes back into the padded grid as well, ready for the gradients
+                            s[k] += Bl*ku[row+k];
+                            u[row+k] = s[k];
+                            v[row+k] += Bl*kv[row+k];
+                        }
+                    }
                 }
             }
         }
+        if(l<4)
+        {
+#pragma omp single
+            {
+                fill_halo<BC>(padA,griddata);
+                halo_exchange_begin(padA,griddata);
+            }
+        }
     }
-#pragma omp for 
-    for(n=0;n<Nx*Ny*Nz;n++)
+    // the last stage left the new u in padA, so v goes into the otherwise unused padB and we have both padded
+    if(computegradients)
     {
-
-        u[n] = u[n] + dtime*sixth*(ku[n]+2*ku[arraysize+n]+2*ku[2*arraysize+n]+ku[3*arraysize+n]);
-        v[n] = v[n] + dtime*sixth*(kv[n]+2*kv[arraysize+n]+2*kv[2*arraysize+n]+kv[3*arraysize+n]);
+#pragma omp for
+        for(int i=0;i<Nx;i++)
+        {
+            for(int j=0; j<Ny; j++)
+            {
+                const int row = pt(i,j,0,griddata);
+                const int padrow = padpt(i,j,0,griddata);
+                for(int k=0; k<Nz; k++) padB[padrow+k] = v[row+k];
+            }
+        }
+#pragma omp single
+        {
+            fill_halo<BC>(padA,griddata);
+            fill_halo<BC>(padB,griddata);
+            halo_exchange_begin(padA,griddata);
+            halo_exchange_begin(padB,griddata);
+            halo_exchange_end();
+        }
+        crossgrad_from_padded(padA,padB,ucvx,ucvy,ucvz,ucvmag,griddata);
     }
-
+    if(activeblocks.measure) update_active_blocks<BC>(u,padB,griddata);
 }
 
 /*************************File reading and writing*****************************/
 
-int intersect3D_SegmentPlane( knotpoint SegmentStart, knotpoint SegmentEnd, knotpoint PlaneSegmentStart, knotpoint PlaneSegmentEnd, double& IntersectionFraction, std::vector<double>& IntersectionPoint )
+int intersect3D_SegmentPlane( const double SegmentStart[3], const double SegmentEnd[3], const double PlaneSegmentStart[3], const double PlaneSegmentEnd[3], double& IntersectionFraction, double IntersectionPoint[3] )
 {
-    double ux = SegmentEnd.xcoord - SegmentStart.xcoord ;
-    double uy = SegmentEnd.ycoord - SegmentStart.ycoord ;
-    double uz = SegmentEnd.zcoord - SegmentStart.zcoord ;
+    double ux = SegmentEnd[0] - SegmentStart[0] ;
+    double uy = SegmentEnd[1] - SegmentStart[1] ;
+    double uz = SegmentEnd[2] - SegmentStart[2] ;
 
-    double wx= SegmentStart.xcoord - PlaneSegmentStart.xcoord ;
-    double wy = SegmentStart.ycoord - PlaneSegmentStart.ycoord ;
-    double wz = SegmentStart.zcoord - PlaneSegmentStart.zcoord ;
+    double wx= SegmentStart[0] - PlaneSegmentStart[0] ;
+    double wy = SegmentStart[1] - PlaneSegmentStart[1] ;
+    double wz = SegmentStart[2] - PlaneSegmentStart[2] ;
 
-    double nx= PlaneSegmentEnd.xcoord  - PlaneSegmentStart.xcoord ;
-    double ny = PlaneSegmentEnd.ycoord  - PlaneSegmentStart.ycoord ;
-    double nz = PlaneSegmentEnd.zcoord  - PlaneSegmentStart.zcoord ;
+    double nx= PlaneSegmentEnd[0]  - PlaneSegmentStart[0] ;
+    double ny = PlaneSegmentEnd[1]  - PlaneSegmentStart[1] ;
+    double nz = PlaneSegmentEnd[2]  - PlaneSegmentStart[2] ;
 
     double D = nx*ux+ ny*uy + nz*uz;
     double N = - (nx*wx+ ny*wy + nz*wz);
@@ -1157,54 +1726,217 @@ int intersect3D_SegmentPlane( knotpoint SegmentStart, knotpoint SegmentEnd, knot
 
 
     IntersectionFraction = sI;
-    IntersectionPoint[0] = SegmentStart.xcoord + sI * ux;
-    IntersectionPoint[1] = SegmentStart.ycoord + sI * uy;
-    IntersectionPoint[2] = SegmentStart.zcoord + sI * uz;
+    IntersectionPoint[0] = SegmentStart[0] + sI * ux;
+    IntersectionPoint[1] = SegmentStart[1] + sI * uy;
+    IntersectionPoint[2] = SegmentStart[2] + sI * uz;
     return 1;
 }
 
-double my_f(const gsl_vector* minimum, void* params)
+void build_segment_grid(const knotcurve& curve, SegmentGrid& grid)
 {
-    struct parameters* myparameters = (struct parameters *) params;
-    likely::TriCubicInterpolator* interpolateducvmag = myparameters->ucvmag;
-    gsl_vector* tempf = gsl_vector_alloc (3);
-    gsl_vector* tempv = gsl_vector_alloc (3);
-    gsl_vector* tempb = gsl_vector_alloc (3);
-    gsl_vector_memcpy (tempf,myparameters->f);
-    gsl_vector_memcpy (tempv,myparameters->v);
-    gsl_vector_memcpy (tempb,myparameters->b);
-
-    // s gives us how much of f to add to p
-
-    gsl_vector_scale(tempf,gsl_vector_get (minimum, 0));
-    gsl_vector_scale(tempb,gsl_vector_get (minimum, 1));
-    gsl_vector_add(tempf,tempb);
-    gsl_vector_add(tempv,tempf);
-    double px = gsl_vector_get(tempv, 0);
-    double py = gsl_vector_get(tempv, 1);
-    double pz = gsl_vector_get(tempv, 2);
-    gsl_vector_free(tempf);
-    gsl_vector_free(tempv);
-    gsl_vector_free(tempb);
-
-    double value = -1*((*interpolateducvmag)(px,py,pz));
-    return value;
+    const knotpoints& points = curve.knotcurve;
+    const int NP = points.size();
+    vector<double> midpoints(3*NP);
+    double lower[3] = {0,0,0};
+    double upper[3] = {0,0,0};
+    double longest = 0;
+    for(int t=0;t<NP;t++)
+    {
+        const int next = (t+1)%NP;
+        midpoints[3*t] = 0.5*(points.xcoord[t] + points.xcoord[next]);
+        midpoints[3*t+1] = 0.5*(points.ycoord[t] + points.ycoord[next]);
+        midpoints[3*t+2] = 0.5*(points.zcoord[t] + points.zcoord[next]);
+        const double dx = points.xcoord[next] - points.xcoord[t];
+        const double dy = points.ycoord[next] - points.ycoord[t];
+        const double dz = points.zcoord[next] - points.zcoord[t];
+        longest = std::max(longest,sqrt(dx*dx + dy*dy + dz*dz));
+        for(int d=0;d<3;d++)
+        {
+            if(t==0 || midpoints[3*t+d] < lower[d]) lower[d] = midpoints[3*t+d];
+            if(t==0 || midpoints[3*t+d] > upper[d]) upper[d] = midpoints[3*t+d];
+        }
+    }
+
+    // the cells can be no smaller than the longest segment. past that, they grow until there are about as many cells as segments
+    grid.cellsize = (longest > 0) ? longest : 1;
+    long numcells;
+    do
+    {
+        numcells = 1;
+        for(int d=0;d<3;d++)
+        {
+            grid.dims[d] = (int)((upper[d]-lower[d])/grid.cellsize) + 1;
+            numcells *= grid.dims[d];
+        }
+        if(numcells > 2*NP + 1) grid.cellsize *= 1.25;
+    }
+    while(numcells > 2*NP + 1);
+    for(int d=0;d<3;d++) grid.origin[d] = lower[d];
+
+    // file the segments by cell, with a counting sort
+    vector<int> cell(NP);
+    grid.cellstart.assign(numcells+1,0);
+    for(int t=0;t<NP;t++)
+    {
+        int index[3];
+        for(int d=0;d<3;d++) index[d] = std::min(grid.dims[d]-1,(int)((midpoints[3*t+d]-grid.origin[d])/grid.cellsize));
+        cell[t] = (index[0]*grid.dims[1] + index[1])*grid.dims[2] + index[2];
+        grid.cellstart[cell[t]+1]++;
+    }
+    for(int n=0;n<numcells;n++) grid.cellstart[n+1] += grid.cellstart[n];
+    grid.segments.resize(NP);
+    vector<int> next(grid.cellstart.begin(),grid.cellstart.end()-1);
+    for(int t=0;t<NP;t++) grid.segments[next[cell[t]]++] = t;
 }
-void cross_product(const gsl_vector *u, const gsl_vector *v, gsl_vector *product)
-{
-    double p1 = gsl_vector_get(u, 1)*gsl_vector_get(v, 2)
-        - gsl_vector_get(u, 2)*gsl_vector_get(v, 1);
 
-    double p2 = gsl_vector_get(u, 2)*gsl_vector_get(v, 0)
-        - gsl_vector_get(u, 0)*gsl_vector_get(v, 2);
+bool closest_plane_intersection(const knotcurve& curve, const SegmentGrid& grid, const double PlaneSegmentStart[3], const double PlaneSegmentEnd[3], double maxdistance, double ClosestIntersection[3])
+{
+    const knotpoints& points = curve.knotcurve;
+    const int NP = points.size();
+    const double h = grid.cellsize;
+    const double* start = PlaneSegmentStart;
+    // the cell the point is in. it may well be off the grid
+    int centre[3];
+    int lastshell = 0;
+    for(int d=0;d<3;d++)
+    {
+        centre[d] = (int)floor((start[d]-grid.origin[d])/h);
+        lastshell = std::max(lastshell,std::max(abs(centre[d]),abs(grid.dims[d]-1-centre[d])));
+    }
 
-    double p3 = gsl_vector_get(u, 0)*gsl_vector_get(v, 1)
-        - gsl_vector_get(u, 1)*gsl_vector_get(v, 0);
+    double closestdistancesquare = maxdistance*maxdistance;
+    int closestsegment = -1;
+    double IntersectionFraction;
+    double IntersectionPoint[3];
+    for(int shell=0;shell<=lastshell;shell++)
+    {
+        // the cells of this shell are at least shell-1 cells from the point, and the segments filed there reach at most half a cell out
+        // of them. once that is further than the closest crossing so far, nothing further out can beat it
+        const double reach = (shell-1.5)*h;
+        if(reach > 0 && reach*reach >= closestdistancesquare) break;
+        for(int i=std::max(0,centre[0]-shell);i<=std::min(grid.dims[0]-1,centre[0]+shell);i++)
+        {
+            for(int j=std::max(0,centre[1]-shell);j<=std::min(grid.dims[1]-1,centre[1]+shell);j++)
+            {
+                // on the sides of the shell every k is in it, elsewhere only its top and bottom
+                const bool side = (abs(i-centre[0])==shell || abs(j-centre[1])==shell);
+                const int kstart = side ? std::max(0,centre[2]-shell) : centre[2]-shell;
+                const int kend = side ? std::min(grid.dims[2]-1,centre[2]+shell) : centre[2]+shell;
+                const int kstep = side ? 1 : 2*shell;
+                for(int k=kstart;k<=kend;k+=kstep)
+                {
+                    if(k<0 || k>=grid.dims[2]) continue;
+                    const int n = (i*grid.dims[1] + j)*grid.dims[2] + k;
+                    for(int m=grid.cellstart[n];m<grid.cellstart[n+1];m++)
+                    {
+                        const int t = grid.segments[m];
+                        const double SegmentStart[3] = {points.xcoord[t], points.ycoord[t], points.zcoord[t]};
+                        const double SegmentEnd[3] = {points.xcoord[(t+1)%NP], points.ycoord[(t+1)%NP], points.zcoord[(t+1)%NP]};
+                        if(intersect3D_SegmentPlane(SegmentStart,SegmentEnd,PlaneSegmentStart,PlaneSegmentEnd,IntersectionFraction,IntersectionPoint) == 1)
+                        {
+                            const double dx = IntersectionPoint[0] - start[0];
+                            const double dy = IntersectionPoint[1] - start[1];
+                            const double dz = IntersectionPoint[2] - start[2];
+                            const double intersectiondistancesquare = dx*dx + dy*dy + dz*dz;
+                            // ties go to the first segment along the curve, whichever order the cells are searched in
+                            if(intersectiondistancesquare < closestdistancesquare || (intersectiondistancesquare == closestdistancesquare && t < closestsegment))
+                            {
+                                closestdistancesquare = intersectiondistancesquare;
+                                closestsegment = t;
+                                ClosestIntersection[0] = IntersectionPoint[0];
+                                ClosestIntersection[1] = IntersectionPoint[1];
+                                ClosestIntersection[2] = IntersectionPoint[2];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return (closestsegment >= 0);
+}
 
-    gsl_vector_set(product, 0, p1);
-    gsl_vector_set(product, 1, p2);
-    gsl_vector_set(product, 2, p3);
+template <class DataCube> void maximise_in_plane(const likely::BasicTriCubicInterpolator<DataCube>& interpolator, const double v[3], const double f[3], const double b[3], double& alongf, double& alongb)
+{
+    // Newton's method for the maximum of the interpolated field g along v + alongf f + alongb b. the in plane gradient comes from the
+    // interpolators analytic gradient, the in plane Hessian from central differences of that gradient a small step either way along f and b.
+    // where the surface isn't locally concave we take a gradient ascent step instead, and either way a step is cut back until it goes uphill.
+    const double maxstep = lambda/(8*M_PI);     // the furthest we move in one step, the initial size of the old simplex
+    const double tolerance = 1e-3;              // converged once a step is shorter than this
+    const double e = 1e-3*interpolator.getSpacing();
+    const int maxiterations = 100;
+    alongf = 0;
+    alongb = 0;
+    double gradient[3];
+    typename likely::BasicTriCubicInterpolator<DataCube>::Cell cell;
+    for(int iter=0; iter<maxiterations; iter++)
+    {
+        double px = v[0] + alongf*f[0] + alongb*b[0];
+        double py = v[1] + alongf*f[1] + alongb*b[1];
+        double pz = v[2] + alongf*f[2] + alongb*b[2];
+        const double g = interpolator(px,py,pz,gradient,cell);
+        const double ga = gradient[0]*f[0] + gradient[1]*f[1] + gradient[2]*f[2];
+        const double gb = gradient[0]*b[0] + gradient[1]*b[1] + gradient[2]*b[2];
+        // the Hessian, from the changes in the in plane gradient across the point
+        double gaa, gab, gba, gbb;
+        interpolator(px + e*f[0],py + e*f[1],pz + e*f[2],gradient,cell);
+        gaa = gradient[0]*f[0] + gradient[1]*f[1] + gradient[2]*f[2];
+        gba = gradient[0]*b[0] + gradient[1]*b[1] + gradient[2]*b[2];
+        interpolator(px - e*f[0],py - e*f[1],pz - e*f[2],gradient,cell);
+        gaa = (gaa - (gradient[0]*f[0] + gradient[1]*f[1] + gradient[2]*f[2]))/(2*e);
+        gba = (gba - (gradient[0]*b[0] + gradient[1]*b[1] + gradient[2]*b[2]))/(2*e);
+        interpolator(px + e*b[0],py + e*b[1],pz + e*b[2],gradient,cell);
+        gab = gradient[0]*f[0] + gradient[1]*f[1] + gradient[2]*f[2];
+        gbb = gradient[0]*b[0] + gradient[1]*b[1] + gradient[2]*b[2];
+        interpolator(px - e*b[0],py - e*b[1],pz - e*b[2],gradient,cell);
+        gab = (gab - (gradient[0]*f[0] + gradient[1]*f[1] + gradient[2]*f[2]))/(2*e);
+        gbb = (gbb - (gradient[0]*b[0] + gradient[1]*b[1] + gradient[2]*b[2]))/(2*e);
+        gab = 0.5*(gab + gba);
+
+        double da, db;
+        const double det = gaa*gbb - gab*gab;
+        if(gaa < 0 && det > 0)
+        {
+            // solve H (da,db) = -(ga,gb)
+            da = -(gbb*ga - gab*gb)/det;
+            db = -(gaa*gb - gab*ga)/det;
+        }
+        else
+        {
+            const double gradnorm = sqrt(ga*ga + gb*gb);
+            if(gradnorm == 0) break;
+            da = maxstep*ga/gradnorm;
+            db = maxstep*gb/gradnorm;
+        }
+        double steplength = sqrt(da*da + db*db);
+        if(steplength > maxstep)
+        {
+            da *= maxstep/steplength;
+            db *= maxstep/steplength;
+            steplength = maxstep;
+        }
+        // backtrack until the step doesn't take us downhill
+        int halvings = 0;
+        while(halvings < 20)
+        {
+            px = v[0] + (alongf+da)*f[0] + (alongb+db)*b[0];
+            py = v[1] + (alongf+da)*f[1] + (alongb+db)*b[1];
+            pz = v[2] + (alongf+da)*f[2] + (alongb+db)*b[2];
+            if(interpolator(px,py,pz,cell) >= g) break;
+            da *= 0.5;
+            db *= 0.5;
+            steplength *= 0.5;
+            halvings++;
+        }
+        if(halvings == 20) break;   // nowhere uphill to go, we are at the maximum
+        alongf += da;
+        alongb += db;
+        if(steplength < tolerance) break;
+    }
 }
+// the magnitudes the curve tracing maximises, from the grid or the lean memory mode's cache
+template void maximise_in_plane<Field>(const likely::BasicTriCubicInterpolator<Field>& interpolator, const double v[3], const double f[3], const double b[3], double& alongf, double& alongb);
+template void maximise_in_plane<UcvCache>(const likely::BasicTriCubicInterpolator<UcvCache>& interpolator, const double v[3], const double f[3], const double b[3], double& alongf, double& alongb);
 void rotatedisplace(double& xcoord, double& ycoord, double& zcoord, const double theta, const double ux,const double uy,const double uz)
 {
 
@@ -1217,69 +1949,36 @@ void rotatedisplace(double& xcoord, double& ycoord, double& zcoord, const double
     zcoord = zprime;
 
 }
-int circularmod(int i, int N)    // mod i by N in a cirucler fashion, ie wrapping around both in the +ve and -ve directions
-{
-    if(i<0) return (N - ((-i)%N))%N;
-    else return i%N;
-}
-// inlined functions for incrementing things respecting boundaries
-int incp(int i, int p, int N)    //increment i with p for periodic boundary
-{
-    if(i+p<0) return (N+i+p);
-    else return ((i+p)%N);
-}
-
-int incw(int i, int p, int N)    //increment with reflecting boundary between -1 and 0 and N-1 and N
-{
-    if(i+p<0) return (-(i+p+1));
-    if(i+p>N-1) return (2*N-(i+p+1));
-    return (i+p);
-}
-
-int incabsorb(int i, int p, int N)    //increment with reflecting boundary between -1 and 0 and N-1 and N
+void gauss_integrand(const vector<double>& p, const vector<double>& a, const vector<double>& b, vector<double>& density)
 {
-    if(i+p<0) return (0);
-    if(i+p>N-1) return (N-1);
-    return (i+p);
-}
-// this function is specifically designed to incremenet, in the direction specified, respecting the boundary conditions, which are global enums
-int gridinc(int i, int p, int N, int direction )    //increment with reflecting boundary between -1 and 0 and N-1 and N
-{
-
-    if(BoundaryType == ALLREFLECTING)
-    {
-        return incw(i,p,N);
-    }
-
-    if(BoundaryType == ALLPERIODIC)
-    {
-        return incp(i,p,N);
-    }
-
-    if(BoundaryType == ZPERIODIC)
+    const int NP = density.size();
+    const double* px = &p[0]; const double* py = &p[NP]; const double* pz = &p[2*NP];
+    const double* bx = &b[0]; const double* by = &b[NP]; const double* bz = &b[2*NP];
+    // the rows are independent, so they go out as tasks. each row is a plain loop over the other points, split either side of the
+    // diagonal so it vectorises
+#pragma omp taskloop grainsize(64) default(none) shared(p,a,density,px,py,pz,bx,by,bz,NP)
+    for(int s=0; s<NP; s++)
     {
-        if(direction ==2) return incp(i,p,N);
-        else return incw(i,p,N);
+        const double x0 = px[s], y0 = py[s], z0 = pz[s];
+        const double ax = a[s], ay = a[NP+s], az = a[2*NP+s];
+        double sum = 0;
+        for(int half=0; half<2; half++)
+        {
+            const int mstart = (half==0) ? 0 : s+1;
+            const int mend = (half==0) ? s : NP;
+#pragma omp simd reduction(+:sum)
+            for(int m=mstart; m<mend; m++)
+            {
+                const double xdiff = x0 - px[m];
+                const double ydiff = y0 - py[m];
+                const double zdiff = z0 - pz[m];
+                const double dist2 = xdiff*xdiff + ydiff*ydiff + zdiff*zdiff;
+                sum += (xdiff*(ay*bz[m] - az*by[m]) + ydiff*(az*bx[m] - ax*bz[m]) + zdiff*(ax*by[m] - ay*bx[m]))/(dist2*sqrt(dist2));
+            }
+        }
+        density[s] = sum;
     }
-    return 0;
-}
-double x(int i,const Griddata& griddata)
-{
-    return (i+0.5-griddata.Nx/2.0)*griddata.h;
 }
-double y(int i,const Griddata& griddata)
-{
-    return (i+0.5-griddata.Ny/2.0)*griddata.h;
-}
-double z(int i,const Griddata& griddata)
-{
-    return (i+0.5-griddata.Nz/2.0)*griddata.h;
-}
-int pt( int i,  int j,  int k,const Griddata& griddata)       //convert i,j,k to single index
-{
-    return (i*griddata.Ny*griddata.Nz+j*griddata.Nz+k);
-}
-
 int coordstopt(double x, double y, double z, Griddata&griddata)
 {
     double h = griddata.h;
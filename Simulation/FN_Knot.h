@@ -1,4 +1,5 @@
 #include "FN_Constants.h"
+#include "Precision.h"
 #include "TriCubicInterpolator.h"
 #include <stdlib.h>
 #include <iostream>
@@ -9,8 +10,6 @@
 #include <math.h>
 #include <vector>
 #include <time.h>
-#include <gsl/gsl_multimin.h>
-#include <gsl/gsl_vector.h>
 using namespace std;
 
 #ifndef FNKNOT_H
@@ -21,12 +20,6 @@ struct Griddata
     int Nx,Ny,Nz;
     double h;
 };
-struct parameters
-{
-	gsl_vector *v,*f,*b;
-    likely::TriCubicInterpolator* ucvmag;
-    Griddata mygriddata;
-};
 
 struct viewpoint
 {
@@ -45,48 +38,73 @@ struct triangle
     double centre[3];  //centre position vector
 };
 
-struct knotpoint
-{
-    double xcoord;   //position vector x coord
-    double ycoord;   //position vector y coord
-    double zcoord;   //position vector z coord
-    double modxcoord;   //position vector x coord, modded out by the lattice
-    double modycoord;   //position vector y coord, ""
-    double modzcoord;   //position vector z coord, ""
-    double ax;       //grad vector x coord
-    double ay;       //grad vector y coord
-    double az;       //grad vector z coord
-    double tx;       //grad vector x coord
-    double ty;       //grad vector y coord
-    double tz;       //grad vector z coord
-    double nx;       //grad vector x coord
-    double ny;       //grad vector y coord
-    double nz;       //grad vector z coord
-    double bx;       //grad vector x coord
-    double by;       //grad vector y coord
-    double bz;       //grad vector z coord
-    double vx;       //grad vector x coord
-    double vy;       //grad vector y coord
-    double vz;       //grad vector z coord
-    double kappaNx;  //curvature vector x component
-    double kappaNy;  //curvature vector x component
-    double kappaNz;  //curvature vector x component
-    double vdotnx;       //grad vector x coord
-    double vdotny;       //grad vector x coord
-    double vdotnz;       //grad vector y coord
-    double vdotbx;       //grad vector x coord
-    double vdotby;       //grad vector x coord
-    double vdotbz;       //grad vector y coord
-    double curvature;        // curvature
-    double torsion;        // torsion
-    double twist;    //local twist value
-    double writhe;   //local writhe value
-    double length;   //length of line
+// the points of a curve. each quantity is kept for all the points together, point s being entry s of every array, so the loops along
+// the curve run through contiguous memory. resize, push_back and erase_front keep all the arrays the same length
+struct knotpoints
+{
+    std::vector<double> xcoord;   //position vector x coord
+    std::vector<double> ycoord;   //position vector y coord
+    std::vector<double> zcoord;   //position vector z coord
+    std::vector<double> modxcoord;   //position vector x coord, modded out by the lattice
+    std::vector<double> modycoord;   //position vector y coord, ""
+    std::vector<double> modzcoord;   //position vector z coord, ""
+    std::vector<double> ax;       //grad vector x coord
+    std::vector<double> ay;       //grad vector y coord
+    std::vector<double> az;       //grad vector z coord
+    std::vector<double> tx;       //grad vector x coord
+    std::vector<double> ty;       //grad vector y coord
+    std::vector<double> tz;       //grad vector z coord
+    std::vector<double> nx;       //grad vector x coord
+    std::vector<double> ny;       //grad vector y coord
+    std::vector<double> nz;       //grad vector z coord
+    std::vector<double> bx;       //grad vector x coord
+    std::vector<double> by;       //grad vector y coord
+    std::vector<double> bz;       //grad vector z coord
+    std::vector<double> vx;       //grad vector x coord
+    std::vector<double> vy;       //grad vector y coord
+    std::vector<double> vz;       //grad vector z coord
+    std::vector<double> kappaNx;  //curvature vector x component
+    std::vector<double> kappaNy;  //curvature vector x component
+    std::vector<double> kappaNz;  //curvature vector x component
+    std::vector<double> vdotnx;       //grad vector x coord
+    std::vector<double> vdotny;       //grad vector x coord
+    std::vector<double> vdotnz;       //grad vector y coord
+    std::vector<double> vdotbx;       //grad vector x coord
+    std::vector<double> vdotby;       //grad vector x coord
+    std::vector<double> vdotbz;       //grad vector y coord
+    std::vector<double> curvature;        // curvature
+    std::vector<double> torsion;        // torsion
+    std::vector<double> twist;    //local twist value
+    std::vector<double> writhe;   //local writhe value
+    std::vector<double> length;   //length of line
+
+    std::size_t size() const { return xcoord.size(); }
+    bool empty() const { return xcoord.empty(); }
+    // new points have everything zero
+    void resize(std::size_t n) { for_each_array([n](std::vector<double>& a){ a.resize(n,0); }); }
+    void push_back(double x, double y, double z)
+    {
+        resize(size()+1);
+        xcoord.back() = x;
+        ycoord.back() = y;
+        zcoord.back() = z;
+    }
+    // drop the first n points
+    void erase_front(std::size_t n) { for_each_array([n](std::vector<double>& a){ a.erase(a.begin(),a.begin()+n); }); }
+
+private:
+    template <class F> void for_each_array(const F& f)
+    {
+        f(xcoord); f(ycoord); f(zcoord); f(modxcoord); f(modycoord); f(modzcoord);
+        f(ax); f(ay); f(az); f(tx); f(ty); f(tz); f(nx); f(ny); f(nz); f(bx); f(by); f(bz); f(vx); f(vy); f(vz);
+        f(kappaNx); f(kappaNy); f(kappaNz); f(vdotnx); f(vdotny); f(vdotnz); f(vdotbx); f(vdotby); f(vdotbz);
+        f(curvature); f(torsion); f(twist); f(writhe); f(length);
+    }
 };
 
 struct knotcurve
 {
-    std::vector<knotpoint> knotcurve; // the actual data of the curve
+    knotpoints knotcurve; // the actual data of the curve
     // global data for the knot component
     double twist;    //total twist value
     double writhe;   //total  writhe value
@@ -96,6 +114,18 @@ struct knotcurve
     double zavgpos;
 };
 
+// a uniform grid over the segments of a curve, for finding the segments near a point without looking at all of them. segment t runs from
+// point t to point t+1, and is filed under the cell holding its midpoint. the cells are at least as big as the longest segment, so every
+// point of a segment lies within half a cell of where it is filed
+struct SegmentGrid
+{
+    double origin[3];
+    double cellsize;
+    int dims[3];
+    vector<int> cellstart;  // the segments in cell n are segments[cellstart[n]] to segments[cellstart[n+1]-1]
+    vector<int> segments;
+};
+
 struct Link
 {
     std::vector<knotcurve> Components;
@@ -106,23 +136,96 @@ struct Link
     double twist;
 };
 
+// what rank 0's analysis of the fields carries from one iteration to the next, and the iterations it does each part of it on
+struct AnalysisState
+{
+    vector<knotcurve> knotcurves;       // the knot as last traced
+    vector<knotcurve> knotcurvesold;    // as traced at the last velocity print, for the velocity at the next
+    viewpoint sensorpoint;              // the point u is logged at
+    int InitialSkipIteration;
+    int FrequentKnotplotPrintIteration;
+    int VelocityKnotplotPrintIteration;
+    int UVPrintIteration;
+    int CheckpointIteration;
+    int startiteration;
+};
+
+// grad u x grad v near the filaments, for the lean memory mode. see Gradients.h
+class UcvCache;
+
 /*************************General maths and integer functions*****************************/
 
-// little inline guys
-double x(int i, const Griddata &griddata);
-double y(int i, const Griddata &griddata);
-double z(int i, const Griddata &griddata);
+// little inline guys. these are defined here, rather than in FN_Knot.cpp, so every translation unit can fold them into its loops
 int sign(int i);
-int pt(int i,  int j,  int k, const Griddata &griddata);       //convert i,j,k to single index
 int coordstopt(double x, double y, double z, Griddata&griddata);
-int circularmod(int i, int N);    // mod i by N in a cirucler fashion, ie wrapping around both in the +ve and -ve directions
-int incp(int i, int p, int N);    //increment i with p for periodic boundary
-int incw(int i, int p, int N);    //increment with reflecting boundary between -1 and 0 and N-1 and N
-int gridinc(int i, int p, int N, int direction );    //increment with reflecting boundary between -1 and 0 and N-1 and N
+inline double x(int i,const Griddata& griddata)
+{
+    return (i+0.5-griddata.Nx/2.0)*griddata.h;
+}
+inline double y(int i,const Griddata& griddata)
+{
+    return (i+0.5-griddata.Ny/2.0)*griddata.h;
+}
+inline double z(int i,const Griddata& griddata)
+{
+    return (i+0.5-griddata.Nz/2.0)*griddata.h;
+}
+inline int pt( int i,  int j,  int k,const Griddata& griddata)       //convert i,j,k to single index
+{
+    return (i*griddata.Ny*griddata.Nz+j*griddata.Nz+k);
+}
+inline int circularmod(int i, int N)    // mod i by N in a cirucler fashion, ie wrapping around both in the +ve and -ve directions
+{
+    if(i<0) return (N - ((-i)%N))%N;
+    else return i%N;
+}
+// inlined functions for incrementing things respecting boundaries
+inline int incp(int i, int p, int N)    //increment i with p for periodic boundary
+{
+    if(i+p<0) return (N+i+p);
+    else return ((i+p)%N);
+}
+inline int incw(int i, int p, int N)    //increment with reflecting boundary between -1 and 0 and N-1 and N
+{
+    if(i+p<0) return (-(i+p+1));
+    if(i+p>N-1) return (2*N-(i+p+1));
+    return (i+p);
+}
+inline int incabsorb(int i, int p, int N)    //increment with reflecting boundary between -1 and 0 and N-1 and N
+{
+    if(i+p<0) return (0);
+    if(i+p>N-1) return (N-1);
+    return (i+p);
+}
+// this function is specifically designed to incremenet, in the direction specified, respecting the boundary condition BC.
+// as BC is a template parameter the branches below are resolved at compile time
+template <enum BoundaryType BC> inline int gridinc(int i, int p, int N, int direction )
+{
+    if(BC == ALLREFLECTING) return incw(i,p,N);
+    if(BC == ALLPERIODIC) return incp(i,p,N);
+    // ZPERIODIC
+    if(direction ==2) return incp(i,p,N);
+    else return incw(i,p,N);
+}
+// the same, for code which isnt specialised - respects the global BoundaryType
+inline int gridinc(int i, int p, int N, int direction )
+{
+    switch(BoundaryType)
+    {
+        case ALLREFLECTING: return gridinc<ALLREFLECTING>(i,p,N,direction);
+        case ZPERIODIC: return gridinc<ZPERIODIC>(i,p,N,direction);
+        case ALLPERIODIC: return gridinc<ALLPERIODIC>(i,p,N,direction);
+    }
+    return 0;
+}
 
-void cross_product(const gsl_vector *u, const gsl_vector *v, gsl_vector *product);
-double my_f(const gsl_vector* minimum, void* params);
+// find the maximum of the interpolated field in the plane through v spanned by the unit vectors f and b, nearest v. v + alongf f + alongb b is the maximum
+template <class DataCube> void maximise_in_plane(const likely::BasicTriCubicInterpolator<DataCube>& interpolator, const double v[3], const double f[3], const double b[3], double& alongf, double& alongb);
 void rotatedisplace(double& xcoord, double& ycoord, double& zcoord, const double theta, const double dispx,const double dispy,const double dispz);
+// the Gauss integrand of the writhe, for each of NP points summed over all of the others: density[s] = sum over m != s of
+// (p_s - p_m).(a_s x b_m)/|p_s - p_m|^3. p, a and b hold all the x's, then all the y's, then all the z's. the rows are shared out
+// as omp tasks, so call it from inside a single (or master) block of a parallel region to have them run in parallel
+void gauss_integrand(const vector<double>& p, const vector<double>& a, const vector<double>& b, vector<double>& density);
 
 
 /*************************Functions for B and Phi calcs*****************************/
@@ -132,16 +235,42 @@ void phi_calc_surface(vector<double>&phi, std::vector<triangle>& knotsurface, co
 void phi_calc_manual( vector<double>&phi,const Griddata& griddata);
 
 //FitzHugh Nagumo functions
-void uv_initialise(vector<double>&phi, vector<double>&u, vector<double>&v,const Griddata& griddata);
-void crossgrad_calc(vector<double>&u, vector<double>&v, vector<double>&ucvx, vector<double>&ucvy, vector<double>&ucvz, vector<double>&ucvmag, const Griddata &griddata);
-void find_knot_properties(vector<double>&ucvx, vector<double>&ucvy, vector<double>&ucvz, vector<double>& ucvmag, vector<double>&u, vector<knotcurve>& knotcurves, double t, gsl_multimin_fminimizer* minimizerstate, const Griddata &griddata);
+void uv_initialise(vector<double>&phi, Field& u, Field& v,const Griddata& griddata);
+void find_knot_properties(Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& u, vector<knotcurve>& knotcurves, double t, const Griddata &griddata);
+// the same, with grad u x grad v from a UcvCache (see Gradients.h) in place of the grids
+void find_knot_properties(const UcvCache& ucv, Field& u, vector<knotcurve>& knotcurves, double t, const Griddata &griddata);
+// find_knot_properties keeps the labels of the components from one trace to the next, by matching each trace's against the last. this
+// forgets the last, so the next trace is labelled afresh - for tracing a different run in the same process
+void reset_component_matching();
+// a component is only ever seeded from a point where |grad u x grad v| is at least this
+const double SeedThreshold = 0.45;
 void find_knot_velocity(const vector<knotcurve>& knotcurves, vector<knotcurve>& knotcurvesold, const Griddata &griddata, const double deltatime);
-void uv_update(vector<double>&u, vector<double>&v,  vector<double>&ku, vector<double>&kv, const Griddata &griddata);
+// the update and gradient kernels are templated on the boundary condition, so each one gets its own fully inlined loop.
+// padA and padB are ghost padded work grids (see Stencil.h). Pick the kernels for the run once, at startup, with the choose_ functions.
+// all of them are called by every thread of the parallel region in main, they share out the work with orphaned omp for loops.
+// if computegradients is set, the update also leaves grad u x grad v of the new u and v in the ucv grids, computed off the back of its last pass
+template <enum BoundaryType BC> void crossgrad_calc(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB, const Griddata &griddata);
+template <enum BoundaryType BC> void uv_update_rk4(Field& u, Field& v,  Field& ku, Field& kv, Field& padA, Field& padB, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata &griddata);    // ku,kv hold 3 grids
+template <enum BoundaryType BC> void uv_update_lowstorage_rk4(Field& u, Field& v,  Field& ku, Field& kv, Field& padA, Field& padB, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata &griddata);    // ku,kv hold 1 grid, padB is only used for the gradients
+typedef void (*crossgradfunction)(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Field& padA, Field& padB, const Griddata &griddata);
+typedef void (*uvupdatefunction)(Field& u, Field& v,  Field& ku, Field& kv, Field& padA, Field& padB, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata &griddata);
+crossgradfunction choose_crossgrad_calc(enum BoundaryType boundarytype);
+uvupdatefunction choose_uv_update(enum BoundaryType boundarytype, TimeStepperType timestepper);
+// grad u x grad v from u and v already in padded grids with their halos filled. an orphaned omp for, shared by crossgrad_calc and the updates
+void crossgrad_from_padded(const Field& padu, const Field& padv, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, const Griddata &griddata);
+// does iteration it print or trace anything which needs grad u x grad v. checkpoints dont, but they need the fields brought to rank 0 (or off the device) just the same
+bool gradients_needed(int it, int InitialSkipIteration, int FrequentKnotplotPrintIteration, int VelocityKnotplotPrintIteration, int UVPrintIteration, int CheckpointIteration);
+// everything rank 0 does with the fields of iteration it, at time t: tracing the knot, its velocity, the prints and the checkpoints.
+// from one thread, inside a single block of a parallel region. returns whether the knot was traced
+bool analyse_iteration(int it, double t, Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, AnalysisState& analysis, const Griddata &griddata);
+// a whole run, from reading the parameters named on the command line to the last of its output - the main of FN_Knot, and each job of
+// the ensemble (see Ensemble.cpp). 0 if it got to the end, 1 if it couldn't start
+int run_simulation(int argc, char** argv);
 // 3d geometry functions
-int intersect3D_SegmentPlane( knotpoint SegmentStart, knotpoint SegmentEnd, knotpoint PlaneSegmentStart, knotpoint PlaneSegmentEnd, double& IntersectionFraction, std::vector<double>& IntersectionPoint );
-
-// things for the grown function
-
-inline int incabsorb(int i, int p, int N);
+int intersect3D_SegmentPlane( const double SegmentStart[3], const double SegmentEnd[3], const double PlaneSegmentStart[3], const double PlaneSegmentEnd[3], double& IntersectionFraction, double IntersectionPoint[3] );
+void build_segment_grid(const knotcurve& curve, SegmentGrid& grid);
+// the nearest point to the start of the segment PlaneSegmentStart -> PlaneSegmentEnd at which the curve crosses the plane normal to that segment,
+// searching the cells of grid outwards from it. only crossings closer than maxdistance are looked for. returns false if there are none
+bool closest_plane_intersection(const knotcurve& curve, const SegmentGrid& grid, const double PlaneSegmentStart[3], const double PlaneSegmentEnd[3], double maxdistance, double ClosestIntersection[3]);
 
 #endif //FNKNOT_H
@@ -0,0 +1,234 @@
+#include "Gradients.h"
+#include "FN_Constants.h"
+#include <math.h>
+#include <algorithm>
+
+void UcvGrids::candidates(double threshold, vector<int>& found) const
+{
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+    // each x plane gets its own list, so joining them back up leaves the candidates in grid order
+    vector< vector<int> > planecandidates(Nx);
+#pragma omp taskloop grainsize(1) default(none) shared(planecandidates,threshold,Nx,Ny,Nz)
+    for(int i=0;i<Nx;i++)
+    {
+        for(int j=0; j<Ny; j++)
+        {
+            for(int k=0; k<Nz; k++)
+            {
+                int n = pt(i,j,k,griddata);
+                if(ucvmag[n] >= threshold) planecandidates[i].push_back(n);
+            }
+        }
+    }
+    found.clear();
+    for(int i=0;i<Nx;i++) found.insert(found.end(),planecandidates[i].begin(),planecandidates[i].end());
+}
+
+// the central differences of crossgrad_from_padded, with the neighbours the halos would have given
+template <enum BoundaryType BC> static inline void ucv_at_point(const Field& u, const Field& v, int i, int j, int k, const Griddata& griddata, fieldvalue ucv[4])
+{
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+    const double h = griddata.h;
+    const int xup = pt(gridinc<BC>(i,1,Nx,0),j,k,griddata);
+    const int xdown = pt(gridinc<BC>(i,-1,Nx,0),j,k,griddata);
+    const int yup = pt(i,gridinc<BC>(j,1,Ny,1),k,griddata);
+    const int ydown = pt(i,gridinc<BC>(j,-1,Ny,1),k,griddata);
+    const int zup = pt(i,j,gridinc<BC>(k,1,Nz,2),griddata);
+    const int zdown = pt(i,j,gridinc<BC>(k,-1,Nz,2),griddata);
+    const double dxu = 0.5*((double)u[xup]-u[xdown])/h;
+    const double dxv = 0.5*((double)v[xup]-v[xdown])/h;
+    const double dyu = 0.5*((double)u[yup]-u[ydown])/h;
+    const double dyv = 0.5*((double)v[yup]-v[ydown])/h;
+    const double dzu = 0.5*((double)u[zup]-u[zdown])/h;
+    const double dzv = 0.5*((double)v[zup]-v[zdown])/h;
+    ucv[0] = dyu*dzv - dzu*dyv;
+    ucv[1] = dzu*dxv - dxu*dzv;
+    ucv[2] = dxu*dyv - dyu*dxv;
+    ucv[3] = sqrt(ucv[0]*ucv[0] + ucv[1]*ucv[1] + ucv[2]*ucv[2]);
+}
+
+// the points of block b, in i, j and k
+static void block_range(int b, const int nb[3], const Griddata& griddata, int lower[3], int upper[3])
+{
+    lower[0] = (b/(nb[2]*nb[1]))*UcvBlockSize;
+    lower[1] = ((b/nb[2])%nb[1])*UcvBlockSize;
+    lower[2] = (b%nb[2])*UcvBlockSize;
+    upper[0] = std::min(lower[0]+UcvBlockSize,griddata.Nx);
+    upper[1] = std::min(lower[1]+UcvBlockSize,griddata.Ny);
+    upper[2] = std::min(lower[2]+UcvBlockSize,griddata.Nz);
+}
+
+// mark the blocks with a point at or above threshold
+template <enum BoundaryType BC> static void find_bright_blocks(const Field& u, const Field& v, const Griddata& griddata, const int nb[3], double threshold, vector<char>& bright)
+{
+    const int numblocks = bright.size();
+#pragma omp taskloop grainsize(16) default(none) shared(u,v,griddata,nb,threshold,bright,numblocks)
+    for(int b=0;b<numblocks;b++)
+    {
+        int lower[3], upper[3];
+        block_range(b,nb,griddata,lower,upper);
+        bool found = false;
+        for(int i=lower[0];i<upper[0] && !found;i++)
+        {
+            for(int j=lower[1];j<upper[1] && !found;j++)
+            {
+                for(int k=lower[2];k<upper[2] && !found;k++)
+                {
+                    fieldvalue ucv[4];
+                    ucv_at_point<BC>(u,v,i,j,k,griddata,ucv);
+                    found = (ucv[3] >= threshold);
+                }
+            }
+        }
+        bright[b] = found;
+    }
+}
+
+// fill in the kept blocks
+template <enum BoundaryType BC> static void fill_blocks(const Field& u, const Field& v, const Griddata& griddata, const int nb[3], const vector<int>& kept, const vector<int>& slot, Field& values)
+{
+    const int B3 = UcvBlockSize*UcvBlockSize*UcvBlockSize;
+    const int numkept = kept.size();
+#pragma omp taskloop grainsize(4) default(none) shared(u,v,griddata,nb,kept,slot,values,numkept,B3)
+    for(int q=0;q<numkept;q++)
+    {
+        const int b = kept[q];
+        int lower[3], upper[3];
+        block_range(b,nb,griddata,lower,upper);
+        fieldvalue* block = &values[slot[b]];
+        for(int i=lower[0];i<upper[0];i++)
+        {
+            for(int j=lower[1];j<upper[1];j++)
+            {
+                for(int k=lower[2];k<upper[2];k++)
+                {
+                    fieldvalue ucv[4];
+                    ucv_at_point<BC>(u,v,i,j,k,griddata,ucv);
+                    const int local = ((i-lower[0])*UcvBlockSize + (j-lower[1]))*UcvBlockSize + (k-lower[2]);
+                    for(int c=0;c<4;c++) block[c*B3 + local] = ucv[c];
+                }
+            }
+        }
+    }
+}
+
+UcvCache::UcvCache(const Field& u, const Field& v, const Griddata& griddata) : u(u), v(v), griddata(griddata)
+{
+    nb[0] = (griddata.Nx + UcvBlockSize - 1)/UcvBlockSize;
+    nb[1] = (griddata.Ny + UcvBlockSize - 1)/UcvBlockSize;
+    nb[2] = (griddata.Nz + UcvBlockSize - 1)/UcvBlockSize;
+    slot.assign(nb[0]*nb[1]*nb[2],-1);
+}
+
+void UcvCache::build(const vector<knotcurve>& knotcurves, double threshold)
+{
+    const int numblocks = slot.size();
+    vector<char> near(numblocks,0);
+    switch(BoundaryType)
+    {
+        case ALLREFLECTING: find_bright_blocks<ALLREFLECTING>(u,v,griddata,nb,threshold,near); break;
+        case ZPERIODIC: find_bright_blocks<ZPERIODIC>(u,v,griddata,nb,threshold,near); break;
+        case ALLPERIODIC: find_bright_blocks<ALLPERIODIC>(u,v,griddata,nb,threshold,near); break;
+    }
+    // the blocks the curves go through, found as trace_curve finds the grid point below a curve point
+    const int N[3] = {griddata.Nx,griddata.Ny,griddata.Nz};
+    for(unsigned int c=0;c<knotcurves.size();c++)
+    {
+        const knotpoints& Points = knotcurves[c].knotcurve;
+        for(unsigned int s=0;s<Points.size();s++)
+        {
+            const double coords[3] = {Points.xcoord[s],Points.ycoord[s],Points.zcoord[s]};
+            int block[3];
+            for(int d=0;d<3;d++) block[d] = circularmod((int)((coords[d]/griddata.h) - 0.5 + N[d]/2.0),N[d])/UcvBlockSize;
+            near[(block[0]*nb[1] + block[1])*nb[2] + block[2]] = 1;
+        }
+    }
+
+    // keep those and all their neighbours. as for the halos, only a periodic direction wraps round
+    const bool wrap[3] = {(BoundaryType == ALLPERIODIC), (BoundaryType == ALLPERIODIC), (BoundaryType == ALLPERIODIC || BoundaryType == ZPERIODIC)};
+    vector<int> kept;
+    const int B3 = UcvBlockSize*UcvBlockSize*UcvBlockSize;
+    for(int b=0;b<numblocks;b++)
+    {
+        const int centre[3] = {b/(nb[2]*nb[1]), (b/nb[2])%nb[1], b%nb[2]};
+        bool keep = false;
+        for(int d=0;d<27 && !keep;d++)
+        {
+            int neighbour[3] = {centre[0] + d/9 - 1, centre[1] + (d/3)%3 - 1, centre[2] + d%3 - 1};
+            bool inside = true;
+            for(int e=0;e<3;e++)
+            {
+                if(neighbour[e] < 0 || neighbour[e] >= nb[e])
+                {
+                    if(wrap[e]) neighbour[e] = (neighbour[e] + nb[e])%nb[e];
+                    else inside = false;
+                }
+            }
+            if(inside) keep = near[(neighbour[0]*nb[1] + neighbour[1])*nb[2] + neighbour[2]];
+        }
+        slot[b] = keep ? 4*B3*kept.size() : -1;
+        if(keep) kept.push_back(b);
+    }
+    values.resize(4*B3*kept.size());
+    switch(BoundaryType)
+    {
+        case ALLREFLECTING: fill_blocks<ALLREFLECTING>(u,v,griddata,nb,kept,slot,values); break;
+        case ZPERIODIC: fill_blocks<ZPERIODIC>(u,v,griddata,nb,kept,slot,values); break;
+        case ALLPERIODIC: fill_blocks<ALLPERIODIC>(u,v,griddata,nb,kept,slot,values); break;
+    }
+}
+
+double UcvCache::value(int n, int component) const
+{
+    const int i = n/(griddata.Ny*griddata.Nz);
+    const int j = (n/griddata.Nz)%griddata.Ny;
+    const int k = n%griddata.Nz;
+    const int b = ((i/UcvBlockSize)*nb[1] + j/UcvBlockSize)*nb[2] + k/UcvBlockSize;
+    if(slot[b] >= 0)
+    {
+        const int local = ((i%UcvBlockSize)*UcvBlockSize + j%UcvBlockSize)*UcvBlockSize + k%UcvBlockSize;
+        return values[slot[b] + component*UcvBlockSize*UcvBlockSize*UcvBlockSize + local];
+    }
+    fieldvalue ucv[4];
+    switch(BoundaryType)
+    {
+        case ALLREFLECTING: ucv_at_point<ALLREFLECTING>(u,v,i,j,k,griddata,ucv); break;
+        case ZPERIODIC: ucv_at_point<ZPERIODIC>(u,v,i,j,k,griddata,ucv); break;
+        case ALLPERIODIC: ucv_at_point<ALLPERIODIC>(u,v,i,j,k,griddata,ucv); break;
+    }
+    return ucv[component];
+}
+
+void UcvCache::candidates(double threshold, vector<int>& found) const
+{
+    const int numblocks = slot.size();
+    const int B3 = UcvBlockSize*UcvBlockSize*UcvBlockSize;
+    // each block gets its own list, and they are put in grid order afterwards - the blocks cut across the rows
+    vector< vector<int> > blockcandidates(numblocks);
+#pragma omp taskloop grainsize(16) default(none) shared(blockcandidates,threshold,numblocks,B3)
+    for(int b=0;b<numblocks;b++)
+    {
+        if(slot[b] < 0) continue;
+        int lower[3], upper[3];
+        block_range(b,nb,griddata,lower,upper);
+        const fieldvalue* mag = &values[slot[b] + 3*B3];
+        for(int i=lower[0];i<upper[0];i++)
+        {
+            for(int j=lower[1];j<upper[1];j++)
+            {
+                for(int k=lower[2];k<upper[2];k++)
+                {
+                    const int local = ((i-lower[0])*UcvBlockSize + (j-lower[1]))*UcvBlockSize + (k-lower[2]);
+                    if(mag[local] >= threshold) blockcandidates[b].push_back(pt(i,j,k,griddata));
+                }
+            }
+        }
+    }
+    found.clear();
+    for(int b=0;b<numblocks;b++) found.insert(found.end(),blockcandidates[b].begin(),blockcandidates[b].end());
+    sort(found.begin(),found.end());
+}
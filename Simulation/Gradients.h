@@ -0,0 +1,64 @@
+#include "FN_Knot.h"
+using namespace std;
+
+#ifndef GRADIENTS_H
+#define GRADIENTS_H
+
+/* grad u x grad v, as the curve tracing and the uv prints read it. there are two kinds, and the code reading them is templated on which.
+   both give the components x, y, z and the magnitude mag at grid point n, find the points where mag is at or above a threshold, and hand
+   the magnitudes to the tricubic interpolator as magnitudes(), which is a Magnitudes */
+
+// the four whole grids, as the update and crossgrad_calc leave them
+struct UcvGrids
+{
+    typedef Field Magnitudes;
+    UcvGrids(const Field& ucvx, const Field& ucvy, const Field& ucvz, const Field& ucvmag, const Griddata& griddata) : ucvx(ucvx), ucvy(ucvy), ucvz(ucvz), ucvmag(ucvmag), griddata(griddata) {}
+    double x(int n) const { return ucvx[n]; }
+    double y(int n) const { return ucvy[n]; }
+    double z(int n) const { return ucvz[n]; }
+    double mag(int n) const { return ucvmag[n]; }
+    const Field& magnitudes() const { return ucvmag; }
+    // the points where mag is at least threshold, in grid order. from inside a single block, the search goes out as tasks
+    void candidates(double threshold, vector<int>& found) const;
+    const Field& ucvx;
+    const Field& ucvy;
+    const Field& ucvz;
+    const Field& ucvmag;
+    const Griddata& griddata;
+};
+
+/* the lean memory mode (INSERT_LEAN_MEMORY), where there are no ucv grids. grad u x grad v is worked out from u and v when rank 0 has
+   analysis to do, and only kept for the blocks of the grid near the filaments - the blocks with a point at or above the threshold it is
+   built with, and those the curves it is given (the knot as last traced) go through, along with all the blocks round them. anywhere else
+   it is worked out point by point, whenever it is asked for, so it is never wrong, only slower. the values are exactly the ones
+   crossgrad_calc would have put in the grids */
+const int UcvBlockSize = 8;
+
+class UcvCache
+{
+public:
+    typedef UcvCache Magnitudes;
+    // u and v have to stay where they are for as long as the cache is used
+    UcvCache(const Field& u, const Field& v, const Griddata& griddata);
+    // work out the blocks to keep, and fill them. from inside a single block, the work goes out as tasks
+    void build(const vector<knotcurve>& knotcurves, double threshold);
+    double x(int n) const { return value(n,0); }
+    double y(int n) const { return value(n,1); }
+    double z(int n) const { return value(n,2); }
+    double mag(int n) const { return value(n,3); }
+    // the magnitude, for the tricubic interpolator
+    double operator[](int n) const { return value(n,3); }
+    const UcvCache& magnitudes() const { return *this; }
+    // as for UcvGrids. only the cached blocks are searched, so threshold should be no lower than the one the cache was built with
+    void candidates(double threshold, vector<int>& found) const;
+private:
+    double value(int n, int component) const;
+    const Field& u;
+    const Field& v;
+    Griddata griddata;
+    int nb[3];              // the number of blocks in i, j and k
+    vector<int> slot;       // where each block starts in values, or -1 if it isn't kept. indexed by (bi*nb[1] + bj)*nb[2] + bk
+    Field values;           // x, y, z and mag of each point of the kept blocks, a block at a time, a component at a time within it
+};
+
+#endif //GRADIENTS_H
@@ -0,0 +1,215 @@
+#include "Hdf5Output.h"
+#include "FN_Constants.h"
+
+#ifdef USE_HDF5
+#include <hdf5.h>
+#include <algorithm>
+
+static const char* hdf5filename = "uv_fields.h5";
+static const char* fieldnames[3] = {"u","v","ucrossv"};
+
+// what the XDMF file needs to know about each print in the file
+struct XdmfEntry
+{
+    string group;
+    string suffix;      // which series it is part of, the end of the group name from the _ on
+    double time;
+    int dims[3];        // x, y, z
+    double origin[3];
+    double spacing;
+};
+static bool entry_earlier(const XdmfEntry& a, const XdmfEntry& b) { return a.time < b.time; }
+
+static hid_t hdf5file = -1;
+static vector<XdmfEntry> xdmfentries;
+
+static void write_attribute(hid_t location, const char* name, const double* values, hsize_t n)
+{
+    hid_t space = H5Screate_simple(1,&n,NULL);
+    hid_t attribute = H5Acreate(location,name,H5T_IEEE_F64LE,space,H5P_DEFAULT,H5P_DEFAULT);
+    H5Awrite(attribute,H5T_NATIVE_DOUBLE,values);
+    H5Aclose(attribute);
+    H5Sclose(space);
+}
+
+static bool read_attribute(hid_t location, const char* name, double* values)
+{
+    if(H5Aexists(location,name) <= 0) return false;
+    hid_t attribute = H5Aopen(location,name,H5P_DEFAULT);
+    const bool ok = (H5Aread(attribute,H5T_NATIVE_DOUBLE,values) >= 0);
+    H5Aclose(attribute);
+    return ok;
+}
+
+// H5Literate callback, picking up the prints a previous run left in the file
+static herr_t collect_entry(hid_t location, const char* name, const H5L_info_t* info, void* data)
+{
+    vector<XdmfEntry>& entries = *(vector<XdmfEntry>*)data;
+    hid_t group = H5Gopen(location,name,H5P_DEFAULT);
+    if(group < 0) return 0;
+    XdmfEntry entry;
+    entry.group = name;
+    const size_t underscore = entry.group.find('_');
+    if(underscore != string::npos) entry.suffix = entry.group.substr(underscore);
+    bool ok = read_attribute(group,"time",&entry.time) && read_attribute(group,"origin",entry.origin) && read_attribute(group,"spacing",&entry.spacing);
+    if(ok && H5Lexists(group,fieldnames[0],H5P_DEFAULT) > 0)
+    {
+        hid_t dataset = H5Dopen(group,fieldnames[0],H5P_DEFAULT);
+        hid_t space = H5Dget_space(dataset);
+        hsize_t dims[3];
+        ok = (H5Sget_simple_extent_ndims(space) == 3);
+        if(ok)
+        {
+            H5Sget_simple_extent_dims(space,dims,NULL);
+            // the datasets are stored z, y, x
+            entry.dims[0] = dims[2];
+            entry.dims[1] = dims[1];
+            entry.dims[2] = dims[0];
+        }
+        H5Sclose(space);
+        H5Dclose(dataset);
+    }
+    else ok = false;
+    H5Gclose(group);
+    if(ok) entries.push_back(entry);
+    return 0;
+}
+
+static int open_file()
+{
+    // keep adding to the file if it is already there, as it will be on a restart
+    H5E_BEGIN_TRY
+    {
+        hdf5file = H5Fopen(hdf5filename,H5F_ACC_RDWR,H5P_DEFAULT);
+    }
+    H5E_END_TRY;
+    if(hdf5file >= 0)
+    {
+        H5Literate(hdf5file,H5_INDEX_NAME,H5_ITER_NATIVE,NULL,collect_entry,&xdmfentries);
+    }
+    else
+    {
+        hdf5file = H5Fcreate(hdf5filename,H5F_ACC_TRUNC,H5P_DEFAULT,H5P_DEFAULT);
+    }
+    if(hdf5file < 0)
+    {
+        cout << "Couldn't open " << hdf5filename << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+// rewritten after every print, so it always describes everything in its series
+static void write_xdmf(const string& suffix)
+{
+    std::sort(xdmfentries.begin(),xdmfentries.end(),entry_earlier);
+    const string xdmffilename = "uv_fields" + suffix + ".xmf";
+    ofstream xdmfout (xdmffilename.c_str());
+    xdmfout << "<?xml version=\"1.0\" ?>\n<!DOCTYPE Xdmf SYSTEM \"Xdmf.dtd\" []>\n<Xdmf Version=\"2.0\">\n <Domain>\n";
+    xdmfout << "  <Grid Name=\"UV fields\" GridType=\"Collection\" CollectionType=\"Temporal\">\n";
+    for(unsigned int n=0;n<xdmfentries.size();n++)
+    {
+        const XdmfEntry& entry = xdmfentries[n];
+        if(entry.suffix != suffix) continue;
+        // XDMF lists everything slowest index first, so z, y, x
+        stringstream dims;
+        dims << entry.dims[2] << ' ' << entry.dims[1] << ' ' << entry.dims[0];
+        xdmfout << "   <Grid Name=\"" << entry.group << "\" GridType=\"Uniform\">\n";
+        xdmfout << "    <Time Value=\"" << entry.time << "\"/>\n";
+        xdmfout << "    <Topology TopologyType=\"3DCoRectMesh\" Dimensions=\"" << dims.str() << "\"/>\n";
+        xdmfout << "    <Geometry GeometryType=\"ORIGIN_DXDYDZ\">\n";
+        xdmfout << "     <DataItem Dimensions=\"3\" NumberType=\"Float\" Precision=\"8\" Format=\"XML\">" << entry.origin[2] << ' ' << entry.origin[1] << ' ' << entry.origin[0] << "</DataItem>\n";
+        xdmfout << "     <DataItem Dimensions=\"3\" NumberType=\"Float\" Precision=\"8\" Format=\"XML\">" << entry.spacing << ' ' << entry.spacing << ' ' << entry.spacing << "</DataItem>\n";
+        xdmfout << "    </Geometry>\n";
+        for(int field=0;field<3;field++)
+        {
+            xdmfout << "    <Attribute Name=\"" << fieldnames[field] << "\" AttributeType=\"Scalar\" Center=\"Node\">\n";
+            xdmfout << "     <DataItem Dimensions=\"" << dims.str() << "\" NumberType=\"Float\" Precision=\"4\" Format=\"HDF\">" << hdf5filename << ":/" << entry.group << '/' << fieldnames[field] << "</DataItem>\n";
+            xdmfout << "    </Attribute>\n";
+        }
+        xdmfout << "   </Grid>\n";
+    }
+    xdmfout << "  </Grid>\n </Domain>\n</Xdmf>\n";
+    xdmfout.close();
+}
+
+int hdf5_write_uv(const float* data, const string& suffix, double t, const int dims[3], const double origin[3], double spacing)
+{
+    if(hdf5file < 0 && open_file()) return 1;
+
+    const int Nx = dims[0];
+    const int Ny = dims[1];
+    const int Nz = dims[2];
+    XdmfEntry entry;
+    stringstream ss;
+    ss << "t" << t << suffix;
+    entry.group = ss.str();
+    entry.suffix = suffix;
+    entry.time = t;
+    for(int d=0;d<3;d++)
+    {
+        entry.dims[d] = dims[d];
+        entry.origin[d] = origin[d];
+    }
+    entry.spacing = spacing;
+
+    // a restart repeats the print of the time it starts from, the new one replaces the old
+    if(H5Lexists(hdf5file,entry.group.c_str(),H5P_DEFAULT) > 0)
+    {
+        H5Ldelete(hdf5file,entry.group.c_str(),H5P_DEFAULT);
+        for(unsigned int n=0;n<xdmfentries.size();n++) if(xdmfentries[n].group == entry.group) { xdmfentries.erase(xdmfentries.begin()+n); break; }
+    }
+    hid_t group = H5Gcreate(hdf5file,entry.group.c_str(),H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
+    if(group < 0)
+    {
+        cout << "Couldn't add " << entry.group << " to " << hdf5filename << "\n";
+        return 1;
+    }
+    write_attribute(group,"time",&entry.time,1);
+    write_attribute(group,"origin",entry.origin,3);
+    write_attribute(group,"spacing",&entry.spacing,1);
+
+    // chunks of whole z planes, about 4MB of them
+    const hsize_t filedims[3] = {(hsize_t)Nz,(hsize_t)Ny,(hsize_t)Nx};
+    const hsize_t chunk[3] = {(hsize_t)std::max(1,std::min(Nz,(1<<20)/(Nx*Ny))),(hsize_t)Ny,(hsize_t)Nx};
+    hid_t space = H5Screate_simple(3,filedims,NULL);
+    hid_t properties = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(properties,3,chunk);
+    if(HDF5Digits >= 0) H5Pset_scaleoffset(properties,H5Z_SO_FLOAT_DSCALE,HDF5Digits);
+    if(HDF5Compression > 0)
+    {
+        H5Pset_shuffle(properties);
+        H5Pset_deflate(properties,HDF5Compression);
+    }
+    const size_t blocksize = (size_t)Nx*Ny*Nz;
+    int status = 0;
+    for(int field=0;field<3;field++)
+    {
+        hid_t dataset = H5Dcreate(group,fieldnames[field],H5T_IEEE_F32LE,space,H5P_DEFAULT,properties,H5P_DEFAULT);
+        if(dataset < 0 || H5Dwrite(dataset,H5T_NATIVE_FLOAT,H5S_ALL,H5S_ALL,H5P_DEFAULT,data + field*blocksize) < 0) status = 1;
+        if(dataset >= 0) H5Dclose(dataset);
+    }
+    H5Pclose(properties);
+    H5Sclose(space);
+    H5Gclose(group);
+    // so the file can be looked at while the run carries on
+    H5Fflush(hdf5file,H5F_SCOPE_GLOBAL);
+    if(status)
+    {
+        cout << "Couldn't write " << entry.group << " to " << hdf5filename << "\n";
+        return 1;
+    }
+
+    xdmfentries.push_back(entry);
+    write_xdmf(suffix);
+    return 0;
+}
+
+void hdf5_close()
+{
+    if(hdf5file >= 0) H5Fclose(hdf5file);
+    hdf5file = -1;
+    xdmfentries.clear();
+}
+
+#endif
@@ -0,0 +1,24 @@
+#include "FN_Knot.h"
+using namespace std;
+
+#ifndef HDF5OUTPUT_H
+#define HDF5OUTPUT_H
+
+/* the HDF5 backend for the uv output. built with -DUSE_HDF5 (make hdf5), and picked at runtime with INSERT_UV_FORMAT=HDF5_FILE, every
+   uv print goes into the one file uv_fields.h5, as a group t<time> holding u, v and ucrossv. they are chunked float datasets, in the same
+   x fastest order as the vtk files, shuffled and deflated (INSERT_HDF5_COMPRESSION), and optionally rounded to a fixed number of decimal
+   places first by HDF5's scale-offset filter (INSERT_HDF5_DIGITS) - lossy, but with the error kept below a unit in the last place kept.
+   uv_fields.xmf describes the whole series as an XDMF temporal collection, so ParaView can open it directly. a restarted run adds its
+   prints to the same file. with MPI the fields are gathered to rank 0 and written from there, as for the vtk files.
+   the region of interest output (INSERT_ROI_MARGIN) writes two series, t<time>_coarse and t<time>_roi, each with its own XDMF file.
+   without USE_HDF5 none of this is compiled in. */
+
+#ifdef USE_HDF5
+// write one print, as part of the series named by suffix ("" for whole grid prints). data holds u, v and ucvmag one after another, each
+// dims[0]*dims[1]*dims[2] floats with x fastest, on points spacing apart starting from origin. returns 0 on success
+int hdf5_write_uv(const float* data, const string& suffix, double t, const int dims[3], const double origin[3], double spacing);
+// close the file at the end of the run
+void hdf5_close();
+#endif
+
+#endif //HDF5OUTPUT_H
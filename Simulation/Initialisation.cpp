@@ -1,6 +1,7 @@
 #include "Initialisation.h"
 #include "FN_Constants.h"
 #include "ReadingWriting.h"
+#include "Treecode.h"
 #include <math.h>
 #include <string.h>
 
@@ -20,13 +21,10 @@ void InitialiseFromFile(Link& Curve)
     double minyin = 0;
     double minzin = 0;
 
+    // each component is read in whole, and its lines parsed in parallel, a point from each
     for(int i=0;i<Curve.NumComponents;i++)
     {
         stringstream ss;
-        string buff,filename;
-
-        ss.clear();
-        ss.str("");
         if (Curve.NumComponents==1)
         {
             ss << knot_filename << ".txt";
@@ -36,26 +34,23 @@ void InitialiseFromFile(Link& Curve)
             ss << knot_filename <<"_"<< i <<  ".txt";
         }
 
-        filename = ss.str();
-        ifstream CurveInputStream;   //knot file(s)
-        CurveInputStream.open(filename.c_str());
-        while(CurveInputStream.good())   //read in points for knot
+        string contents;
+        vector<const char*> lines;
+        if(read_file(ss.str(),contents)) split_lines(contents,lines);
+        knotpoints& Points = Curve.Components[i].knotcurve;
+        Points.resize(lines.size());
+        const int NP = lines.size();
+#pragma omp parallel for default(none) shared(lines,Points,NP) reduction(max:maxxin,maxyin,maxzin) reduction(min:minxin,minyin,minzin)
+        for(int s=0; s<NP; s++)
         {
-            double xcoord,ycoord,zcoord;    //temporary variables
-            if(getline(CurveInputStream,buff))
-            {
-                ss.clear();
-                ss.str("");
-                ss << buff;
-                ss >> xcoord >> ycoord >> zcoord;
-            }
-            else break;
-            // construct a point and put it on the curve
-            knotpoint Point;
-            Point.xcoord = xcoord;
-            Point.ycoord = ycoord;
-            Point.zcoord = zcoord;
-            Curve.Components[i].knotcurve.push_back(Point);
+            char* end;
+            const double xcoord = strtod(lines[s],&end);
+            const double ycoord = strtod(end,&end);
+            const double zcoord = strtod(end,&end);
+            // put the point on the curve
+            Points.xcoord[s] = xcoord;
+            Points.ycoord[s] = ycoord;
+            Points.zcoord[s] = zcoord;
             // track max and min input values
             if(xcoord>maxxin) maxxin = xcoord;
             if(ycoord>maxyin) maxyin = ycoord;
@@ -64,9 +59,8 @@ void InitialiseFromFile(Link& Curve)
             if(ycoord<minyin) minyin = ycoord;
             if(zcoord<minzin) minzin = zcoord;
         }
-        CurveInputStream.close();
         // keep track of how many total points are added to the link
-        Curve.NumPoints += Curve.Components[i].knotcurve.size();
+        Curve.NumPoints += Points.size();
     }
 
     // now centre and scale to a standard size
@@ -80,9 +74,9 @@ void InitialiseFromFile(Link& Curve)
     {
         for(int s=0; s<Curve.Components[i].knotcurve.size(); s++)
         {
-            Curve.Components[i].knotcurve[s].xcoord = scale[0]*(Curve.Components[i].knotcurve[s].xcoord - midpoint[0]);
-            Curve.Components[i].knotcurve[s].ycoord = scale[1]*(Curve.Components[i].knotcurve[s].ycoord - midpoint[1]);
-            Curve.Components[i].knotcurve[s].zcoord = scale[2]*(Curve.Components[i].knotcurve[s].zcoord - midpoint[2]);
+            Curve.Components[i].knotcurve.xcoord[s] = scale[0]*(Curve.Components[i].knotcurve.xcoord[s] - midpoint[0]);
+            Curve.Components[i].knotcurve.ycoord[s] = scale[1]*(Curve.Components[i].knotcurve.ycoord[s] - midpoint[1]);
+            Curve.Components[i].knotcurve.zcoord[s] = scale[2]*(Curve.Components[i].knotcurve.zcoord[s] - midpoint[2]);
         }
     }
     // basic geometry
@@ -109,11 +103,11 @@ void ComputeLengths(Link& Curve)
         int NP = Curve.Components[i].knotcurve.size();
         for(int s=0; s<NP; s++)
         {
-            double dx = (Curve.Components[i].knotcurve[incp(s,1,NP)].xcoord - Curve.Components[i].knotcurve[s].xcoord);
-            double dy = (Curve.Components[i].knotcurve[incp(s,1,NP)].ycoord - Curve.Components[i].knotcurve[s].ycoord);
-            double dz = (Curve.Components[i].knotcurve[incp(s,1,NP)].zcoord - Curve.Components[i].knotcurve[s].zcoord);
+            double dx = (Curve.Components[i].knotcurve.xcoord[incp(s,1,NP)] - Curve.Components[i].knotcurve.xcoord[s]);
+            double dy = (Curve.Components[i].knotcurve.ycoord[incp(s,1,NP)] - Curve.Components[i].knotcurve.ycoord[s]);
+            double dz = (Curve.Components[i].knotcurve.zcoord[incp(s,1,NP)] - Curve.Components[i].knotcurve.zcoord[s]);
             double deltas = sqrt(dx*dx+dy*dy+dz*dz);
-            Curve.Components[i].knotcurve[s].length = deltas;
+            Curve.Components[i].knotcurve.length[s] = deltas;
             Curve.Components[i].length += deltas;
         }
     }
@@ -127,11 +121,11 @@ void ComputeTangent(Link& Curve)
         int NP = Curve.Components[i].knotcurve.size();
         for(int s=0; s<NP; s++)        // central difference scheme
         {
-            double dsp = Curve.Components[i].knotcurve[s].length;
-            double dsm = Curve.Components[i].knotcurve[incp(s,-1,NP)].length;
-            Curve.Components[i].knotcurve[s].tx = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,1,NP)].xcoord + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve[s].xcoord - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,-1,NP)].xcoord;
-            Curve.Components[i].knotcurve[s].ty = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,1,NP)].ycoord + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve[s].ycoord - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,-1,NP)].ycoord;
-            Curve.Components[i].knotcurve[s].tz = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,1,NP)].zcoord + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve[s].zcoord - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,-1,NP)].zcoord;
+            double dsp = Curve.Components[i].knotcurve.length[s];
+            double dsm = Curve.Components[i].knotcurve.length[incp(s,-1,NP)];
+            Curve.Components[i].knotcurve.tx[s] = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve.xcoord[incp(s,1,NP)] + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve.xcoord[s] - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve.xcoord[incp(s,-1,NP)];
+            Curve.Components[i].knotcurve.ty[s] = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve.ycoord[incp(s,1,NP)] + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve.ycoord[s] - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve.ycoord[incp(s,-1,NP)];
+            Curve.Components[i].knotcurve.tz[s] = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve.zcoord[incp(s,1,NP)] + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve.zcoord[s] - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve.zcoord[incp(s,-1,NP)];
         }
     }
 }
@@ -144,16 +138,16 @@ void ComputeKappaN(Link& Curve)
         int NP = Curve.Components[i].knotcurve.size();
         for(int s=0; s<NP; s++)    // central difference scheme
         {
-            double dsp = Curve.Components[i].knotcurve[s].length;
-            double dsm = Curve.Components[i].knotcurve[incp(s,-1,NP)].length;
-            double kappaNx = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,1,NP)].tx + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve[s].tx - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,-1,NP)].tx;
-            double kappaNy = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,1,NP)].ty + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve[s].ty - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,-1,NP)].ty;
-            double kappaNz = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,1,NP)].tz + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve[s].tz - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve[incp(s,-1,NP)].tz;
-            Curve.Components[i].knotcurve[s].kappaNx = kappaNx;
-            Curve.Components[i].knotcurve[s].kappaNy = kappaNy;
-            Curve.Components[i].knotcurve[s].kappaNz = kappaNz;
+            double dsp = Curve.Components[i].knotcurve.length[s];
+            double dsm = Curve.Components[i].knotcurve.length[incp(s,-1,NP)];
+            double kappaNx = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve.tx[incp(s,1,NP)] + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve.tx[s] - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve.tx[incp(s,-1,NP)];
+            double kappaNy = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve.ty[incp(s,1,NP)] + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve.ty[s] - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve.ty[incp(s,-1,NP)];
+            double kappaNz = (dsm/(dsp*(dsp+dsm)))*Curve.Components[i].knotcurve.tz[incp(s,1,NP)] + ((dsp-dsm)/(dsp*dsm))*Curve.Components[i].knotcurve.tz[s] - (dsp/(dsm*(dsp+dsm)))*Curve.Components[i].knotcurve.tz[incp(s,-1,NP)];
+            Curve.Components[i].knotcurve.kappaNx[s] = kappaNx;
+            Curve.Components[i].knotcurve.kappaNy[s] = kappaNy;
+            Curve.Components[i].knotcurve.kappaNz[s] = kappaNz;
             // no longer need this -- could remove
-            Curve.Components[i].knotcurve[s].curvature = sqrt(kappaNx*kappaNx + kappaNy*kappaNy + kappaNz*kappaNz);
+            Curve.Components[i].knotcurve.curvature[s] = sqrt(kappaNx*kappaNx + kappaNy*kappaNy + kappaNz*kappaNz);
         }
     }
 }
@@ -171,24 +165,17 @@ void RefineCurve(Link& Curve)
         int NP = Curve.Components[i].knotcurve.size();
         for (int s=0; s<NP; s++) // run over the points of each component
         {
-            knotpoint Point;
             // keep old point
-            Point.xcoord = Curve.Components[i].knotcurve[s].xcoord;
-            Point.ycoord = Curve.Components[i].knotcurve[s].ycoord;
-            Point.zcoord = Curve.Components[i].knotcurve[s].zcoord;
-            NewCurve.Components[i].knotcurve.push_back(Point);
+            NewCurve.Components[i].knotcurve.push_back(Curve.Components[i].knotcurve.xcoord[s],Curve.Components[i].knotcurve.ycoord[s],Curve.Components[i].knotcurve.zcoord[s]);
             // create new point
-            double ds = 0.5*Curve.Components[i].knotcurve[s].length;
-            double x1 = Curve.Components[i].knotcurve[s].xcoord + ds*Curve.Components[i].knotcurve[s].tx + 0.5*ds*ds*Curve.Components[i].knotcurve[s].kappaNx;
-            double x2 = Curve.Components[i].knotcurve[incp(s,1,NP)].xcoord - ds*Curve.Components[i].knotcurve[incp(s,1,NP)].tx + 0.5*ds*ds*Curve.Components[i].knotcurve[incp(s,1,NP)].kappaNx;
-            Point.xcoord = 0.5*(x1+x2);
-            double y1 = Curve.Components[i].knotcurve[s].ycoord + ds*Curve.Components[i].knotcurve[s].ty + 0.5*ds*ds*Curve.Components[i].knotcurve[s].kappaNy;
-            double y2 = Curve.Components[i].knotcurve[incp(s,1,NP)].ycoord - ds*Curve.Components[i].knotcurve[incp(s,1,NP)].ty + 0.5*ds*ds*Curve.Components[i].knotcurve[incp(s,1,NP)].kappaNy;
-            Point.ycoord = 0.5*(y1+y2);
-            double z1 = Curve.Components[i].knotcurve[s].zcoord + ds*Curve.Components[i].knotcurve[s].tz + 0.5*ds*ds*Curve.Components[i].knotcurve[s].kappaNz;
-            double z2 = Curve.Components[i].knotcurve[incp(s,1,NP)].zcoord - ds*Curve.Components[i].knotcurve[incp(s,1,NP)].tz + 0.5*ds*ds*Curve.Components[i].knotcurve[incp(s,1,NP)].kappaNz;
-            Point.zcoord = 0.5*(z1+z2);
-            NewCurve.Components[i].knotcurve.push_back(Point);
+            double ds = 0.5*Curve.Components[i].knotcurve.length[s];
+            double x1 = Curve.Components[i].knotcurve.xcoord[s] + ds*Curve.Components[i].knotcurve.tx[s] + 0.5*ds*ds*Curve.Components[i].knotcurve.kappaNx[s];
+            double x2 = Curve.Components[i].knotcurve.xcoord[incp(s,1,NP)] - ds*Curve.Components[i].knotcurve.tx[incp(s,1,NP)] + 0.5*ds*ds*Curve.Components[i].knotcurve.kappaNx[incp(s,1,NP)];
+            double y1 = Curve.Components[i].knotcurve.ycoord[s] + ds*Curve.Components[i].knotcurve.ty[s] + 0.5*ds*ds*Curve.Components[i].knotcurve.kappaNy[s];
+            double y2 = Curve.Components[i].knotcurve.ycoord[incp(s,1,NP)] - ds*Curve.Components[i].knotcurve.ty[incp(s,1,NP)] + 0.5*ds*ds*Curve.Components[i].knotcurve.kappaNy[incp(s,1,NP)];
+            double z1 = Curve.Components[i].knotcurve.zcoord[s] + ds*Curve.Components[i].knotcurve.tz[s] + 0.5*ds*ds*Curve.Components[i].knotcurve.kappaNz[s];
+            double z2 = Curve.Components[i].knotcurve.zcoord[incp(s,1,NP)] - ds*Curve.Components[i].knotcurve.tz[incp(s,1,NP)] + 0.5*ds*ds*Curve.Components[i].knotcurve.kappaNz[incp(s,1,NP)];
+            NewCurve.Components[i].knotcurve.push_back(0.5*(x1+x2),0.5*(y1+y2),0.5*(z1+z2));
         }
         NewCurve.NumPoints += NewCurve.Components[i].knotcurve.size();
     }
@@ -200,34 +187,27 @@ void ComputeWrithe(Link& Curve)
 {
     for(int i=0; i<Curve.NumComponents; i++)
     {
-        double Wr = 0.0;
         int NP = Curve.Components[i].knotcurve.size();
-
-        for (int s=0; s<NP; s++) // running over the knot
+        // the trapezium rule weighted tangents. summing each pair both ways round double counts the integral
+        vector<double> points(3*NP), tangents(3*NP), density(NP);
+        for (int s=0; s<NP; s++)
         {
-            double a1x = Curve.Components[i].knotcurve[s].xcoord;
-            double a1y = Curve.Components[i].knotcurve[s].ycoord;
-            double a1z = Curve.Components[i].knotcurve[s].zcoord;
-            double t1x = Curve.Components[i].knotcurve[s].tx;
-            double t1y = Curve.Components[i].knotcurve[s].ty;
-            double t1z = Curve.Components[i].knotcurve[s].tz;
-            double ds = 0.5*(Curve.Components[i].knotcurve[s].length+Curve.Components[i].knotcurve[incp(s,-1,NP)].length);
-
-            for (int t=s+1; t<NP; t++) // run over all points ahead of s
-            {
-                double a2x = Curve.Components[i].knotcurve[t].xcoord;
-                double a2y = Curve.Components[i].knotcurve[t].ycoord;
-                double a2z = Curve.Components[i].knotcurve[t].zcoord;
-                double t2x = Curve.Components[i].knotcurve[t].tx;
-                double t2y = Curve.Components[i].knotcurve[t].ty;
-                double t2z = Curve.Components[i].knotcurve[t].tz;
-                double dt = 0.5*(Curve.Components[i].knotcurve[t].length+Curve.Components[i].knotcurve[incp(t,-1,NP)].length);
-
-                double dist = sqrt((a1x-a2x)*(a1x-a2x)+(a1y-a2y)*(a1y-a2y)+(a1z-a2z)*(a1z-a2z));
-                Wr += ds*dt*((a1x-a2x)*(t1y*t2z-t1z*t2y)+(a1y-a2y)*(t1z*t2x-t1x*t2z)+(a1z-a2z)*(t1x*t2y-t1y*t2x))/(dist*dist*dist);
-            }
+            double ds = 0.5*(Curve.Components[i].knotcurve.length[s]+Curve.Components[i].knotcurve.length[incp(s,-1,NP)]);
+            points[s] = Curve.Components[i].knotcurve.xcoord[s];
+            points[NP+s] = Curve.Components[i].knotcurve.ycoord[s];
+            points[2*NP+s] = Curve.Components[i].knotcurve.zcoord[s];
+            tangents[s] = ds*Curve.Components[i].knotcurve.tx[s];
+            tangents[NP+s] = ds*Curve.Components[i].knotcurve.ty[s];
+            tangents[2*NP+s] = ds*Curve.Components[i].knotcurve.tz[s];
         }
-        Wr /= 2.0*M_PI;
+#pragma omp parallel default(none) shared(points,tangents,density)
+        {
+#pragma omp single
+            gauss_integrand(points,tangents,tangents,density);
+        }
+        double Wr = 0.0;
+        for (int s=0; s<NP; s++) Wr += density[s];
+        Wr /= 4.0*M_PI;
         Curve.Components[i].writhe=Wr;
     }
 }
@@ -254,9 +234,9 @@ double SolidAngleCalc(const Link& Curve, const viewpoint& View)
         for (int s=0; s<NP; s++)
         {
             // define the view vector -- n = (Curve - View)/|Curve - View|
-            double viewx = Curve.Components[i].knotcurve[s].xcoord - View.xcoord;
-            double viewy = Curve.Components[i].knotcurve[s].ycoord - View.ycoord;
-            double viewz = Curve.Components[i].knotcurve[s].zcoord - View.zcoord;
+            double viewx = Curve.Components[i].knotcurve.xcoord[s] - View.xcoord;
+            double viewy = Curve.Components[i].knotcurve.ycoord[s] - View.ycoord;
+            double viewz = Curve.Components[i].knotcurve.zcoord[s] - View.zcoord;
             double dist = sqrt(viewx*viewx + viewy*viewy + viewz*viewz);
             double ndotninfty = viewz*ninftyz/dist;
             if (ndotninfty<ndotnmin) {ndotnmin = ndotninfty; smin = s;}
@@ -268,8 +248,8 @@ double SolidAngleCalc(const Link& Curve, const viewpoint& View)
             else                                       // unless another threshold is exceeded -- value can be changed
             {
                 ninftyz = 0.0;
-                ninftyx = Curve.Components[i].knotcurve[smin].ty;    // set an orthogonal direction -- not guaranteed to be a good choice
-                ninftyy = -Curve.Components[i].knotcurve[smin].tx;
+                ninftyx = Curve.Components[i].knotcurve.ty[smin];    // set an orthogonal direction -- not guaranteed to be a good choice
+                ninftyy = -Curve.Components[i].knotcurve.tx[smin];
                 double norm = sqrt(ninftyx*ninftyx + ninftyy*ninftyy);
                 ninftyx /= norm;
                 ninftyy /= norm;
@@ -281,16 +261,16 @@ double SolidAngleCalc(const Link& Curve, const viewpoint& View)
         for (int s=0; s<NP; s++)
         {
             // define the view vector -- n = (Curve - View)/|Curve - View|
-            double viewx = Curve.Components[i].knotcurve[s].xcoord - View.xcoord;
-            double viewy = Curve.Components[i].knotcurve[s].ycoord - View.ycoord;
-            double viewz = Curve.Components[i].knotcurve[s].zcoord - View.zcoord;
+            double viewx = Curve.Components[i].knotcurve.xcoord[s] - View.xcoord;
+            double viewy = Curve.Components[i].knotcurve.ycoord[s] - View.ycoord;
+            double viewz = Curve.Components[i].knotcurve.zcoord[s] - View.zcoord;
             double dist = sqrt(viewx*viewx + viewy*viewy + viewz*viewz);
             double ndotninfty = viewx*ninftyx + viewy*ninftyy + viewz*ninftyz;
-            double tx = Curve.Components[i].knotcurve[s].tx;
-            double ty = Curve.Components[i].knotcurve[s].ty;
-            double tz = Curve.Components[i].knotcurve[s].tz;
+            double tx = Curve.Components[i].knotcurve.tx[s];
+            double ty = Curve.Components[i].knotcurve.ty[s];
+            double tz = Curve.Components[i].knotcurve.tz[s];
             // trapezium rule quadrature
-            double ds = 0.5*(Curve.Components[i].knotcurve[s].length+Curve.Components[i].knotcurve[incp(s,-1,NP)].length);
+            double ds = 0.5*(Curve.Components[i].knotcurve.length[s]+Curve.Components[i].knotcurve.length[incp(s,-1,NP)]);
             // and here's the integrand
             Integral += (ds/dist)*(ninftyz*(ty*viewx-tx*viewy)+ninftyx*(tz*viewy-ty*viewz)+ninftyy*(tx*viewz-tz*viewx))/(dist + ndotninfty);
         }
@@ -300,13 +280,61 @@ double SolidAngleCalc(const Link& Curve, const viewpoint& View)
     return totalomega;
 }
 
+// SolidAngleCalc, with the sums over each component done by the treecode
+double SolidAngleCalc(const Link& Curve, const vector<SourceTree>& trees, const viewpoint& View)
+{
+    double totalomega = 0;
+    const double view[3] = {View.xcoord, View.ycoord, View.zcoord};
+    for(int i=0; i<Curve.NumComponents; i++)
+    {
+        // the same choice of asymptotic direction as SolidAngleCalc. the tree only has to find the extremes of n.ninfty past the thresholds
+        int smin,smax;
+        double ninfty[3] = {0.0, 0.0, 1.0};
+        if (View.zcoord>0) {ninfty[2] = -1.0;}
+        double ndotnmin = min_z_cosine(trees[i],view,ninfty[2],-0.98,smin);
+        if (ndotnmin < -0.98)
+        {
+            double ndotnmax = -min_z_cosine(trees[i],view,-ninfty[2],-0.98,smax);
+            if (ndotnmax < 0.98) {ninfty[2] = -ninfty[2];}
+            else
+            {
+                ninfty[2] = 0.0;
+                ninfty[0] = Curve.Components[i].knotcurve.ty[smin];    // set an orthogonal direction -- not guaranteed to be a good choice
+                ninfty[1] = -Curve.Components[i].knotcurve.tx[smin];
+                double norm = sqrt(ninfty[0]*ninfty[0] + ninfty[1]*ninfty[1]);
+                ninfty[0] /= norm;
+                ninfty[1] /= norm;
+            }
+        }
+        totalomega += curve_sum(trees[i],view,ninfty,SolidAngleTolerance);
+    }
+    return totalomega;
+}
+
 void phi_calc_curve(vector<double>& phi, const Link& Curve, const Griddata& griddata)
 {
     int Nx = griddata.Nx;
     int Ny = griddata.Ny;
     int Nz = griddata.Nz;
 
-#pragma omp parallel default(none) shared(phi,Curve,griddata,Nx,Ny,Nz)
+    // with a tolerance, put each component in a tree, its sources the points weighted by the trapezium rule ds times the tangent
+    const bool usetree = (SolidAngleTolerance > 0);
+    vector<SourceTree> trees(usetree ? Curve.NumComponents : 0);
+    for(int i=0; i<trees.size(); i++)
+    {
+        int NP = Curve.Components[i].knotcurve.size();
+        vector<double> p(3*NP), w(3*NP);
+        for (int s=0; s<NP; s++)
+        {
+            const knotpoints& Points = Curve.Components[i].knotcurve;
+            double ds = 0.5*(Points.length[s]+Points.length[incp(s,-1,NP)]);
+            p[3*s] = Points.xcoord[s]; p[3*s+1] = Points.ycoord[s]; p[3*s+2] = Points.zcoord[s];
+            w[3*s] = ds*Points.tx[s]; w[3*s+1] = ds*Points.ty[s]; w[3*s+2] = ds*Points.tz[s];
+        }
+        build_tree(trees[i],p,w);
+    }
+
+#pragma omp parallel default(none) shared(phi,Curve,griddata,Nx,Ny,Nz,trees,usetree)
     {
         double SolidAngle;
         viewpoint Point;
@@ -323,7 +351,7 @@ void phi_calc_curve(vector<double>& phi, const Link& Curve, const Griddata& grid
                     Point.zcoord = z(k,griddata);
                     int n = pt(i,j,k,griddata);
 
-                    SolidAngle = SolidAngleCalc(Curve,Point);
+                    SolidAngle = usetree ? SolidAngleCalc(Curve,trees,Point) : SolidAngleCalc(Curve,Point);
                     // put in the interval [0,4pi]
                     while(SolidAngle>4*M_PI) SolidAngle -= 4*M_PI;
                     while(SolidAngle<0) SolidAngle += 4*M_PI;
@@ -345,7 +373,23 @@ void phi_calc_surface(vector<double>&phi,vector<triangle>& knotsurface, const Gr
     int i,j,k,n,s;
     double rx,ry,rz,r;
     cout << "Calculating scalar potential...\n";
-#pragma omp parallel default(none) shared (Nx,Ny,Nz,griddata, knotsurface, phi ) private ( i, j, k, n, s, rx, ry, rz , r)
+    // with a tolerance, put the triangles in a tree, their sources the centres weighted by the area times the normal
+    const bool usetree = (SolidAngleTolerance > 0);
+    SourceTree tree;
+    if(usetree)
+    {
+        vector<double> p(3*knotsurface.size()), w(3*knotsurface.size());
+        for(s=0;s<knotsurface.size();s++)
+        {
+            for(int d=0;d<3;d++)
+            {
+                p[3*s+d] = knotsurface[s].centre[d];
+                w[3*s+d] = knotsurface[s].area*knotsurface[s].normal[d];
+            }
+        }
+        build_tree(tree,p,w);
+    }
+#pragma omp parallel default(none) shared (Nx,Ny,Nz,griddata, knotsurface, phi, tree, usetree, SolidAngleTolerance) private ( i, j, k, n, s, rx, ry, rz , r)
     {
 #pragma omp for
         for(i=0;i<Nx;i++)
@@ -356,13 +400,21 @@ void phi_calc_surface(vector<double>&phi,vector<triangle>& knotsurface, const Gr
                 {
                     n = pt(i,j,k,griddata);
                     phi[n] = 0;
-                    for(s=0;s<knotsurface.size();s++)
+                    if(usetree)
                     {
-                        rx = knotsurface[s].centre[0]-x(i,griddata);
-                        ry = knotsurface[s].centre[1]-y(j,griddata);
-                        rz = knotsurface[s].centre[2]-z(k,griddata);
-                        r = sqrt(rx*rx+ry*ry+rz*rz);
-                        if(r>0) phi[n] += (rx*knotsurface[s].normal[0] + ry*knotsurface[s].normal[1] + rz*knotsurface[s].normal[2])*knotsurface[s].area/(2*r*r*r);
+                        const double view[3] = {x(i,griddata), y(j,griddata), z(k,griddata)};
+                        phi[n] = 0.5*dipole_sum(tree,view,SolidAngleTolerance);
+                    }
+                    else
+                    {
+                        for(s=0;s<knotsurface.size();s++)
+                        {
+                            rx = knotsurface[s].centre[0]-x(i,griddata);
+                            ry = knotsurface[s].centre[1]-y(j,griddata);
+                            rz = knotsurface[s].centre[2]-z(k,griddata);
+                            r = sqrt(rx*rx+ry*ry+rz*rz);
+                            if(r>0) phi[n] += (rx*knotsurface[s].normal[0] + ry*knotsurface[s].normal[1] + rz*knotsurface[s].normal[2])*knotsurface[s].area/(2*r*r*r);
+                        }
                     }
                     while(phi[n]>M_PI) phi[n] -= 2*M_PI;
                     while(phi[n]<-M_PI) phi[n] += 2*M_PI;
@@ -398,16 +450,50 @@ void phi_calc_manual(vector<double>&phi,const Griddata& griddata)
     print_B_phi(phi,griddata);
 }
 
+// the vertices and normal of a triangle as read in, and its centre
+static void set_triangle(triangle& facet, const double normal[3], const double vertices[9])
+{
+    facet.centre[0] = 0;
+    facet.centre[1] = 0;
+    facet.centre[2] = 0;
+    for(int j=0;j<3;j++)
+    {
+        facet.normal[j] = normal[j];
+        facet.xvertex[j] = vertices[3*j];
+        facet.yvertex[j] = vertices[3*j+1];
+        facet.zvertex[j] = vertices[3*j+2];
+        facet.centre[0] += facet.xvertex[j]/3.0;
+        facet.centre[1] += facet.yvertex[j]/3.0;
+        facet.centre[2] += facet.zvertex[j]/3.0;
+    }
+}
+
+// a binary stl file is an 80 byte header, the number of triangles, and 50 bytes for each: the normal and the three vertices as little
+// endian floats, and two bytes of attributes. we take it as one if it is exactly that size
+static bool is_binary_stl(const string& contents, unsigned int& numtriangles)
+{
+    if(contents.size() < 84) return false;
+    const unsigned char* count = (const unsigned char*)&contents[80];
+    numtriangles = count[0] | (count[1] << 8) | (count[2] << 16) | ((unsigned int)count[3] << 24);
+    return contents.size() == 84 + 50*(size_t)numtriangles;
+}
+
+static float littleendianfloat(const char* bytes)
+{
+    const unsigned char* b = (const unsigned char*)bytes;
+    const unsigned int bits = b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+    float value;
+    memcpy(&value,&bits,sizeof(float));
+    return value;
+}
+
 double init_from_surface_file(vector<triangle>& knotsurface)
 {
-    string filename, buff;
     stringstream ss;
     double A = 0;   //total area
-    int i=0;
+    int i;
     int j;
-    double r10,r20,r21,s,xcoord,ycoord,zcoord;
-    string temp;
-    ifstream knotin;
+    double r10,r20,r21,s;
     /*  For recording max and min input values*/
     double maxxin = 0;
     double maxyin = 0;
@@ -420,60 +506,58 @@ double init_from_surface_file(vector<triangle>& knotsurface)
     ss.str("");
     ss << knot_filename << ".stl";
 
-    filename = ss.str();
-    knotin.open(filename.c_str());
-    if(knotin.good())
+    // the file is read in whole and the triangles parsed in parallel, from either kind of stl file
+    string contents;
+    if(!read_file(ss.str(),contents)) cout << "Error reading file\n";
+    unsigned int numtriangles;
+    vector<const char*> lines;
+    const bool binary = is_binary_stl(contents,numtriangles);
+    if(!binary)
     {
-        if(getline(knotin,buff)) temp = buff;
+        // the name of the solid, then seven lines a triangle: facet normal, outer loop, three vertices, endloop and endfacet
+        split_lines(contents,lines);
+        numtriangles = 0;
+        while(1 + 7*(size_t)numtriangles + 4 < lines.size())
+        {
+            const char* facet = lines[1 + 7*numtriangles];
+            while(isspace(*facet)) facet++;
+            if(strncmp(facet,"endsolid",8) == 0) break;
+            numtriangles++;
+        }
     }
-    else cout << "Error reading file\n";
-    while(knotin.good())   //read in points for knot
+    const int T = numtriangles;
+    knotsurface.resize(T);
+#pragma omp parallel for default(none) shared(knotsurface,contents,lines,binary,T) reduction(max:maxxin,maxyin,maxzin) reduction(min:minxin,minyin,minzin)
+    for(int t=0; t<T; t++)
     {
-        if(getline(knotin,buff))  //read in surface normal
+        double normal[3], vertices[9];
+        if(binary)
         {
-            ss.clear();
-            ss.str("");
-            ss << buff;
-            ss >> temp;
-            if(temp.compare("endsolid") == 0) break;
-            knotsurface.push_back(triangle());
-            ss >> temp >> knotsurface[i].normal[0] >> knotsurface[i].normal[1] >> knotsurface[i].normal[2];
+            const char* record = &contents[84 + 50*(size_t)t];
+            for(int d=0;d<3;d++) normal[d] = littleendianfloat(record + 4*d);
+            for(int d=0;d<9;d++) vertices[d] = littleendianfloat(record + 12 + 4*d);
         }
-
-        if(getline(knotin,buff)) temp = buff;   //read in "outer loop"
-        knotsurface[i].centre[0] = 0;
-        knotsurface[i].centre[1] = 0;
-        knotsurface[i].centre[2] = 0;
-        for(j=0;j<3;j++)
+        else
         {
-            if(getline(knotin,buff))  //read in vertices
+            char* end;
+            const char* text = skip_words(lines[1 + 7*t],2);
+            for(int d=0;d<3;d++) { normal[d] = strtod(text,&end); text = end; }
+            for(int v=0;v<3;v++)
             {
-                ss.clear();
-                ss.str("");
-                ss << buff;
-                ss >> temp >> xcoord >> ycoord >> zcoord;
-
-                if(xcoord>maxxin) maxxin = xcoord;
-                if(ycoord>maxyin) maxyin = ycoord;
-                if(zcoord>maxzin) maxzin = zcoord;
-                if(xcoord<minxin) minxin = xcoord;
-                if(ycoord<minyin) minyin = ycoord;
-                if(zcoord<minzin) minzin = zcoord;
-
-                knotsurface[i].xvertex[j] = xcoord;
-                knotsurface[i].yvertex[j] = ycoord;
-                knotsurface[i].zvertex[j] = zcoord;
-                knotsurface[i].centre[0] += knotsurface[i].xvertex[j]/3.0;
-                knotsurface[i].centre[1] += knotsurface[i].yvertex[j]/3.0;
-                knotsurface[i].centre[2] += knotsurface[i].zvertex[j]/3.0;
+                text = skip_words(lines[3 + 7*t + v],1);
+                for(int d=0;d<3;d++) { vertices[3*v+d] = strtod(text,&end); text = end; }
             }
         }
-        //cout << i << " (" << knotsurface[i].centre[0] << ',' << knotsurface[i].centre[1] << ',' << knotsurface[i].centre[2] << ") , (" << knotsurface[i].normal[0] << ',' << knotsurface[i].normal[1] << ',' << knotsurface[i].normal[2] << ") \n";
-
-        if(getline(knotin,buff)) temp = buff;   //read in "outer loop"
-        if(getline(knotin,buff)) temp = buff;   //read in "outer loop"
-
-        i++;
+        set_triangle(knotsurface[t],normal,vertices);
+        for(int v=0;v<3;v++)
+        {
+            if(vertices[3*v]>maxxin) maxxin = vertices[3*v];
+            if(vertices[3*v+1]>maxyin) maxyin = vertices[3*v+1];
+            if(vertices[3*v+2]>maxzin) maxzin = vertices[3*v+2];
+            if(vertices[3*v]<minxin) minxin = vertices[3*v];
+            if(vertices[3*v+1]<minyin) minyin = vertices[3*v+1];
+            if(vertices[3*v+2]<minzin) minzin = vertices[3*v+2];
+        }
     }
 
 
@@ -534,22 +618,23 @@ void scalefunction(double *scale, double *midpoint, double maxxin, double minxin
     midpoint[0] = 0.5*(maxxin+minxin);
     midpoint[1] = 0.5*(maxyin+minyin);
     midpoint[2] = 0.5*(maxzin+minzin);
-#if PRESERVE_RATIOS
-    double minscale=1000000000;
-    int imin=3;
-    for(int i = 0;i<3;i++)   //find minimum scale factor
+    if(PreserveRatios)
     {
-        if(scale[i] < minscale && nonzeroheight[i])
+        double minscale=1000000000;
+        int imin=3;
+        for(int i = 0;i<3;i++)   //find minimum scale factor
+        {
+            if(scale[i] < minscale && nonzeroheight[i])
+            {
+                imin = i;
+                minscale = scale[i];
+            }
+        }
+        if(imin < 3)      //scale x,y, and z directions by same scale factor
         {
-            imin = i;
-            minscale = scale[i];
+            for(int i = 0;i<3;i++) scale[i] = scale[imin];
         }
     }
-    if(imin < 3)      //scale x,y, and z directions by same scale factor
-    {
-        for(int i = 0;i<3;i++) scale[i] = scale[imin];
-    }
-#endif
 
     // apply manual scale factor tweaks
     scale[0] *= xscalefactortweak;
@@ -9,6 +9,7 @@
 #include <vector>
 #include <time.h>
 #include "FN_Knot.h"
+#include "Treecode.h"
 using namespace std;
 
 #ifndef SOLIDANGLECALCULATION_H
@@ -31,6 +32,8 @@ void ComputeWrithe(struct Link& Curve);
 /***********************Functions for outputting the solid angle*************************/
 
 double SolidAngleCalc(const Link& Curve, const viewpoint& View);
+// as above, with the sum over each component done by its treecode to within SolidAngleTolerance
+double SolidAngleCalc(const Link& Curve, const vector<SourceTree>& trees, const viewpoint& View);
 void phi_calc_curve(vector<double> &phi, const struct Link& Curve, const Griddata &griddata);
 double init_from_surface_file(std::vector<triangle>& knotsurface);
 
@@ -0,0 +1,107 @@
+#include "Pipeline.h"
+#include "FN_Constants.h"
+#include <omp.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// the fields of one iteration, as the analysis wants them
+struct Snapshot
+{
+    int iteration;
+    double time;
+    Field u, v, ucvx, ucvy, ucvz, ucvmag;
+};
+
+static std::thread analyser;
+static std::mutex pipelinemutex;
+static std::condition_variable queuechanged;     // signalled when a snapshot is queued, finished, or the pipeline is told to stop
+static deque<Snapshot*> queued;                  // waiting or being analysed, oldest first. the one at the front is being worked on
+static vector<Snapshot*> spare;                  // done with, to be filled again
+static int numsnapshots = 0;
+static bool stopping = false;
+static AnalysisState* pipelineanalysis = NULL;
+static Griddata pipelinegriddata;
+
+static void run_pipeline()
+{
+    AnalysisState& analysis = *pipelineanalysis;
+    const Griddata griddata = pipelinegriddata;
+    const int numthreads = AnalysisThreads;
+    while(true)
+    {
+        Snapshot* snapshot;
+        {
+            std::unique_lock<std::mutex> lock(pipelinemutex);
+            while(queued.empty() && !stopping) queuechanged.wait(lock);
+            if(queued.empty()) return;
+            snapshot = queued.front();
+        }
+        // the same analysis the single in main does without the pipeline, with a team of our own for its tasks
+#pragma omp parallel num_threads(numthreads) default(none) shared(snapshot,analysis,griddata)
+        {
+#pragma omp single
+            analyse_iteration(snapshot->iteration,snapshot->time,snapshot->u,snapshot->v,snapshot->ucvx,snapshot->ucvy,snapshot->ucvz,snapshot->ucvmag,analysis,griddata);
+        }
+        {
+            std::lock_guard<std::mutex> lock(pipelinemutex);
+            queued.pop_front();
+            spare.push_back(snapshot);
+        }
+        queuechanged.notify_all();
+    }
+}
+
+void start_pipeline(AnalysisState& analysis, const Griddata& griddata)
+{
+    pipelineanalysis = &analysis;
+    pipelinegriddata = griddata;
+    stopping = false;
+    analyser = std::thread(run_pipeline);
+}
+
+void queue_snapshot(int it, double t, const Field& u, const Field& v, const Field& ucvx, const Field& ucvy, const Field& ucvz, const Field& ucvmag)
+{
+    Snapshot* snapshot = NULL;
+    {
+        // a snapshot which has been analysed, a new one if we are still under the limit, or else wait for the analysis to free one
+        std::unique_lock<std::mutex> lock(pipelinemutex);
+        while(spare.empty() && numsnapshots >= AnalysisSnapshots) queuechanged.wait(lock);
+        if(!spare.empty())
+        {
+            snapshot = spare.back();
+            spare.pop_back();
+        }
+        else
+        {
+            snapshot = new Snapshot;
+            numsnapshots++;
+        }
+    }
+    snapshot->iteration = it;
+    snapshot->time = t;
+    const Field* fields[6] = {&u,&v,&ucvx,&ucvy,&ucvz,&ucvmag};
+    Field* copies[6] = {&snapshot->u,&snapshot->v,&snapshot->ucvx,&snapshot->ucvy,&snapshot->ucvz,&snapshot->ucvmag};
+    // the threads waiting at the end of the single pick up the copies
+#pragma omp taskloop grainsize(1) default(none) shared(fields,copies)
+    for(int f=0;f<6;f++) *copies[f] = *fields[f];
+    {
+        std::lock_guard<std::mutex> lock(pipelinemutex);
+        queued.push_back(snapshot);
+    }
+    queuechanged.notify_all();
+}
+
+void finish_pipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(pipelinemutex);
+        stopping = true;
+    }
+    queuechanged.notify_all();
+    if(analyser.joinable()) analyser.join();
+    for(unsigned int n=0;n<spare.size();n++) delete spare[n];
+    spare.clear();
+    numsnapshots = 0;
+}
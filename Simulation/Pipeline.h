@@ -0,0 +1,20 @@
+#include "FN_Knot.h"
+using namespace std;
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/* the analysis pipeline. with INSERT_ANALYSIS_THREADS above 0, the update doesn't stop for rank 0 to trace and print the knot. on every
+   iteration with analysis to do, rank 0 copies u, v and the ucv grids into a snapshot and queues it, and the update goes straight on.
+   a thread of its own takes the snapshots one at a time, in order, and runs analyse_iteration on each with a team of AnalysisThreads
+   OpenMP threads, so everything comes out just as it would have, labelled with the time of its snapshot. at most AnalysisSnapshots are
+   held at once - queueing another waits until the oldest is done. the snapshots are kept for reuse, so their grids are only allocated once */
+
+// start the analysis thread, which owns the analysis state from here until finish_pipeline. rank 0 only, from outside any parallel region
+void start_pipeline(AnalysisState& analysis, const Griddata& griddata);
+// queue a copy of the fields of iteration it, at time t. from the single in main, the copies go out as tasks
+void queue_snapshot(int it, double t, const Field& u, const Field& v, const Field& ucvx, const Field& ucvy, const Field& ucvz, const Field& ucvmag);
+// wait for the snapshots queued so far to be analysed, and stop the thread
+void finish_pipeline();
+
+#endif //PIPELINE_H
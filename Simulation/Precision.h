@@ -0,0 +1,19 @@
+#include <vector>
+
+#ifndef PRECISION_H
+#define PRECISION_H
+
+/* what the grids of the fields are stored as. doubles, unless built with -DFLOAT_FIELDS (make float), when u, v, the slopes and stage
+   inputs of the update, and grad u x grad v are all floats - half the memory, and half the traffic of the update, which is bound by it.
+   the kernels load the floats into doubles and do all their arithmetic, and the sums of the slopes, in double, only rounding what they
+   store. the curves traced from the fields, and everything worked out from them, stay double either way, as do the files - the uv prints
+   were floats already, and checkpoints are written as doubles, so either build can restart from the other's.
+   Shell_Scripts/comparetimeseries.py sets the twist, writhe and length a float run gives against a double one */
+#ifdef FLOAT_FIELDS
+typedef float fieldvalue;
+#else
+typedef double fieldvalue;
+#endif
+typedef std::vector<fieldvalue> Field;
+
+#endif //PRECISION_H
@@ -0,0 +1,133 @@
+#include "Profiling.h"
+#include "FN_Constants.h"
+#include "Distributed.h"
+#include <omp.h>
+#include <algorithm>
+
+static const char* phasenames[NumProfilePhases] = {"update","gather","snapshot","seeds","tracing","curves","smoothing","writhe","velocity","printknot","printuv","checkpoint"};
+
+// each thread's stencil time on a line of its own, so the threads aren't fighting over one
+struct ThreadTime
+{
+    double seconds;
+    char pad[64 - sizeof(double)];
+};
+
+static double phasetotals[NumProfilePhases];
+static double outputbytes = 0;
+static double pointsstepped = 0;
+static vector<ThreadTime> stenciltimes;
+// the totals at the last row
+static double lastphasetotals[NumProfilePhases];
+static double lastoutputbytes = 0;
+static double lastpointsstepped = 0;
+static vector<double> laststenciltimes;
+static double lastrowtime = 0;
+static double starttime = 0;
+static ofstream performancelog;
+
+// the traffic of one grid point through a step: each grid the passes of the update read or write counted once, as if nothing stayed in
+// cache from one pass to the next. the classic scheme reads its stage input and v, writes the slopes and the next input, and the last
+// stage reads all three slopes back. the low storage one goes over the slopes, v and its running u twice a stage
+double stencil_bytes_per_point()
+{
+    if(TimeStepper == RK4LOWSTORAGE) return sizeof(fieldvalue)*(2 + 5*12 + 1);
+    return sizeof(fieldvalue)*(2 + 6 + 7 + 7 + 11);
+}
+
+ProfileTimer::ProfileTimer(ProfilePhase phase) : phase(phase), start(omp_get_wtime()) {}
+ProfileTimer::~ProfileTimer() { profile_add(phase,omp_get_wtime() - start); }
+
+void setup_profiling(int numthreads)
+{
+    stenciltimes.assign(numthreads,ThreadTime());
+    laststenciltimes.assign(numthreads,0);
+    for(int p=0;p<NumProfilePhases;p++) phasetotals[p] = lastphasetotals[p] = 0;
+    starttime = lastrowtime = omp_get_wtime();
+}
+
+void profile_add(ProfilePhase phase, double seconds)
+{
+#pragma omp atomic
+    phasetotals[phase] += seconds;
+}
+
+void profile_output_bytes(double bytes)
+{
+#pragma omp atomic
+    outputbytes += bytes;
+}
+
+void profile_stencil_loop(double seconds)
+{
+    const int thread = omp_get_thread_num();
+    if(thread < (int)stenciltimes.size()) stenciltimes[thread].seconds += seconds;
+}
+
+void profile_points_stepped(double points)
+{
+    pointsstepped += points;
+}
+
+void log_performance(int it, double t)
+{
+    // the collective first, every rank has to get here
+    const double points = distributed_sum(pointsstepped - lastpointsstepped);
+    lastpointsstepped = pointsstepped;
+    const double now = omp_get_wtime();
+    const double wall = now - lastrowtime;
+    lastrowtime = now;
+    // the stencil times are only written between the barriers of the update, which we are not in
+    double busiest = 0, average = 0;
+    for(unsigned int n=0;n<stenciltimes.size();n++)
+    {
+        const double seconds = stenciltimes[n].seconds - laststenciltimes[n];
+        laststenciltimes[n] = stenciltimes[n].seconds;
+        busiest = std::max(busiest,seconds);
+        average += seconds/stenciltimes.size();
+    }
+    double phases[NumProfilePhases];
+    for(int p=0;p<NumProfilePhases;p++)
+    {
+        double total;
+#pragma omp atomic read
+        total = phasetotals[p];
+        phases[p] = total - lastphasetotals[p];
+        lastphasetotals[p] = total;
+    }
+    double bytes;
+#pragma omp atomic read
+    bytes = outputbytes;
+    const double newbytes = bytes - lastoutputbytes;
+    lastoutputbytes = bytes;
+    if(decomposition.rank != 0) return;
+
+    if(!performancelog.is_open())
+    {
+        performancelog.open("performance.csv",std::ofstream::app);
+        // a restarted run carries on with the same columns
+        if(performancelog.tellp() == 0)
+        {
+            performancelog << "iteration,time,wall";
+            for(int p=0;p<NumProfilePhases;p++) performancelog << ',' << phasenames[p];
+            performancelog << ",pointspersecond,stencilGBpersecond,outputbytes,stencilimbalance\n";
+        }
+    }
+    const double updatetime = phases[ProfileUpdate];
+    performancelog << it << ',' << t << ',' << wall;
+    for(int p=0;p<NumProfilePhases;p++) performancelog << ',' << phases[p];
+    performancelog << ',' << ((updatetime > 0) ? points/updatetime : 0);
+    performancelog << ',' << ((updatetime > 0) ? 1e-9*points*stencil_bytes_per_point()/updatetime : 0);
+    performancelog << ',' << newbytes << ',' << ((average > 0) ? busiest/average : 0) << '\n';
+    performancelog.flush();
+}
+
+void report_performance()
+{
+    if(decomposition.rank != 0) return;
+    const double wall = omp_get_wtime() - starttime;
+    cout << "Wall time " << wall << "s, of which\n";
+    for(int p=0;p<NumProfilePhases;p++) cout << "  " << phasenames[p] << "\t" << phasetotals[p] << "s\n";
+    cout << "Output written " << outputbytes/1e6 << "MB\n";
+    if(performancelog.is_open()) performancelog.close();
+}
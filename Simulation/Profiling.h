@@ -0,0 +1,59 @@
+#include "FN_Knot.h"
+using namespace std;
+
+#ifndef PROFILING_H
+#define PROFILING_H
+
+/* where the time goes. every phase of an iteration adds its wall time to a running total, and with INSERT_PERF_LOG_TIME above 0 rank 0
+   writes a row of performance.csv that often, of what was spent since the row before: the seconds in each phase, the grid points stepped
+   per second and the memory traffic of the stencil that makes (each grid the update reads or writes counted once per pass), the bytes
+   handed to the output, and how unevenly the threads shared the stencil loops - the busiest thread's time over the average. the phases
+   timed inside tasks (the smoothing and the writhe) are summed over the tasks, so they can come to more than the wall time. the timers are
+   taken on rank 0, the points stepped are summed over the ranks */
+
+enum ProfilePhase
+{
+    ProfileUpdate,          // uv_update, and any refined patches, for all the threads
+    ProfileGather,          // bringing the fields to rank 0, or off the device
+    ProfileSnapshot,        // copying them for the analysis thread
+    ProfileSeeds,           // the search for the seeds of the components, and in the lean memory mode building the UcvCache first
+    ProfileTracing,         // tracing them, in rounds
+    ProfileCurves,          // their geometry, twist and writhe
+    ProfileSmoothing,       // the fft smoothing, summed over the tasks
+    ProfileWrithe,          // the writhe integrand, summed over the tasks
+    ProfileVelocity,        // find_knot_velocity
+    ProfilePrintKnot,
+    ProfilePrintUV,         // the staging copy, the writer thread does the rest
+    ProfileCheckpoint,
+    NumProfilePhases
+};
+
+// adds the wall time from its construction to its destruction to phase
+class ProfileTimer
+{
+public:
+    ProfileTimer(ProfilePhase phase);
+    ~ProfileTimer();
+private:
+    ProfilePhase phase;
+    double start;
+};
+
+// before the parallel region. the stencil loops of numthreads threads are timed
+void setup_profiling(int numthreads);
+// add to phase, from any thread
+void profile_add(ProfilePhase phase, double seconds);
+// bytes handed to the output, from any thread
+void profile_output_bytes(double bytes);
+// the time this thread spent on its share of a stencil loop, before the barrier at its end. within a parallel region
+void profile_stencil_loop(double seconds);
+// grid points stepped by this rank in one update. from one thread
+void profile_points_stepped(double points);
+// the row for the time since the last one, ending at iteration it. every rank, from one thread - the points are summed over the ranks
+void log_performance(int it, double t);
+// the totals of the whole run, on rank 0
+void report_performance();
+// the bytes of memory traffic one grid point makes through a step of the update, as counted for the log
+double stencil_bytes_per_point();
+
+#endif //PROFILING_H
@@ -1,184 +1,174 @@
 #include "ReadingWriting.h"
 #include "FN_Constants.h"
 #include "FN_Knot.h"
+#include "Hdf5Output.h"
+#include "Distributed.h"
+#include "Profiling.h"
+#include "Gradients.h"
 #include <string.h>
+#include <ctype.h>
+#include <thread>
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-int uvfile_read_BINARY(vector<double>&u, vector<double>&v,const Griddata& griddata)
+// the number of bytes from start to just after the n'th newline, or 0 if there arent that many before end
+static size_t skip_lines(const char* start, const char* end, int n)
 {
-    int Nx = griddata.Nx;
-    int Ny = griddata.Ny;
-    int Nz = griddata.Nz;
-    string temp,buff;
-    stringstream ss;
-    ifstream fin (B_filename.c_str(), std::ios::in  | std::ios::binary);
-    int i,j,k,n;
-
-    for(i=0;i<10;i++)
+    const char* p = start;
+    for(int line=0; line<n; line++)
     {
-        if(fin.good())
-        {
-            if(getline(fin,buff)) temp = buff;
-        }
-        else
-        {
-            cout << "Something went wrong!\n";
-            return 1;
-        }
+        const char* newline = (const char*)memchr(p,'\n',end-p);
+        if(newline == NULL) return 0;
+        p = newline+1;
     }
+    return p - start;
+}
 
-    for(k=0; k<Nz; k++)
+// Nx*Ny*Nz big endian floats in the vtk order, x fastest, into field. the k planes go to the threads
+static void read_bigendian_block(const char* block, Field& field, const Griddata& griddata)
+{
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+#pragma omp parallel for collapse(2)
+    for(int k=0; k<Nz; k++)
     {
-        for(j=0; j<Ny; j++)
+        for(int j=0; j<Ny; j++)
         {
-            for(i=0; i<Nx; i++)
+            const char* row = block + ((size_t)k*Ny + j)*Nx*sizeof(float);
+            for(int i=0; i<Nx; i++)
             {
-                n=pt(i,j,k,griddata);
-                char* memblock;
-                char* swapped;
-                memblock = new char [sizeof(float)];
-                swapped = new char [sizeof(float)];
-                fin.read(memblock,sizeof(float));
-                ByteSwap(memblock, swapped);
-                float value = 12;
-                memcpy(&value, swapped, 4);
-                u[n] = value;
-                delete[] memblock;
-                delete[] swapped;
+                char swapped[sizeof(float)];
+                ByteSwap(row + i*sizeof(float),swapped);
+                float value;
+                memcpy(&value,swapped,sizeof(float));
+                field[pt(i,j,k,griddata)] = value;
             }
         }
     }
+}
 
-    for(i=0;i<3;i++)
+int uvfile_read_BINARY(Field& u, Field& v,const Griddata& griddata)
+{
+    // mapped straight in, as the checkpoints are, and copied out in parallel
+    const int fd = open(B_filename.c_str(),O_RDONLY);
+    struct stat filestat;
+    if(fd < 0 || fstat(fd,&filestat) != 0)
     {
-        if(fin.good())
-        {
-            if(getline(fin,buff)) temp = buff;
-        }
-        else
-        {
-            cout << "Something went wrong!\n";
-            return 1;
-        }
+        if(fd >= 0) close(fd);
+        cout << "Something went wrong!\n";
+        return 1;
     }
-
-    for(k=0; k<Nz; k++)
+    void* mapped = mmap(NULL,filestat.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(mapped == MAP_FAILED)
     {
-        for(j=0; j<Ny; j++)
-        {
-            for(i=0; i<Nx; i++)
-            {
-                n=pt(i,j,k,griddata);
-                char* memblock;
-                char* swapped;
-                memblock = new char [sizeof(float)];
-                swapped = new char [sizeof(float)];
-                fin.read(memblock,sizeof(float));
-                ByteSwap(memblock, swapped);
-                float value = 12;
-                memcpy(&value, swapped, 4);
-                v[n] = value;
-                delete[] memblock;
-                delete[] swapped;
-            }
-        }
+        cout << "Something went wrong!\n";
+        return 1;
     }
-
-    fin.close();
-
+    const char* start = (const char*)mapped;
+    const char* end = start + filestat.st_size;
+    const size_t blockbytes = (size_t)griddata.Nx*griddata.Ny*griddata.Nz*sizeof(float);
+    // ten lines of header before u, and after it the end of its line and two more before v
+    const size_t ustart = skip_lines(start,end,10);
+    size_t vstart = 0;
+    if(ustart > 0 && ustart + blockbytes <= (size_t)filestat.st_size)
+    {
+        const size_t gap = skip_lines(start + ustart + blockbytes,end,3);
+        if(gap > 0) vstart = ustart + blockbytes + gap;
+    }
+    if(vstart == 0 || vstart + blockbytes > (size_t)filestat.st_size)
+    {
+        cout << "Something went wrong!\n";
+        munmap(mapped,filestat.st_size);
+        return 1;
+    }
+    read_bigendian_block(start + ustart,u,griddata);
+    read_bigendian_block(start + vstart,v,griddata);
+    munmap(mapped,filestat.st_size);
     return 0;
 }
 
-int uvfile_read_ASCII(vector<double>&u, vector<double>&v,const Griddata& griddata)
+// a value as the stream would read it into a field
+static inline fieldvalue parse_fieldvalue(const char* text)
+{
+#ifdef FLOAT_FIELDS
+    return strtof(text,NULL);
+#else
+    return strtod(text,NULL);
+#endif
+}
+
+int uvfile_read_ASCII(Field& u, Field& v,const Griddata& griddata)
 {
     int Nx = griddata.Nx;
     int Ny = griddata.Ny;
     int Nz = griddata.Nz;
-    string temp,buff;
-    stringstream ss;
-    ifstream fin (B_filename.c_str());
-    int i,j,k,n;
-
-    for(i=0;i<10;i++)
+    // ten lines of header, a value of u per line, two more lines and then v. the lines are parsed in parallel
+    string contents;
+    vector<const char*> lines;
+    const size_t gridsize = (size_t)Nx*Ny*Nz;
+    if(read_file(B_filename,contents)) split_lines(contents,lines);
+    if(lines.size() < 12 + 2*gridsize)
     {
-        if(fin.good())
-        {
-            if(getline(fin,buff)) temp = buff;
-        }
-        else
-        {
-            cout << "Something went wrong!\n";
-            return 1;
-        }
+        cout << "Something went wrong!\n";
+        return 1;
     }
-
-    for(k=0; k<Nz; k++)
+    const char** ulines = &lines[10];
+    const char** vlines = &lines[12 + gridsize];
+#pragma omp parallel for collapse(2)
+    for(int k=0; k<Nz; k++)
     {
-        for(j=0; j<Ny; j++)
+        for(int j=0; j<Ny; j++)
         {
-            for(i=0; i<Nx; i++)
+            for(int i=0; i<Nx; i++)
             {
-                n=pt(i,j,k,griddata);
-                ss.clear();
-                ss.str("");
-                if(fin.good())
-                {
-                    if(getline(fin,buff))
-                    {
-                        ss << buff;
-                        ss >> u[n];
-                    }
-                }
-                else
-                {
-                    cout << "Something went wrong!\n";
-                    return 1;
-                }
+                const size_t line = ((size_t)k*Ny + j)*Nx + i;
+                const int n = pt(i,j,k,griddata);
+                u[n] = parse_fieldvalue(ulines[line]);
+                v[n] = parse_fieldvalue(vlines[line]);
             }
         }
     }
+    return 0;
+}
 
-    for(i=0;i<2;i++)
-    {
-        if(fin.good())
-        {
-            if(getline(fin,buff)) temp = buff;
-        }
-        else
-        {
-            cout << "Something went wrong!\n";
-            return 1;
-        }
-    }
-
-    for(k=0; k<Nz; k++)
+// the field interpolated from its grid onto the finer one, in place. a row of k at a time, each thread with its own voxel cache, so the
+// interpolator can be shared
+static void resample_grid(Field& field, const Griddata& griddata, const Griddata& finegriddata)
+{
+    const int Nx = finegriddata.Nx;
+    const int Ny = finegriddata.Ny;
+    const int Nz = finegriddata.Nz;
+    Field finegrid((size_t)Nx*Ny*Nz);
+    likely::TriCubicInterpolator interpolator(field, griddata.h, griddata.Nx,griddata.Ny,griddata.Nz);
+#pragma omp parallel for collapse(2)
+    for(int i=0;i<Nx;i++)
     {
-        for(j=0; j<Ny; j++)
+        for(int j=0; j<Ny; j++)
         {
-            for(i=0; i<Nx; i++)
+            likely::TriCubicInterpolator::Cell cell;
+            vector<double> points(3*Nz);
+            for(int k=0; k<Nz; k++)
             {
-                n=pt(i,j,k,griddata);
-                ss.clear();
-                ss.str("");
-                if(fin.good())
-                {
-                    if(getline(fin,buff)) ss << buff;
-                    ss >> v[n];
-                }
-                else
-                {
-                    cout << "Something went wrong!\n";
-                    return 1;
-                }
+                // get the point in space this gridpoint corresponds to
+                points[3*k]= x(i,finegriddata);
+                points[3*k+1]= y(j,finegriddata);
+                points[3*k+2]= z(k,finegriddata);
             }
+            // the k row is contiguous in the grid
+            interpolator.evaluate(&points[0],&finegrid[pt(i,j,0,finegriddata)],Nz,cell);
         }
     }
-
-    fin.close();
-
-    return 0;
+    field.swap(finegrid);
 }
 
-int uvfile_read(vector<double>&u, vector<double>&v, vector<double>& ku, vector<double>& kv, vector<double>& ucvx, vector<double>& ucvy,vector<double>& ucvz, vector<double>& ucvmag,Griddata& griddata)
+int uvfile_read(Field& u, Field& v, Field& ucvx, Field& ucvy,Field& ucvz, Field& ucvmag,Griddata& griddata)
 {
     string buff,datatype,dimensions,xdim,ydim,zdim;
     ifstream fin (B_filename.c_str());
@@ -197,11 +187,11 @@ int uvfile_read(vector<double>&u, vector<double>&v, vector<double>& ku, vector<d
 
     if(datatype.compare("ASCII")==0)
     {
-        uvfile_read_ASCII(u,v,griddata);
+        if(uvfile_read_ASCII(u,v,griddata)) return 1;
     }
     else if(datatype.compare("BINARY")==0)
     {
-        uvfile_read_BINARY(u,v,griddata);
+        if(uvfile_read_BINARY(u,v,griddata)) return 1;
     }
 
     // okay we've read in the file - now, did we want to interpolate?
@@ -215,57 +205,130 @@ int uvfile_read(vector<double>&u, vector<double>&v, vector<double>& ku, vector<d
         interpolatedgriddata.Nz = interpolatedNz;
         interpolatedgriddata.h = ((initialNx-1)*initialh)/(interpolatedNx-1);
 
-        vector<double>interpolatedugrid(interpolatedNx*interpolatedNy*interpolatedNz);
-        vector<double>interpolatedvgrid(interpolatedNx*interpolatedNy*interpolatedNz);
+        // u and then v, each swapped in for the coarse one as soon as it is done, so there is only ever one fine grid more than we keep
+        resample_grid(u,griddata,interpolatedgriddata);
+        resample_grid(v,griddata,interpolatedgriddata);
 
-        // interpolate u and v
-        likely::TriCubicInterpolator interpolatedu(u, initialh, initialNx,initialNy,initialNz);
-        likely::TriCubicInterpolator interpolatedv(v, initialh, initialNx,initialNy,initialNz);
-        for(int i=0;i<interpolatedNx;i++)
+        // the ucv grids are just sized for the new grid, the update fills them. in the lean memory mode there are none
+        if(!LeanMemory)
         {
-            for(int j=0; j<interpolatedNy; j++)
-            {
-                for(int k=0; k<interpolatedNz; k++)   //Central difference
-                {
-
-                    // get the point in space this gridpoint corresponds to
-                    double px= x(i,interpolatedgriddata);
-                    double py= y(j,interpolatedgriddata);
-                    double pz= z(k,interpolatedgriddata);
-                    // interpolate
-                    interpolatedugrid[pt(i,j,k,interpolatedgriddata)]= interpolatedu(px,py,pz);
-                    interpolatedvgrid[pt(i,j,k,interpolatedgriddata)]= interpolatedv(px,py,pz);
-                }
-            }
+            ucvx.resize(interpolatedNx*interpolatedNy*interpolatedNz);
+            ucvy.resize(interpolatedNx*interpolatedNy*interpolatedNz);
+            ucvz.resize(interpolatedNx*interpolatedNy*interpolatedNz);
+            ucvmag.resize(interpolatedNx*interpolatedNy*interpolatedNz);
         }
 
-        // resize all arrays, set the new u and v arrays, and set the new griddata
-        ucvx.resize(interpolatedNx*interpolatedNy*interpolatedNz);
-        ucvy.resize(interpolatedNx*interpolatedNy*interpolatedNz);
-        ucvz.resize(interpolatedNx*interpolatedNy*interpolatedNz);
-        ucvmag.resize(interpolatedNx*interpolatedNy*interpolatedNz);
-        ku.resize(4*interpolatedNx*interpolatedNy*interpolatedNz);
-        kv.resize(4*interpolatedNx*interpolatedNy*interpolatedNz);
-
-        u = interpolatedugrid;
-        v = interpolatedvgrid;
-
         griddata=interpolatedgriddata;
     }
 
     return 0;
 }
 
-void print_sensor_point(double CurrentTime, viewpoint sensorpoint, vector<double>&u,Griddata griddata)
+// the scalar logs (globaldata, the sensor point) are opened once and kept open, rather than reopened for every line. they are flushed
+// with every knot print, so a run which is killed still has all it printed
+static map<string,ofstream*> logfiles;
+static ofstream& log_file(const string& filename)
+{
+    ofstream*& file = logfiles[filename];
+    if(file == NULL) file = new ofstream(filename.c_str(), std::ofstream::app);
+    return *file;
+}
+
+void flush_logs()
 {
+    for(map<string,ofstream*>::iterator it=logfiles.begin(); it!=logfiles.end(); ++it) it->second->flush();
+}
+
+void print_sensor_point(double CurrentTime, viewpoint sensorpoint, Field& u,Griddata griddata)
+{
+        // a point off the grid has no u to log - its index would be off the end of u, or at some other point of it
+        const double coords[3] = {sensorpoint.xcoord,sensorpoint.ycoord,sensorpoint.zcoord};
+        const int N[3] = {griddata.Nx,griddata.Ny,griddata.Nz};
+        for(int d=0;d<3;d++)
+        {
+            // the index coordstopt truncates
+            const double index = coords[d]/griddata.h + N[d]/2.0;
+            if(index <= -1 || (int)index >= N[d]) return;
+        }
         // grab the indices corresponding to the point
         int n = coordstopt(sensorpoint.xcoord,sensorpoint.ycoord,sensorpoint.zcoord,griddata);
         /***Write values to file*******/
         stringstream ss;
         ss << "sensorpoint" << "_" << sensorpoint.xcoord << "_" << sensorpoint.ycoord << "_" << sensorpoint.zcoord <<  ".txt";
-        ofstream wrout (ss.str().c_str(), std::ofstream::app);
-        wrout << CurrentTime << '\t' << u[n] << '\n';
-        wrout.close();
+        log_file(ss.str()) << CurrentTime << '\t' << u[n] << '\n';
+}
+
+// the binary knot series, knotplots.bin. a file header - the magic, the version, the number of point fields and their names, 16
+// characters each - then a record per component per print: a KnotRecordHeader, then each point field in turn, npoints floats each.
+// the file only ever grows, a restarted run appends to it. the velocity print of a time comes after its plain print, so readers
+// should take the last record of any time and component. Shell_Scripts/timeseriesconverter.py reads it, and has the layout of
+// KnotRecordHeader in it as '<dii6d'
+struct KnotRecordHeader
+{
+    double t;
+    int component;
+    int npoints;
+    double writhe, twist, length;
+    double xavgpos, yavgpos, zavgpos;
+};
+static const char knotseriesmagic[8] = {'F','N','K','N','O','T','C','V'};
+static const int knotseriesversion = 1;
+static const int numknotfields = 29;
+static const char* knotfieldnames[numknotfields] = {"x","y","z","curvature","torsion","ax","ay","az","vx","vy","vz","tx","ty","tz","nx","ny","nz",
+    "bx","by","bz","vdotnx","vdotny","vdotnz","vdotbx","vdotby","vdotbz","writhe","twist","length"};
+static ofstream knotseries;
+
+// the arrays of the curve, in the order of knotfieldnames
+static void knot_fields(const knotpoints& Points, const vector<double>* fields[numknotfields])
+{
+    const vector<double>* arrays[numknotfields] = {&Points.xcoord,&Points.ycoord,&Points.zcoord,&Points.curvature,&Points.torsion,&Points.ax,&Points.ay,&Points.az,
+        &Points.vx,&Points.vy,&Points.vz,&Points.tx,&Points.ty,&Points.tz,&Points.nx,&Points.ny,&Points.nz,&Points.bx,&Points.by,&Points.bz,
+        &Points.vdotnx,&Points.vdotny,&Points.vdotnz,&Points.vdotbx,&Points.vdotby,&Points.vdotbz,&Points.writhe,&Points.twist,&Points.length};
+    for(int f=0;f<numknotfields;f++) fields[f] = arrays[f];
+}
+
+static void append_knot_record(double t, int c, const knotcurve& curve)
+{
+    if(!knotseries.is_open())
+    {
+        knotseries.open("knotplots.bin",std::ios::binary | std::ios::out | std::ios::app);
+        // a new file gets the header, an old one is carried on with
+        if(knotseries.tellp() == 0)
+        {
+            char names[numknotfields][16];
+            memset(names,0,sizeof(names));
+            for(int f=0;f<numknotfields;f++) strncpy(names[f],knotfieldnames[f],15);
+            knotseries.write(knotseriesmagic,sizeof(knotseriesmagic));
+            knotseries.write((const char*) &knotseriesversion,sizeof(int));
+            knotseries.write((const char*) &numknotfields,sizeof(int));
+            knotseries.write((const char*) names,sizeof(names));
+        }
+    }
+    const int n = curve.knotcurve.size();
+    KnotRecordHeader header;
+    memset(&header,0,sizeof(header));
+    header.t = t;
+    header.component = c;
+    header.npoints = n;
+    header.writhe = curve.writhe;
+    header.twist = curve.twist;
+    header.length = curve.length;
+    header.xavgpos = curve.xavgpos;
+    header.yavgpos = curve.yavgpos;
+    header.zavgpos = curve.zavgpos;
+    // the record goes out in one write, each field contiguous
+    vector<char> record(sizeof(header) + (size_t)numknotfields*n*sizeof(float));
+    memcpy(&record[0],&header,sizeof(header));
+    float* data = (float*)&record[sizeof(header)];
+    const vector<double>* fields[numknotfields];
+    knot_fields(curve.knotcurve,fields);
+    for(int f=0;f<numknotfields;f++)
+    {
+        const vector<double>& values = *fields[f];
+        for(int i=0;i<n;i++) data[(size_t)f*n+i] = values[i];
+    }
+    knotseries.write(&record[0],record.size());
+    profile_output_bytes(record.size());
 }
 
 void print_knot( double t, vector<knotcurve>& knotcurves,const Griddata& griddata)
@@ -276,9 +339,13 @@ void print_knot( double t, vector<knotcurve>& knotcurves,const Griddata& griddat
         /***Write values to file*******/
         stringstream ss;
         ss << "globaldata" << "_" << c <<  ".txt";
-        ofstream wrout (ss.str().c_str(), std::ofstream::app);
-        wrout << t << '\t' << knotcurves[c].writhe << '\t' << knotcurves[c].twist << '\t' << knotcurves[c].length << '\n';
-        wrout.close();
+        log_file(ss.str()) << t << '\t' << knotcurves[c].writhe << '\t' << knotcurves[c].twist << '\t' << knotcurves[c].length << '\n';
+
+        if(KnotFormat == KNOT_SERIES)
+        {
+            append_knot_record(t,c,knotcurves[c]);
+            continue;
+        }
 
         ss.str("");
         ss.clear();
@@ -294,7 +361,7 @@ void print_knot( double t, vector<knotcurve>& knotcurves,const Griddata& griddat
 
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].xcoord << ' ' << knotcurves[c].knotcurve[i].ycoord << ' ' << knotcurves[c].knotcurve[i].zcoord << '\n';
+            knotout << knotcurves[c].knotcurve.xcoord[i] << ' ' << knotcurves[c].knotcurve.ycoord[i] << ' ' << knotcurves[c].knotcurve.zcoord[i] << '\n';
         }
 
         knotout << "\n\nCELLS " << n << ' ' << 3*n << '\n';
@@ -316,70 +383,74 @@ void print_knot( double t, vector<knotcurve>& knotcurves,const Griddata& griddat
         knotout << "\nSCALARS Curvature float\nLOOKUP_TABLE default\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].curvature << '\n'; }
+            knotout << knotcurves[c].knotcurve.curvature[i] << '\n'; }
 
         knotout << "\nSCALARS Torsion float\nLOOKUP_TABLE default\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].torsion << '\n';
+            knotout << knotcurves[c].knotcurve.torsion[i] << '\n';
         }
 
         knotout << "\nVECTORS A float\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].ax << ' ' << knotcurves[c].knotcurve[i].ay << ' ' << knotcurves[c].knotcurve[i].az << '\n';
+            knotout << knotcurves[c].knotcurve.ax[i] << ' ' << knotcurves[c].knotcurve.ay[i] << ' ' << knotcurves[c].knotcurve.az[i] << '\n';
         }
 
         knotout << "\nVECTORS V float\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].vx << ' ' << knotcurves[c].knotcurve[i].vy << ' ' << knotcurves[c].knotcurve[i].vz << '\n';
+            knotout << knotcurves[c].knotcurve.vx[i] << ' ' << knotcurves[c].knotcurve.vy[i] << ' ' << knotcurves[c].knotcurve.vz[i] << '\n';
         }
         knotout << "\nVECTORS t float\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].tx << ' ' << knotcurves[c].knotcurve[i].ty << ' ' << knotcurves[c].knotcurve[i].tz << '\n';
+            knotout << knotcurves[c].knotcurve.tx[i] << ' ' << knotcurves[c].knotcurve.ty[i] << ' ' << knotcurves[c].knotcurve.tz[i] << '\n';
         }
         knotout << "\nVECTORS n float\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].nx << ' ' << knotcurves[c].knotcurve[i].ny << ' ' << knotcurves[c].knotcurve[i].nz << '\n';
+            knotout << knotcurves[c].knotcurve.nx[i] << ' ' << knotcurves[c].knotcurve.ny[i] << ' ' << knotcurves[c].knotcurve.nz[i] << '\n';
         }
         knotout << "\nVECTORS b float\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].bx << ' ' << knotcurves[c].knotcurve[i].by << ' ' << knotcurves[c].knotcurve[i].bz << '\n';
+            knotout << knotcurves[c].knotcurve.bx[i] << ' ' << knotcurves[c].knotcurve.by[i] << ' ' << knotcurves[c].knotcurve.bz[i] << '\n';
         }
         knotout << "\nVECTORS vdotn float\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].vdotnx << ' ' << knotcurves[c].knotcurve[i].vdotny << ' ' << knotcurves[c].knotcurve[i].vdotnz << '\n';
+            knotout << knotcurves[c].knotcurve.vdotnx[i] << ' ' << knotcurves[c].knotcurve.vdotny[i] << ' ' << knotcurves[c].knotcurve.vdotnz[i] << '\n';
         }
         knotout << "\nVECTORS vdotb float\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].vdotbx << ' ' << knotcurves[c].knotcurve[i].vdotby << ' ' << knotcurves[c].knotcurve[i].vdotbz << '\n';
+            knotout << knotcurves[c].knotcurve.vdotbx[i] << ' ' << knotcurves[c].knotcurve.vdotby[i] << ' ' << knotcurves[c].knotcurve.vdotbz[i] << '\n';
         }
         knotout << "\n\nCELL_DATA " << n << "\n\n";
         knotout << "\nSCALARS Writhe float\nLOOKUP_TABLE default\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].writhe << '\n';
+            knotout << knotcurves[c].knotcurve.writhe[i] << '\n';
         }
 
         knotout << "\nSCALARS Twist float\nLOOKUP_TABLE default\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].twist << '\n';
+            knotout << knotcurves[c].knotcurve.twist[i] << '\n';
         }
 
         knotout << "\nSCALARS Length float\nLOOKUP_TABLE default\n";
         for(i=0; i<n; i++)
         {
-            knotout << knotcurves[c].knotcurve[i].length << '\n';
+            knotout << knotcurves[c].knotcurve.length[i] << '\n';
         }
+        profile_output_bytes(knotout.tellp());
         knotout.close();
     }
+    // a print is only ever a few records, so each goes to disk whole, along with the lines it put in the logs
+    if(knotseries.is_open()) knotseries.flush();
+    flush_logs();
 }
 
 void print_B_phi( vector<double>&phi, const Griddata& griddata)
@@ -413,71 +484,356 @@ void print_B_phi( vector<double>&phi, const Griddata& griddata)
     Bout.close();
 }
 
-void print_uv( vector<double>&u, vector<double>&v, vector<double>&ucvx, vector<double>&ucvy, vector<double>&ucvz,vector<double>&ucvmag, double t, const Griddata& griddata)
+// the uv files are written in the background, so the solver isnt held up by the disk. print_uv converts the fields into one of two
+// staging buffers, already as the floats the file wants in the order it wants them, and a writer thread puts each buffer out in
+// one go. the solver only waits if both buffers are still being written when the next print comes round
+struct UVOutputBuffer
 {
-    int Nx = griddata.Nx;
-    int Ny = griddata.Ny;
-    int Nz = griddata.Nz;
-    double h = griddata.h;
-    int i,j,k,n;
-    stringstream ss;
-    ss << "uv_plot" << t << ".vtk";
-    ofstream uvout (ss.str().c_str(),std::ios::binary | std::ios::out);
+    string filename;
+    string header;
+    string suffix;
+    vector<float> data;     // u, then v, then ucvmag, each in the vtk x fastest order
+    double t;
+    int dims[3];
+    double origin[3];
+    double spacing;
+    std::thread writer;
+};
+static UVOutputBuffer uvbuffers[2];
+static int nextuvbuffer = 0;
 
-    uvout << "# vtk DataFile Version 3.0\nUV fields\nBINARY\nDATASET STRUCTURED_POINTS\n";
-    uvout << "DIMENSIONS " << Nx << ' ' << Ny << ' ' << Nz << '\n';
-    uvout << "ORIGIN " << x(0,griddata) << ' ' << y(0,griddata) << ' ' << z(0,griddata) << '\n';
-    uvout << "SPACING " << h << ' ' << h << ' ' << h << '\n';
-    uvout << "POINT_DATA " << Nx*Ny*Nz << '\n';
-    uvout << "SCALARS u float\nLOOKUP_TABLE default\n";
+// the part of the grid a print covers - dims[d] points, stride apart, from start[d]
+struct UVRegion
+{
+    int start[3];
+    int dims[3];
+    int stride;
+};
 
+// FloatSwap, without the union, so the compiler can vectorise it over a whole row
+static inline float bigendianfloat(double value)
+{
+    float f = value;
+    unsigned int b;
+    memcpy(&b,&f,sizeof(float));
+    b = (b >> 24) | ((b >> 8) & 0x0000ff00u) | ((b << 8) & 0x00ff0000u) | (b << 24);
+    memcpy(&f,&b,sizeof(float));
+    return f;
+}
 
-    for(k=0; k<Nz; k++)
+static void write_uv_buffer(UVOutputBuffer* buffer)
+{
+#ifdef USE_HDF5
+    if(UVFormat == HDF5_FILE)
     {
-        for(j=0; j<Ny; j++)
-        {
-            for(i=0; i<Nx; i++)
-            {
-                n = pt(i,j,k,griddata);
-                float val =  FloatSwap(u[n]);
-                uvout.write((char*) &val, sizeof(float));
-            }
-        }
+        hdf5_write_uv(&buffer->data[0],buffer->suffix,buffer->t,buffer->dims,buffer->origin,buffer->spacing);
+        return;
     }
+#endif
+    const size_t blocksize = buffer->data.size()/3;
+    const char* names[3] = {"u","v","ucrossv"};
+    ofstream uvout (buffer->filename.c_str(),std::ios::binary | std::ios::out);
+    uvout << buffer->header;
+    for(int field=0;field<3;field++)
+    {
+        if(field > 0) uvout << "\n";
+        uvout << "SCALARS " << names[field] << " float\nLOOKUP_TABLE default\n";
+        uvout.write((const char*) &buffer->data[field*blocksize], blocksize*sizeof(float));
+    }
+    uvout.close();
+}
 
-    uvout << "\n" << "SCALARS v float\nLOOKUP_TABLE default\n";
+// print the region of the fields, to uv_plot<t><suffix>.vtk (or the HDF5 series suffix). ucvmag is the grid, or a UcvCache
+template <class Magnitudes> static void print_uv_region(const Field& u, const Field& v, const Magnitudes& ucvmag, double t, const Griddata& griddata, const UVRegion& region, const string& suffix)
+{
+    const int Nx = region.dims[0];
+    const int Ny = region.dims[1];
+    const int Nz = region.dims[2];
+    const int stride = region.stride;
+    const int istart = region.start[0];
+    const int jstart = region.start[1];
+    const int kstart = region.start[2];
+    double h = stride*griddata.h;
+    const size_t blocksize = (size_t)Nx*Ny*Nz;
 
+    UVOutputBuffer& buffer = uvbuffers[nextuvbuffer];
+    UVOutputBuffer& otherbuffer = uvbuffers[1 - nextuvbuffer];
+    nextuvbuffer = 1 - nextuvbuffer;
+    if(buffer.writer.joinable()) buffer.writer.join();
 
-    for(k=0; k<Nz; k++)
+    buffer.t = t;
+    buffer.suffix = suffix;
+    buffer.origin[0] = x(istart,griddata);
+    buffer.origin[1] = y(jstart,griddata);
+    buffer.origin[2] = z(kstart,griddata);
+    buffer.spacing = h;
+    for(int d=0;d<3;d++) buffer.dims[d] = region.dims[d];
+    stringstream ss;
+    ss << "uv_plot" << t << suffix << ".vtk";
+    buffer.filename = ss.str();
+    stringstream header;
+    header << "# vtk DataFile Version 3.0\nUV fields\nBINARY\nDATASET STRUCTURED_POINTS\n";
+    header << "DIMENSIONS " << Nx << ' ' << Ny << ' ' << Nz << '\n';
+    header << "ORIGIN " << buffer.origin[0] << ' ' << buffer.origin[1] << ' ' << buffer.origin[2] << '\n';
+    header << "SPACING " << h << ' ' << h << ' ' << h << '\n';
+    header << "POINT_DATA " << Nx*Ny*Nz << '\n';
+    buffer.header = header.str();
+    buffer.data.resize(3*blocksize);
+
+    // the staging copy is the only part the solver waits for. we are inside the single block in main, so it goes out as tasks, a k plane each.
+    // the vtk files are big endian, the HDF5 library takes the floats as they are
+    float* data = &buffer.data[0];
+    const bool bigendian = (UVFormat == VTK_FILES);
+#pragma omp taskloop grainsize(1) default(none) shared(u,v,ucvmag,data,griddata,Nx,Ny,Nz,stride,istart,jstart,kstart,blocksize,bigendian)
+    for(int kk=0; kk<Nz; kk++)
     {
-        for(j=0; j<Ny; j++)
+        for(int jj=0; jj<Ny; jj++)
         {
-            for(i=0; i<Nx; i++)
+            const size_t row = ((size_t)kk*Ny + jj)*Nx;
+            const int rowstart = pt(istart,jstart+jj*stride,kstart+kk*stride,griddata);
+            const int istep = stride*griddata.Ny*griddata.Nz;
+            if(bigendian)
             {
-                n = pt(i,j,k,griddata);
-                float val =  FloatSwap(v[n]);
-                uvout.write( (char*) &val, sizeof(float));
+#pragma omp simd
+                for(int ii=0; ii<Nx; ii++)
+                {
+                    const int n = rowstart + ii*istep;
+                    data[row+ii] = bigendianfloat(u[n]);
+                    data[blocksize+row+ii] = bigendianfloat(v[n]);
+                    data[2*blocksize+row+ii] = bigendianfloat(ucvmag[n]);
+                }
+            }
+            else
+            {
+#pragma omp simd
+                for(int ii=0; ii<Nx; ii++)
+                {
+                    const int n = rowstart + ii*istep;
+                    data[row+ii] = u[n];
+                    data[blocksize+row+ii] = v[n];
+                    data[2*blocksize+row+ii] = ucvmag[n];
+                }
             }
         }
     }
 
-    uvout << "\n" << "SCALARS ucrossv float\nLOOKUP_TABLE default\n";
+    // the prints all go into the one HDF5 file, so they have to be written one at a time, and in order
+    if(UVFormat == HDF5_FILE && otherbuffer.writer.joinable()) otherbuffer.writer.join();
+    buffer.writer = std::thread(write_uv_buffer,&buffer);
+    // what the file gets before any compression
+    profile_output_bytes(buffer.header.size() + buffer.data.size()*sizeof(float));
+}
 
-    for(k=0; k<Nz; k++)
+// the box of grid points within margin of the modded points of the knot. false if there are no points
+static bool knot_region(const vector<knotcurve>& knotcurves, const Griddata& griddata, double margin, UVRegion& region)
+{
+    double lower[3], upper[3];
+    bool found = false;
+    for(unsigned int c=0;c<knotcurves.size();c++)
     {
-        for(j=0; j<Ny; j++)
+        for(unsigned int s=0;s<knotcurves[c].knotcurve.size();s++)
         {
-            for(i=0; i<Nx; i++)
+            const knotpoints& Points = knotcurves[c].knotcurve;
+            const double coords[3] = {Points.modxcoord[s],Points.modycoord[s],Points.modzcoord[s]};
+            for(int d=0;d<3;d++)
             {
-                n = pt(i,j,k,griddata);
-                //float val = FloatSwap(sqrt(ucvx[n]*ucvx[n] + ucvy[n]*ucvy[n] + ucvz[n]*ucvz[n]));
-                float val = FloatSwap(ucvmag[n]);
-                uvout.write( (char*) &val, sizeof(float));
+                if(!found || coords[d] < lower[d]) lower[d] = coords[d];
+                if(!found || coords[d] > upper[d]) upper[d] = coords[d];
             }
+            found = true;
         }
     }
+    if(!found) return false;
+    // x(i) = (i+0.5-Nx/2)h, so the grid point at position p is p/h + Nx/2 - 0.5
+    const int N[3] = {griddata.Nx,griddata.Ny,griddata.Nz};
+    for(int d=0;d<3;d++)
+    {
+        const int first = std::max(0,(int)floor((lower[d]-margin)/griddata.h + N[d]/2.0 - 0.5));
+        const int last = std::min(N[d]-1,(int)ceil((upper[d]+margin)/griddata.h + N[d]/2.0 - 0.5));
+        region.start[d] = first;
+        region.dims[d] = std::max(1,last-first+1);
+    }
+    region.stride = 1;
+    return true;
+}
 
-    uvout.close();
+template <class Magnitudes> static void print_uv_regions(const Field& u, const Field& v, const Magnitudes& ucvmag, const vector<knotcurve>& knotcurves, double t, const Griddata& griddata)
+{
+    UVRegion whole;
+    whole.start[0] = 0; whole.start[1] = 0; whole.start[2] = 0;
+    whole.dims[0] = griddata.Nx; whole.dims[1] = griddata.Ny; whole.dims[2] = griddata.Nz;
+    whole.stride = 1;
+    UVRegion knot;
+    if(ROIMargin > 0 && knot_region(knotcurves,griddata,ROIMargin,knot))
+    {
+        UVRegion coarse = whole;
+        coarse.stride = ROICoarseStride;
+        for(int d=0;d<3;d++) coarse.dims[d] = (whole.dims[d]-1)/ROICoarseStride + 1;
+        print_uv_region(u,v,ucvmag,t,griddata,knot,"_roi");
+        print_uv_region(u,v,ucvmag,t,griddata,coarse,"_coarse");
+    }
+    else
+    {
+        print_uv_region(u,v,ucvmag,t,griddata,whole,"");
+    }
+}
+
+void print_uv( Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz,Field& ucvmag, const vector<knotcurve>& knotcurves, double t, const Griddata& griddata)
+{
+    print_uv_regions(u,v,ucvmag,knotcurves,t,griddata);
+}
+
+void print_uv(Field& u, Field& v, const UcvCache& ucv, const vector<knotcurve>& knotcurves, double t, const Griddata& griddata)
+{
+    print_uv_regions(u,v,ucv,knotcurves,t,griddata);
+}
+
+void finish_output()
+{
+    for(int b=0;b<2;b++) if(uvbuffers[b].writer.joinable()) uvbuffers[b].writer.join();
+#ifdef USE_HDF5
+    hdf5_close();
+#endif
+    if(knotseries.is_open()) knotseries.close();
+    for(map<string,ofstream*>::iterator it=logfiles.begin(); it!=logfiles.end(); ++it) delete it->second;
+    logfiles.clear();
+}
+
+// the checkpoint files. a fixed header, then u and v as raw doubles in the pt() order, so a restart picks up bit for bit where the run
+// left off. they are written in the byte order of the machine, which the header records - in practice little endian
+struct CheckpointHeader
+{
+    char magic[8];
+    int version;
+    int byteorder;      // checkpointbyteorder as written, so a file from a machine of the other endianness is caught
+    int Nx, Ny, Nz;
+    int iteration;
+    int boundarytype;
+    int timestepper;
+    double h;
+    double time;
+    double dtime;
+    double epsilon, beta, gamma;   // the FN parameters it was run with
+};
+static const char checkpointmagic[8] = {'F','N','K','N','O','T','C','K'};
+static const int checkpointversion = 1;
+static const int checkpointbyteorder = 0x01020304;
+
+int write_checkpoint(const Field& u, const Field& v, int iteration, double t, const Griddata& griddata)
+{
+    CheckpointHeader header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,checkpointmagic,sizeof(header.magic));
+    header.version = checkpointversion;
+    header.byteorder = checkpointbyteorder;
+    header.Nx = griddata.Nx;
+    header.Ny = griddata.Ny;
+    header.Nz = griddata.Nz;
+    header.iteration = iteration;
+    header.boundarytype = BoundaryType;
+    header.timestepper = TimeStepper;
+    header.h = griddata.h;
+    header.time = t;
+    header.dtime = dtime;
+    header.epsilon = epsilon;
+    header.beta = beta;
+    header.gamma = gam;
+
+    // written under a temporary name and moved into place, so a run killed part way through never leaves a truncated checkpoint behind
+    stringstream ss;
+    ss << "checkpoint" << t << ".chk";
+    const string filename = ss.str();
+    const string partialfilename = filename + ".part";
+    ofstream chkout (partialfilename.c_str(),std::ios::binary | std::ios::out);
+    const size_t gridsize = (size_t)griddata.Nx*griddata.Ny*griddata.Nz;
+#ifdef FLOAT_FIELDS
+    // checkpoints are doubles whatever the fields are stored as
+    const vector<double> ud(u.begin(),u.end()), vd(v.begin(),v.end());
+#else
+    const vector<double>& ud = u;
+    const vector<double>& vd = v;
+#endif
+    chkout.write((const char*) &header, sizeof(header));
+    chkout.write((const char*) &ud[0], gridsize*sizeof(double));
+    chkout.write((const char*) &vd[0], gridsize*sizeof(double));
+    chkout.close();
+    if(!chkout || rename(partialfilename.c_str(),filename.c_str()) != 0)
+    {
+        cout << "Couldn't write the checkpoint " << filename << "\n";
+        return 1;
+    }
+    profile_output_bytes(sizeof(header) + 2*gridsize*sizeof(double));
+    return 0;
+}
+
+int checkpoint_read(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Griddata& griddata, int& iteration)
+{
+    const int fd = open(B_filename.c_str(),O_RDONLY);
+    if(fd < 0)
+    {
+        cout << "Couldn't open the checkpoint " << B_filename << "\n";
+        return 1;
+    }
+    struct stat filestat;
+    if(fstat(fd,&filestat) != 0 || filestat.st_size < (off_t)sizeof(CheckpointHeader))
+    {
+        cout << B_filename << " is too short to be a checkpoint\n";
+        close(fd);
+        return 1;
+    }
+    // map the file straight in, rather than reading it through a stream, and copy it out in parallel
+    void* mapped = mmap(NULL,filestat.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(mapped == MAP_FAILED)
+    {
+        cout << "Couldn't map the checkpoint " << B_filename << "\n";
+        return 1;
+    }
+    CheckpointHeader header;
+    memcpy(&header,mapped,sizeof(header));
+    const size_t gridsize = (size_t)header.Nx*header.Ny*header.Nz;
+    string problem;
+    if(memcmp(header.magic,checkpointmagic,sizeof(header.magic)) != 0) problem = " isn't a checkpoint file";
+    else if(header.version != checkpointversion) problem = " was written by a different version of the code";
+    else if(header.byteorder != checkpointbyteorder) problem = " was written on a machine of the other endianness";
+    else if((size_t)filestat.st_size != sizeof(header) + 2*gridsize*sizeof(double)) problem = " is the wrong size for the grid in its header";
+    if(!problem.empty())
+    {
+        cout << B_filename << problem << "\n";
+        munmap(mapped,filestat.st_size);
+        return 1;
+    }
+
+    // the run carries on with whatever the parameters say, but it is only an exact continuation if they havent changed
+    if(header.boundarytype != BoundaryType || header.timestepper != TimeStepper || header.dtime != dtime || header.epsilon != epsilon || header.beta != beta || header.gamma != gam)
+    {
+        cout << "Warning: the boundary condition, time stepping or FN parameters differ from the ones " << B_filename << " was written with\n";
+    }
+
+    griddata.Nx = header.Nx;
+    griddata.Ny = header.Ny;
+    griddata.Nz = header.Nz;
+    griddata.h = header.h;
+    iteration = header.iteration;
+    u.resize(gridsize);
+    v.resize(gridsize);
+    if(!LeanMemory)
+    {
+        ucvx.resize(gridsize);
+        ucvy.resize(gridsize);
+        ucvz.resize(gridsize);
+        ucvmag.resize(gridsize);
+    }
+    const double* fields = (const double*)((const char*)mapped + sizeof(header));
+    const long n = gridsize;
+#pragma omp parallel for
+    for(long i=0;i<n;i++)
+    {
+        u[i] = fields[i];
+        v[i] = fields[n+i];
+    }
+    munmap(mapped,filestat.st_size);
+    return 0;
 }
 
 float FloatSwap( float f )
@@ -505,3 +861,240 @@ void ByteSwap(const char* TobeSwapped, char* swapped )
     swapped[3] = TobeSwapped[0];
     return;
 }
+
+bool read_file(const string& filename, string& contents)
+{
+    ifstream fin (filename.c_str(),std::ios::in | std::ios::binary | std::ios::ate);
+    if(!fin.good()) return false;
+    const std::streamoff size = fin.tellg();
+    contents.resize(size);
+    fin.seekg(0);
+    if(size > 0) fin.read(&contents[0],size);
+    return fin.good();
+}
+
+void split_lines(string& contents, vector<const char*>& lines)
+{
+    lines.clear();
+    char* start = &contents[0];
+    char* const end = start + contents.size();
+    while(start < end)
+    {
+        lines.push_back(start);
+        char* newline = (char*)memchr(start,'\n',end-start);
+        if(newline == NULL) break;
+        *newline = '\0';
+        if(newline > start && newline[-1] == '\r') newline[-1] = '\0';
+        start = newline+1;
+    }
+}
+
+const char* skip_words(const char* line, int n)
+{
+    for(int w=0; w<n; w++)
+    {
+        while(isspace(*line)) line++;
+        while(*line != '\0' && !isspace(*line)) line++;
+    }
+    return line;
+}
+
+int read_parameters(int argc, char** argv)
+{
+    // any argument with an '=' in it is a KEY=VALUE override, anything else is the name of the parameter file
+    string parameterfilename = "parameters";
+    vector<string> overrides;
+    for(int i=1;i<argc;i++)
+    {
+        string arg = argv[i];
+        if(arg.find('=') == string::npos) parameterfilename = arg;
+        else overrides.push_back(arg);
+    }
+
+    ifstream fin (parameterfilename.c_str());
+    if(!fin.good())
+    {
+        cout << "Couldn't open the parameter file " << parameterfilename << "\n";
+        return 1;
+    }
+    string buff;
+    while(getline(fin,buff))
+    {
+        if(set_parameter(buff)) return 1;
+    }
+    fin.close();
+    // the command line wins over the file
+    for(unsigned int i=0;i<overrides.size();i++)
+    {
+        if(set_parameter(overrides[i])) return 1;
+    }
+
+    if(AnalysisThreads > 0 && RefineMargin > 0)
+    {
+        if(decomposition.rank == 0) cout << "The refined patches follow the knot as soon as it is traced, INSERT_ANALYSIS_THREADS has to be 0 with them\n";
+        return 1;
+    }
+    if(LeanMemory && RefineMargin > 0)
+    {
+        if(decomposition.rank == 0) cout << "The refined patches fill the grad u x grad v grids, INSERT_LEAN_MEMORY has to be 0 with them\n";
+        return 1;
+    }
+
+    // now the quantities which are derived from the ones we just read
+    NumSlopeGrids = (TimeStepper == RK4CLASSIC) ? 3 : 1;
+    xmax = 8*initialNx*initialh/10.0;
+    ymax = 8*initialNy*initialh/10.0;
+    zmax = 8*initialNz*initialh/10.0;
+    return 0;
+}
+
+static string trim_whitespace(const string& text)
+{
+    size_t start = 0;
+    size_t end = text.size();
+    while(start < end && isspace(text[start])) start++;
+    while(end > start && isspace(text[end-1])) end--;
+    return text.substr(start,end-start);
+}
+
+int set_parameter(const string& line)
+{
+    // trim the whitespace off the ends of the key and the value, and skip blank lines, comments, and bare keys with no value (as in
+    // the job start templates). whitespace inside a value is kept, so a quoted one can have spaces in it
+    const string trimmed = trim_whitespace(line);
+    size_t equalspos = trimmed.find('=');
+    if(trimmed.empty() || trimmed[0]=='#' || equalspos == string::npos) return 0;
+
+    string key = trim_whitespace(trimmed.substr(0,equalspos));
+    string value = trim_whitespace(trimmed.substr(equalspos+1));
+    // the INSERT_ can be left off, the shell style quotes round strings are dropped
+    if(key.compare(0,7,"INSERT_") != 0) key = "INSERT_" + key;
+    if(value.size()>=2 && (value[0]=='"' || value[0]=='\'') && value[value.size()-1]==value[0]) value = value.substr(1,value.size()-2);
+
+    stringstream ss(value);
+    bool ok = true;
+    if(key == "INSERT_INITIALISATION_TYPE")
+    {
+        if(value == "FROM_SURFACE_FILE") option = FROM_SURFACE_FILE;
+        else if(value == "FROM_CURVE_FILE") option = FROM_CURVE_FILE;
+        else if(value == "FROM_UV_FILE") option = FROM_UV_FILE;
+        else if(value == "FROM_FUNCTION") option = FROM_FUNCTION;
+        else if(value == "FROM_CHECKPOINT_FILE") option = FROM_CHECKPOINT_FILE;
+        else ok = false;
+    }
+    else if(key == "INSERT_BOUNDARY_TYPE")
+    {
+        if(value == "ALLREFLECTING") BoundaryType = ALLREFLECTING;
+        else if(value == "ZPERIODIC") BoundaryType = ZPERIODIC;
+        else if(value == "ALLPERIODIC") BoundaryType = ALLPERIODIC;
+        else ok = false;
+    }
+    else if(key == "INSERT_RK_SCHEME")
+    {
+        if(value == "RK4CLASSIC") TimeStepper = RK4CLASSIC;
+        else if(value == "RK4LOWSTORAGE") TimeStepper = RK4LOWSTORAGE;
+        else ok = false;
+    }
+    else if(key == "INSERT_UV_FORMAT")
+    {
+        if(value == "VTK_FILES") UVFormat = VTK_FILES;
+        else if(value == "HDF5_FILE")
+        {
+#ifdef USE_HDF5
+            UVFormat = HDF5_FILE;
+#else
+            cout << "This build has no HDF5 output, build it with make hdf5 to use " << value << "\n";
+            return 1;
+#endif
+        }
+        else ok = false;
+    }
+    else if(key == "INSERT_HDF5_COMPRESSION") ok = (ss >> HDF5Compression) && ss.eof() && HDF5Compression >= 0 && HDF5Compression <= 9;
+    else if(key == "INSERT_HDF5_DIGITS") ok = (ss >> HDF5Digits) && ss.eof() && HDF5Digits >= -1;
+    else if(key == "INSERT_KNOT_FORMAT")
+    {
+        if(value == "VTK_KNOTPLOTS") KnotFormat = VTK_KNOTPLOTS;
+        else if(value == "KNOT_SERIES") KnotFormat = KNOT_SERIES;
+        else ok = false;
+    }
+    else if(key == "INSERT_ROI_MARGIN") ok = (ss >> ROIMargin) && ss.eof() && ROIMargin >= 0;
+    else if(key == "INSERT_ROI_COARSE_STRIDE") ok = (ss >> ROICoarseStride) && ss.eof() && ROICoarseStride >= 1;
+    else if(key == "INSERT_ACTIVE_THRESHOLD")
+    {
+        ok = (ss >> ActiveThreshold) && ss.eof() && ActiveThreshold >= 0;
+#ifdef USE_GPU
+        if(ok && ActiveThreshold > 0)
+        {
+            cout << "The GPU backend always steps the whole grid, " << key << " has to be 0\n";
+            return 1;
+        }
+#endif
+    }
+    else if(key == "INSERT_ACTIVE_CHECKTIME") ok = (ss >> ActiveCheckTime) && ss.eof() && ActiveCheckTime > 0;
+    else if(key == "INSERT_REFINE_MARGIN")
+    {
+        ok = (ss >> RefineMargin) && ss.eof() && RefineMargin >= 0;
+#ifdef USE_GPU
+        if(ok && RefineMargin > 0)
+        {
+            cout << "The GPU backend has no refined patches, " << key << " has to be 0\n";
+            return 1;
+        }
+#endif
+        if(ok && RefineMargin > 0 && decomposition.numranks > 1)
+        {
+            if(decomposition.rank == 0) cout << "The refined patches need the whole grid on one rank, " << key << " has to be 0 with more than one\n";
+            return 1;
+        }
+    }
+    else if(key == "INSERT_ANALYSIS_THREADS") ok = (ss >> AnalysisThreads) && ss.eof() && AnalysisThreads >= 0;
+    else if(key == "INSERT_ANALYSIS_SNAPSHOTS") ok = (ss >> AnalysisSnapshots) && ss.eof() && AnalysisSnapshots >= 1;
+    else if(key == "INSERT_LEAN_MEMORY")
+    {
+        ok = (ss >> LeanMemory) && ss.eof();
+#ifdef USE_GPU
+        if(ok && LeanMemory)
+        {
+            cout << "The GPU backend keeps the gradients on the device, " << key << " has to be 0\n";
+            return 1;
+        }
+#endif
+    }
+    else if(key == "INSERT_SURFACE_FILENAME") knot_filename = value;
+    else if(key == "INSERT_UV_FILENAME") B_filename = value;
+    else if(key == "INSERT_NUM_COMPONENTS") ok = (ss >> NumComponents) && ss.eof();
+    else if(key == "INSERT_SOLIDANGLE_TOLERANCE") ok = (ss >> SolidAngleTolerance) && ss.eof() && SolidAngleTolerance >= 0;
+    else if(key == "INSERT_PRESERVE_RATIOS") ok = (ss >> PreserveRatios) && ss.eof();
+    else if(key == "INSERT_RUNTIME") ok = (ss >> TTime) && ss.eof();
+    else if(key == "INSERT_UVPRINTTIME") ok = (ss >> UVPrintTime) && ss.eof();
+    else if(key == "INSERT_VELOCITYPRINTTIME") ok = (ss >> VelocityKnotplotPrintTime) && ss.eof();
+    else if(key == "INSERT_FREQUENTPRINTTIME") ok = (ss >> FrequentKnotplotPrintTime) && ss.eof();
+    else if(key == "INSERT_SKIPTIME") ok = (ss >> InitialSkipTime) && ss.eof();
+    else if(key == "INSERT_CHECKPOINTTIME") ok = (ss >> CheckpointTime) && ss.eof() && CheckpointTime >= 0;
+    else if(key == "INSERT_PERF_LOG_TIME") ok = (ss >> PerfLogTime) && ss.eof() && PerfLogTime >= 0;
+    else if(key == "INSERT_GRIDSPACING") ok = (ss >> initialh) && ss.eof();
+    else if(key == "INSERT_NX") ok = (ss >> initialNx) && ss.eof();
+    else if(key == "INSERT_NY") ok = (ss >> initialNy) && ss.eof();
+    else if(key == "INSERT_NZ") ok = (ss >> initialNz) && ss.eof();
+    else if(key == "INSERT_INTERPOLATION_FLAG") ok = (ss >> interpolationflag) && ss.eof();
+    else if(key == "INSERT_INTERPOLATED_NX") ok = (ss >> interpolatedNx) && ss.eof();
+    else if(key == "INSERT_INTERPOLATED_NY") ok = (ss >> interpolatedNy) && ss.eof();
+    else if(key == "INSERT_INTERPOLATED_NZ") ok = (ss >> interpolatedNz) && ss.eof();
+    else if(key == "INSERT_TIMESTEP") ok = (ss >> dtime) && ss.eof();
+    else if(key == "INSERT_EPSILON") ok = (ss >> epsilon) && ss.eof();
+    else if(key == "INSERT_BETA") ok = (ss >> beta) && ss.eof();
+    else if(key == "INSERT_GAMMA") ok = (ss >> gam) && ss.eof();
+    else
+    {
+        // old parameter files carry a few keys nothing reads (INSERT_RADIUS), so this is only a warning
+        cout << "Ignoring unknown parameter " << key << "\n";
+        return 0;
+    }
+
+    if(!ok)
+    {
+        cout << "Couldn't understand the value " << value << " given for " << key << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -6,14 +6,35 @@ using namespace std;
 #define READINGWRITING_H
 
 void print_B_phi(vector<double>&phi, const Griddata &griddata);
-void print_uv(vector<double>&u, vector<double>&v, vector<double>&ucvx, vector<double>&ucvy, vector<double>&ucvz, vector<double>&ucvmag, double t, const Griddata &griddata);
+// the file is written by a background thread, print_uv returns once the fields are copied.
+// knotcurves is the last traced knot, which the region of interest output (INSERT_ROI_MARGIN) prints round
+void print_uv(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, const vector<knotcurve>& knotcurves, double t, const Griddata &griddata);
+// the same, with |grad u x grad v| from a UcvCache (see Gradients.h)
+void print_uv(Field& u, Field& v, const UcvCache& ucv, const vector<knotcurve>& knotcurves, double t, const Griddata &griddata);
+// the knotplot vtk files, or a record each in knotplots.bin (INSERT_KNOT_FORMAT), and a line each in the globaldata logs
 void print_knot(double t, vector<knotcurve>& knotcurves, const Griddata &griddata);
-void print_sensor_point(double CurrentTime, viewpoint sensorpoint, vector<double>&u,Griddata griddata);
-int uvfile_read(vector<double>&u, vector<double>&v, vector<double>& ku, vector<double>& kv, vector<double>& ucvx, vector<double>& ucvy, vector<double>& ucvz, vector<double> &ucvmag, Griddata &griddata);
-int uvfile_read_ASCII(vector<double>&u, vector<double>&v, const Griddata &griddata); // for legacy purposes
-int uvfile_read_BINARY(vector<double>&u, vector<double>&v, const Griddata &griddata);
+void print_sensor_point(double CurrentTime, viewpoint sensorpoint, Field& u,Griddata griddata);
+// the scalar logs are kept open and buffered. flush_logs puts everything so far on disk
+void flush_logs();
+// at the end of the run: wait for any uv writes still going, and close every output file
+void finish_output();
+int uvfile_read(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Griddata &griddata);
+// the native restart files. write_checkpoint writes u and v at full precision, with the grid, time and run parameters, to checkpoint<t>.chk.
+// checkpoint_read loads the one named by B_filename, resizing the fields to its grid, and gives the iteration it was written at
+int write_checkpoint(const Field& u, const Field& v, int iteration, double t, const Griddata &griddata);
+int checkpoint_read(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, Griddata &griddata, int& iteration);
+int uvfile_read_ASCII(Field& u, Field& v, const Griddata &griddata); // for legacy purposes
+int uvfile_read_BINARY(Field& u, Field& v, const Griddata &griddata);
+int read_parameters(int argc, char** argv); // fill the (RUNTIME) options in FN_Constants.h from the parameter file and the command line
+int set_parameter(const string& line); // apply a single KEY=VALUE line
 float FloatSwap( float f );
 void ByteSwap(const char* TobeSwapped, char* swapped );
+// for the readers which parse a file in parallel: read_file reads the whole of it in one go, split_lines then splits it into lines as
+// getline would, replacing the '\n's (and any '\r's before them) with nulls so each line can be parsed in place, by strtod after
+// skip_words has passed over the words at its start. the lines point into contents, so it has to be kept while they are used
+bool read_file(const string& filename, string& contents);
+void split_lines(string& contents, vector<const char*>& lines);
+const char* skip_words(const char* line, int n);
 
 
 #endif //READINGWRITING_H
@@ -0,0 +1,396 @@
+#include "Refinement.h"
+#include "FN_Constants.h"
+#include "Stencil.h"
+#include <math.h>
+#include <algorithm>
+
+vector<Patch> patches;
+
+// where the grid cells lower-1 to upper round a patch are kept
+static int box_index(const Patch& patch, int i, int j, int k)
+{
+    const int by = patch.upper[1] - patch.lower[1] + 2;
+    const int bz = patch.upper[2] - patch.lower[2] + 2;
+    return ((i - patch.lower[0] + 1)*by + (j - patch.lower[1] + 1))*bz + (k - patch.lower[2] + 1);
+}
+
+static int box_size(const Patch& patch)
+{
+    return (patch.upper[0] - patch.lower[0] + 2)*(patch.upper[1] - patch.lower[1] + 2)*(patch.upper[2] - patch.lower[2] + 2);
+}
+
+// the grid cells lower-1 to upper of planes ifirst to ilast
+static void copy_box(const Field& grid, const Griddata& griddata, const Patch& patch, Field& box, int ifirst, int ilast)
+{
+    for(int i=ifirst;i<=ilast;i++)
+    {
+        for(int j=patch.lower[1]-1;j<=patch.upper[1];j++)
+        {
+            const int row = pt(i,j,0,griddata);
+            const int boxrow = box_index(patch,i,j,0);
+            for(int k=patch.lower[2]-1;k<=patch.upper[2];k++) box[boxrow+k] = grid[row+k];
+        }
+    }
+}
+
+// fine point a of a patch starting at grid cell lower sits at this grid cell, fractionally. the ghost points, a = -1 and a = N,
+// come out between lower-1 and upper
+static inline double fine_to_coarse(int a, int lower)
+{
+    return lower + (a + 0.5)/RefineRatio - 0.5;
+}
+
+static double trilinear(const Field& box, const Patch& patch, const double c[3])
+{
+    int base[3];
+    double w[3];
+    for(int d=0;d<3;d++)
+    {
+        base[d] = (int)floor(c[d]);
+        w[d] = c[d] - base[d];
+    }
+    double value = 0;
+    for(int corner=0;corner<8;corner++)
+    {
+        const int di = corner>>2;
+        const int dj = (corner>>1)&1;
+        const int dk = corner&1;
+        const double weight = (di ? w[0] : 1-w[0])*(dj ? w[1] : 1-w[1])*(dk ? w[2] : 1-w[2]);
+        if(weight != 0) value += weight*box[box_index(patch,base[0]+di,base[1]+dj,base[2]+dk)];
+    }
+    return value;
+}
+
+// the ghost faces of a padded patch grid, from the grid a fraction alpha of the way through its step. serial, it is only O(N^2)
+static void fill_patch_halo(const Patch& patch, Field& padded, double alpha)
+{
+    const Griddata& fine = patch.griddata;
+    const int N[3] = {fine.Nx,fine.Ny,fine.Nz};
+    for(int face=0;face<6;face++)
+    {
+        const int d = face/2;
+        const int d1 = (d+1)%3;
+        const int d2 = (d+2)%3;
+        int a[3];
+        a[d] = (face%2==0) ? -1 : N[d];
+        for(a[d1]=0;a[d1]<N[d1];a[d1]++)
+        {
+            for(a[d2]=0;a[d2]<N[d2];a[d2]++)
+            {
+                double c[3];
+                for(int e=0;e<3;e++) c[e] = fine_to_coarse(a[e],patch.lower[e]);
+                padded[padpt(a[0],a[1],a[2],fine)] = (1-alpha)*trilinear(patch.coarseold,patch,c) + alpha*trilinear(patch.coarsenew,patch,c);
+            }
+        }
+    }
+}
+
+void regrid_patches(const vector<knotcurve>& knotcurves, const Field& u, const Field& v, const Griddata& griddata)
+{
+    const int N[3] = {griddata.Nx,griddata.Ny,griddata.Nz};
+    const double h = griddata.h;
+
+    // a box round each component, from its points modded into the grid. x(i) = (i+0.5-Nx/2)h, so position p is at cell p/h + Nx/2 - 0.5
+    vector<Patch> newpatches;
+    for(unsigned int c=0;c<knotcurves.size();c++)
+    {
+        const knotpoints& points = knotcurves[c].knotcurve;
+        if(points.empty()) continue;
+        const vector<double>* coords[3] = {&points.modxcoord,&points.modycoord,&points.modzcoord};
+        double lowest[3], highest[3];
+        for(int d=0;d<3;d++)
+        {
+            lowest[d] = *std::min_element(coords[d]->begin(),coords[d]->end());
+            highest[d] = *std::max_element(coords[d]->begin(),coords[d]->end());
+        }
+        Patch patch;
+        bool empty = false;
+        for(int d=0;d<3;d++)
+        {
+            patch.lower[d] = std::max(2,(int)floor((lowest[d]-RefineMargin)/h + N[d]/2.0 - 0.5));
+            patch.upper[d] = std::min(N[d]-2,(int)ceil((highest[d]+RefineMargin)/h + N[d]/2.0 - 0.5) + 1);
+            if(patch.upper[d] <= patch.lower[d]) empty = true;
+        }
+        if(!empty) newpatches.push_back(patch);
+    }
+    // boxes which overlap or touch become one, until none do
+    bool merged = true;
+    while(merged)
+    {
+        merged = false;
+        for(unsigned int a=0;a<newpatches.size() && !merged;a++)
+        {
+            for(unsigned int b=a+1;b<newpatches.size() && !merged;b++)
+            {
+                bool touching = true;
+                for(int d=0;d<3;d++) if(newpatches[a].lower[d] > newpatches[b].upper[d] || newpatches[b].lower[d] > newpatches[a].upper[d]) touching = false;
+                if(touching)
+                {
+                    for(int d=0;d<3;d++)
+                    {
+                        newpatches[a].lower[d] = std::min(newpatches[a].lower[d],newpatches[b].lower[d]);
+                        newpatches[a].upper[d] = std::max(newpatches[a].upper[d],newpatches[b].upper[d]);
+                    }
+                    newpatches.erase(newpatches.begin()+b);
+                    merged = true;
+                }
+            }
+        }
+    }
+
+    long long finepoints = 0;
+    for(unsigned int p=0;p<newpatches.size();p++)
+    {
+        Patch& patch = newpatches[p];
+        patch.griddata.Nx = RefineRatio*(patch.upper[0]-patch.lower[0]);
+        patch.griddata.Ny = RefineRatio*(patch.upper[1]-patch.lower[1]);
+        patch.griddata.Nz = RefineRatio*(patch.upper[2]-patch.lower[2]);
+        patch.griddata.h = h/RefineRatio;
+        const Griddata& fine = patch.griddata;
+        const int finesize = fine.Nx*fine.Ny*fine.Nz;
+        finepoints += finesize;
+        patch.u.resize(finesize);
+        patch.v.resize(finesize);
+        patch.ku.assign(3*finesize,0);
+        patch.kv.assign(3*finesize,0);
+        patch.padA.resize(padsize(fine));
+        patch.padB.resize(padsize(fine));
+        patch.coarseold.resize(box_size(patch));
+        patch.coarsenew.resize(box_size(patch));
+        // the grid round the patch, to interpolate from where no old patch was
+        Field ubox(box_size(patch)), vbox(box_size(patch));
+        copy_box(u,griddata,patch,ubox,patch.lower[0]-1,patch.upper[0]);
+        copy_box(v,griddata,patch,vbox,patch.lower[0]-1,patch.upper[0]);
+        // we are inside the single block in main, so the planes go out as tasks
+#pragma omp taskloop grainsize(1) default(none) shared(patch,fine,ubox,vbox,patches)
+        for(int a=0;a<fine.Nx;a++)
+        {
+            for(int b=0;b<fine.Ny;b++)
+            {
+                for(int c=0;c<fine.Nz;c++)
+                {
+                    const int n = pt(a,b,c,fine);
+                    // the fine points of every patch sit on the one lattice, RefineRatio times finer than the grid
+                    const int global[3] = {RefineRatio*patch.lower[0]+a,RefineRatio*patch.lower[1]+b,RefineRatio*patch.lower[2]+c};
+                    bool found = false;
+                    for(unsigned int q=0;q<patches.size() && !found;q++)
+                    {
+                        const Patch& old = patches[q];
+                        int local[3];
+                        found = true;
+                        for(int d=0;d<3;d++)
+                        {
+                            local[d] = global[d] - RefineRatio*old.lower[d];
+                            if(local[d] < 0 || local[d] >= RefineRatio*(old.upper[d]-old.lower[d])) found = false;
+                        }
+                        if(found)
+                        {
+                            const int m = pt(local[0],local[1],local[2],old.griddata);
+                            patch.u[n] = old.u[m];
+                            patch.v[n] = old.v[m];
+                        }
+                    }
+                    if(!found)
+                    {
+                        const double coords[3] = {fine_to_coarse(a,patch.lower[0]),fine_to_coarse(b,patch.lower[1]),fine_to_coarse(c,patch.lower[2])};
+                        patch.u[n] = trilinear(ubox,patch,coords);
+                        patch.v[n] = trilinear(vbox,patch,coords);
+                    }
+                }
+            }
+        }
+    }
+    patches.swap(newpatches);
+
+    if(!patches.empty())
+    {
+        cout << "Refined " << patches.size() << " patches, " << 100.0*finepoints/((double)RefineRatio*RefineRatio*RefineRatio*N[0]*N[1]*N[2]) << "% of the grid\n";
+        // the fine steps are the diffusive limit of the classic Runge-Kutta that much closer
+        static bool warned = false;
+        const double fineh = h/RefineRatio;
+        if(!warned && dtime/RefineRatio > 0.2*fineh*fineh)
+        {
+            cout << "Warning - a time step of " << dtime/RefineRatio << " may be too long for the patch spacing of " << fineh << "\n";
+            warned = true;
+        }
+    }
+}
+
+void save_patch_boundaries(const Field& u, const Griddata& griddata)
+{
+    for(unsigned int p=0;p<patches.size();p++)
+    {
+        Patch& patch = patches[p];
+#pragma omp for
+        for(int i=patch.lower[0]-1;i<=patch.upper[0];i++) copy_box(u,griddata,patch,patch.coarseold,i,i);
+    }
+}
+
+// one fine step of dt/RefineRatio, the substep'th of the grid's step. the same classic Runge-Kutta as uv_update_rk4, with the ghost
+// layer interpolated from the grid at each stage time rather than filled by the boundary condition
+static void step_patch(Patch& patch, int substep)
+{
+    const Griddata& griddata = patch.griddata;
+    const int Nx = griddata.Nx;
+    const int Ny = griddata.Ny;
+    const int Nz = griddata.Nz;
+    const double h = griddata.h;
+    const int arraysize = Nx*Ny*Nz;
+    const int sx = (Ny+2)*(Nz+2);
+    const int sy = Nz+2;
+    Field& u = patch.u;
+    Field& v = patch.v;
+    Field& ku = patch.ku;
+    Field& kv = patch.kv;
+    Field& padA = patch.padA;
+    Field& padB = patch.padB;
+
+    const double eps = epsilon;
+    const double bet = beta;
+    const double gm = gam;
+    const double dt = dtime/RefineRatio;
+    const double sixth = 1.0/6.0;
+    const double ONETHIRD = 1.0/3.0;
+    const double oneoverepsilon = 1.0/eps;
+    const double oneoverhsq = 1.0/(h*h);
+    const double inc[4] = {0, 0.5, 0.5, 1};
+
+#pragma omp for
+    for(int i=0;i<Nx;i++)
+    {
+        for(int j=0; j<Ny; j++)
+        {
+            const int row = pt(i,j,0,griddata);
+            const int padrow = padpt(i,j,0,griddata);
+            for(int k=0; k<Nz; k++) padA[padrow+k] = u[row+k];
+        }
+    }
+#pragma omp single
+    fill_patch_halo(patch,padA,(double)substep/RefineRatio);
+
+    for(int l=0;l<4;l++)
+    {
+        const double vinc = dt*inc[l];
+        const double nextinc = (l<3) ? dt*inc[l+1] : 0;
+        const double dtsixth = dt*sixth;
+#pragma omp for collapse(2)
+        for(int i=0;i<Nx;i++)
+        {
+            for(int j=0; j<Ny; j++)
+            {
+                const int row = pt(i,j,0,griddata);
+                const fieldvalue* s = &padA[padpt(i,j,0,griddata)];
+                fieldvalue* snext = &padB[padpt(i,j,0,griddata)];
+#pragma omp simd
+                for(int k=0; k<Nz; k++)   //Central difference
+                {
+                    const int n = row + k;
+                    const double currentu = s[k];
+                    const double currentv = (l==0) ? v[n] : v[n] + vinc*kv[(l-1)*arraysize+n];
+                    const double D2u = oneoverhsq*((double)s[k+sx] + s[k-sx] + s[k+sy] + s[k-sy] + s[k+1] + s[k-1] - 6.0*currentu);
+                    const double kun = oneoverepsilon*(currentu - (ONETHIRD*currentu)*(currentu*currentu) - currentv) + D2u;
+                    const double kvn = eps*(currentu + bet - gm*currentv);
+                    if(l<3)
+                    {
+                        ku[l*arraysize+n] = kun;
+                        kv[l*arraysize+n] = kvn;
+                        snext[k] = u[n] + nextinc*kun;
+                    }
+                    else
+                    {
+                        u[n] = u[n] + dtsixth*((double)ku[n]+2*ku[arraysize+n]+2*ku[2*arraysize+n]+kun);
+                        v[n] = v[n] + dtsixth*((double)kv[n]+2*kv[arraysize+n]+2*kv[2*arraysize+n]+kvn);
+                    }
+                }
+            }
+        }
+        if(l<3)
+        {
+#pragma omp single
+            {
+                fill_patch_halo(patch,padB,(substep + inc[l+1])/RefineRatio);
+                padA.swap(padB);
+            }
+        }
+    }
+}
+
+bool step_patches(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata& griddata)
+{
+    // the patches only change in the single in main, so every thread agrees on this
+    if(patches.empty()) return false;
+    const int R3 = RefineRatio*RefineRatio*RefineRatio;
+    for(unsigned int p=0;p<patches.size();p++)
+    {
+        Patch& patch = patches[p];
+#pragma omp for
+        for(int i=patch.lower[0]-1;i<=patch.upper[0];i++) copy_box(u,griddata,patch,patch.coarsenew,i,i);
+        for(int substep=0;substep<RefineRatio;substep++) step_patch(patch,substep);
+        // each grid cell under the patch takes the average of the fine points in it
+        const Griddata& fine = patch.griddata;
+#pragma omp for
+        for(int i=patch.lower[0];i<patch.upper[0];i++)
+        {
+            for(int j=patch.lower[1];j<patch.upper[1];j++)
+            {
+                for(int k=patch.lower[2];k<patch.upper[2];k++)
+                {
+                    double usum = 0;
+                    double vsum = 0;
+                    for(int child=0;child<R3;child++)
+                    {
+                        const int a = RefineRatio*(i-patch.lower[0]) + child/(RefineRatio*RefineRatio);
+                        const int b = RefineRatio*(j-patch.lower[1]) + (child/RefineRatio)%RefineRatio;
+                        const int c = RefineRatio*(k-patch.lower[2]) + child%RefineRatio;
+                        const int m = pt(a,b,c,fine);
+                        usum += patch.u[m];
+                        vsum += patch.v[m];
+                    }
+                    const int n = pt(i,j,k,griddata);
+                    u[n] = usum/R3;
+                    v[n] = vsum/R3;
+                }
+            }
+        }
+    }
+    // the gradients the grid's update worked out are out of date on the patches and the cells next to them. the patches keep two
+    // cells clear of the edges, so these all have neighbours on every side
+    if(computegradients)
+    {
+        const double h = griddata.h;
+        const int sx = griddata.Ny*griddata.Nz;
+        const int sy = griddata.Nz;
+        for(unsigned int p=0;p<patches.size();p++)
+        {
+            const Patch& patch = patches[p];
+#pragma omp for
+            for(int i=patch.lower[0]-1;i<=patch.upper[0];i++)
+            {
+                for(int j=patch.lower[1]-1;j<=patch.upper[1];j++)
+                {
+                    for(int k=patch.lower[2]-1;k<=patch.upper[2];k++)
+                    {
+                        const int n = pt(i,j,k,griddata);
+                        const double dxu = 0.5*(u[n+sx]-u[n-sx])/h;
+                        const double dxv = 0.5*(v[n+sx]-v[n-sx])/h;
+                        const double dyu = 0.5*(u[n+sy]-u[n-sy])/h;
+                        const double dyv = 0.5*(v[n+sy]-v[n-sy])/h;
+                        const double dzu = 0.5*(u[n+1]-u[n-1])/h;
+                        const double dzv = 0.5*(v[n+1]-v[n-1])/h;
+                        ucvx[n] = dyu*dzv - dzu*dyv;
+                        ucvy[n] = dzu*dxv - dxu*dzv;    //Grad u cross Grad v
+                        ucvz[n] = dxu*dyv - dyu*dxv;
+                        ucvmag[n] = sqrt(ucvx[n]*ucvx[n] + ucvy[n]*ucvy[n] + ucvz[n]*ucvz[n]);
+                    }
+                }
+            }
+        }
+    }
+    // the grid under the patches has moved, so with active block stepping (Stencil.h) those blocks have to be stepped next time
+    if(ActiveThreshold > 0)
+    {
+#pragma omp single
+        for(unsigned int p=0;p<patches.size();p++) activate_blocks(patches[p].lower,patches[p].upper);
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+#include "FN_Knot.h"
+using namespace std;
+
+#ifndef REFINEMENT_H
+#define REFINEMENT_H
+
+/* refined patches round the vortex lines. with INSERT_REFINE_MARGIN above 0, each traced component gets a box of the grid round it,
+   pushed out by the margin, which is covered by a patch RefineRatio times finer. boxes which overlap are merged. the patches are made
+   again every time the knot is traced, starting from the old patches where they overlap and from the grid everywhere else.
+   each step of the grid is followed by RefineRatio steps of each patch, of dt/RefineRatio. the ghost layer of a patch comes from the
+   grid, interpolated in space (trilinear) and in time (linearly, between the grid before and after its step) to each stage of the
+   fine Runge-Kutta. afterwards the grid under the patch is set to the average of the fine points in each of its cells, so the curve
+   tracing and the output see the patches through the grid, and grad u x grad v is worked out again round them when it is needed.
+   the patches keep two grid cells clear of the edges of the box, so every ghost point has grid points on both sides of it.
+   the fine steps always use the classic Runge-Kutta. a single rank on the host only, the device and distributed backends refuse it */
+
+const int RefineRatio = 2;
+
+struct Patch
+{
+    int lower[3], upper[3];         // the grid cells covered, lower to upper-1 in i, j and k
+    Griddata griddata;              // the fine grid. fine point a covers the grid cell lower + a/RefineRatio
+    Field u, v;
+    Field ku, kv;          // the first three slopes, as in uv_update_rk4
+    Field padA, padB;      // ghost padded stage inputs, see Stencil.h
+    Field coarseold, coarsenew;    // grid u on the cells lower-1 to upper, before and after the grid's step
+};
+extern vector<Patch> patches;
+
+// make the patches round knotcurves. from one thread, inside the single in main
+void regrid_patches(const vector<knotcurve>& knotcurves, const Field& u, const Field& v, const Griddata& griddata);
+// keep the grid round each patch from before the step. within a parallel region, before the grid's update
+void save_patch_boundaries(const Field& u, const Griddata& griddata);
+// step the patches up to the grid's new time, and put them back on the grid. within a parallel region, after the grid's update.
+// if computegradients, the ucv grids are worked out again round the patches. returns whether there were any
+bool step_patches(Field& u, Field& v, Field& ucvx, Field& ucvy, Field& ucvz, Field& ucvmag, bool computegradients, const Griddata& griddata);
+
+#endif //REFINEMENT_H
@@ -0,0 +1,228 @@
+#include "Stencil.h"
+#include "FN_Constants.h"
+#include "Distributed.h"
+#include <math.h>
+#include <omp.h>
+#include <algorithm>
+
+ActiveBlocks activeblocks;
+
+int padsize(const Griddata& griddata)
+{
+    return (griddata.Nx+2)*(griddata.Ny+2)*(griddata.Nz+2);
+}
+
+int stencil_ichunk(int nplanes, const Griddata& griddata)
+{
+    const int tiles = ((griddata.Ny + StencilBlockJ - 1)/StencilBlockJ)*((griddata.Nz + StencilBlockK - 1)/StencilBlockK);
+    int chunks = (StencilItemsPerThread*omp_get_num_threads() + tiles - 1)/tiles;
+    chunks = std::max(std::min(chunks,nplanes/StencilMinChunk),1);
+    return std::max((nplanes + chunks - 1)/chunks,1);
+}
+
+template <enum BoundaryType BC> void pad_grid(const Field& grid, Field& padded, const Griddata& griddata)
+{
+    int Nx = griddata.Nx;
+    int Ny = griddata.Ny;
+    int Nz = griddata.Nz;
+    for(int i=0;i<Nx;i++)
+    {
+        for(int j=0; j<Ny; j++)
+        {
+            const fieldvalue* row = &grid[pt(i,j,0,griddata)];
+            fieldvalue* padrow = &padded[padpt(i,j,0,griddata)];
+            for(int k=0; k<Nz; k++) padrow[k] = row[k];
+        }
+    }
+    fill_halo<BC>(padded,griddata);
+}
+
+// the ghost values are exactly what gridinc would have given: reflecting boundaries copy the edge cell (incw), periodic ones wrap (incp)
+template <enum BoundaryType BC> void fill_halo(Field& padded, const Griddata& griddata)
+{
+    int Nx = griddata.Nx;
+    int Ny = griddata.Ny;
+    int Nz = griddata.Nz;
+    const bool xperiodic = (BC == ALLPERIODIC);
+    const bool yperiodic = (BC == ALLPERIODIC);
+    const bool zperiodic = (BC == ALLPERIODIC || BC == ZPERIODIC);
+
+    // x faces
+    for(int j=0; j<Ny; j++)
+    {
+        for(int k=0; k<Nz; k++)
+        {
+            padded[padpt(-1,j,k,griddata)] = padded[padpt(xperiodic ? Nx-1 : 0,j,k,griddata)];
+            padded[padpt(Nx,j,k,griddata)] = padded[padpt(xperiodic ? 0 : Nx-1,j,k,griddata)];
+        }
+    }
+    // y faces
+    for(int i=0; i<Nx; i++)
+    {
+        for(int k=0; k<Nz; k++)
+        {
+            padded[padpt(i,-1,k,griddata)] = padded[padpt(i,yperiodic ? Ny-1 : 0,k,griddata)];
+            padded[padpt(i,Ny,k,griddata)] = padded[padpt(i,yperiodic ? 0 : Ny-1,k,griddata)];
+        }
+    }
+    // z faces
+    for(int i=0; i<Nx; i++)
+    {
+        for(int j=0; j<Ny; j++)
+        {
+            padded[padpt(i,j,-1,griddata)] = padded[padpt(i,j,zperiodic ? Nz-1 : 0,griddata)];
+            padded[padpt(i,j,Nz,griddata)] = padded[padpt(i,j,zperiodic ? 0 : Nz-1,griddata)];
+        }
+    }
+}
+
+void setup_active_blocks(const Griddata& griddata)
+{
+    activeblocks.nb[0] = (griddata.Nx + ActiveBlockSize - 1)/ActiveBlockSize;
+    activeblocks.nb[1] = (griddata.Ny + ActiveBlockSize - 1)/ActiveBlockSize;
+    activeblocks.nb[2] = (griddata.Nz + ActiveBlockSize - 1)/ActiveBlockSize;
+    const int numblocks = activeblocks.nb[0]*activeblocks.nb[1]*activeblocks.nb[2];
+    activeblocks.active.assign(numblocks,1);
+    activeblocks.activity.assign(numblocks,0);
+    activeblocks.numactive = numblocks;
+    activeblocks.measure = false;
+    activeblocks.stepped = 0;
+    activeblocks.skipped = 0;
+}
+
+void activate_all_blocks()
+{
+    std::fill(activeblocks.active.begin(),activeblocks.active.end(),1);
+    activeblocks.numactive = activeblocks.active.size();
+}
+
+// the points of block b, in i, j and k
+static void block_range(int b, const Griddata& griddata, int lower[3], int upper[3])
+{
+    const int bk = b%activeblocks.nb[2];
+    const int bj = (b/activeblocks.nb[2])%activeblocks.nb[1];
+    const int bi = b/(activeblocks.nb[2]*activeblocks.nb[1]);
+    lower[0] = bi*ActiveBlockSize;
+    lower[1] = bj*ActiveBlockSize;
+    lower[2] = bk*ActiveBlockSize;
+    upper[0] = std::min(lower[0]+ActiveBlockSize,griddata.Nx);
+    upper[1] = std::min(lower[1]+ActiveBlockSize,griddata.Ny);
+    upper[2] = std::min(lower[2]+ActiveBlockSize,griddata.Nz);
+}
+
+void measure_activity(const Field& ku, const Field& kv, double scale, const Griddata& griddata)
+{
+    const int numblocks = activeblocks.active.size();
+    // a block each, so nobody shares a maximum
+#pragma omp for schedule(dynamic)
+    for(int b=0;b<numblocks;b++)
+    {
+        int lower[3], upper[3];
+        block_range(b,griddata,lower,upper);
+        double largest = 0;
+        for(int i=lower[0];i<upper[0];i++)
+        {
+            for(int j=lower[1];j<upper[1];j++)
+            {
+                const int row = pt(i,j,0,griddata);
+#pragma omp simd reduction(max:largest)
+                for(int k=lower[2];k<upper[2];k++) largest = std::max(largest,(double)std::max(fabs(ku[row+k]),fabs(kv[row+k])));
+            }
+        }
+        activeblocks.activity[b] = scale*largest;
+    }
+}
+
+template <enum BoundaryType BC> void update_active_blocks(const Field& u, Field& padB, const Griddata& griddata)
+{
+#pragma omp single
+    {
+        const int* nb = activeblocks.nb;
+        // as for the halos, only a periodic direction wraps round. in x the neighbouring blocks may be on another rank, so with more
+        // than one the blocks on the slab faces are always stepped
+        const bool wrap[3] = {(BC == ALLPERIODIC) && (decomposition.numranks == 1), (BC == ALLPERIODIC), (BC == ALLPERIODIC || BC == ZPERIODIC)};
+        activeblocks.numactive = 0;
+        for(int bi=0;bi<nb[0];bi++)
+        {
+            for(int bj=0;bj<nb[1];bj++)
+            {
+                for(int bk=0;bk<nb[2];bk++)
+                {
+                    const int centre[3] = {bi,bj,bk};
+                    bool active = (decomposition.numranks > 1) && (bi == 0 || bi == nb[0]-1);
+                    for(int d=0;d<27 && !active;d++)
+                    {
+                        int neighbour[3] = {centre[0] + d/9 - 1, centre[1] + (d/3)%3 - 1, centre[2] + d%3 - 1};
+                        bool inside = true;
+                        for(int e=0;e<3;e++)
+                        {
+                            if(neighbour[e] < 0 || neighbour[e] >= nb[e])
+                            {
+                                if(wrap[e]) neighbour[e] = (neighbour[e] + nb[e])%nb[e];
+                                else inside = false;
+                            }
+                        }
+                        if(inside) active = (activeblocks.activity[(neighbour[0]*nb[1] + neighbour[1])*nb[2] + neighbour[2]] >= ActiveThreshold);
+                    }
+                    activeblocks.active[(bi*nb[1] + bj)*nb[2] + bk] = active;
+                    if(active) activeblocks.numactive++;
+                }
+            }
+        }
+    }
+    const int numblocks = activeblocks.active.size();
+#pragma omp for schedule(dynamic)
+    for(int b=0;b<numblocks;b++)
+    {
+        if(activeblocks.active[b]) continue;
+        int lower[3], upper[3];
+        block_range(b,griddata,lower,upper);
+        for(int i=lower[0];i<upper[0];i++)
+        {
+            for(int j=lower[1];j<upper[1];j++)
+            {
+                const int row = pt(i,j,0,griddata);
+                const int padrow = padpt(i,j,0,griddata);
+                for(int k=lower[2];k<upper[2];k++) padB[padrow+k] = u[row+k];
+            }
+        }
+    }
+}
+
+void activate_blocks(const int lower[3], const int upper[3])
+{
+    int first[3], last[3];
+    for(int d=0;d<3;d++)
+    {
+        first[d] = std::max(0,(lower[d]-1)/ActiveBlockSize);
+        last[d] = std::min(activeblocks.nb[d]-1,upper[d]/ActiveBlockSize);
+    }
+    for(int bi=first[0];bi<=last[0];bi++)
+    {
+        for(int bj=first[1];bj<=last[1];bj++)
+        {
+            for(int bk=first[2];bk<=last[2];bk++)
+            {
+                char& active = activeblocks.active[(bi*activeblocks.nb[1] + bj)*activeblocks.nb[2] + bk];
+                if(!active) activeblocks.numactive++;
+                active = 1;
+            }
+        }
+    }
+}
+
+void count_active_blocks()
+{
+    activeblocks.stepped += activeblocks.numactive;
+    activeblocks.skipped += activeblocks.active.size() - activeblocks.numactive;
+}
+
+template void pad_grid<ALLREFLECTING>(const Field& grid, Field& padded, const Griddata& griddata);
+template void pad_grid<ZPERIODIC>(const Field& grid, Field& padded, const Griddata& griddata);
+template void pad_grid<ALLPERIODIC>(const Field& grid, Field& padded, const Griddata& griddata);
+template void fill_halo<ALLREFLECTING>(Field& padded, const Griddata& griddata);
+template void fill_halo<ZPERIODIC>(Field& padded, const Griddata& griddata);
+template void fill_halo<ALLPERIODIC>(Field& padded, const Griddata& griddata);
+template void update_active_blocks<ALLREFLECTING>(const Field& u, Field& padB, const Griddata& griddata);
+template void update_active_blocks<ZPERIODIC>(const Field& u, Field& padB, const Griddata& griddata);
+template void update_active_blocks<ALLPERIODIC>(const Field& u, Field& padB, const Griddata& griddata);
@@ -0,0 +1,70 @@
+#include "FN_Knot.h"
+using namespace std;
+
+#ifndef STENCIL_H
+#define STENCIL_H
+
+/*************************Ghost padded grids for the stencil kernels*****************************/
+// a padded grid carries one ghost layer on each face, so i,j,k run over -1..N. the ghost layers are filled
+// according to BoundaryType once per stage, and the kernels are then plain unit stride loops with no boundary branches.
+// only the faces are filled - the 7 point laplacian and the central differences never look at edges or corners
+
+// tile sizes for the cache blocked loops. each j,k tile is swept through a chunk of i, so three i-planes of it should sit in cache
+const int StencilBlockJ = 16;
+const int StencilBlockK = 256;
+// at the usual grid sizes a plane has only a few tiles, no more than there are threads, so the chunks of i are shared out along with
+// them. there are enough chunks for StencilItemsPerThread (chunk, tile) items a thread, to even out the shares, but none are thinner
+// than StencilMinChunk planes - each one reads two more planes of its tiles than it updates
+const int StencilItemsPerThread = 8;
+const int StencilMinChunk = 4;
+// the planes in each chunk, for a sweep over nplanes planes by the team of the enclosing parallel region
+int stencil_ichunk(int nplanes, const Griddata& griddata);
+
+inline int padpt(int i, int j, int k, const Griddata& griddata)    // convert i,j,k (-1..N) to a single padded index
+{
+    return ((i+1)*(griddata.Ny+2) + (j+1))*(griddata.Nz+2) + (k+1);
+}
+int padsize(const Griddata& griddata);
+// both of these are specialised on the boundary condition, like the kernels that use them
+template <enum BoundaryType BC> void pad_grid(const Field& grid, Field& padded, const Griddata& griddata);    // copy the interior and fill the halo, serial
+template <enum BoundaryType BC> void fill_halo(Field& padded, const Griddata& griddata);    // serial - it is only O(N^2), call it from one thread
+
+/*************************Active blocks*****************************/
+// with INSERT_ACTIVE_THRESHOLD above 0, the update kernels only step the blocks of the grid where something is happening - cubes of
+// ActiveBlockSize points on a side. every ActiveCheckIteration steps there is a full step, which measures the largest |du/dt| and |dv/dt|
+// in each block. the blocks where both are below the threshold, and which have no neighbour above it, are left where they are until the
+// next full step. the neighbours are there so that a wave coming in gets stepped before it arrives - the check interval should be short
+// enough for a wave to cross less than a block in it.
+// without a threshold every block is always active, and the kernels sweep their tiles whole as before
+const int ActiveBlockSize = 16;    // StencilBlockK should be a multiple of it
+
+struct ActiveBlocks
+{
+    int nb[3];                  // the number of blocks in i, j and k
+    vector<char> active;        // whether each block is stepped, indexed by (bi*nb[1] + bj)*nb[2] + bk
+    vector<double> activity;    // the largest |du/dt| or |dv/dt| each block had on the last full step
+    int numactive;
+    bool measure;               // set by main for the full steps, the kernels fill in activity
+    double stepped, skipped;    // block updates done and left out so far, for the report at the end
+};
+extern ActiveBlocks activeblocks;
+
+inline bool block_active(int i, int j, int k)    // is the block holding i,j,k stepped
+{
+    return activeblocks.active[((i/ActiveBlockSize)*activeblocks.nb[1] + j/ActiveBlockSize)*activeblocks.nb[2] + k/ActiveBlockSize];
+}
+// size the blocks for the grid this rank steps, all active
+void setup_active_blocks(const Griddata& griddata);
+// make every block active for a full step, which measures them. call from one thread
+void activate_all_blocks();
+// the kernels call this on full steps, with the slopes of u and v at the start of the step times scale. within a parallel region
+void measure_activity(const Field& ku, const Field& kv, double scale, const Griddata& griddata);
+// after a full step, pick the blocks to step until the next one. the frozen ones have u copied into padB, where the classic scheme's
+// stages look for their neighbours. within a parallel region
+template <enum BoundaryType BC> void update_active_blocks(const Field& u, Field& padB, const Griddata& griddata);
+// make the blocks holding the cells lower-1 to upper active, as something else has changed them. call from one thread
+void activate_blocks(const int lower[3], const int upper[3]);
+// add this step to the totals for the report. call from one thread
+void count_active_blocks();
+
+#endif //STENCIL_H
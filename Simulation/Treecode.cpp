@@ -0,0 +1,241 @@
+#include "Treecode.h"
+#include <math.h>
+#include <algorithm>
+
+// the most sources we leave in a node before splitting it
+static const int leafsize = 16;
+
+// orders sources along one axis, for splitting a node at the median
+struct axis_less
+{
+    const vector<double>* p;
+    int axis;
+    bool operator()(int a, int b) const { return (*p)[3*a+axis] < (*p)[3*b+axis]; }
+};
+
+// add the node holding sources order[first] to order[first+count-1] to the tree, and everything below it. returns its index
+static int build_node(SourceTree& tree, vector<int>& order, const vector<double>& p, const vector<double>& w, int first, int count)
+{
+    double lower[3], upper[3];
+    for(int d=0;d<3;d++) { lower[d] = p[3*order[first]+d]; upper[d] = lower[d]; }
+    for(int s=first;s<first+count;s++)
+    {
+        for(int d=0;d<3;d++)
+        {
+            lower[d] = std::min(lower[d],p[3*order[s]+d]);
+            upper[d] = std::max(upper[d],p[3*order[s]+d]);
+        }
+    }
+
+    TreeNode node;
+    node.first = first;
+    node.count = count;
+    node.left = -1;
+    node.right = -1;
+    node.size = 0;
+    for(int d=0;d<3;d++)
+    {
+        node.centre[d] = 0.5*(lower[d]+upper[d]);
+        node.weight[d] = 0;
+        for(int e=0;e<3;e++) node.moment[d][e] = 0;
+    }
+    for(int s=first;s<first+count;s++)
+    {
+        const int n = order[s];
+        double delta[3];
+        for(int d=0;d<3;d++) delta[d] = p[3*n+d] - node.centre[d];
+        node.size = std::max(node.size,sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]));
+        for(int j=0;j<3;j++)
+        {
+            node.weight[j] += w[3*n+j];
+            for(int k=0;k<3;k++) node.moment[j][k] += w[3*n+j]*delta[k];
+        }
+    }
+    const int index = tree.nodes.size();
+    tree.nodes.push_back(node);
+
+    if(count > leafsize)
+    {
+        // split at the median of the longest side of the box
+        axis_less compare;
+        compare.p = &p;
+        compare.axis = 0;
+        for(int d=1;d<3;d++) if(upper[d]-lower[d] > upper[compare.axis]-lower[compare.axis]) compare.axis = d;
+        const int half = count/2;
+        std::nth_element(order.begin()+first,order.begin()+first+half,order.begin()+first+count,compare);
+        const int left = build_node(tree,order,p,w,first,half);
+        const int right = build_node(tree,order,p,w,first+half,count-half);
+        tree.nodes[index].left = left;
+        tree.nodes[index].right = right;
+    }
+    return index;
+}
+
+void build_tree(SourceTree& tree, const vector<double>& p, const vector<double>& w)
+{
+    const int n = p.size()/3;
+    tree.nodes.clear();
+    vector<int> order(n);
+    for(int s=0;s<n;s++) order[s] = s;
+    if(n > 0) build_node(tree,order,p,w,0,n);
+
+    tree.px.resize(n); tree.py.resize(n); tree.pz.resize(n);
+    tree.wx.resize(n); tree.wy.resize(n); tree.wz.resize(n);
+    tree.index = order;
+    for(int s=0;s<n;s++)
+    {
+        tree.px[s] = p[3*order[s]]; tree.py[s] = p[3*order[s]+1]; tree.pz[s] = p[3*order[s]+2];
+        tree.wx[s] = w[3*order[s]]; tree.wy[s] = w[3*order[s]+1]; tree.wz[s] = w[3*order[s]+2];
+    }
+}
+
+// the smallest sign*(p-view)_z/|p-view| any source in the node could have. the sources all lie within node.size of its centre,
+// so seen from outside that ball they all lie in a cone about the direction of the centre
+static double z_cosine_bound(const TreeNode& node, const double view[3], double sign)
+{
+    const double Rx = node.centre[0] - view[0];
+    const double Ry = node.centre[1] - view[1];
+    const double Rz = node.centre[2] - view[2];
+    const double R = sqrt(Rx*Rx + Ry*Ry + Rz*Rz);
+    if(R <= node.size) return -1;
+    const double centreangle = acos(std::max(-1.0,std::min(1.0,sign*Rz/R)));
+    const double coneangle = asin(node.size/R);
+    return cos(std::min(M_PI,centreangle + coneangle));
+}
+
+double min_z_cosine(const SourceTree& tree, const double view[3], double sign, double threshold, int& argmin)
+{
+    double best = threshold;
+    argmin = -1;
+    if(tree.nodes.empty()) return best;
+    // branch and bound - skip any node which can't beat the best so far, and look at the more promising child first. starting
+    // from the threshold, most view points never open more than a few nodes
+    int stack[128];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        const TreeNode& node = tree.nodes[stack[--top]];
+        if(z_cosine_bound(node,view,sign) >= best) continue;
+        if(node.left < 0)
+        {
+            for(int s=node.first;s<node.first+node.count;s++)
+            {
+                const double viewx = tree.px[s] - view[0];
+                const double viewy = tree.py[s] - view[1];
+                const double viewz = tree.pz[s] - view[2];
+                const double dist = sqrt(viewx*viewx + viewy*viewy + viewz*viewz);
+                const double cosine = sign*viewz/dist;
+                if(cosine < best) { best = cosine; argmin = tree.index[s]; }
+            }
+        }
+        else
+        {
+            const double leftbound = z_cosine_bound(tree.nodes[node.left],view,sign);
+            const double rightbound = z_cosine_bound(tree.nodes[node.right],view,sign);
+            if(leftbound < rightbound) { stack[top++] = node.right; stack[top++] = node.left; }
+            else { stack[top++] = node.left; stack[top++] = node.right; }
+        }
+    }
+    return best;
+}
+
+double dipole_sum(const SourceTree& tree, const double view[3], double tolerance)
+{
+    double sum = 0;
+    if(tree.nodes.empty()) return sum;
+    int stack[128];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        const TreeNode& node = tree.nodes[stack[--top]];
+        const double Rx = node.centre[0] - view[0];
+        const double Ry = node.centre[1] - view[1];
+        const double Rz = node.centre[2] - view[2];
+        const double R = sqrt(Rx*Rx + Ry*Ry + Rz*Rz);
+        if(node.size < tolerance*R)
+        {
+            // far enough away to expand w.r/r^3 about the centre to first order in (p-centre)
+            const double R3 = R*R*R;
+            const double trace = node.moment[0][0] + node.moment[1][1] + node.moment[2][2];
+            const double RMR = Rx*(node.moment[0][0]*Rx + node.moment[0][1]*Ry + node.moment[0][2]*Rz)
+                + Ry*(node.moment[1][0]*Rx + node.moment[1][1]*Ry + node.moment[1][2]*Rz)
+                + Rz*(node.moment[2][0]*Rx + node.moment[2][1]*Ry + node.moment[2][2]*Rz);
+            sum += (Rx*node.weight[0] + Ry*node.weight[1] + Rz*node.weight[2] + trace)/R3 - 3*RMR/(R3*R*R);
+        }
+        else if(node.left < 0)
+        {
+            for(int s=node.first;s<node.first+node.count;s++)
+            {
+                const double rx = tree.px[s] - view[0];
+                const double ry = tree.py[s] - view[1];
+                const double rz = tree.pz[s] - view[2];
+                const double r = sqrt(rx*rx + ry*ry + rz*rz);
+                if(r>0) sum += (rx*tree.wx[s] + ry*tree.wy[s] + rz*tree.wz[s])/(r*r*r);
+            }
+        }
+        else
+        {
+            stack[top++] = node.left;
+            stack[top++] = node.right;
+        }
+    }
+    return sum;
+}
+
+double curve_sum(const SourceTree& tree, const double view[3], const double ninfty[3], double tolerance)
+{
+    const double nx = ninfty[0];
+    const double ny = ninfty[1];
+    const double nz = ninfty[2];
+    double sum = 0;
+    if(tree.nodes.empty()) return sum;
+    int stack[128];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        const TreeNode& node = tree.nodes[stack[--top]];
+        const double Rx = node.centre[0] - view[0];
+        const double Ry = node.centre[1] - view[1];
+        const double Rz = node.centre[2] - view[2];
+        const double R = sqrt(Rx*Rx + Ry*Ry + Rz*Rz);
+        const double ndotR = nx*Rx + ny*Ry + nz*Rz;
+        // the integrand is w.G(r), with G = (n x r)/D and D = |r|(|r| + n.r). it blows up along the string r = -|r|n,
+        // so a node has to be far from the view point and from the string to be expanded
+        if(node.size < tolerance*std::min(R,R + ndotR))
+        {
+            const double D = R*(R + ndotR);
+            const double ax = ny*Rz - nz*Ry;
+            const double ay = nz*Rx - nx*Rz;
+            const double az = nx*Ry - ny*Rx;
+            // the derivatives of D, and the first order term sum_jk M_jk dG_j/dr_k
+            const double dD[3] = {2*Rx + Rx*ndotR/R + R*nx, 2*Ry + Ry*ndotR/R + R*ny, 2*Rz + Rz*ndotR/R + R*nz};
+            const double (*M)[3] = node.moment;
+            // d(n x r)/dr_k = n x e_k
+            const double term1 = (nz*M[1][0] - ny*M[2][0]) + (nx*M[2][1] - nz*M[0][1]) + (ny*M[0][2] - nx*M[1][2]);
+            double term2 = 0;
+            for(int k=0;k<3;k++) term2 += dD[k]*(ax*M[0][k] + ay*M[1][k] + az*M[2][k]);
+            sum += (ax*node.weight[0] + ay*node.weight[1] + az*node.weight[2] + term1)/D - term2/(D*D);
+        }
+        else if(node.left < 0)
+        {
+            for(int s=node.first;s<node.first+node.count;s++)
+            {
+                const double viewx = tree.px[s] - view[0];
+                const double viewy = tree.py[s] - view[1];
+                const double viewz = tree.pz[s] - view[2];
+                const double dist = sqrt(viewx*viewx + viewy*viewy + viewz*viewz);
+                const double ndotninfty = viewx*nx + viewy*ny + viewz*nz;
+                sum += (nz*(tree.wy[s]*viewx-tree.wx[s]*viewy)+nx*(tree.wz[s]*viewy-tree.wy[s]*viewz)+ny*(tree.wx[s]*viewz-tree.wz[s]*viewx))/(dist*(dist + ndotninfty));
+            }
+        }
+        else
+        {
+            stack[top++] = node.left;
+            stack[top++] = node.right;
+        }
+    }
+    return sum;
+}
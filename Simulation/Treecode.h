@@ -0,0 +1,46 @@
+#include <vector>
+using namespace std;
+
+#ifndef TREECODE_H
+#define TREECODE_H
+
+/* a Barnes-Hut treecode for the solid angle integrals of the initialisation. the sources (points of a curve component, or triangles
+   of a surface) each carry a position and a vector weight - ds times the tangent for a curve, the area times the normal for a surface.
+   they are sorted into a binary tree of boxes, each node holding the zeroth and first moments of the weights of everything below it.
+   a node seen from further than its size over the tolerance is summed from its moments, rather than source by source
+   with a tolerance of 0 every source is summed directly, as before. */
+
+struct TreeNode
+{
+    double centre[3];
+    double size;            // the distance from the centre to the furthest source in the node
+    double weight[3];       // the sum of the source weights w
+    double moment[3][3];    // moment[j][k] = sum of w_j (p - centre)_k
+    int first, count;       // the sources in the node are first to first+count-1, in tree order
+    int left, right;        // the children, or -1 for a leaf
+};
+
+struct SourceTree
+{
+    // the sources, reordered so each node holds a contiguous run of them
+    vector<double> px, py, pz;
+    vector<double> wx, wy, wz;
+    vector<int> index;      // the index each source had in the list the tree was built from
+    vector<TreeNode> nodes; // nodes[0] is the root
+};
+
+// build the tree over n sources from their positions p and weights w, stored as x,y,z triples
+void build_tree(SourceTree& tree, const vector<double>& p, const vector<double>& w);
+
+// the minimum over the sources of sign*(p-view)_z/|p-view|, and the index (in the original list) of the source with it,
+// if that minimum is below threshold. otherwise returns threshold, and argmin is -1
+double min_z_cosine(const SourceTree& tree, const double view[3], double sign, double threshold, int& argmin);
+
+// sum over the sources of w.(p - view)/|p - view|^3, skipping any source sitting on the view point
+double dipole_sum(const SourceTree& tree, const double view[3], double tolerance);
+
+// sum over the sources of ninfty.((p - view) x w)/(|p - view| (|p - view| + ninfty.(p - view))),
+// the integrand of SolidAngleCalc. ninfty must keep clear of every source, as SolidAngleCalc picks it
+double curve_sum(const SourceTree& tree, const double view[3], const double ninfty[3], double tolerance);
+
+#endif //TREECODE_H
@@ -1,14 +1,15 @@
 // Created 23-Dec-2011 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
 
 #include "TriCubicInterpolator.h"
+#include "Gradients.h"
 #include "RuntimeError.h"
 
 #include <cmath>
 
 namespace local = likely;
 
-local::TriCubicInterpolator::TriCubicInterpolator(DataCube& data, double spacing, int n1, int n2, int n3)
-: _data(data), _spacing(spacing), _n1(n1), _n2(n2), _n3(n3), _initialized(false)
+template <class DataCube> local::BasicTriCubicInterpolator<DataCube>::BasicTriCubicInterpolator(const DataCube& data, double spacing, int n1, int n2, int n3)
+: _data(data), _spacing(spacing), _n1(n1), _n2(n2), _n3(n3)
 {
     if(_n2 == 0 && _n3 == 0) {
         _n3 = _n2 = _n1;
@@ -17,9 +18,75 @@ local::TriCubicInterpolator::TriCubicInterpolator(DataCube& data, double spacing
     if(_spacing <= 0) throw RuntimeError("Bad datacube grid spacing.");
 }
 
-local::TriCubicInterpolator::~TriCubicInterpolator() { }
+template <class DataCube> local::BasicTriCubicInterpolator<DataCube>::~BasicTriCubicInterpolator() { }
 
-double local::TriCubicInterpolator::operator()(double x, double y, double z) const {
+namespace {
+    // Evaluates the interpolation at dx,dy,dz within the voxel with the given coefficients.
+    inline double polynomial(const double* coefs, double dx, double dy, double dz) {
+        const double dypow[4] = {1, dy, dy*dy, dy*dy*dy};
+        const double dzpow[4] = {1, dz, dz*dz, dz*dz*dz};
+        double result(0);
+        #pragma omp simd reduction(+:result)
+        for(int jk = 0; jk < 16; ++jk) {
+            const double* c = coefs + 4*jk;
+            result += dypow[jk%4]*dzpow[jk/4]*(c[0] + dx*(c[1] + dx*(c[2] + dx*c[3])));
+        }
+        return result;
+    }
+}
+
+template <class DataCube> double local::BasicTriCubicInterpolator<DataCube>::operator()(double x, double y, double z, Cell& cell) const {
+    double dx,dy,dz;
+    _setCell(x,y,z,cell,dx,dy,dz);
+    return polynomial(cell.coefs,dx,dy,dz);
+}
+
+template <class DataCube> double local::BasicTriCubicInterpolator<DataCube>::operator()(double x, double y, double z) const {
+    Cell cell;
+    return (*this)(x,y,z,cell);
+}
+
+template <class DataCube> void local::BasicTriCubicInterpolator<DataCube>::evaluate(const double* points, fieldvalue* values, int n, Cell& cell) const {
+    for(int p = 0; p < n; ++p) {
+        double dx,dy,dz;
+        _setCell(points[3*p],points[3*p+1],points[3*p+2],cell,dx,dy,dz);
+        values[p] = polynomial(cell.coefs,dx,dy,dz);
+    }
+}
+
+template <class DataCube> double local::BasicTriCubicInterpolator<DataCube>::operator()(double x, double y, double z, double gradient[3], Cell& cell) const {
+    double dx,dy,dz;
+    _setCell(x,y,z,cell,dx,dy,dz);
+    // Evaluate the interpolation and its derivatives within this grid voxel, from the same coefficients.
+    const double* coefs = cell.coefs;
+    int ijkn(0);
+    double dzpow(1), ddzpow(0);
+    double result(0), resultx(0), resulty(0), resultz(0);
+    for(int k = 0; k < 4; ++k) {
+        double dypow(1), ddypow(0);
+        for(int j = 0; j < 4; ++j) {
+            double c0(coefs[ijkn]), c1(coefs[ijkn+1]), c2(coefs[ijkn+2]), c3(coefs[ijkn+3]);
+            double xpoly = c0 + dx*(c1 + dx*(c2 + dx*c3));
+            double dxpoly = c1 + dx*(2*c2 + dx*3*c3);
+            result += dypow*dzpow*xpoly;
+            resultx += dypow*dzpow*dxpoly;
+            resulty += ddypow*dzpow*xpoly;
+            resultz += dypow*ddzpow*xpoly;
+            ijkn += 4;
+            ddypow = ddypow*dy + dypow;
+            dypow *= dy;
+        }
+        ddzpow = ddzpow*dz + dzpow;
+        dzpow *= dz;
+    }
+    // The voxel coordinates are in units of the grid spacing.
+    gradient[0] = resultx/_spacing;
+    gradient[1] = resulty/_spacing;
+    gradient[2] = resultz/_spacing;
+    return result;
+}
+
+template <class DataCube> void local::BasicTriCubicInterpolator<DataCube>::_setCell(double x, double y, double z, Cell& cell, double& dx, double& dy, double& dz) const {
     // Code here is based on:
     // https://svn.blender.org/svnroot/bf-blender/branches/volume25/source/blender/blenlib/intern/voxel.c
     
@@ -27,9 +94,9 @@ double local::TriCubicInterpolator::operator()(double x, double y, double z) con
     // assuming the grid is centre aligned, ie we have the relation
     // x(i) = (i+((Nx-1)/2))*spacing
     //double dx(std::fmod(x/_spacing,_n1)), dy(std::fmod(y/_spacing,_n2)), dz(std::fmod(z/_spacing,_n3));
-    double dx  = (x/_spacing)+(_n1 -1)/2;
-    double dy  = (y/_spacing)+(_n2 -1)/2;
-    double dz  = (z/_spacing)+(_n3 -1)/2;
+    dx  = (x/_spacing)+(_n1 -1)/2;
+    dy  = (y/_spacing)+(_n2 -1)/2;
+    dz  = (z/_spacing)+(_n3 -1)/2;
     if(dx < 0) dx += _n1;
     if(dy < 0) dy += _n2;
     if(dz < 0) dz += _n3;
@@ -38,7 +105,7 @@ double local::TriCubicInterpolator::operator()(double x, double y, double z) con
     int yi = (int)std::floor(dy);
     int zi = (int)std::floor(dz);
     // Check if we can re-use coefficients from the last interpolation.
-    if(!_initialized || xi != _i1 || yi != _i2 || zi != _i3) {
+    if(!cell.initialized || xi != cell.i1 || yi != cell.i2 || zi != cell.i3) {
         // Extract the local vocal values and calculate partial derivatives.
 		double x[64] = {
 		    // values of f(x,y,z) at each corner.
@@ -111,38 +178,26 @@ double local::TriCubicInterpolator::operator()(double x, double y, double z) con
 		};
 		// Convert voxel values and partial derivatives to interpolation coefficients.
     	for (int i=0;i<64;++i) {
-    		_coefs[i] = 0.0;
+    		double coef(0);
+    		#pragma omp simd reduction(+:coef)
     		for (int j=0;j<64;++j) {
-    			_coefs[i] += _C[i][j]*x[j];
+    			coef += _C[i][j]*x[j];
     		}
+    		cell.coefs[i] = coef;
     	}
         // Remember this voxel for next time.
-        _i1 = xi;
-        _i2 = yi;
-        _i3 = zi;
-        _initialized = true;
+        cell.i1 = xi;
+        cell.i2 = yi;
+        cell.i3 = zi;
+        cell.initialized = true;
     }
-    // Evaluate the interpolation within this grid voxel.
+    // Leave dx,dy,dz as the offsets within the voxel.
     dx -= xi;
     dy -= yi;
     dz -= zi;
-    int ijkn(0);
-    double dzpow(1);
-    double result(0);
-    for(int k = 0; k < 4; ++k) {
-        double dypow(1);
-        for(int j = 0; j < 4; ++j) {
-            result += dypow*dzpow*
-                (_coefs[ijkn] + dx*(_coefs[ijkn+1] + dx*(_coefs[ijkn+2] + dx*_coefs[ijkn+3])));
-            ijkn += 4;
-            dypow *= dy;
-        }
-        dzpow *= dz;
-    }
-    return result;
 }
 
-int local::TriCubicInterpolator::_C[64][64] = {
+template <class DataCube> const double local::BasicTriCubicInterpolator<DataCube>::_C[64][64] = {
     { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
     { 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
     {-3, 3, 0, 0, 0, 0, 0, 0,-2,-1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
@@ -208,3 +263,7 @@ int local::TriCubicInterpolator::_C[64][64] = {
     {-12,12,12,-12,12,-12,-12,12,-8,-4, 8, 4, 8, 4,-8,-4,-6, 6,-6, 6, 6,-6, 6,-6,-6, 6, 6,-6,-6, 6, 6,-6,-4,-2,-4,-2, 4, 2, 4, 2,-4,-2, 4, 2,-4,-2, 4, 2,-3, 3,-3, 3,-3, 3,-3, 3,-2,-1,-2,-1,-2,-1,-2,-1},
     { 8,-8,-8, 8,-8, 8, 8,-8, 4, 4,-4,-4,-4,-4, 4, 4, 4,-4, 4,-4,-4, 4,-4, 4, 4,-4,-4, 4, 4,-4,-4, 4, 2, 2, 2, 2,-2,-2,-2,-2, 2, 2,-2,-2, 2, 2,-2,-2, 2,-2, 2,-2, 2,-2, 2,-2, 1, 1, 1, 1, 1, 1, 1, 1}
 };
+
+// the grids the code interpolates: u and v when a uv file is read onto a new grid, and |grad u x grad v| for the curve tracing
+template class local::BasicTriCubicInterpolator<Field>;
+template class local::BasicTriCubicInterpolator<UcvCache>;